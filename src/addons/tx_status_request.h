@@ -7,6 +7,8 @@
 #include "../platform/m256.h"
 #include "../platform/debugging.h"
 #include "../platform/memory_util.h"
+#include "../platform/random.h"
+#include "../platform/read_write_lock.h"
 
 #include "../network_messages/header.h"
 
@@ -39,6 +41,30 @@ static struct
 } txStatusData;
 
 
+// Hash index digest -> position in confirmedTx, for answering status requests of single transactions without
+// scanning ticks. It uses open addressing with linear probing. Slots hold position + 1 (0 means empty). The table
+// size is the smallest power of 2 that is at least 1.5 times confirmedTxLength, so the load factor stays below 2/3.
+// The hash function mixes all 256 bits of the digest with a random key drawn in resetConfirmedTxIndex(), so digests
+// cannot be crafted to collide in the table.
+// The index is only written by the tick processor (under confirmedTxLock) and read by the request processors. A slot
+// is written after the confirmedTx element it points to, so inserting doesn't need to block readers. Only clearing the
+// index in resetConfirmedTxIndex() does, because probing with the old hash key would give wrong results. Readers hold
+// confirmedTxIndexLock for reading while looking up digests.
+constexpr unsigned long long confirmedTxIndexSize = []()
+{
+    unsigned long long size = 1;
+    while (size < confirmedTxLength + confirmedTxLength / 2)
+        size <<= 1;
+    return size;
+}();
+static_assert(confirmedTxLength < 0xffffffff, "Positions in confirmedTx are stored as unsigned int");
+
+static volatile unsigned int* confirmedTxIndex = NULL;
+static unsigned long long confirmedTxIndexHashKey[4];
+static unsigned long long confirmedTxIndexPopulation = 0;
+static ReadWriteLock confirmedTxIndexLock;
+
+
 #define REQUEST_TX_STATUS 201
 
 struct RequestTxStatus
@@ -70,6 +96,157 @@ struct RespondTxStatus
 #pragma pack(pop)
 static RespondTxStatus* tickTxStatusStorage = NULL;
 
+
+#define REQUEST_TX_STATUS_OF_DIGEST 203
+
+// Request status of one transaction by its digest
+struct RequestTxStatusOfDigest
+{
+    m256i digest;
+};
+
+static_assert(sizeof(RequestTxStatusOfDigest) == 32, "unexpected size");
+
+#define RESPOND_TX_STATUS_OF_DIGEST 204
+
+struct RespondTxStatusOfDigest
+{
+    m256i digest;
+    unsigned int currentTickOfNode;
+    unsigned int tick; // 0 if the transaction is not found in the stored ticks (or its tick isn't processed yet)
+    unsigned char moneyFlew;
+    unsigned char _padding[7];
+};
+
+static_assert(sizeof(RespondTxStatusOfDigest) == 32 + 4 + 4 + 8, "unexpected size");
+
+#define REQUEST_TX_STATUS_OF_DIGESTS 205
+
+// Request status of up to maxNumberOfDigests transactions. The number of digests is derived from the payload size,
+// so only the used part of digests is sent.
+struct RequestTxStatusOfDigests
+{
+    static constexpr unsigned int maxNumberOfDigests = 1024;
+
+    m256i digests[maxNumberOfDigests];
+};
+
+static_assert(sizeof(RequestTxStatusOfDigests) == 32 * RequestTxStatusOfDigests::maxNumberOfDigests, "unexpected size");
+
+#define RESPOND_TX_STATUS_OF_DIGESTS 206
+
+struct TxStatusOfDigest
+{
+    unsigned int tick; // 0 if the transaction is not found in the stored ticks (or its tick isn't processed yet)
+    unsigned char moneyFlew;
+    unsigned char _padding[3];
+};
+
+// Response to RequestTxStatusOfDigests, status is in the order of the requested digests
+struct RespondTxStatusOfDigests
+{
+    unsigned int currentTickOfNode;
+    unsigned int numberOfDigests;
+
+    // only numberOfDigests elements are sent with this message
+    TxStatusOfDigest status[RequestTxStatusOfDigests::maxNumberOfDigests];
+
+    // return size of this struct to be sent
+    unsigned int size() const
+    {
+        return offsetof(RespondTxStatusOfDigests, status) + numberOfDigests * sizeof(TxStatusOfDigest);
+    }
+};
+
+static_assert(sizeof(TxStatusOfDigest) == 8, "unexpected size");
+
+
+static unsigned long long confirmedTxIndexHash(const m256i& digest)
+{
+    unsigned long long h = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+        h = (h ^ digest.m256i_u64[i] ^ confirmedTxIndexHashKey[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+    return h & (confirmedTxIndexSize - 1);
+}
+
+// Remove all elements of index and draw new random hash key. Waits until running lookups are finished and blocks new
+// ones until done.
+static void resetConfirmedTxIndex()
+{
+    confirmedTxIndexLock.acquireWrite();
+    for (int i = 0; i < 4; ++i)
+    {
+        random64(&confirmedTxIndexHashKey[i]);
+    }
+    setMem((void*)confirmedTxIndex, confirmedTxIndexSize * sizeof(confirmedTxIndex[0]), 0);
+    confirmedTxIndexPopulation = 0;
+    confirmedTxIndexLock.releaseWrite();
+}
+
+// Add element confirmedTx[position] to index. Elements without tick (empty) are skipped.
+static void insertIntoConfirmedTxIndex(unsigned int position)
+{
+    const ConfirmedTx& tx = confirmedTx[position];
+    if (!tx.tick || confirmedTxIndexPopulation >= confirmedTxLength)
+        return;
+
+    unsigned long long slotIdx = confirmedTxIndexHash(tx.digest);
+    while (confirmedTxIndex[slotIdx])
+    {
+        slotIdx = (slotIdx + 1) & (confirmedTxIndexSize - 1);
+    }
+    confirmedTxIndex[slotIdx] = position + 1;
+    ++confirmedTxIndexPopulation;
+}
+
+// Return confirmed tx with digest or NULL if it is not stored. May run concurrently with insertIntoConfirmedTxIndex().
+// The caller has to hold confirmedTxIndexLock for reading if resetConfirmedTxIndex() may run concurrently.
+static const ConfirmedTx* findConfirmedTx(const m256i& digest)
+{
+    unsigned long long slotIdx = confirmedTxIndexHash(digest);
+    unsigned int position;
+    while ((position = confirmedTxIndex[slotIdx]) != 0)
+    {
+        const ConfirmedTx& tx = confirmedTx[position - 1];
+        if (tx.digest == digest)
+        {
+            return &tx;
+        }
+        slotIdx = (slotIdx + 1) & (confirmedTxIndexSize - 1);
+    }
+    return NULL;
+}
+
+// Rebuild index from content of confirmedTx, for example after loading a snapshot. Lookups running concurrently may
+// not find transactions that haven't been inserted again yet.
+static void rebuildConfirmedTxIndex(unsigned int numberOfTransactionsInCurrentEpoch)
+{
+    resetConfirmedTxIndex();
+
+    if (numberOfTransactionsInCurrentEpoch > confirmedTxCurrentEpochLength)
+        numberOfTransactionsInCurrentEpoch = confirmedTxCurrentEpochLength;
+    for (unsigned int position = 0; position < numberOfTransactionsInCurrentEpoch; ++position)
+    {
+        insertIntoConfirmedTxIndex(position);
+    }
+
+    if (txStatusData.confirmedTxPreviousEpochBeginTick)
+    {
+        unsigned int numberOfTransactionsInPreviousEpoch = 0;
+        for (unsigned int tickOffset = 0; tickOffset < TICKS_TO_KEEP_FROM_PRIOR_EPOCH; ++tickOffset)
+        {
+            numberOfTransactionsInPreviousEpoch += txStatusData.tickTxCounter[MAX_NUMBER_OF_TICKS_PER_EPOCH + tickOffset];
+        }
+        for (unsigned int i = 0; i < numberOfTransactionsInPreviousEpoch && i < confirmedTxPreviousEpochLength; ++i)
+        {
+            insertIntoConfirmedTxIndex((unsigned int)(confirmedTxCurrentEpochLength + i));
+        }
+    }
+}
+
 // Allocate buffers
 static bool initTxStatusRequestAddOn()
 {
@@ -79,6 +256,11 @@ static bool initTxStatusRequestAddOn()
     // allocate tickTxStatus responses storage
     if (!allocPoolWithErrorLog(L"tickTxStatusStorage", MAX_NUMBER_OF_PROCESSORS * sizeof(RespondTxStatus), (void**)&tickTxStatusStorage, __LINE__))
         return false;
+    // allocate digest index of confirmed TX's
+    if (!allocPoolWithErrorLog(L"confirmedTxIndex", confirmedTxIndexSize * sizeof(confirmedTxIndex[0]), (void**)&confirmedTxIndex, __LINE__))
+        return false;
+    confirmedTxIndexLock.reset();
+    resetConfirmedTxIndex();
     txStatusData.confirmedTxPreviousEpochBeginTick = 0;
     txStatusData.confirmedTxCurrentEpochBeginTick = 0;
     return true;
@@ -90,6 +272,13 @@ static void deinitTxStatusRequestAddOn()
 {
     if (confirmedTx)
         freePool(confirmedTx);
+    if (tickTxStatusStorage)
+        freePool(tickTxStatusStorage);
+    if (confirmedTxIndex)
+        freePool((void*)confirmedTxIndex);
+    confirmedTx = NULL;
+    tickTxStatusStorage = NULL;
+    confirmedTxIndex = NULL;
 }
 
 
@@ -143,6 +332,13 @@ static void beginEpochTxStatusRequestAddOn(unsigned int newInitialTick)
         setMem(confirmedTx, confirmedTxCurrentEpochLength * sizeof(ConfirmedTx), 0);
         setMem(txStatusData.tickTxCounter, MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(txStatusData.tickTxCounter[0]), 0);
         setMem(txStatusData.tickTxIndexStart, MAX_NUMBER_OF_TICKS_PER_EPOCH * sizeof(txStatusData.tickTxIndexStart[0]), 0);
+
+        // index only the ticks kept from the previous epoch
+        resetConfirmedTxIndex();
+        for (unsigned int i = 0; i < txCount; ++i)
+        {
+            insertIntoConfirmedTxIndex((unsigned int)(confirmedTxCurrentEpochLength + i));
+        }
     }
     else
     {
@@ -153,6 +349,7 @@ static void beginEpochTxStatusRequestAddOn(unsigned int newInitialTick)
         setMem(confirmedTx, confirmedTxLength * sizeof(ConfirmedTx), 0);
         setMem(txStatusData.tickTxCounter, sizeof(txStatusData.tickTxCounter), 0);
         setMem(txStatusData.tickTxIndexStart, sizeof(txStatusData.tickTxIndexStart), 0);
+        resetConfirmedTxIndex();
     }
 
     tickBegin = newInitialTick;
@@ -186,6 +383,9 @@ static bool saveConfirmedTx(unsigned int txNumberMinusOne, bool moneyFlew, unsig
     // keep track of tx number in tick to find it later easier
     txStatusData.tickTxCounter[tickIndex]++;
 
+    // make tx findable by digest
+    insertIntoConfirmedTxIndex(txNumberMinusOne);
+
     RELEASE(confirmedTxLock);
 
     return true;
@@ -248,6 +448,62 @@ static void processRequestConfirmedTx(long long processorNumber, Peer *peer, Req
     enqueueResponse(peer, tickTxStatus.size(), RESPOND_TX_STATUS, header->dejavu(), &tickTxStatus);
 }
 
+
+// Fill status of tx with digest, only reporting tx of ticks that have been processed already
+static void getTxStatusOfDigest(const m256i& digest, unsigned int currentTick, unsigned int& tick, unsigned char& moneyFlew)
+{
+    const ConfirmedTx* tx = findConfirmedTx(digest);
+    if (tx && tx->tick < currentTick)
+    {
+        tick = tx->tick;
+        moneyFlew = tx->moneyFlew;
+    }
+    else
+    {
+        tick = 0;
+        moneyFlew = 0;
+    }
+}
+
+static void processRequestTxStatusOfDigest(Peer* peer, RequestResponseHeader* header)
+{
+    if (header->size() != sizeof(RequestResponseHeader) + sizeof(RequestTxStatusOfDigest))
+        return;
+    RequestTxStatusOfDigest* request = header->getPayload<RequestTxStatusOfDigest>();
+
+    RespondTxStatusOfDigest response;
+    setMem(&response, sizeof(response), 0);
+    response.digest = request->digest;
+    response.currentTickOfNode = system.tick;
+    confirmedTxIndexLock.acquireRead();
+    getTxStatusOfDigest(request->digest, response.currentTickOfNode, response.tick, response.moneyFlew);
+    confirmedTxIndexLock.releaseRead();
+
+    enqueueResponse(peer, sizeof(response), RESPOND_TX_STATUS_OF_DIGEST, header->dejavu(), &response);
+}
+
+static void processRequestTxStatusOfDigests(Peer* peer, RequestResponseHeader* header)
+{
+    const unsigned int payloadSize = header->size() - sizeof(RequestResponseHeader);
+    if (!payloadSize || payloadSize > sizeof(RequestTxStatusOfDigests) || payloadSize % sizeof(m256i))
+        return;
+    RequestTxStatusOfDigests* request = header->getPayload<RequestTxStatusOfDigests>();
+
+    RespondTxStatusOfDigests response;
+    response.currentTickOfNode = system.tick;
+    response.numberOfDigests = payloadSize / sizeof(m256i);
+    confirmedTxIndexLock.acquireRead();
+    for (unsigned int i = 0; i < response.numberOfDigests; ++i)
+    {
+        TxStatusOfDigest& status = response.status[i];
+        setMem(&status, sizeof(status), 0);
+        getTxStatusOfDigest(request->digests[i], response.currentTickOfNode, status.tick, status.moneyFlew);
+    }
+    confirmedTxIndexLock.releaseRead();
+
+    enqueueResponse(peer, response.size(), RESPOND_TX_STATUS_OF_DIGESTS, header->dejavu(), &response);
+}
+
 #if TICK_STORAGE_AUTOSAVE_MODE
 // can only be called from main thread
 static bool saveStateTxStatus(const unsigned int numberOfTransactions, CHAR16* directory)
@@ -292,6 +548,7 @@ static bool loadStateTxStatus(const unsigned int numberOfTransactions, CHAR16* d
             return false;
         }
     }
+    rebuildConfirmedTxIndex(numberOfTransactions);
     return true;
 }
 #endif // TICK_STORAGE_AUTOSAVE_MODE
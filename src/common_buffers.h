@@ -12,16 +12,55 @@ constexpr unsigned long long universeSizeInBytes = ASSETS_CAPACITY * sizeof(Asse
 // TODO: check that max contract state size does not exceed size of spectrum or universe
 constexpr unsigned long long reorgBufferSize = (spectrumSizeInBytes >= universeSizeInBytes) ? spectrumSizeInBytes : universeSizeInBytes;
 
-// Buffer used for reorganizing spectrum and universe hash maps, currently also used as scratchpad buffer for contracts
+// Buffer used for reorganizing spectrum and universe hash maps, also used as scratchpad buffer for contract procedures
+// (see reorgScratchpad) and for saving / loading states in the main processor.
 // Must be large enough to fit any contract, full spectrum, and full universe!
 GLOBAL_VAR_DECL void* reorgBuffer GLOBAL_VAR_INIT(nullptr);
 
+// Buffer for temporary data that is handed out as a whole to its current owner, with usage statistics
+struct ScratchpadArena
+{
+    void* buffer;
+    unsigned long long size;
+    unsigned long long maxRequestedSize;
+    unsigned long long numberOfRequests;
+    unsigned long long numberOfFailedRequests;
+
+    void init(void* buffer, unsigned long long size)
+    {
+        this->buffer = buffer;
+        this->size = size;
+        maxRequestedSize = 0;
+        numberOfRequests = 0;
+        numberOfFailedRequests = 0;
+    }
+
+    // Return buffer if it has at least requestedSize bytes, otherwise nullptr. Not thread-safe, only to be called
+    // by the processor owning the arena.
+    void* get(unsigned long long requestedSize)
+    {
+        ++numberOfRequests;
+        if (requestedSize > maxRequestedSize)
+            maxRequestedSize = requestedSize;
+        if (requestedSize > size)
+        {
+            ++numberOfFailedRequests;
+            return nullptr;
+        }
+        return buffer;
+    }
+};
+
+// Scratchpad of the processor running contract procedures (tick / contract processor), using reorgBuffer
+GLOBAL_VAR_DECL ScratchpadArena reorgScratchpad;
+
 static bool initCommonBuffers()
 {
     if (!allocPoolWithErrorLog(L"reorgBuffer", reorgBufferSize, (void**)&reorgBuffer, __LINE__))
     {
         return false;
     }
+    reorgScratchpad.init(reorgBuffer, reorgBufferSize);
 
     return true;
 }
@@ -33,8 +72,11 @@ static void deinitCommonBuffers()
         freePool(reorgBuffer);
         reorgBuffer = nullptr;
     }
+    reorgScratchpad.init(nullptr, 0);
 }
 
+// Return reorgBuffer, only to be used by the core in the tick / contract processor or the main processor.
+// Contract code uses __scratchpad(size) defined in contract_exec.h.
 static void* __scratchpad()
 {
     return reorgBuffer;
@@ -28,6 +28,10 @@ constexpr unsigned long long MAX_CONTRACT_STATE_SIZE = 1073741824;
 // If increased, the size of contractLocalsStack should be increased as well.
 constexpr unsigned int MAX_SIZE_OF_CONTRACT_LOCALS = 32 * 1024;
 
+// Size of scratchpad of each contract function run by a request processor. Functions can only modify containers in
+// their input, output, and locals. Cleaning up or rebuilding a container needs at most its own size as scratchpad.
+constexpr unsigned long long CONTRACT_FUNCTION_SCRATCHPAD_SIZE = 2 * (MAX_SIZE_OF_CONTRACT_LOCALS + 2 * 65536);
+
 // TODO: make sure the limit of nested calls is not violated
 constexpr unsigned short MAX_NESTED_CONTRACT_CALLS = 10;
 
@@ -42,9 +46,7 @@ template <typename T> static void __logContractDebugMessage(unsigned int, T&);
 template <typename T> static void __logContractErrorMessage(unsigned int, T&);
 template <typename T> static void __logContractInfoMessage(unsigned int, T&);
 template <typename T> static void __logContractWarningMessage(unsigned int, T&);
-static void* __scratchpad();    // TODO: concurrency support (n buffers for n allowed concurrent contract executions)
-// static void* __tryAcquireScratchpad(unsigned int size);  // Thread-safe, may return nullptr if no appropriate buffer is available
-// static void __ReleaseScratchpad(void*);
+static void* __scratchpad(unsigned long long size);    // Scratchpad of running processor, nullptr if smaller than size
 
 template <unsigned int functionOrProcedureId>
 struct __FunctionOrProcedureBeginEndGuard
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/assert.h"
+
+#include "network_messages/special_command.h"
+
+
+enum ContractEntryPointKind
+{
+    ContractEntryPointSystemProcedure = 0,
+    ContractEntryPointUserProcedure = 1,
+    ContractEntryPointUserFunction = 2,
+};
+
+// Execution statistics per contract entry point (system procedure, user procedure, or user function), for finding
+// out which entry points use most of the tick budget or of the request processors.
+//
+// Entry points are registered single-threaded during contract initialization, so lookup of entry points doesn't
+// need locking. Each contract has a small open-addressing hash table keyed by kind and input type. Updating the
+// statistics of an entry point is protected by one lock per entry point, because user functions may run
+// concurrently in several request processors.
+template <unsigned int numberOfContracts, unsigned int maxEntryPointsPerContract>
+class ContractEntryPointStatsTable
+{
+public:
+    static_assert(maxEntryPointsPerContract > 0 && (maxEntryPointsPerContract & (maxEntryPointsPerContract - 1)) == 0, "maxEntryPointsPerContract must be a power of 2");
+
+    // Maximum number of entry points that can be registered per contract (load factor <= 0.5)
+    static constexpr unsigned int capacityPerContract = maxEntryPointsPerContract / 2;
+
+    // Remove all entry points and statistics
+    void reset()
+    {
+        setMem(entries, sizeof(entries), 0);
+        setMem(population, sizeof(population), 0);
+    }
+
+    // Register entry point. Not thread-safe, only to be called during initialization. Returns false if the table
+    // of the contract is full.
+    bool registerEntryPoint(unsigned int contractIndex, ContractEntryPointKind kind, unsigned short inputType)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        const unsigned int key = makeKey(kind, inputType);
+        Entry* table = entries[contractIndex];
+        unsigned int slotIdx = hash(key);
+        while (table[slotIdx].key)
+        {
+            if (table[slotIdx].key == key)
+                return true;
+            slotIdx = (slotIdx + 1) & (maxEntryPointsPerContract - 1);
+        }
+        if (population[contractIndex] >= capacityPerContract)
+            return false;
+        table[slotIdx].stats.kind = (unsigned char)kind;
+        table[slotIdx].stats.inputType = inputType;
+        table[slotIdx].key = key;
+        ++population[contractIndex];
+        return true;
+    }
+
+    // Add one finished call to statistics of entry point. Calls of unregistered entry points are ignored.
+    void record(unsigned int contractIndex, ContractEntryPointKind kind, unsigned short inputType,
+        unsigned long long executionTicks, unsigned int localsStackSize,
+        unsigned long long spectrumOperations, unsigned long long universeOperations)
+    {
+        Entry* entry = find(contractIndex, kind, inputType);
+        if (!entry)
+            return;
+
+        ACQUIRE(entry->lock);
+        ContractEntryPointStatistics& stats = entry->stats;
+        ++stats.numberOfCalls;
+        stats.totalExecutionTicks += executionTicks;
+        if (executionTicks > stats.maxExecutionTicks)
+            stats.maxExecutionTicks = executionTicks;
+        if (localsStackSize > stats.maxLocalsStackSize)
+            stats.maxLocalsStackSize = localsStackSize;
+        stats.numberOfSpectrumOperations += spectrumOperations;
+        stats.numberOfUniverseOperations += universeOperations;
+        RELEASE(entry->lock);
+    }
+
+    // Copy statistics of all registered entry points of contract to output array with capacityPerContract elements.
+    // Returns the number of entry points.
+    unsigned int getStatistics(unsigned int contractIndex, ContractEntryPointStatistics* output)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        unsigned int count = 0;
+        for (unsigned int slotIdx = 0; slotIdx < maxEntryPointsPerContract && count < capacityPerContract; ++slotIdx)
+        {
+            Entry& entry = entries[contractIndex][slotIdx];
+            if (entry.key)
+            {
+                ACQUIRE(entry.lock);
+                copyMem(&output[count], &entry.stats, sizeof(ContractEntryPointStatistics));
+                RELEASE(entry.lock);
+                ++count;
+            }
+        }
+        return count;
+    }
+
+private:
+    struct Entry
+    {
+        ContractEntryPointStatistics stats;
+        unsigned int key; // 0 means empty, otherwise makeKey()
+        volatile char lock;
+        char padding[11];
+    };
+    static_assert(sizeof(Entry) == 64, "Unexpected size of entry");
+
+    static unsigned int makeKey(ContractEntryPointKind kind, unsigned short inputType)
+    {
+        return ((unsigned int)(kind + 1) << 16) | inputType;
+    }
+
+    static unsigned int hash(unsigned int key)
+    {
+        return ((key * 0x9E3779B1u) >> 16) & (maxEntryPointsPerContract - 1);
+    }
+
+    Entry* find(unsigned int contractIndex, ContractEntryPointKind kind, unsigned short inputType)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        const unsigned int key = makeKey(kind, inputType);
+        Entry* table = entries[contractIndex];
+        unsigned int slotIdx = hash(key);
+        while (table[slotIdx].key)
+        {
+            if (table[slotIdx].key == key)
+                return &table[slotIdx];
+            slotIdx = (slotIdx + 1) & (maxEntryPointsPerContract - 1);
+        }
+        return nullptr;
+    }
+
+    Entry entries[numberOfContracts][maxEntryPointsPerContract];
+    unsigned int population[numberOfContracts];
+};
@@ -8,10 +8,14 @@
 #include "platform/read_write_lock.h"
 #include "platform/debugging.h"
 #include "platform/memory.h"
+#include <lib/platform_common/processor.h>
 
 #include "contract_core/contract_def.h"
 #include "contract_core/stack_buffer.h"
 #include "contract_core/contract_action_tracker.h"
+#include "contract_core/contract_function_cache.h"
+#include "contract_core/contract_entry_point_stats.h"
+#include "contract_core/contract_state_checkpoint.h"
 
 #include "logging/logging.h"
 #include "common_buffers.h"
@@ -51,8 +55,33 @@ GLOBAL_VAR_DECL ContractExecErrorData contractExecutionErrorData[contractCount];
 
 GLOBAL_VAR_DECL ReadWriteLock contractStateLock[contractCount];
 GLOBAL_VAR_DECL unsigned char* contractStates[contractCount];
+#if CONTRACT_STATE_CHECKPOINTS
+// Contract states at the end of the last tick, updated in getComputerDigest()
+GLOBAL_VAR_DECL ContractStateCheckpoint<contractCount> contractStateCheckpoint;
+#endif
 GLOBAL_VAR_DECL volatile long long contractTotalExecutionTicks[contractCount];
 
+// Execution statistics per entry point of each contract (exported by special command, printed in logInfo())
+typedef ContractEntryPointStatsTable<contractCount, 128> ContractEntryPointStatsTableType;
+GLOBAL_VAR_DECL ContractEntryPointStatsTableType contractEntryPointStats;
+
+// Number of QPI spectrum / universe operations of the entry point call currently running with the stack of
+// the same index, added to contractEntryPointStats when the call has finished
+struct ContractExecutionOperationCounters
+{
+    unsigned long long spectrumOperations;
+    unsigned long long universeOperations;
+};
+GLOBAL_VAR_DECL ContractExecutionOperationCounters contractExecutionOperationCounters[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
+
+// Scratchpads of contract functions run by request processors, one per contract execution stack
+GLOBAL_VAR_DECL void* contractFunctionScratchpadBuffer GLOBAL_VAR_INIT(nullptr);
+GLOBAL_VAR_DECL ScratchpadArena contractFunctionScratchpads[NUMBER_OF_CONTRACT_EXECUTION_BUFFERS];
+
+// Scratchpad used by contract code running in each processor, nullptr means reorgScratchpad (used by procedures,
+// which are only run by the tick / contract processor)
+GLOBAL_VAR_DECL ScratchpadArena* contractScratchpadOfProcessor[MAX_NUMBER_OF_PROCESSORS];
+
 // Contract error state, persistent and only set on error of procedure (TODO: only execute procedures if NoContractError)
 GLOBAL_VAR_DECL unsigned int contractError[contractCount];
 
@@ -60,6 +89,10 @@ GLOBAL_VAR_DECL unsigned int contractError[contractCount];
 // access to contractStateChangeFlags thread-safe
 GLOBAL_VAR_DECL unsigned long long* contractStateChangeFlags GLOBAL_VAR_INIT(nullptr);
 
+// Cache of outputs of user functions requested by clients, invalidated by the tick processor after state changes
+typedef ContractFunctionResultCache<1024, 1024> ContractFunctionResultCacheType;
+GLOBAL_VAR_DECL ContractFunctionResultCacheType contractFunctionResultCache;
+
 
 // Contract system procedures that serve as callbacks, such as PRE_ACQUIRE_SHARES,
 // break the rule that contracts can only call other contracts with lower index.
@@ -162,6 +195,8 @@ static bool initContractExec()
     contractLocalsStackLockWaitingCountMax = 0;
 
     setMem((void*)contractTotalExecutionTicks, sizeof(contractTotalExecutionTicks), 0);
+    contractEntryPointStats.reset();
+    setMem(contractExecutionOperationCounters, sizeof(contractExecutionOperationCounters), 0);
     setMem((void*)contractError, sizeof(contractError), 0);
     setMem((void*)contractExecutionErrorData, sizeof(contractExecutionErrorData), 0);
     for (int i = 0; i < contractCount; ++i)
@@ -174,6 +209,17 @@ static bool initContractExec()
         return false;
     }
     setMem(contractStateChangeFlags, MAX_NUMBER_OF_CONTRACTS / 8, 0xFF);
+    contractFunctionResultCache.reset();
+
+    if (!allocPoolWithErrorLog(L"contractFunctionScratchpadBuffer", NUMBER_OF_CONTRACT_EXECUTION_BUFFERS * CONTRACT_FUNCTION_SCRATCHPAD_SIZE, &contractFunctionScratchpadBuffer, __LINE__))
+    {
+        return false;
+    }
+    for (int i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
+    {
+        contractFunctionScratchpads[i].init((char*)contractFunctionScratchpadBuffer + i * CONTRACT_FUNCTION_SCRATCHPAD_SIZE, CONTRACT_FUNCTION_SCRATCHPAD_SIZE);
+    }
+    setMem(contractScratchpadOfProcessor, sizeof(contractScratchpadOfProcessor), 0);
 
     contractCallbacksRunning = NoContractCallback;
 
@@ -190,9 +236,32 @@ static void deinitContractExec()
         freePool(contractStateChangeFlags);
     }
 
+    if (contractFunctionScratchpadBuffer)
+    {
+        freePool(contractFunctionScratchpadBuffer);
+        contractFunctionScratchpadBuffer = nullptr;
+    }
+
     contractActionTracker.freeBuffer();
 }
 
+// Set scratchpad used by contract code running in this processor (nullptr for reorgScratchpad)
+static void setContractScratchpadOfRunningProcessor(ScratchpadArena* scratchpad)
+{
+    const unsigned long long processorID = getRunningProcessorID();
+    if (processorID < MAX_NUMBER_OF_PROCESSORS)
+        contractScratchpadOfProcessor[processorID] = scratchpad;
+}
+
+// Return scratchpad buffer of the processor running the contract code (for example for cleanup of QPI containers),
+// or nullptr if the scratchpad is smaller than size.
+static void* __scratchpad(unsigned long long size)
+{
+    const unsigned long long processorID = getRunningProcessorID();
+    ScratchpadArena* scratchpad = (processorID < MAX_NUMBER_OF_PROCESSORS) ? contractScratchpadOfProcessor[processorID] : nullptr;
+    return (scratchpad) ? scratchpad->get(size) : reorgScratchpad.get(size);
+}
+
 // Acquire lock of an currently unused stack (may block if all in use)
 // stacksToIgnore > 0 can be passed by low priority tasks to keep some stacks reserved for high prio purposes.
 static void acquireContractLocalsStack(int& stackIdx, unsigned int stacksToIgnore = 0)
@@ -234,6 +303,37 @@ static void releaseContractLocalsStack(int& stackIdx)
     stackIdx = -1;
 }
 
+// Start accounting of entry point call, to be called after acquiring the stack and before allocating input / output
+static void beginContractEntryPointAccounting(int stackIndex)
+{
+    ASSERT(stackIndex >= 0 && stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    contractLocalsStack[stackIndex].resetPeakSize();
+    contractExecutionOperationCounters[stackIndex].spectrumOperations = 0;
+    contractExecutionOperationCounters[stackIndex].universeOperations = 0;
+}
+
+// Finish accounting of entry point call started with beginContractEntryPointAccounting(), before releasing the stack
+static void endContractEntryPointAccounting(int stackIndex, unsigned int contractIndex, ContractEntryPointKind kind, unsigned short inputType, unsigned long long executionTicks)
+{
+    ASSERT(stackIndex >= 0 && stackIndex < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS);
+    contractEntryPointStats.record(contractIndex, kind, inputType, executionTicks, contractLocalsStack[stackIndex].peakSize(),
+        contractExecutionOperationCounters[stackIndex].spectrumOperations, contractExecutionOperationCounters[stackIndex].universeOperations);
+}
+
+// Count QPI operation accessing the spectrum in statistics of the running entry point call
+static void countContractSpectrumOperation(int stackIndex)
+{
+    if (stackIndex >= 0)
+        ++contractExecutionOperationCounters[stackIndex].spectrumOperations;
+}
+
+// Count QPI operation accessing the universe in statistics of the running entry point call
+static void countContractUniverseOperation(int stackIndex)
+{
+    if (stackIndex >= 0)
+        ++contractExecutionOperationCounters[stackIndex].universeOperations;
+}
+
 // Allocate storage on ContractLocalsStack of QPI execution context
 void* QPI::QpiContextFunctionCall::__qpiAllocLocals(unsigned int sizeOfLocals) const
 {
@@ -748,7 +848,8 @@ static void __beginFunctionOrProcedure(const unsigned int functionOrProcedureId)
     // called by all non-empty system procedures, user procedures, and user functions
     // purpose:
     // - make sure the limit of nested calls is not violated
-    // - measure execution time
+    // - measure execution time of nested calls (entry points called by the core are measured in
+    //   QpiContextSystemProcedureCall, QpiContextUserProcedureCall, and QpiContextUserFunctionCall)
     // - construction of execution graph
     // - debugging
 }
@@ -761,6 +862,11 @@ static void __endFunctionOrProcedure(const unsigned int functionOrProcedureId)
 
 QPI::QpiContextForInit::QpiContextForInit(unsigned int contractIndex) : QpiContext(contractIndex, NULL_ID, NULL_ID, 0, REGISTER_USER_FUNCTIONS_AND_PROCEDURES_CALL)
 {
+    for (unsigned short systemProcId = 0; systemProcId < contractSystemProcedureCount; ++systemProcId)
+    {
+        if (contractSystemProcedures[contractIndex][systemProcId])
+            contractEntryPointStats.registerEntryPoint(contractIndex, ContractEntryPointSystemProcedure, systemProcId);
+    }
 }
 
 void QPI::QpiContextForInit::__registerUserFunction(USER_FUNCTION userFunction, unsigned short inputType, unsigned short inputSize, unsigned short outputSize, unsigned int localsSize) const
@@ -769,6 +875,7 @@ void QPI::QpiContextForInit::__registerUserFunction(USER_FUNCTION userFunction,
     contractUserFunctionInputSizes[_currentContractIndex][inputType] = inputSize;
     contractUserFunctionOutputSizes[_currentContractIndex][inputType] = outputSize;
     contractUserFunctionLocalsSizes[_currentContractIndex][inputType] = localsSize;
+    contractEntryPointStats.registerEntryPoint(_currentContractIndex, ContractEntryPointUserFunction, inputType);
 }
 
 void QPI::QpiContextForInit::__registerUserProcedure(USER_PROCEDURE userProcedure, unsigned short inputType, unsigned short inputSize, unsigned short outputSize, unsigned int localsSize) const
@@ -777,6 +884,7 @@ void QPI::QpiContextForInit::__registerUserProcedure(USER_PROCEDURE userProcedur
     contractUserProcedureInputSizes[_currentContractIndex][inputType] = inputSize;
     contractUserProcedureOutputSizes[_currentContractIndex][inputType] = outputSize;
     contractUserProcedureLocalsSizes[_currentContractIndex][inputType] = localsSize;
+    contractEntryPointStats.registerEntryPoint(_currentContractIndex, ContractEntryPointUserProcedure, inputType);
 }
 
 
@@ -829,6 +937,7 @@ private:
         // reserve stack for this processor (may block), needed even if there are no locals, because procedure may call
         // functions / procedures / notifications that create locals etc.
         acquireContractLocalsStack(_stackIndex);
+        beginContractEntryPointAccounting(_stackIndex);
 
         // acquire state for writing (may block)
         contractStateLock[_currentContractIndex].acquireWrite();
@@ -856,7 +965,9 @@ private:
             contractLocalsStack[_stackIndex].free();
             ASSERT(contractLocalsStack[_stackIndex].size() == 0);
         }
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        endContractEntryPointAccounting(_stackIndex, _currentContractIndex, ContractEntryPointSystemProcedure, (unsigned short)systemProcId, executionTicks);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
@@ -906,6 +1017,7 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
 
         // reserve stack for this processor (may block)
         acquireContractLocalsStack(_stackIndex);
+        beginContractEntryPointAccounting(_stackIndex);
 
         // allocate input, output, and locals buffer from stack and init them
         unsigned short fullInputSize = contractUserProcedureInputSizes[_currentContractIndex][inputType];
@@ -958,7 +1070,9 @@ struct QpiContextUserProcedureCall : public QPI::QpiContextProcedureCall
         // run procedure
         const unsigned long long startTick = __rdtsc();
         contractUserProcedures[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        endContractEntryPointAccounting(_stackIndex, _currentContractIndex, ContractEntryPointUserProcedure, inputType, executionTicks);
 
         // release lock of contract state and set state to changed
         contractStateLock[_currentContractIndex].releaseWrite();
@@ -1019,6 +1133,10 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
         // reserve stack for this processor (may block)
         constexpr unsigned int stacksNotUsedToReserveThemForStateWriter = 1;
         acquireContractLocalsStack(_stackIndex, stacksNotUsedToReserveThemForStateWriter);
+        beginContractEntryPointAccounting(_stackIndex);
+
+        // use scratchpad of stack, because functions run concurrently in the request processors
+        setContractScratchpadOfRunningProcessor(&contractFunctionScratchpads[_stackIndex]);
 
         // allocate input, output, and locals buffer from stack and init them
         unsigned short fullInputSize = contractUserFunctionInputSizes[_currentContractIndex][inputType];
@@ -1076,7 +1194,8 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
             rollbackContractFunctionCall(_stackIndex);
             ASSERT(contractLocalsStack[_stackIndex].size() == 0);
 
-            // release stack
+            // release scratchpad and stack
+            setContractScratchpadOfRunningProcessor(nullptr);
             releaseContractLocalsStack(_stackIndex);
 
             // return error code, allowing to handle error, for example retry later
@@ -1089,10 +1208,13 @@ struct QpiContextUserFunctionCall : public QPI::QpiContextFunctionCall
         // run function
         const unsigned long long startTick = __rdtsc();
         contractUserFunctions[_currentContractIndex][inputType](*this, contractStates[_currentContractIndex], inputBuffer, outputBuffer, localsBuffer);
-        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], __rdtsc() - startTick);
+        const unsigned long long executionTicks = __rdtsc() - startTick;
+        _interlockedadd64(&contractTotalExecutionTicks[_currentContractIndex], executionTicks);
+        endContractEntryPointAccounting(_stackIndex, _currentContractIndex, ContractEntryPointUserFunction, inputType, executionTicks);
 
-        // release lock of contract state
+        // release lock of contract state and scratchpad
         __qpiReleaseStateForReading(_currentContractIndex);
+        setContractScratchpadOfRunningProcessor(nullptr);
 
         return NoContractError;
     }
@@ -0,0 +1,148 @@
+#pragma once
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/assert.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Bounded cache of outputs of contract user functions (REQUEST_CONTRACT_FUNCTION), keyed by contract index, input
+// type, and digest of the input. Many clients query the same getters with the same input while the ledger doesn't
+// change, so the output can be returned without executing the function again.
+//
+// Functions may read the state of other contracts, the spectrum, the universe, and the current tick / time. So all
+// entries are invalidated at once by increasing the version whenever any of them may have changed (see
+// invalidate()). An output is only stored with the version read before executing the function, so results of
+// executions overlapping with a change are never returned afterwards.
+//
+// The cache is direct-mapped with one lock per entry, so request processors don't contend on a global lock.
+template <unsigned int numberOfEntries, unsigned int maxOutputSize>
+class ContractFunctionResultCache
+{
+public:
+    static_assert(numberOfEntries > 0 && (numberOfEntries & (numberOfEntries - 1)) == 0, "numberOfEntries must be a power of 2");
+    static_assert(maxOutputSize <= 0xffff, "Output size is stored as unsigned short");
+
+    // Size of output buffer required by tryGet()
+    static constexpr unsigned int maxCachedOutputSize = maxOutputSize;
+
+    // Clear all entries and counters
+    void reset()
+    {
+        setMem(entries, sizeof(entries), 0);
+        version = 1;
+        hits = 0;
+        misses = 0;
+        stores = 0;
+    }
+
+    // Invalidate all entries. Called by the tick processor whenever contract states, spectrum, universe, or tick
+    // may have changed.
+    void invalidate()
+    {
+        ATOMIC_INC64(version);
+    }
+
+    // Return current version, to be passed to tryGet() and put()
+    long long currentVersion()
+    {
+        return ATOMIC_LOAD64(version);
+    }
+
+    // Compute digest of the input of a function call, which is used as key together with contract index and input type
+    static void computeInputDigest(const void* input, unsigned short inputSize, m256i& inputDigest)
+    {
+        KangarooTwelve(input, inputSize, &inputDigest, sizeof(inputDigest));
+    }
+
+    // Copy cached output to output buffer (of at least maxOutputSize bytes) and return true if available for the
+    // given key and the version returned by currentVersion() before.
+    bool tryGet(unsigned int contractIndex, unsigned short inputType, unsigned short inputSize, const m256i& inputDigest,
+        long long expectedVersion, void* output, unsigned short& outputSize)
+    {
+        Entry& entry = entries[entryIndex(contractIndex, inputType, inputDigest)];
+        bool found = false;
+        ACQUIRE(entry.lock);
+        if (entry.version == expectedVersion && entry.contractIndex == contractIndex && entry.inputType == inputType
+            && entry.inputSize == inputSize && entry.inputDigest == inputDigest)
+        {
+            outputSize = entry.outputSize;
+            copyMem(output, entry.output, outputSize);
+            found = true;
+        }
+        RELEASE(entry.lock);
+
+        if (found)
+            ATOMIC_INC64(hits);
+        else
+            ATOMIC_INC64(misses);
+        return found;
+    }
+
+    // Store output of function executed with the version returned by currentVersion() before the execution. Outputs
+    // larger than maxOutputSize and outputs of outdated versions aren't stored.
+    void put(unsigned int contractIndex, unsigned short inputType, unsigned short inputSize, const m256i& inputDigest,
+        long long executionVersion, const void* output, unsigned short outputSize)
+    {
+        if (outputSize > maxOutputSize || executionVersion != currentVersion())
+            return;
+
+        Entry& entry = entries[entryIndex(contractIndex, inputType, inputDigest)];
+        ACQUIRE(entry.lock);
+        entry.version = executionVersion;
+        entry.contractIndex = contractIndex;
+        entry.inputType = inputType;
+        entry.inputSize = inputSize;
+        entry.inputDigest = inputDigest;
+        entry.outputSize = outputSize;
+        copyMem(entry.output, output, outputSize);
+        RELEASE(entry.lock);
+        ATOMIC_INC64(stores);
+    }
+
+    // Number of requests answered from cache
+    long long hitCount()
+    {
+        return ATOMIC_LOAD64(hits);
+    }
+
+    // Number of requests not found in cache
+    long long missCount()
+    {
+        return ATOMIC_LOAD64(misses);
+    }
+
+    // Number of outputs stored in cache
+    long long storeCount()
+    {
+        return ATOMIC_LOAD64(stores);
+    }
+
+private:
+    struct Entry
+    {
+        volatile char lock;
+        unsigned short inputType;
+        unsigned short inputSize;
+        unsigned short outputSize;
+        unsigned int contractIndex;
+        long long version;
+        m256i inputDigest;
+        unsigned char output[maxOutputSize];
+    };
+
+    static unsigned int entryIndex(unsigned int contractIndex, unsigned short inputType, const m256i& inputDigest)
+    {
+        unsigned long long h = inputDigest.m256i_u64[0] ^ ((unsigned long long)contractIndex << 16) ^ inputType;
+        h *= 0x9E3779B97F4A7C15ULL;
+        return (unsigned int)(h >> 32) & (numberOfEntries - 1);
+    }
+
+    Entry entries[numberOfEntries];
+    long long version;
+    long long hits;
+    long long misses;
+    long long stores;
+};
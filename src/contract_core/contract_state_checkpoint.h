@@ -0,0 +1,249 @@
+#pragma once
+
+#include <lib/platform_common/qintrin.h>
+
+#include "platform/memory_util.h"
+#include "platform/assert.h"
+
+
+// Checkpoint of the contract states at the last tick boundary, kept as a second copy of all states with page
+// granularity. It allows to restore the state of a contract in memory and tells the persistence layer which pages
+// have changed since the states were saved last time.
+//
+// UEFI gives us no page protection for copy-on-write, so writes are detected in software: the contract state change
+// flags (contractStateChangeFlags) tell which contracts have been changed since the last checkpoint, and only the
+// pages of these contracts are compared with the checkpoint. Only pages that differ are copied. So the cost of a
+// checkpoint is O(size of changed contracts) for comparing (without writing) plus O(dirty pages) for copying,
+// instead of copying all states. Unchanged contracts cost nothing.
+//
+// All functions except the const getters have to be called by the only thread that changes contract states (the tick
+// processor) or while no contract is running.
+template <unsigned int numberOfContracts>
+class ContractStateCheckpoint
+{
+public:
+    static constexpr unsigned long long pageSize = 4096;
+
+    static constexpr unsigned long long getNumberOfPages(unsigned long long stateSize)
+    {
+        return (stateSize + pageSize - 1) / pageSize;
+    }
+
+    // Allocate checkpoint buffers and take initial checkpoint of the states. All pages are marked as unsaved.
+    // Contracts with state size 0 are skipped.
+    bool init(unsigned char* const* states, const unsigned long long* stateSizes)
+    {
+        setMem(contracts, sizeof(contracts), 0);
+        numberOfCopiedPages = 0;
+        for (unsigned int contractIndex = 0; contractIndex < numberOfContracts; contractIndex++)
+        {
+            Contract& contract = contracts[contractIndex];
+            contract.state = states[contractIndex];
+            contract.stateSize = stateSizes[contractIndex];
+            if (!contract.stateSize)
+            {
+                continue;
+            }
+            const unsigned long long numberOfFlagWords = (getNumberOfPages(contract.stateSize) + 63) / 64;
+            if (!allocPoolWithErrorLog(L"contractStateCheckpoint", contract.stateSize, (void**)&contract.checkpoint, __LINE__)
+                || !allocPoolWithErrorLog(L"contractStateUnsavedPages", numberOfFlagWords * 8, (void**)&contract.unsavedPageFlags, __LINE__))
+            {
+                deinit();
+                return false;
+            }
+            copyMem(contract.checkpoint, contract.state, contract.stateSize);
+            markAllPagesUnsaved(contractIndex);
+        }
+        initialized = true;
+        return true;
+    }
+
+    void deinit()
+    {
+        for (unsigned int contractIndex = 0; contractIndex < numberOfContracts; contractIndex++)
+        {
+            if (contracts[contractIndex].checkpoint)
+            {
+                freePool(contracts[contractIndex].checkpoint);
+            }
+            if (contracts[contractIndex].unsavedPageFlags)
+            {
+                freePool(contracts[contractIndex].unsavedPageFlags);
+            }
+        }
+        setMem(contracts, sizeof(contracts), 0);
+        initialized = false;
+    }
+
+    bool isInitialized() const
+    {
+        return initialized;
+    }
+
+    // Take checkpoint of the states of all contracts whose bit is set in changeFlags (bit i of changeFlags[i / 64] for
+    // contract i, same layout as contractStateChangeFlags). Changed pages are copied to the checkpoint and marked as
+    // unsaved. Returns the number of copied pages.
+    unsigned long long update(const unsigned long long* changeFlags)
+    {
+        if (!initialized)
+        {
+            return 0;
+        }
+        unsigned long long copiedPages = 0;
+        for (unsigned int contractIndex = 0; contractIndex < numberOfContracts; contractIndex++)
+        {
+            if (changeFlags[contractIndex >> 6] & (1ULL << (contractIndex & 63)))
+            {
+                copiedPages += updateContract(contractIndex);
+            }
+        }
+        numberOfCopiedPages += copiedPages;
+        return copiedPages;
+    }
+
+    // Take checkpoint of the state of one contract. Returns the number of copied pages.
+    unsigned long long updateContract(unsigned int contractIndex)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        Contract& contract = contracts[contractIndex];
+        unsigned long long copiedPages = 0;
+        for (unsigned long long page = 0, offset = 0; offset < contract.stateSize; page++, offset += pageSize)
+        {
+            const unsigned long long size = (contract.stateSize - offset < pageSize) ? contract.stateSize - offset : pageSize;
+            if (!isEqual(contract.state + offset, contract.checkpoint + offset, size))
+            {
+                copyMem(contract.checkpoint + offset, contract.state + offset, size);
+                contract.unsavedPageFlags[page >> 6] |= (1ULL << (page & 63));
+                copiedPages++;
+            }
+        }
+        return copiedPages;
+    }
+
+    // Restore the state of a contract from the last checkpoint. Only pages that have changed since the checkpoint are
+    // copied. The caller has to set the change flag of the contract, because the state digest needs to be updated.
+    // Returns the number of restored pages.
+    unsigned long long restore(unsigned int contractIndex)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        Contract& contract = contracts[contractIndex];
+        if (!initialized || !contract.checkpoint)
+        {
+            return 0;
+        }
+        unsigned long long restoredPages = 0;
+        for (unsigned long long offset = 0; offset < contract.stateSize; offset += pageSize)
+        {
+            const unsigned long long size = (contract.stateSize - offset < pageSize) ? contract.stateSize - offset : pageSize;
+            if (!isEqual(contract.state + offset, contract.checkpoint + offset, size))
+            {
+                copyMem(contract.state + offset, contract.checkpoint + offset, size);
+                restoredPages++;
+            }
+        }
+        return restoredPages;
+    }
+
+    // State of contract at the last checkpoint, which may be read (for example for saving) while the contract is running
+    const unsigned char* getCheckpoint(unsigned int contractIndex) const
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        return contracts[contractIndex].checkpoint;
+    }
+
+    // Return if page of the checkpoint has changed since markSaved() was called for the contract
+    bool isPageUnsaved(unsigned int contractIndex, unsigned long long page) const
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        ASSERT(page < getNumberOfPages(contracts[contractIndex].stateSize));
+        return (contracts[contractIndex].unsavedPageFlags[page >> 6] >> (page & 63)) & 1;
+    }
+
+    // Return number of pages of the checkpoint that have changed since markSaved() was called for the contract
+    unsigned long long getNumberOfUnsavedPages(unsigned int contractIndex) const
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        const Contract& contract = contracts[contractIndex];
+        unsigned long long count = 0;
+        const unsigned long long numberOfFlagWords = (getNumberOfPages(contract.stateSize) + 63) / 64;
+        for (unsigned long long i = 0; i < numberOfFlagWords; i++)
+        {
+            count += _mm_popcnt_u64(contract.unsavedPageFlags[i]);
+        }
+        return count;
+    }
+
+    // Flags of the pages of the checkpoint that have changed since markSaved() was called for the contract (bit p of
+    // element p / 64 for page p), for example to pass to savePages()
+    const unsigned long long* getUnsavedPageFlags(unsigned int contractIndex) const
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        return contracts[contractIndex].unsavedPageFlags;
+    }
+
+    // Call after the checkpoint of the contract has been saved
+    void markSaved(unsigned int contractIndex)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        const Contract& contract = contracts[contractIndex];
+        if (contract.unsavedPageFlags)
+        {
+            setMem(contract.unsavedPageFlags, (getNumberOfPages(contract.stateSize) + 63) / 64 * 8, 0);
+        }
+    }
+
+    // Call if the saved data of the contract got lost, for example because it will be saved to another directory
+    void markAllPagesUnsaved(unsigned int contractIndex)
+    {
+        ASSERT(contractIndex < numberOfContracts);
+        const Contract& contract = contracts[contractIndex];
+        const unsigned long long numberOfPages = getNumberOfPages(contract.stateSize);
+        for (unsigned long long page = 0; page < numberOfPages; page++)
+        {
+            contract.unsavedPageFlags[page >> 6] |= (1ULL << (page & 63));
+        }
+    }
+
+    // Total number of pages copied by update() since init()
+    unsigned long long getNumberOfCopiedPages() const
+    {
+        return numberOfCopiedPages;
+    }
+
+private:
+    static bool isEqual(const unsigned char* a, const unsigned char* b, unsigned long long size)
+    {
+        unsigned long long i = 0;
+        for (; i + 128 <= size; i += 128)
+        {
+            __m256i diff = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)), _mm256_loadu_si256((const __m256i*)(b + i)));
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 32)), _mm256_loadu_si256((const __m256i*)(b + i + 32))));
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 64)), _mm256_loadu_si256((const __m256i*)(b + i + 64))));
+            diff = _mm256_or_si256(diff, _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i + 96)), _mm256_loadu_si256((const __m256i*)(b + i + 96))));
+            if (!_mm256_testz_si256(diff, diff))
+            {
+                return false;
+            }
+        }
+        for (; i < size; i++)
+        {
+            if (a[i] != b[i])
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    struct Contract
+    {
+        unsigned char* state;
+        unsigned char* checkpoint;
+        unsigned long long* unsavedPageFlags;
+        unsigned long long stateSize;
+    };
+
+    Contract contracts[numberOfContracts];
+    unsigned long long numberOfCopiedPages;
+    bool initialized;
+};
@@ -1,11 +1,21 @@
 #pragma once
 
 #include "contracts/qpi.h"
+#include "contract_core/contract_exec.h"
 
 #include "assets/assets.h"
 #include "spectrum/spectrum.h"
 
 
+// Buffers for collecting dividends in distributeDividends(). It is only called in procedures, which are not run
+// concurrently (tick processor or contract processor), and it cannot be nested, because it is not available in
+// POST_INCOMING_TRANSFER callbacks.
+GLOBAL_VAR_DECL struct DividendBatch
+{
+    EnergyIncrease transfers[NUMBER_OF_COMPUTORS];        // in order of iteration, used for actions, logs, and callbacks
+    EnergyIncrease sortedIncreases[NUMBER_OF_COMPUTORS];  // sorted by hash map index in increaseEnergyBatch()
+} dividendBatch;
+
 
 // Start iteration with issuance filter (selects first record).
 void QPI::AssetIssuanceIterator::begin(const QPI::AssetIssuanceSelect& issuance)
@@ -379,6 +389,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
     uint16 sourceOwnershipManagingContractIndex, uint16 sourcePossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -462,6 +474,8 @@ sint64 QPI::QpiContextProcedureCall::acquireShares(
 
 bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return false;
@@ -488,28 +502,32 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
     if (decreaseEnergy(index, amountPerShare * NUMBER_OF_COMPUTORS))
     {
+        // Collect dividends of all shareholders while holding universeLock only
         ACQUIRE(universeLock);
 
         Asset asset(id::zero(), *((unsigned long long*)contractDescriptions[_currentContractIndex].assetName));
         AssetPossessionIterator iter(asset);
         long long totalShareCounter = 0;
+        unsigned int holderCount = 0;
 
         while (!iter.reachedEnd())
         {
             ASSERT(iter.possessionIndex() < ASSETS_CAPACITY);
 
             const auto& possession = assets[iter.possessionIndex()].varStruct.possession;
-            const long long dividend = amountPerShare * possession.numberOfShares;
-
-            increaseEnergy(possession.publicKey, dividend);
-
-            if (!contractActionTracker.addQuTransfer(_currentContractId, possession.publicKey, dividend))
-                __qpiAbort(ContractErrorTooManyActions);
-
-            __qpiNotifyPostIncomingTransfer(_currentContractId, possession.publicKey, dividend, TransferType::qpiDistributeDividends);
 
-            const QuTransfer quTransfer = { _currentContractId, possession.publicKey, dividend };
-            logger.logQuTransfer(quTransfer);
+            // Possession records with 0 shares may remain until the universe is reorganized at the end of the epoch.
+            // They are skipped, so each holder has at least one share and the batch cannot exceed NUMBER_OF_COMPUTORS.
+            if (possession.numberOfShares > 0)
+            {
+                ASSERT(holderCount < NUMBER_OF_COMPUTORS);
+                if (holderCount < NUMBER_OF_COMPUTORS)
+                {
+                    dividendBatch.transfers[holderCount].publicKey = possession.publicKey;
+                    dividendBatch.transfers[holderCount].amount = amountPerShare * possession.numberOfShares;
+                    ++holderCount;
+                }
+            }
 
             totalShareCounter += possession.numberOfShares;
 
@@ -519,6 +537,30 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
         ASSERT(totalShareCounter == NUMBER_OF_COMPUTORS || totalShareCounter == 0);
 
         RELEASE(universeLock);
+
+        // Apply all balance increases with one acquisition of spectrumLock (sorted copy keeps the original order
+        // of transfers for actions, logs, and callbacks)
+        copyMem(dividendBatch.sortedIncreases, dividendBatch.transfers, holderCount * sizeof(EnergyIncrease));
+        increaseEnergyBatch(dividendBatch.sortedIncreases, holderCount);
+
+        for (unsigned int i = 0; i < holderCount; i++)
+        {
+            if (!contractActionTracker.addQuTransfer(_currentContractId, dividendBatch.transfers[i].publicKey, dividendBatch.transfers[i].amount))
+                __qpiAbort(ContractErrorTooManyActions);
+        }
+
+        // Emit all transfer logs in one batch
+        for (unsigned int i = 0; i < holderCount; i++)
+        {
+            const QuTransfer quTransfer = { _currentContractId, dividendBatch.transfers[i].publicKey, dividendBatch.transfers[i].amount };
+            logger.logQuTransfer(quTransfer);
+        }
+
+        // Notify receiving contracts after universeLock has been released, so callbacks cannot deadlock on it
+        for (unsigned int i = 0; i < holderCount; i++)
+        {
+            __qpiNotifyPostIncomingTransfer(_currentContractId, dividendBatch.transfers[i].publicKey, dividendBatch.transfers[i].amount, TransferType::qpiDistributeDividends);
+        }
     }
 
     return true;
@@ -527,6 +569,8 @@ bool QPI::QpiContextProcedureCall::distributeDividends(long long amountPerShare)
 
 long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, const QPI::id& issuer, signed char numberOfDecimalPlaces, long long numberOfShares, unsigned long long unitOfMeasurement) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     if (((unsigned char)name) < 'A' || ((unsigned char)name) > 'Z'
         || name > 0xFFFFFFFFFFFFFF)
     {
@@ -589,11 +633,15 @@ long long QPI::QpiContextProcedureCall::issueAsset(unsigned long long name, cons
 // TODO: remove after testing period, because numberOfShares() can do this and more
 long long QPI::QpiContextFunctionCall::numberOfPossessedShares(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, unsigned short ownershipManagingContractIndex, unsigned short possessionManagingContractIndex) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     return ::numberOfPossessedShares(assetName, issuer, owner, possessor, ownershipManagingContractIndex, possessionManagingContractIndex);
 }
 
 sint64 QPI::QpiContextFunctionCall::numberOfShares(const QPI::Asset& asset, const QPI::AssetOwnershipSelect& ownership, const QPI::AssetPossessionSelect& possession) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     return ::numberOfShares(asset, ownership, possession);
 }
 
@@ -602,6 +650,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
     uint16 destinationOwnershipManagingContractIndex, uint16 destinationPossessionManagingContractIndex,
     sint64 offeredTransferFee) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     // prevent nested calling of management rights transfer from callbacks
     if (contractCallbacksRunning & ContractCallbackManagementRightsTransfer)
     {
@@ -682,6 +732,8 @@ sint64 QPI::QpiContextProcedureCall::releaseShares(
 
 long long QPI::QpiContextProcedureCall::transferShareOwnershipAndPossession(unsigned long long assetName, const m256i& issuer, const m256i& owner, const m256i& possessor, long long numberOfShares, const m256i& newOwnerAndPossessor) const
 {
+    countContractUniverseOperation(_stackIndex);
+
     if (numberOfShares <= 0 || numberOfShares > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
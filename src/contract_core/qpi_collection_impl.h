@@ -280,7 +280,8 @@ namespace QPI
 	template <typename T, uint64 L>
 	sint64 Collection<T, L>::_rebuild(sint64 rootIdx)
 	{
-		auto* sortedElementIndices = reinterpret_cast<sint64*>(::__scratchpad());
+		// scratchpad holds up to L sorted indices (padded to multiple of 4) and a queue of L ranges
+		auto* sortedElementIndices = reinterpret_cast<sint64*>(::__scratchpad((L + 3) * sizeof(sint64) + L * sizeof(sint64_4)));
 		if (sortedElementIndices == NULL)
 		{
 			return rootIdx;
@@ -592,12 +593,17 @@ namespace QPI
 			return;
 		}
 
-		// Init buffers
-		auto* _povsBuffer = reinterpret_cast<PoV*>(::__scratchpad());
+		// Init buffers (new pov hash map and stack of up to L element indices for traversing a tree); cleanup is
+		// skipped if scratchpad is too small, povs stay marked for removal
+		auto* _povsBuffer = reinterpret_cast<PoV*>(::__scratchpad(sizeof(_povs) + sizeof(_povOccupationFlags) + L * sizeof(sint64)));
+		if (!_povsBuffer)
+		{
+			return;
+		}
 		auto* _povOccupationFlagsBuffer = reinterpret_cast<uint64*>(_povsBuffer + L);
 		auto* _stackBuffer = reinterpret_cast<sint64*>(
 			_povOccupationFlagsBuffer + sizeof(_povOccupationFlags) / sizeof(_povOccupationFlags[0]));
-		setMem(::__scratchpad(), sizeof(_povs) + sizeof(_povOccupationFlags), 0);
+		setMem(_povsBuffer, sizeof(_povs) + sizeof(_povOccupationFlags), 0);
 		uint64 newPopulation = 0;
 
 		// Go through pov hash map. For each pov that is occupied but not marked for removal, insert pov in new Collection's pov buffers and
@@ -217,12 +217,16 @@ namespace QPI
 			return;
 		}
 
-		// Init buffers
-		auto* _elementsBuffer = reinterpret_cast<Element*>(::__scratchpad());
+		// Init buffers (cleanup is skipped if scratchpad is too small, elements stay marked for removal)
+		auto* _elementsBuffer = reinterpret_cast<Element*>(::__scratchpad(sizeof(_elements) + sizeof(_occupationFlags)));
+		if (!_elementsBuffer)
+		{
+			return;
+		}
 		auto* _occupationFlagsBuffer = reinterpret_cast<uint64*>(_elementsBuffer + L);
 		auto* _stackBuffer = reinterpret_cast<sint64*>(
 			_occupationFlagsBuffer + sizeof(_occupationFlags) / sizeof(_occupationFlags[0]));
-		setMem(::__scratchpad(), sizeof(_elements) + sizeof(_occupationFlags), 0);
+		setMem(_elementsBuffer, sizeof(_elements) + sizeof(_occupationFlags), 0);
 		uint64 newPopulation = 0;
 
 		// Go through hash map. For each element that is occupied but not marked for removal, insert element in new hash map's buffers.
@@ -505,12 +509,16 @@ namespace QPI
 			return;
 		}
 
-		// Init buffers
-		auto* _keyBuffer = reinterpret_cast<KeyT*>(::__scratchpad());
+		// Init buffers (cleanup is skipped if scratchpad is too small, keys stay marked for removal)
+		auto* _keyBuffer = reinterpret_cast<KeyT*>(::__scratchpad(sizeof(_keys) + sizeof(_occupationFlags)));
+		if (!_keyBuffer)
+		{
+			return;
+		}
 		auto* _occupationFlagsBuffer = reinterpret_cast<uint64*>(_keyBuffer + L);
 		auto* _stackBuffer = reinterpret_cast<sint64*>(
 			_occupationFlagsBuffer + sizeof(_occupationFlags) / sizeof(_occupationFlags[0]));
-		setMem(::__scratchpad(), sizeof(_keys) + sizeof(_occupationFlags), 0);
+		setMem(_keyBuffer, sizeof(_keys) + sizeof(_occupationFlags), 0);
 		uint64 newPopulation = 0;
 
 		// Go through hash map. For each element that is occupied but not marked for removal, insert element in new hash map's buffers.
@@ -6,31 +6,21 @@
 
 bool QPI::QpiContextFunctionCall::getEntity(const m256i& id, QPI::Entity& entity) const
 {
-    int index = spectrumIndex(id);
-    if (index < 0)
-    {
-        entity.publicKey = id;
-        entity.incomingAmount = 0;
-        entity.outgoingAmount = 0;
-        entity.numberOfIncomingTransfers = 0;
-        entity.numberOfOutgoingTransfers = 0;
-        entity.latestIncomingTransferTick = 0;
-        entity.latestOutgoingTransferTick = 0;
-
-        return false;
-    }
-    else
-    {
-        entity.publicKey = spectrum[index].publicKey;
-        entity.incomingAmount = spectrum[index].incomingAmount;
-        entity.outgoingAmount = spectrum[index].outgoingAmount;
-        entity.numberOfIncomingTransfers = spectrum[index].numberOfIncomingTransfers;
-        entity.numberOfOutgoingTransfers = spectrum[index].numberOfOutgoingTransfers;
-        entity.latestIncomingTransferTick = spectrum[index].latestIncomingTransferTick;
-        entity.latestOutgoingTransferTick = spectrum[index].latestOutgoingTransferTick;
-
-        return true;
-    }
+    countContractSpectrumOperation(_stackIndex);
+
+    // Read without acquiring spectrumLock, so user functions don't wait for the transactions being processed
+    ::Entity spectrumEntity;
+    const int index = readEntity(id, spectrumEntity);
+
+    entity.publicKey = spectrumEntity.publicKey;
+    entity.incomingAmount = spectrumEntity.incomingAmount;
+    entity.outgoingAmount = spectrumEntity.outgoingAmount;
+    entity.numberOfIncomingTransfers = spectrumEntity.numberOfIncomingTransfers;
+    entity.numberOfOutgoingTransfers = spectrumEntity.numberOfOutgoingTransfers;
+    entity.latestIncomingTransferTick = spectrumEntity.latestIncomingTransferTick;
+    entity.latestOutgoingTransferTick = spectrumEntity.latestOutgoingTransferTick;
+
+    return index >= 0;
 }
 
 // Return reference to fee reserve of contract for changing its value (data stored in state of contract 0)
@@ -42,6 +32,8 @@ static long long& contractFeeReserve(unsigned int contractIndex)
 
 long long QPI::QpiContextProcedureCall::burn(long long amount) const
 {
+    countContractSpectrumOperation(_stackIndex);
+
     if (amount < 0 || amount > MAX_AMOUNT)
     {
         return -((long long)(MAX_AMOUNT + 1));
@@ -76,6 +68,8 @@ long long QPI::QpiContextProcedureCall::burn(long long amount) const
 
 long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long long amount) const
 {
+    countContractSpectrumOperation(_stackIndex);
+
     if (contractCallbacksRunning & ContractCallbackPostIncomingTransfer)
     {
         return INVALID_AMOUNT;
@@ -118,6 +112,8 @@ long long QPI::QpiContextProcedureCall::transfer(const m256i& destination, long
 
 m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 {
+    countContractSpectrumOperation(_stackIndex);
+
     int index = spectrumIndex(currentId);
     while (++index < SPECTRUM_CAPACITY)
     {
@@ -133,6 +129,8 @@ m256i QPI::QpiContextFunctionCall::nextId(const m256i& currentId) const
 
 m256i QPI::QpiContextFunctionCall::prevId(const m256i& currentId) const
 {
+    countContractSpectrumOperation(_stackIndex);
+
     int index = spectrumIndex(currentId);
     while (--index >= 0)
     {
@@ -24,6 +24,7 @@ struct StackBuffer
     void init()
     {
         _allocatedSize = 0;
+        _peakAllocatedSize = 0;
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
         _maxAllocatedSize = 0;
         _failedAllocAttempts = 0;
@@ -42,6 +43,18 @@ struct StackBuffer
         return _allocatedSize;
     }
 
+    // Max number of bytes used since last call of resetPeakSize() (or init()).
+    SizeType peakSize() const
+    {
+        return _peakAllocatedSize;
+    }
+
+    // Start measuring peak size from current size, for example for measuring stack usage of one contract call.
+    void resetPeakSize()
+    {
+        _peakAllocatedSize = _allocatedSize;
+    }
+
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
     SizeType maxSizeObserved() const
     {
@@ -96,6 +109,8 @@ struct StackBuffer
          
         // update size
         _allocatedSize = newSize;
+        if (_allocatedSize > _peakAllocatedSize)
+            _peakAllocatedSize = _allocatedSize;
 #ifdef TRACK_MAX_STACK_BUFFER_SIZE
         ASSERT(_maxAllocatedSize <= bufferSize);
         if (_allocatedSize > _maxAllocatedSize)
@@ -196,6 +211,9 @@ protected:
     // number of bytes used in buffer
     SizeType _allocatedSize;
 
+    // max number of bytes used since resetPeakSize()
+    SizeType _peakAllocatedSize;
+
     // Flag used internally to indicate a special block (bit set in size on _buffer)
     static constexpr SizeType specialBlockFlag = (1 << (sizeof(StackBufferSizeType) * 8 - 1));
 
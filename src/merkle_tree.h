@@ -0,0 +1,315 @@
+#pragma once
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/file_io.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Merkle trees of spectrum and universe are stored level by level in one digest array: the 2^depth leaf digests
+// first, followed by the 2^(depth-1) digests of the next level, ..., and the root at index 2^(depth+1) - 2.
+// Leaf i is the digest of the state element i, each inner node is the digest of its 2 children.
+
+// Call processItem(context, i) for each i in [0, numberOfItems). The items may be processed concurrently, so
+// processItem must be thread-safe.
+typedef void (*ParallelForFunction)(unsigned int numberOfItems, void (*processItem)(void* context, unsigned int itemIndex), void* context);
+
+// Default ParallelForFunction processing all items in the calling processor
+static void sequentialFor(unsigned int numberOfItems, void (*processItem)(void* context, unsigned int itemIndex), void* context)
+{
+    for (unsigned int i = 0; i < numberOfItems; ++i)
+    {
+        processItem(context, i);
+    }
+}
+
+// Depth of the subtrees computed as one work item by computeMerkleTree() (4096 leafs per item)
+constexpr unsigned int MERKLE_SUBTREE_DEPTH = 12;
+
+// Number of chunks that computeLargeDigest() hashes independently at most
+constexpr unsigned int LARGE_DIGEST_MAX_CHUNKS = 256;
+
+// Minimum size of the chunks hashed by computeLargeDigest()
+constexpr unsigned long long LARGE_DIGEST_MIN_CHUNK_SIZE = 16 * 1024 * 1024;
+
+static void computeMerkleLeafDigest(const unsigned char* leaf, unsigned int leafSize, m256i& digest)
+{
+    if (leafSize == 64)
+    {
+        KangarooTwelve64To32(leaf, &digest);
+    }
+    else
+    {
+        KangarooTwelve(leaf, leafSize, &digest, 32);
+    }
+}
+
+struct MerkleTreeComputation
+{
+    const unsigned char* leafs;
+    unsigned int leafSize;
+    unsigned int depth;
+    unsigned int subtreeDepth;
+    m256i* digests;
+};
+
+// Compute the digests of the nodes in levels [firstLevel, lastLevel] that are in the subtree with the given index
+// at lastLevel. Level 0 are the leafs, which are hashed from the state data.
+static void computeMerkleTreeLevels(const MerkleTreeComputation& computation, unsigned int firstLevel, unsigned int lastLevel, unsigned long long subtreeIndex)
+{
+    const unsigned long long numberOfLeafs = 1ULL << computation.depth;
+    unsigned long long levelBeginning = 0;
+    unsigned long long levelSize = numberOfLeafs;
+    for (unsigned int level = 0; level < firstLevel; ++level)
+    {
+        levelBeginning += levelSize;
+        levelSize >>= 1;
+    }
+
+    for (unsigned int level = firstLevel; level <= lastLevel; ++level)
+    {
+        const unsigned long long nodesInSubtree = 1ULL << (lastLevel - level);
+        const unsigned long long firstNode = subtreeIndex * nodesInSubtree;
+        if (level == 0)
+        {
+            for (unsigned long long i = firstNode; i < firstNode + nodesInSubtree; ++i)
+            {
+                computeMerkleLeafDigest(computation.leafs + i * computation.leafSize, computation.leafSize, computation.digests[i]);
+            }
+        }
+        else
+        {
+            const unsigned long long previousLevelBeginning = levelBeginning - (levelSize << 1);
+            for (unsigned long long i = firstNode; i < firstNode + nodesInSubtree; ++i)
+            {
+                KangarooTwelve64To32(&computation.digests[previousLevelBeginning + (i << 1)], &computation.digests[levelBeginning + i]);
+            }
+        }
+        levelBeginning += levelSize;
+        levelSize >>= 1;
+    }
+}
+
+static void computeMerkleSubtree(void* context, unsigned int subtreeIndex)
+{
+    const MerkleTreeComputation& computation = *(const MerkleTreeComputation*)context;
+    computeMerkleTreeLevels(computation, 0, computation.subtreeDepth, subtreeIndex);
+}
+
+// Compute all digests of the Merkle tree of 2^depth leafs of leafSize bytes each. The subtrees are independent
+// work items that may be distributed over several processors by parallelFor, the few levels above are computed
+// by the calling processor.
+static void computeMerkleTree(const void* leafs, unsigned int leafSize, unsigned int depth, m256i* digests, ParallelForFunction parallelFor = sequentialFor)
+{
+    MerkleTreeComputation computation;
+    computation.leafs = (const unsigned char*)leafs;
+    computation.leafSize = leafSize;
+    computation.depth = depth;
+    computation.subtreeDepth = (depth < MERKLE_SUBTREE_DEPTH) ? depth : MERKLE_SUBTREE_DEPTH;
+    computation.digests = digests;
+
+    parallelFor(1U << (depth - computation.subtreeDepth), computeMerkleSubtree, &computation);
+    if (depth > computation.subtreeDepth)
+    {
+        computeMerkleTreeLevels(computation, computation.subtreeDepth + 1, depth, 0);
+    }
+}
+
+// Sort indices in place and remove duplicates. Returns the number of unique indices. Insertion sort, because it is
+// only used for the few leafs of one request.
+static unsigned int sortUniqueIndices(unsigned int* indices, unsigned int numberOfIndices)
+{
+    for (unsigned int i = 1; i < numberOfIndices; ++i)
+    {
+        const unsigned int index = indices[i];
+        unsigned int j = i;
+        while (j > 0 && indices[j - 1] > index)
+        {
+            indices[j] = indices[j - 1];
+            --j;
+        }
+        indices[j] = index;
+    }
+
+    unsigned int numberOfUniqueIndices = 0;
+    for (unsigned int i = 0; i < numberOfIndices; ++i)
+    {
+        if (!numberOfUniqueIndices || indices[numberOfUniqueIndices - 1] != indices[i])
+        {
+            indices[numberOfUniqueIndices++] = indices[i];
+        }
+    }
+    return numberOfUniqueIndices;
+}
+
+// Get the siblings of a Merkle multiproof of several leafs, which contains each node needed for computing the
+// root only once. Nodes that can be computed from the proven leafs are left out, so leafs sharing a path need
+// less siblings than individual proofs (at most numberOfIndices * depth). The siblings are written level by level
+// and within a level by ascending node index. indices must be sorted and unique (see sortUniqueIndices()) and are
+// overwritten. Returns the number of siblings. Not thread-safe, protecting digests is up to the caller.
+template <unsigned int depth>
+static unsigned int getMerkleMultiproofSiblings(unsigned int* indices, unsigned int numberOfIndices, const m256i* digests, m256i* siblings)
+{
+    unsigned int numberOfSiblings = 0;
+    unsigned long long levelBeginning = 0;
+    for (unsigned int level = 0; level < depth; ++level)
+    {
+        unsigned int numberOfParents = 0;
+        for (unsigned int i = 0; i < numberOfIndices; ++i)
+        {
+            const unsigned int index = indices[i];
+            if (i + 1 < numberOfIndices && indices[i + 1] == (index ^ 1))
+            {
+                // both children are known to the verifier
+                ++i;
+            }
+            else
+            {
+                siblings[numberOfSiblings++] = digests[levelBeginning + (index ^ 1)];
+            }
+            indices[numberOfParents++] = index >> 1;
+        }
+        numberOfIndices = numberOfParents;
+        levelBeginning += 1ULL << (depth - level);
+    }
+    return numberOfSiblings;
+}
+
+// Verify a Merkle multiproof created by getMerkleMultiproofSiblings(). nodeDigests[i] is the leaf digest of the leaf
+// indices[i] when calling. indices must be sorted and unique, both arrays are overwritten. Returns false if the
+// number of siblings doesn't match. Otherwise, root is set to the computed root, which has to be compared with the
+// expected root by the caller.
+template <unsigned int depth>
+static bool computeMerkleRootFromMultiproof(unsigned int* indices, m256i* nodeDigests, unsigned int numberOfIndices,
+    const m256i* siblings, unsigned int numberOfSiblings, m256i& root)
+{
+    if (!numberOfIndices)
+    {
+        return false;
+    }
+
+    unsigned int siblingIndex = 0;
+    m256i children[2];
+    for (unsigned int level = 0; level < depth; ++level)
+    {
+        unsigned int numberOfParents = 0;
+        for (unsigned int i = 0; i < numberOfIndices; ++i)
+        {
+            const unsigned int index = indices[i];
+            if (i + 1 < numberOfIndices && indices[i + 1] == (index ^ 1))
+            {
+                children[0] = nodeDigests[i];
+                children[1] = nodeDigests[i + 1];
+                ++i;
+            }
+            else
+            {
+                if (siblingIndex >= numberOfSiblings)
+                {
+                    return false;
+                }
+                children[index & 1] = nodeDigests[i];
+                children[(index & 1) ^ 1] = siblings[siblingIndex++];
+            }
+            KangarooTwelve64To32(children, &nodeDigests[numberOfParents]);
+            indices[numberOfParents++] = index >> 1;
+        }
+        numberOfIndices = numberOfParents;
+    }
+    root = nodeDigests[0];
+    return siblingIndex == numberOfSiblings;
+}
+
+struct LargeDigestComputation
+{
+    const unsigned char* data;
+    unsigned long long size;
+    unsigned long long chunkSize;
+    m256i chunkDigests[LARGE_DIGEST_MAX_CHUNKS];
+};
+
+static void computeLargeDigestChunk(void* context, unsigned int chunkIndex)
+{
+    LargeDigestComputation& computation = *(LargeDigestComputation*)context;
+    const unsigned long long offset = chunkIndex * computation.chunkSize;
+    const unsigned long long remainingSize = computation.size - offset;
+    const unsigned long long size = (remainingSize < computation.chunkSize) ? remainingSize : computation.chunkSize;
+    KangarooTwelve(computation.data + offset, (unsigned int)size, &computation.chunkDigests[chunkIndex], 32);
+}
+
+// Compute digest of a large buffer (such as the full spectrum or a Merkle tree) as digest of the digests of up to
+// LARGE_DIGEST_MAX_CHUNKS chunks, which may be hashed in parallel.
+static void computeLargeDigest(const void* data, unsigned long long size, m256i& digest, ParallelForFunction parallelFor = sequentialFor)
+{
+    LargeDigestComputation computation;
+    computation.data = (const unsigned char*)data;
+    computation.size = size;
+    computation.chunkSize = (size + LARGE_DIGEST_MAX_CHUNKS - 1) / LARGE_DIGEST_MAX_CHUNKS;
+    if (computation.chunkSize < LARGE_DIGEST_MIN_CHUNK_SIZE)
+        computation.chunkSize = LARGE_DIGEST_MIN_CHUNK_SIZE;
+    const unsigned int numberOfChunks = (unsigned int)((size + computation.chunkSize - 1) / computation.chunkSize);
+
+    parallelFor(numberOfChunks, computeLargeDigestChunk, &computation);
+    KangarooTwelve(computation.chunkDigests, numberOfChunks * sizeof(m256i), &digest, 32);
+}
+
+// Content of the header file saved with a Merkle tree, for checking that the tree is intact and belongs to the
+// loaded state data before using it instead of recomputing it
+struct MerkleTreeFileHeader
+{
+    m256i leafDataDigest;
+    m256i treeDigest;
+    unsigned long long numberOfLeafs;
+    unsigned long long leafSize;
+};
+
+static constexpr unsigned long long merkleTreeSizeInBytes(unsigned int depth)
+{
+    return ((2ULL << depth) - 1) * sizeof(m256i);
+}
+
+static void computeMerkleTreeFileHeader(const void* leafs, unsigned int leafSize, unsigned int depth, const m256i* digests, MerkleTreeFileHeader& header, ParallelForFunction parallelFor = sequentialFor)
+{
+    setMem(&header, sizeof(header), 0);
+    header.numberOfLeafs = 1ULL << depth;
+    header.leafSize = leafSize;
+    computeLargeDigest(leafs, header.numberOfLeafs * leafSize, header.leafDataDigest, parallelFor);
+    computeLargeDigest(digests, merkleTreeSizeInBytes(depth), header.treeDigest, parallelFor);
+}
+
+// Save Merkle tree to file fileName and its header to file headerFileName.
+static bool saveMerkleTree(const CHAR16* fileName, const CHAR16* headerFileName, const void* leafs, unsigned int leafSize, unsigned int depth,
+    const m256i* digests, const CHAR16* directory = NULL, ParallelForFunction parallelFor = sequentialFor)
+{
+    MerkleTreeFileHeader header;
+    computeMerkleTreeFileHeader(leafs, leafSize, depth, digests, header, parallelFor);
+
+    if (save(fileName, merkleTreeSizeInBytes(depth), (const unsigned char*)digests, directory) != merkleTreeSizeInBytes(depth))
+    {
+        return false;
+    }
+    return save(headerFileName, sizeof(header), (const unsigned char*)&header, directory) == sizeof(header);
+}
+
+// Load Merkle tree saved by saveMerkleTree() for the leafs that have already been loaded. Returns false if the
+// files cannot be read or if the tree does not match its header or the leafs. The content of digests is undefined
+// in this case and the tree has to be recomputed.
+static bool loadMerkleTree(const CHAR16* fileName, const CHAR16* headerFileName, const void* leafs, unsigned int leafSize, unsigned int depth,
+    m256i* digests, const CHAR16* directory = NULL, ParallelForFunction parallelFor = sequentialFor)
+{
+    MerkleTreeFileHeader savedHeader;
+    if (load(headerFileName, sizeof(savedHeader), (unsigned char*)&savedHeader, directory) != sizeof(savedHeader)
+        || savedHeader.numberOfLeafs != (1ULL << depth) || savedHeader.leafSize != leafSize)
+    {
+        return false;
+    }
+    if (load(fileName, merkleTreeSizeInBytes(depth), (unsigned char*)digests, directory) != merkleTreeSizeInBytes(depth))
+    {
+        return false;
+    }
+
+    MerkleTreeFileHeader header;
+    computeMerkleTreeFileHeader(leafs, leafSize, depth, digests, header, parallelFor);
+    return header.leafDataDigest == savedHeader.leafDataDigest && header.treeDigest == savedHeader.treeDigest;
+}
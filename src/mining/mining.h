@@ -98,6 +98,84 @@ struct BroadcastCustomMiningTransaction
 
 BroadcastCustomMiningTransaction gCustomMiningBroadcastTxBuffer[NUMBER_OF_COMPUTORS];
 
+// Number of custom mining shares per computor in the current custom mining phase, incremented by the request
+// processors for each new solution. The computors are split into shards of consecutive indices with separate locks,
+// so solutions of different computors rarely contend on the same lock.
+class CustomMiningSharesCountShards
+{
+public:
+    static constexpr unsigned int numberOfShards = 16;
+    static constexpr unsigned int computorsPerShard = (NUMBER_OF_COMPUTORS + numberOfShards - 1) / numberOfShards;
+
+    void reset()
+    {
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+        {
+            ACQUIRE(shards[s].lock);
+            setMem(shards[s].count, sizeof(shards[s].count), 0);
+            RELEASE(shards[s].lock);
+        }
+    }
+
+    void increment(unsigned int computorIndex)
+    {
+        ASSERT(computorIndex < NUMBER_OF_COMPUTORS);
+        Shard& shard = shards[computorIndex / computorsPerShard];
+        ACQUIRE(shard.lock);
+        shard.count[computorIndex % computorsPerShard]++;
+        RELEASE(shard.lock);
+    }
+
+    // Decrement share count of computor if it is not zero yet
+    void decrement(unsigned int computorIndex)
+    {
+        ASSERT(computorIndex < NUMBER_OF_COMPUTORS);
+        Shard& shard = shards[computorIndex / computorsPerShard];
+        ACQUIRE(shard.lock);
+        unsigned int& count = shard.count[computorIndex % computorsPerShard];
+        if (count > 0)
+            count--;
+        RELEASE(shard.lock);
+    }
+
+    // Copy share counts of all computors to sharesCount, clamped to maxValue, and reset all counts to zero.
+    // Returns the largest count that exceeded maxValue, or 0 if there was no overflow.
+    unsigned int snapshotAndReset(unsigned int* sharesCount, unsigned int maxValue)
+    {
+        unsigned int maxOverflow = 0;
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+        {
+            const unsigned int begin = s * computorsPerShard;
+            const unsigned int end = (begin + computorsPerShard < NUMBER_OF_COMPUTORS) ? begin + computorsPerShard : NUMBER_OF_COMPUTORS;
+            ACQUIRE(shards[s].lock);
+            for (unsigned int k = begin; k < end; ++k)
+            {
+                unsigned int count = shards[s].count[k - begin];
+                if (count > maxValue)
+                {
+                    if (count > maxOverflow)
+                        maxOverflow = count;
+                    count = maxValue;
+                }
+                sharesCount[k] = count;
+            }
+            setMem(shards[s].count, sizeof(shards[s].count), 0);
+            RELEASE(shards[s].lock);
+        }
+        return maxOverflow;
+    }
+
+private:
+    struct Shard
+    {
+        volatile char lock;
+        unsigned int count[computorsPerShard];
+        unsigned char padding[64 - (sizeof(unsigned int) * (computorsPerShard + 1)) % 64];
+    };
+
+    Shard shards[numberOfShards];
+};
+
 class CustomMiningSharesCounter
 {
 private:
@@ -255,19 +333,25 @@ static constexpr int CUSTOM_MINING_CACHE_MISS = -1;
 static constexpr int CUSTOM_MINING_CACHE_COLLISION = -2;
 static constexpr int CUSTOM_MINING_CACHE_HIT = -3;
 
-template <typename T, unsigned int size, unsigned int collisionRetries = 20>
+// The cache is split into numberOfShards contiguous ranges of entries, each with its own lock and statistics, so
+// request processors handling solutions that map to different shards don't contend on one lock. The entry index is
+// still computed from the hash over the whole cache, but probing after a collision wraps around within the shard
+// instead of the whole cache. Entries saved without sharding may be unreachable, so the file name has a version.
+template <typename T, unsigned int size, unsigned int collisionRetries = 20, unsigned int numberOfShards = 1>
 class CustomMininingCache
 {
     static_assert(collisionRetries < size, "Number of fetch retries in case of collision is too big!");
+    static_assert(numberOfShards > 0 && numberOfShards <= size, "Invalid number of shards!");
+
+    static constexpr unsigned int shardSize = (size + numberOfShards - 1) / numberOfShards;
+    static_assert(collisionRetries < size - (numberOfShards - 1) * shardSize, "Number of fetch retries in case of collision is too big for shard size!");
+
 public:
 
     void init()
     {
         setMem((unsigned char*)cache, sizeof(cache), 0);
-        lock = 0;
-        hits = 0;
-        misses = 0;
-        collisions = 0;
+        setMem((unsigned char*)shards, sizeof(shards), 0);
         verification = 0;
         invalid = 0;
     }
@@ -275,12 +359,16 @@ public:
     /// Reset all cache entries
     void reset()
     {
-        ACQUIRE(lock);
-        setMem((unsigned char*)cache, sizeof(cache), 0);
-        hits = 0;
-        misses = 0;
-        collisions = 0;
-        RELEASE(lock);
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+        {
+            Shard& shard = shards[s];
+            ACQUIRE(shard.lock);
+            setMem((unsigned char*)&cache[shardBegin(s)], (shardEnd(s) - shardBegin(s)) * sizeof(T), 0);
+            shard.hits = 0;
+            shard.misses = 0;
+            shard.collisions = 0;
+            RELEASE(shard.lock);
+        }
     }
 
     /// Return maximum number of entries that can be stored in cache
@@ -299,50 +387,23 @@ public:
     void getEntry(T& rData, unsigned int cacheIndex)
     {
         cacheIndex %= capacity();
-        ACQUIRE(lock);
+        Shard& shard = shards[cacheIndex / shardSize];
+        ACQUIRE(shard.lock);
         rData = cache[cacheIndex];
-        RELEASE(lock);
+        RELEASE(shard.lock);
     }
 
     // Try to fetch data from cacheIndex, also checking a few following entries in case of collisions (may update cacheIndex),
     // increments counter of hits, misses, or collisions
     int tryFetching(T& rData, unsigned int& cacheIndex)
     {
-        int retVal;
         unsigned int tryFetchIdx = rData.getHashIndex() % capacity();
-        ACQUIRE(lock);
-        for (unsigned int i = 0; i < collisionRetries; ++i)
-        {
-            const T& cacheData = cache[tryFetchIdx];
-            if (cacheData.isEmpty())
-            {
-                // miss: data not available in cache yet (entry is empty)
-                misses++;
-                retVal = CUSTOM_MINING_CACHE_MISS;
-                break;
-            }
+        Shard& shard = shards[tryFetchIdx / shardSize];
+        ACQUIRE(shard.lock);
+        int retVal = probe(shard, rData, tryFetchIdx);
+        RELEASE(shard.lock);
 
-            if (cacheData.isMatched(rData))
-            {
-                // hit: data available in cache -> return score
-                hits++;
-                retVal = CUSTOM_MINING_CACHE_HIT;
-                break;
-            }
-
-            // collision: other data is mapped to same index -> retry at following index
-            retVal = CUSTOM_MINING_CACHE_COLLISION;
-            tryFetchIdx = (tryFetchIdx + 1) % capacity();
-        }
-        RELEASE(lock);
-
-        if (retVal ==  CUSTOM_MINING_CACHE_COLLISION)
-        {
-            ACQUIRE(lock);
-            collisions++;
-            RELEASE(lock);
-        }
-        else
+        if (retVal != CUSTOM_MINING_CACHE_COLLISION)
         {
             cacheIndex = tryFetchIdx;
         }
@@ -353,44 +414,15 @@ public:
     // increments counter of hits, misses, or collisions
     int tryFetchingAndUpdate(T& rData, int updateCondition)
     {
-        int retVal;
         unsigned int tryFetchIdx = rData.getHashIndex() % capacity();
-        ACQUIRE(lock);
-        for (unsigned int i = 0; i < collisionRetries; ++i)
-        {
-            const T& cacheData = cache[tryFetchIdx];
-            if (cacheData.isEmpty())
-            {
-                // miss: data not available in cache yet (entry is empty)
-                misses++;
-                retVal = CUSTOM_MINING_CACHE_MISS;
-                break;
-            }
-
-            if (cacheData.isMatched(rData))
-            {
-                // hit: data available in cache -> return score
-                hits++;
-                retVal = CUSTOM_MINING_CACHE_HIT;
-                break;
-            }
-
-            // collision: other data is mapped to same index -> retry at following index
-            retVal = CUSTOM_MINING_CACHE_COLLISION;
-            tryFetchIdx = (tryFetchIdx + 1) % capacity();
-        }
+        Shard& shard = shards[tryFetchIdx / shardSize];
+        ACQUIRE(shard.lock);
+        int retVal = probe(shard, rData, tryFetchIdx);
         if (retVal == updateCondition)
         {
             cache[tryFetchIdx] = rData;
         }
-        RELEASE(lock);
-
-        if (retVal == CUSTOM_MINING_CACHE_COLLISION)
-        {
-            ACQUIRE(lock);
-            collisions++;
-            RELEASE(lock);
-        }
+        RELEASE(shard.lock);
         return retVal;
     }
 
@@ -399,9 +431,10 @@ public:
     void addEntry(const T& rData, unsigned int cacheIndex)
     {
         cacheIndex %= capacity();
-        ACQUIRE(lock);
+        Shard& shard = shards[cacheIndex / shardSize];
+        ACQUIRE(shard.lock);
         cache[cacheIndex] = rData;
-        RELEASE(lock);
+        RELEASE(shard.lock);
     }
 
 #ifdef NO_UEFI
@@ -410,9 +443,9 @@ public:
     void save(CHAR16* filename, CHAR16* directory = NULL)
     {
         const unsigned long long beginningTick = __rdtsc();
-        ACQUIRE(lock);
+        acquireAllShards();
         long long savedSize = ::save(filename, sizeof(cache), (unsigned char*)cache, directory);
-        RELEASE(lock);
+        releaseAllShards();
         if (savedSize == sizeof(cache))
         {
             setNumber(message, savedSize, TRUE);
@@ -428,9 +461,9 @@ public:
     {
         bool success = true;
         reset();
-        ACQUIRE(lock);
+        acquireAllShards();
         long long loadedSize = ::load(filename, sizeof(cache), (unsigned char*)cache, directory);
-        RELEASE(lock);
+        releaseAllShards();
         if (loadedSize != sizeof(cache))
         {
             if (loadedSize == -1)
@@ -456,47 +489,103 @@ public:
 #endif
 
     // Return number of hits (data available in cache when fetched)
-    unsigned int hitCount()
+    unsigned int hitCount() const
     {
         unsigned int result = 0;
-        ACQUIRE(lock);
-        result = hits;
-        RELEASE(lock);
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+            result += shards[s].hits;
         return result;
     }
 
     // Return number of misses (data not in cache yet)
-    unsigned int missCount()
+    unsigned int missCount() const
     {
         unsigned int result = 0;
-        ACQUIRE(lock);
-        result = misses;
-        RELEASE(lock);
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+            result += shards[s].misses;
         return result;
     }
 
     // Return number of collisions (other data is mapped to same index)
-    unsigned int collisionCount()
+    unsigned int collisionCount() const
     {
         unsigned int result = 0;
-        ACQUIRE(lock);
-        result = collisions;
-        RELEASE(lock);
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+            result += shards[s].collisions;
         return result;
     }
 
 private:
 
+    // Lock and statistics of a range of entries, padded to a cache line to avoid false sharing between shards.
+    // The statistics are only written with the lock held, reading them for the sums above doesn't need the lock.
+    struct Shard
+    {
+        volatile char lock;
+        unsigned int hits;
+        unsigned int misses;
+        unsigned int collisions;
+        unsigned char padding[48];
+    };
+    static_assert(sizeof(Shard) == 64, "Unexpected size of cache shard");
+
+    static constexpr unsigned int shardBegin(unsigned int s)
+    {
+        return s * shardSize;
+    }
+
+    static constexpr unsigned int shardEnd(unsigned int s)
+    {
+        return (s + 1 < numberOfShards) ? (s + 1) * shardSize : size;
+    }
+
+    // Look for rData starting at tryFetchIdx and update statistics. Requires the lock of the shard containing
+    // tryFetchIdx. On hit or miss, tryFetchIdx is set to the index of the matching or empty entry.
+    int probe(Shard& shard, const T& rData, unsigned int& tryFetchIdx)
+    {
+        const unsigned int s = tryFetchIdx / shardSize;
+        for (unsigned int i = 0; i < collisionRetries; ++i)
+        {
+            const T& cacheData = cache[tryFetchIdx];
+            if (cacheData.isEmpty())
+            {
+                // miss: data not available in cache yet (entry is empty)
+                shard.misses++;
+                return CUSTOM_MINING_CACHE_MISS;
+            }
+
+            if (cacheData.isMatched(rData))
+            {
+                // hit: data available in cache -> return score
+                shard.hits++;
+                return CUSTOM_MINING_CACHE_HIT;
+            }
+
+            // collision: other data is mapped to same index -> retry at following index of the same shard
+            if (++tryFetchIdx == shardEnd(s))
+                tryFetchIdx = shardBegin(s);
+        }
+        shard.collisions++;
+        return CUSTOM_MINING_CACHE_COLLISION;
+    }
+
+    void acquireAllShards()
+    {
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+            ACQUIRE(shards[s].lock);
+    }
+
+    void releaseAllShards()
+    {
+        for (unsigned int s = 0; s < numberOfShards; ++s)
+            RELEASE(shards[s].lock);
+    }
+
     // cache entries (set zero or load from a file on init)
     T cache[size];
 
-    // lock to prevent race conditions on parallel access
-    volatile char lock;
-
-    // statistics of hits, misses, and collisions
-    unsigned int hits;
-    unsigned int misses;
-    unsigned int collisions;
+    // locks to prevent race conditions on parallel access and statistics of hits, misses, and collisions
+    Shard shards[numberOfShards];
 
     // statistics of verification and invalid count
     unsigned int verification;
@@ -604,6 +693,8 @@ private:
 // In charge of storing custom mining
 constexpr unsigned int NUMBER_OF_TASK_PARTITIONS = 4;
 constexpr unsigned long long MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS = (200ULL << 20) / NUMBER_OF_TASK_PARTITIONS / sizeof(CustomMiningSolutionCacheEntry);
+constexpr unsigned int CUSTOM_MINING_SOLUTION_CACHE_SHARDS = 64;
+typedef CustomMininingCache<CustomMiningSolutionCacheEntry, MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS, 20, CUSTOM_MINING_SOLUTION_CACHE_SHARDS> CustomMiningSolutionCache;
 constexpr unsigned long long CUSTOM_MINING_INVALID_INDEX = 0xFFFFFFFFFFFFFFFFULL;
 constexpr unsigned long long CUSTOM_MINING_TASK_STORAGE_COUNT = 60 * 60 * 24 * 8 / 2 / 10; // All epoch tasks in 7 (+1) days, 10s per task, idle phases only
 constexpr unsigned long long CUSTOM_MINING_TASK_STORAGE_SIZE = CUSTOM_MINING_TASK_STORAGE_COUNT * sizeof(CustomMiningTask); // ~16.6MB
@@ -611,7 +702,6 @@ constexpr unsigned long long CUSTOM_MINING_SOLUTION_STORAGE_COUNT = MAX_NUMBER_O
 constexpr unsigned long long CUSTOM_MINING_STORAGE_PROCESSOR_MAX_STORAGE = 10 * 1024 * 1024; // 10MB
 constexpr unsigned long long CUSTOM_MINING_RESPOND_MESSAGE_MAX_SIZE = 1 * 1024 * 1024; // 1MB
 
-static volatile char gCustomMiningSharesCountLock = 0;
 static char gIsInCustomMiningState = 0;
 static volatile char gIsInCustomMiningStateLock = 0;
 static volatile char gCustomMiningTaskStorageLock = 0;
@@ -1228,9 +1318,9 @@ struct CustomMiningTaskPartition
 static CustomMiningTaskPartition gTaskPartition[NUMBER_OF_TASK_PARTITIONS];
 
 #if SOLUTION_CACHE_DYNAMIC_MEM 
-static CustomMininingCache<CustomMiningSolutionCacheEntry, MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS, 20>* gSystemCustomMiningSolutionCache = NULL;
+static CustomMiningSolutionCache* gSystemCustomMiningSolutionCache = NULL;
 #else
-static CustomMininingCache<CustomMiningSolutionCacheEntry, MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS, 20> gSystemCustomMiningSolutionCache[NUMBER_OF_TASK_PARTITIONS];
+static CustomMiningSolutionCache gSystemCustomMiningSolutionCache[NUMBER_OF_TASK_PARTITIONS];
 #endif
 
 static CustomMiningStorage gCustomMiningStorage;
@@ -1278,11 +1368,11 @@ int customMiningInitialize()
     gCustomMiningStorage.init();
 #if SOLUTION_CACHE_DYNAMIC_MEM 
     allocPoolWithErrorLog(L"gSystemCustomMiningSolutionCache",
-        NUMBER_OF_TASK_PARTITIONS * sizeof(CustomMininingCache<CustomMiningSolutionCacheEntry, MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS, 20>),
+        NUMBER_OF_TASK_PARTITIONS * sizeof(CustomMiningSolutionCache),
         (void**)&gSystemCustomMiningSolutionCache,
         __LINE__);
 #endif
-    setMem((unsigned char*)gSystemCustomMiningSolutionCache, NUMBER_OF_TASK_PARTITIONS * sizeof(CustomMininingCache<CustomMiningSolutionCacheEntry, MAX_NUMBER_OF_CUSTOM_MINING_SOLUTIONS, 20>), 0);
+    setMem((unsigned char*)gSystemCustomMiningSolutionCache, NUMBER_OF_TASK_PARTITIONS * sizeof(CustomMiningSolutionCache), 0);
     for (int i = 0; i < NUMBER_OF_TASK_PARTITIONS; i++)
     {
         gSystemCustomMiningSolutionCache[i].init();
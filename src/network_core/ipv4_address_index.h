@@ -0,0 +1,128 @@
+#pragma once
+
+#include "platform/memory_util.h"
+
+#include "network_messages/common_def.h"
+
+
+// Hash map from IPv4Address to an unsigned int value (such as the index in an array of peers) with O(1) find,
+// insert, and remove. It uses open addressing with linear probing and backward shift deletion, so it needs no
+// tombstones and doesn't degrade with churn. Address 0.0.0.0 marks empty entries and cannot be stored.
+//
+// Capacity must be a power of 2 and should be at least twice the number of stored addresses to keep probe
+// sequences short. Instances that aren't zero-initialized statics have to be reset() before use. Not thread-safe,
+// the caller has to lock.
+template <unsigned int capacity>
+class IPv4AddressIndex
+{
+public:
+    static constexpr unsigned int invalidValue = 0xFFFFFFFF;
+
+    void reset()
+    {
+        setMem(entries, sizeof(entries), 0);
+        population = 0;
+    }
+
+    // Return value of address or invalidValue if address is not in index
+    unsigned int find(const IPv4Address& address) const
+    {
+        if (!address.u32)
+        {
+            return invalidValue;
+        }
+        for (unsigned int i = hash(address); entries[i].address.u32; i = (i + 1) & (capacity - 1))
+        {
+            if (entries[i].address == address)
+            {
+                return entries[i].value;
+            }
+        }
+        return invalidValue;
+    }
+
+    // Insert address or update its value. Return false if address is 0 or index is full.
+    bool set(const IPv4Address& address, unsigned int value)
+    {
+        if (!address.u32)
+        {
+            return false;
+        }
+        unsigned int i = hash(address);
+        for (; entries[i].address.u32; i = (i + 1) & (capacity - 1))
+        {
+            if (entries[i].address == address)
+            {
+                entries[i].value = value;
+                return true;
+            }
+        }
+        if (population == capacity - 1) // keep one entry empty to terminate probe sequences
+        {
+            return false;
+        }
+        entries[i].address = address;
+        entries[i].value = value;
+        population++;
+        return true;
+    }
+
+    // Remove address. Return false if it isn't in the index.
+    bool remove(const IPv4Address& address)
+    {
+        if (!address.u32)
+        {
+            return false;
+        }
+        unsigned int i = hash(address);
+        for (; entries[i].address != address; i = (i + 1) & (capacity - 1))
+        {
+            if (!entries[i].address.u32)
+            {
+                return false;
+            }
+        }
+
+        // move following entries of the probe sequence back if the gap is between their home and their position
+        for (unsigned int j = (i + 1) & (capacity - 1); entries[j].address.u32; j = (j + 1) & (capacity - 1))
+        {
+            const unsigned int home = hash(entries[j].address);
+            if (((j - home) & (capacity - 1)) >= ((j - i) & (capacity - 1)))
+            {
+                entries[i] = entries[j];
+                i = j;
+            }
+        }
+        entries[i].address.u32 = 0;
+        population--;
+        return true;
+    }
+
+    unsigned int getPopulation() const
+    {
+        return population;
+    }
+
+private:
+    static_assert(capacity >= 2 && (capacity & (capacity - 1)) == 0, "capacity must be a power of 2");
+
+    static constexpr unsigned int log2(unsigned int x)
+    {
+        return (x <= 1) ? 0 : 1 + log2(x >> 1);
+    }
+
+    // Fibonacci hashing, uses the well-mixed high bits of the product
+    static unsigned int hash(const IPv4Address& address)
+    {
+        return (unsigned int)(((unsigned long long)(address.u32 * 0x9E3779B1u) << log2(capacity)) >> 32);
+    }
+
+    struct Entry
+    {
+        IPv4Address address;
+        unsigned int value;
+    };
+
+    Entry entries[capacity];
+    unsigned int population = 0;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/assert.h"
+
+#include "network_messages/special_command.h"
+
+
+// Traffic and latency statistics per message type (counted since node start), for finding out which messages load
+// the node. Received and sent messages are counted by the main thread, processing by the request processors.
+// Every thread writes to its own counters, so no locks or atomic operations are needed. Readers may see slightly
+// inconsistent sums while counters are updated, which doesn't matter for monitoring.
+template <unsigned int numberOfProcessors>
+class MessageTypeStatisticsTable
+{
+public:
+    static constexpr unsigned int numberOfTypes = 256;
+
+    // Count complete message received from a peer (including duplicates dropped by dejavu), main thread only
+    void recordReceived(unsigned char type, unsigned int bytes)
+    {
+        traffic[type].numberOfReceived++;
+        traffic[type].bytesReceived += bytes;
+    }
+
+    // Count message not added to request queue by admission control, main thread only
+    void recordShed(unsigned char type)
+    {
+        traffic[type].numberOfShed++;
+    }
+
+    // Count message added to the transmit queue of a peer, main thread only
+    void recordSent(unsigned char type, unsigned int bytes)
+    {
+        traffic[type].numberOfSent++;
+        traffic[type].bytesSent += bytes;
+    }
+
+    // Count message processed by request processor, with time spent in the request queue and processing time (TSC)
+    void recordProcessed(unsigned int processorNumber, unsigned char type, unsigned long long queueWaitTicks, unsigned long long processingTicks)
+    {
+        ASSERT(processorNumber < numberOfProcessors);
+        ProcessingCounters& counters = processing[processorNumber][type];
+        counters.numberOfProcessed++;
+        counters.queueWaitTicks += queueWaitTicks;
+        if (queueWaitTicks > counters.maxQueueWaitTicks)
+            counters.maxQueueWaitTicks = queueWaitTicks;
+        counters.processingTicks += processingTicks;
+        if (processingTicks > counters.maxProcessingTicks)
+            counters.maxProcessingTicks = processingTicks;
+    }
+
+    // Get statistics of one message type, merging the counters of all processors
+    void getStatistics(unsigned char type, MessageTypeStatistics& stats) const
+    {
+        setMem(&stats, sizeof(stats), 0);
+        stats.type = type;
+        stats.numberOfReceived = traffic[type].numberOfReceived;
+        stats.bytesReceived = traffic[type].bytesReceived;
+        stats.numberOfSent = traffic[type].numberOfSent;
+        stats.bytesSent = traffic[type].bytesSent;
+        stats.numberOfShed = traffic[type].numberOfShed;
+        for (unsigned int p = 0; p < numberOfProcessors; p++)
+        {
+            const ProcessingCounters& counters = processing[p][type];
+            stats.numberOfProcessed += counters.numberOfProcessed;
+            stats.queueWaitTicks += counters.queueWaitTicks;
+            if (counters.maxQueueWaitTicks > stats.maxQueueWaitTicks)
+                stats.maxQueueWaitTicks = counters.maxQueueWaitTicks;
+            stats.processingTicks += counters.processingTicks;
+            if (counters.maxProcessingTicks > stats.maxProcessingTicks)
+                stats.maxProcessingTicks = counters.maxProcessingTicks;
+        }
+    }
+
+    // Get statistics of all message types that have been seen. Returns number of entries written to stats, which
+    // must have space for numberOfTypes entries.
+    unsigned int getStatistics(MessageTypeStatistics* stats) const
+    {
+        unsigned int count = 0;
+        for (unsigned int type = 0; type < numberOfTypes; type++)
+        {
+            getStatistics((unsigned char)type, stats[count]);
+            if (stats[count].numberOfReceived || stats[count].numberOfSent || stats[count].numberOfProcessed)
+                count++;
+        }
+        return count;
+    }
+
+    void reset()
+    {
+        setMem(traffic, sizeof(traffic), 0);
+        setMem(processing, sizeof(processing), 0);
+    }
+
+private:
+    struct TrafficCounters
+    {
+        unsigned long long numberOfReceived;
+        unsigned long long bytesReceived;
+        unsigned long long numberOfSent;
+        unsigned long long bytesSent;
+        unsigned long long numberOfShed;
+    };
+
+    // 64 bytes, so counters of different processors don't share cache lines
+    struct ProcessingCounters
+    {
+        unsigned long long numberOfProcessed;
+        unsigned long long queueWaitTicks;
+        unsigned long long maxQueueWaitTicks;
+        unsigned long long processingTicks;
+        unsigned long long maxProcessingTicks;
+        unsigned long long padding[3];
+    };
+    static_assert(sizeof(ProcessingCounters) == 64, "Unexpected size");
+
+    TrafficCounters traffic[numberOfTypes];
+    ProcessingCounters processing[numberOfProcessors][numberOfTypes];
+};
@@ -0,0 +1,95 @@
+#pragma once
+
+#include "platform/memory_util.h"
+
+
+// Set of dejavu numbers that have recently been exchanged with one peer (received from it or sent to it), used for
+// not gossiping a message to a peer that already has it. Broadcasted messages keep their dejavu when they are
+// relayed, so the dejavu identifies the message.
+//
+// It's a Bloom filter with two hash functions and two generations: when the current generation is full, it becomes
+// the previous one and the oldest is cleared. So the filter remembers between insertionsPerGeneration and
+// 2 * insertionsPerGeneration dejavu numbers. False positives (about 3% if both generations are full) only make the
+// gossip skip a peer that would have needed the message, which is made up by the other receivers.
+//
+// Not thread-safe, only to be used by the main thread.
+class PeerDejavuFilter
+{
+public:
+    static constexpr unsigned int bitsPerGeneration = 1 << 17;
+    static constexpr unsigned int insertionsPerGeneration = 8192;
+    static constexpr unsigned long long bufferSize = 2 * bitsPerGeneration / 8;
+
+    // Set buffer of bufferSize bytes (owned by caller) and clear filter
+    void setBuffer(void* buffer)
+    {
+        current = (unsigned long long*)buffer;
+        previous = current ? current + bitsPerGeneration / 64 : nullptr;
+        clear();
+    }
+
+    void* getBuffer() const
+    {
+        return (current < previous) ? current : previous;
+    }
+
+    void clear()
+    {
+        if (current)
+        {
+            setMem(current, bitsPerGeneration / 8, 0);
+            setMem(previous, bitsPerGeneration / 8, 0);
+        }
+        numberOfInsertions = 0;
+    }
+
+    // Add dejavu (0 means no dejavu and is ignored)
+    void add(unsigned int dejavu)
+    {
+        if (!dejavu || !current)
+        {
+            return;
+        }
+        if (numberOfInsertions == insertionsPerGeneration)
+        {
+            unsigned long long* oldest = previous;
+            previous = current;
+            current = oldest;
+            setMem(current, bitsPerGeneration / 8, 0);
+            numberOfInsertions = 0;
+        }
+        const unsigned int index1 = hash1(dejavu), index2 = hash2(dejavu);
+        current[index1 >> 6] |= 1ULL << (index1 & 63);
+        current[index2 >> 6] |= 1ULL << (index2 & 63);
+        numberOfInsertions++;
+    }
+
+    // Return if dejavu has (probably) been added recently
+    bool contains(unsigned int dejavu) const
+    {
+        if (!dejavu || !current)
+        {
+            return false;
+        }
+        const unsigned int index1 = hash1(dejavu), index2 = hash2(dejavu);
+        return (((current[index1 >> 6] >> (index1 & 63)) & (current[index2 >> 6] >> (index2 & 63))) & 1)
+            || (((previous[index1 >> 6] >> (index1 & 63)) & (previous[index2 >> 6] >> (index2 & 63))) & 1);
+    }
+
+private:
+    // dejavu numbers are random, so simple hash functions are sufficient
+    static unsigned int hash1(unsigned int dejavu)
+    {
+        return dejavu & (bitsPerGeneration - 1);
+    }
+
+    static unsigned int hash2(unsigned int dejavu)
+    {
+        return (dejavu * 0x9E3779B1u) >> (32 - 17);
+    }
+    static_assert(bitsPerGeneration == (1 << 17), "hash2() has to be adjusted");
+
+    unsigned long long* current = nullptr;
+    unsigned long long* previous = nullptr;
+    unsigned int numberOfInsertions = 0;
+};
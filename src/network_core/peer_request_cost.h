@@ -0,0 +1,199 @@
+#pragma once
+
+#include "platform/concurrency.h"
+
+#include "network_messages/all.h"
+
+
+// Classes of incoming messages with separate budgets for processing time. Gossip (votes, tick data, transactions,
+// and peer exchange broadcasted by other nodes) is never limited, because the node needs it for reaching consensus.
+// Unknown message types count as queries, so a client cannot bypass the limits with unusual messages.
+enum RequestCostClass
+{
+    RequestCostClassGossip = 0,
+    RequestCostClassTickData = 1,
+    RequestCostClassQuery = 2,
+    RequestCostClassContractFunction = 3,
+};
+#define NUMBER_OF_REQUEST_COST_CLASSES 4
+
+static RequestCostClass getRequestCostClass(unsigned char type)
+{
+    switch (type)
+    {
+    case ExchangePublicPeers::type:
+    case BroadcastMessage::type:
+    case BroadcastComputors::type:
+    case BroadcastTick::type:
+    case BroadcastFutureTickData::type:
+    case BROADCAST_TRANSACTION:
+    case RequestComputors::type:
+        return RequestCostClassGossip;
+
+    case RequestQuorumTick::type:
+    case RequestTickData::type:
+    case REQUEST_TICK_TRANSACTIONS:
+        return RequestCostClassTickData;
+
+    case RequestContractFunction::type:
+        return RequestCostClassContractFunction;
+
+    default:
+        return RequestCostClassQuery;
+    }
+}
+
+// Budgets per peer. The budget of a token bucket is refilled continuously with the rate given per second, up to
+// burstSeconds times the rate. A rate of 0 disables the limit.
+struct PeerRequestLimits
+{
+    unsigned long long cpuMicrosecondsPerSecond[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long responseBytesPerSecond;
+    unsigned long long burstSeconds;
+    unsigned long long frequency; // time stamp counter ticks per second
+};
+
+struct TokenBucket
+{
+    long long tokens; // may be negative if more has been charged than available
+    unsigned long long lastRefillTime;
+
+    void reset(unsigned long long now, unsigned long long ratePerSecond, unsigned long long burstSeconds)
+    {
+        tokens = ratePerSecond * burstSeconds;
+        lastRefillTime = now;
+    }
+
+    void refill(unsigned long long now, unsigned long long ratePerSecond, unsigned long long burstSeconds, unsigned long long frequency)
+    {
+        if (!ratePerSecond || !frequency || now <= lastRefillTime)
+        {
+            return;
+        }
+        const long long capacity = ratePerSecond * burstSeconds;
+        const unsigned long long elapsed = now - lastRefillTime;
+        const unsigned long long newTokens = (elapsed / frequency) * ratePerSecond + (elapsed % frequency) * ratePerSecond / frequency;
+        if (!newTokens)
+        {
+            // keep lastRefillTime to accumulate fractions of a token
+            return;
+        }
+        if (tokens + (long long)newTokens >= capacity || newTokens >= (unsigned long long)capacity)
+        {
+            tokens = capacity;
+            lastRefillTime = now;
+        }
+        else
+        {
+            tokens += newTokens;
+            lastRefillTime += (newTokens / ratePerSecond) * frequency + (newTokens % ratePerSecond) * frequency / ratePerSecond;
+        }
+    }
+};
+
+// Cost of the requests of one peer: CPU cycles spent by the request processors per class and bytes of responses,
+// with token buckets limiting them (see PeerRequestLimits). A request is only admitted to the request queue if the
+// budgets of its class are positive. The actual cost is charged after processing, so a single expensive request
+// can exceed the budget, but then the peer has to wait until the debt has been refilled.
+//
+// admit() and chargeResponseBytes() are called by the main thread, chargeCycles() by the request processors.
+class PeerRequestCost
+{
+public:
+    void reset(unsigned long long now, const PeerRequestLimits& limits)
+    {
+        ACQUIRE(lock);
+        for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; c++)
+        {
+            cpuBuckets[c].reset(now, limits.cpuMicrosecondsPerSecond[c], limits.burstSeconds);
+            cycles[c] = 0;
+            numberOfRequests[c] = 0;
+            numberOfRejectedRequests[c] = 0;
+        }
+        responseBytesBucket.reset(now, limits.responseBytesPerSecond, limits.burstSeconds);
+        responseBytes = 0;
+        RELEASE(lock);
+    }
+
+    // Return if request of given class may be processed now
+    bool admit(RequestCostClass costClass, unsigned long long now, const PeerRequestLimits& limits)
+    {
+        bool admitted = true;
+        ACQUIRE(lock);
+        if (costClass != RequestCostClassGossip)
+        {
+            TokenBucket& cpuBucket = cpuBuckets[costClass];
+            cpuBucket.refill(now, limits.cpuMicrosecondsPerSecond[costClass], limits.burstSeconds, limits.frequency);
+            responseBytesBucket.refill(now, limits.responseBytesPerSecond, limits.burstSeconds, limits.frequency);
+            if ((limits.cpuMicrosecondsPerSecond[costClass] && cpuBucket.tokens <= 0)
+                || (limits.responseBytesPerSecond && responseBytesBucket.tokens <= 0))
+            {
+                admitted = false;
+            }
+        }
+        if (admitted)
+            numberOfRequests[costClass]++;
+        else
+            numberOfRejectedRequests[costClass]++;
+        RELEASE(lock);
+        return admitted;
+    }
+
+    // Charge CPU time of processing a request
+    void chargeCycles(RequestCostClass costClass, unsigned long long requestCycles, const PeerRequestLimits& limits)
+    {
+        ACQUIRE(lock);
+        cycles[costClass] += requestCycles;
+        if (limits.frequency)
+        {
+            cpuBuckets[costClass].tokens -= (requestCycles / limits.frequency) * 1000000 + (requestCycles % limits.frequency) * 1000000 / limits.frequency;
+        }
+        RELEASE(lock);
+    }
+
+    // Charge bytes of response sent to the peer
+    void chargeResponseBytes(unsigned long long bytes)
+    {
+        ACQUIRE(lock);
+        responseBytes += bytes;
+        responseBytesBucket.tokens -= bytes;
+        RELEASE(lock);
+    }
+
+    unsigned long long getCycles(RequestCostClass costClass) const
+    {
+        return cycles[costClass];
+    }
+
+    unsigned long long getTotalCycles() const
+    {
+        unsigned long long total = 0;
+        for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; c++)
+            total += cycles[c];
+        return total;
+    }
+
+    unsigned long long getResponseBytes() const
+    {
+        return responseBytes;
+    }
+
+    unsigned long long getNumberOfRequests(RequestCostClass costClass) const
+    {
+        return numberOfRequests[costClass];
+    }
+
+    unsigned long long getNumberOfRejectedRequests(RequestCostClass costClass) const
+    {
+        return numberOfRejectedRequests[costClass];
+    }
+
+private:
+    TokenBucket cpuBuckets[NUMBER_OF_REQUEST_COST_CLASSES]; // tokens in microseconds
+    TokenBucket responseBytesBucket;
+    unsigned long long cycles[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long numberOfRequests[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long numberOfRejectedRequests[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long responseBytes;
+    volatile char lock = 0;
+};
@@ -14,6 +14,13 @@
 #include "network_messages/common_response.h"
 
 #include "tcp4.h"
+#include "shared_message_pool.h"
+#include "peer_request_cost.h"
+#include "request_admission.h"
+#include "request_queue.h"
+#include "peer_dejavu_filter.h"
+#include "ipv4_address_index.h"
+#include "message_type_stats.h"
 #include "kangaroo_twelve.h"
 
 #include "text_output.h"
@@ -25,16 +32,53 @@
 #define NUMBER_OF_INCOMING_CONNECTIONS 88
 #define MAX_NUMBER_OF_PUBLIC_PEERS 1024
 #define REQUEST_QUEUE_BUFFER_SIZE 1073741824
-#define REQUEST_QUEUE_LENGTH 65536 // Must be 65536
+#define REQUEST_QUEUE_LENGTH 65536 // Must be a power of 2
 #define RESPONSE_QUEUE_BUFFER_SIZE 1073741824
 #define RESPONSE_QUEUE_LENGTH 65536 // Must be 65536
 #define NUMBER_OF_PUBLIC_PEERS_TO_KEEP 10
+#define PUBLIC_PEER_INDEX_CAPACITY (2 * MAX_NUMBER_OF_PUBLIC_PEERS)
+#define PUBLIC_PEER_SCORE_MIN -100
+#define PUBLIC_PEER_SCORE_MAX 100
+#define PUBLIC_PEER_SCORE_HANDSHAKE_REWARD 10
+#define PUBLIC_PEER_SCORE_REJECTION_PENALTY 20
+#define PUBLIC_PEER_SELECTION_CANDIDATES 4
 #define NUMBER_OF_WHITE_LIST_PEERS sizeof(whiteListPeers) / sizeof(whiteListPeers[0])
 #define NUMBER_OF_INCOMING_CONNECTIONS_RESERVED_FOR_WHITELIST_IPS 16
+// Shared storage of outgoing messages, replacing the per-peer transmit buffers of BUFFER_SIZE (96 x 32 MB = 3 GB).
+// Broadcasts are stored once for all peers, so the pool mainly has to hold responses to single peers. 2 GB lets 64
+// peers fill their queues up to BUFFER_SIZE with distinct messages before the pool is full and blocking peers are closed.
+#define TRANSMIT_MESSAGE_POOL_SIZE 2147483648ULL
+#define TRANSMIT_MESSAGE_POOL_LENGTH 1048576
+#define PEER_TRANSMIT_QUEUE_LENGTH 4096
+#define MAX_NUMBER_OF_TRANSMIT_FRAGMENTS 32
 static_assert((NUMBER_OF_INCOMING_CONNECTIONS / NUMBER_OF_OUTGOING_CONNECTIONS) >= 11, "Number of incoming connections must be x11+ number of outgoing connections to keep healthy network");
 
 static volatile bool listOfPeersIsStatic = false;
 
+// Outgoing messages of all peers, each message is stored once and referenced by the transmit queues of the receivers
+typedef SharedMessagePool<TRANSMIT_MESSAGE_POOL_SIZE, TRANSMIT_MESSAGE_POOL_LENGTH> TransmitMessagePool;
+static TransmitMessagePool transmitMessagePool;
+static volatile long long numberOfDroppedTransmitMessages = 0; // messages not sent because the pool was full
+
+// Outgoing messages per TransmitPriority that have been dropped because the transmit queue of a peer was full, and
+// how often messages had to wait for another transmission because messages of higher priority were sent first
+static unsigned long long numberOfDroppedOutgoingMessages[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+static unsigned long long numberOfDeferredOutgoingMessages[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+
+// Budgets of request processing per peer (initialized from settings at startup) and incoming requests per
+// RequestCostClass that have been rejected, because a peer exceeded its budget
+static PeerRequestLimits peerRequestLimits;
+static unsigned long long numberOfRateLimitedRequests[NUMBER_OF_REQUEST_COST_CLASSES] = { 0 };
+
+// Admission control of the request queue (limits initialized from settings at startup)
+static RequestAdmissionLimits requestAdmissionLimits;
+static RequestAdmissionControl requestAdmission;
+
+// Gossip to random peers skips peers that already have the message (see Peer::knownDejavus). Number of skipped
+// peers and of sends saved because there were not enough peers without the message.
+static unsigned long long numberOfGossipPeersSkipped = 0;
+static unsigned long long numberOfGossipSendsSaved = 0;
+
 
 struct Peer
 {
@@ -45,9 +89,9 @@ struct Peer
     EFI_TCP4_RECEIVE_DATA receiveData;
     EFI_TCP4_IO_TOKEN receiveToken;
     EFI_TCP4_TRANSMIT_DATA transmitData;
+    EFI_TCP4_FRAGMENT_DATA additionalTransmitFragments[MAX_NUMBER_OF_TRANSMIT_FRAGMENTS - 1]; // continues transmitData.FragmentTable
     EFI_TCP4_IO_TOKEN transmitToken;
-    char* dataToTransmit;
-    unsigned int dataToTransmitSize;
+    PriorityMessageReferenceQueue<PEER_TRANSMIT_QUEUE_LENGTH> transmitQueue;
     BOOLEAN isConnectingAccepting;
     BOOLEAN isConnectedAccepted;
     BOOLEAN isReceiving, isTransmitting;
@@ -56,6 +100,12 @@ struct Peer
     // Indicate the peer is incomming connection type
     BOOLEAN isIncommingConnection;
 
+    // Cost of processing requests of this peer, limiting requests that exceed the budget
+    PeerRequestCost requestCost;
+
+    // Dejavu numbers of messages recently received from or sent to this peer
+    PeerDejavuFilter knownDejavus;
+
     // Extra data to determine if this peer is a fullnode
     // Note: an **active fullnode** is a peer that is able to reply valid tick data, tick vote to this node after getting requested
     // If a peer is an active fullnode, it will receive more requests from this node than others, as well as longer alive connection time.
@@ -107,7 +157,9 @@ struct Peer
         exchangedPublicPeers = FALSE;
         isClosing = FALSE;
         isIncommingConnection = FALSE;
-        dataToTransmitSize = 0;
+        transmitQueue.releaseAll(transmitMessagePool);
+        requestCost.reset(__rdtsc(), peerRequestLimits);
+        knownDejavus.clear();
         lastActiveTick = 0;
         trackRequestedCounter = 0;
         setMem(trackRequestedTick, sizeof(trackRequestedTick), 0);
@@ -115,10 +167,15 @@ struct Peer
     }
 };
 
+static_assert(offsetof(Peer, additionalTransmitFragments) == offsetof(Peer, transmitData) + offsetof(EFI_TCP4_TRANSMIT_DATA, FragmentTable) + sizeof(EFI_TCP4_FRAGMENT_DATA),
+    "additionalTransmitFragments must directly follow transmitData.FragmentTable");
+
 typedef struct
 {
     bool isHandshaked;
     bool isFullnode;
+    bool isKnown; // in knownPublicPeers, never forgotten
+    short score; // connection quality, between PUBLIC_PEER_SCORE_MIN and PUBLIC_PEER_SCORE_MAX
     IPv4Address address;
 } PublicPeer;
 
@@ -130,6 +187,7 @@ static int numberOfAcceptedIncommingConnection = 0;
 static volatile char publicPeersLock = 0;
 static unsigned int numberOfPublicPeers = 0;
 static PublicPeer publicPeers[MAX_NUMBER_OF_PUBLIC_PEERS];
+static IPv4AddressIndex<PUBLIC_PEER_INDEX_CAPACITY> publicPeerIndex; // address -> index in publicPeers
 
 static unsigned long long* dejavu0 = NULL;
 static unsigned long long* dejavu1 = NULL;
@@ -140,29 +198,36 @@ static volatile long long numberOfDiscardedRequests = 0, prevNumberOfDiscardedRe
 static volatile long long numberOfDuplicateRequests = 0, prevNumberOfDuplicateRequests = 0;
 static volatile long long numberOfDisseminatedRequests = 0, prevNumberOfDisseminatedRequests = 0;
 
-static unsigned char* requestQueueBuffer = NULL;
+// Received requests, processed in place by the request processors (enqueue tick is TSC for measuring queue wait time)
+static RequestQueue<REQUEST_QUEUE_BUFFER_SIZE, REQUEST_QUEUE_LENGTH, Peer> requestQueue;
 static unsigned char* responseQueueBuffer = NULL;
 
-static struct Request
-{
-    Peer* peer;
-    unsigned int offset;
-} requestQueueElements[REQUEST_QUEUE_LENGTH];
-
 static struct Response
 {
     Peer* peer;
     unsigned int offset;
 } responseQueueElements[RESPONSE_QUEUE_LENGTH];
 
-static volatile unsigned int requestQueueBufferHead = 0, requestQueueBufferTail = 0;
 static volatile unsigned int responseQueueBufferHead = 0, responseQueueBufferTail = 0;
-static volatile unsigned short requestQueueElementHead = 0, requestQueueElementTail = 0;
 static volatile unsigned short responseQueueElementHead = 0, responseQueueElementTail = 0;
-static volatile char requestQueueTailLock = 0;
 static volatile char responseQueueHeadLock = 0;
 static volatile unsigned long long queueProcessingNumerator = 0, queueProcessingDenominator = 0;
 static volatile unsigned long long tickerLoopNumerator = 0, tickerLoopDenominator = 0;
+static MessageTypeStatisticsTable<MAX_NUMBER_OF_PROCESSORS> messageTypeStatistics;
+
+static unsigned int getNumberOfQueuedRequests()
+{
+    return requestQueue.getNumberOfWaitingRequests();
+}
+
+// Return how full the request queue is in percent, considering both the number of elements and the buffer (including
+// requests in process, whose space is only reused after processing)
+static unsigned int getRequestQueueFillPercent()
+{
+    const unsigned int bytesPercent = (unsigned int)(requestQueue.getNumberOfUsedBytes() * 100 / REQUEST_QUEUE_BUFFER_SIZE);
+    const unsigned int elementsPercent = (unsigned int)(requestQueue.getNumberOfUsedElements() * 100ULL / REQUEST_QUEUE_LENGTH);
+    return (bytesPercent > elementsPercent) ? bytesPercent : elementsPercent;
+}
 
 /*
 static bool isWhiteListPeer(unsigned char address[4])
@@ -197,6 +262,9 @@ static void closePeer(Peer* peer)
             }
 
             peer->isClosing = TRUE;
+
+            // Messages that are not transmitting yet won't be sent, so free them in the shared pool right away
+            peer->transmitQueue.releaseWaiting(transmitMessagePool);
         }
 
         if (!peer->isConnectingAccepting && !peer->isReceiving && !peer->isTransmitting)
@@ -219,110 +287,195 @@ static void closePeer(Peer* peer)
     }
 }
 
-// Add message to sending buffer of specific peer, can only called from main thread (not thread-safe).
-static void push(Peer* peer, RequestResponseHeader* requestResponseHeader)
+// Copy message into the shared pool of outgoing messages. Returns the message index with one reference owned by the
+// caller or TransmitMessagePool::invalidMessageIndex if the pool is full. In the latter case, the peers holding the
+// oldest message are closed, because they block reusing the space of the pool. Can only called from main thread.
+static unsigned int addToTransmitMessagePool(RequestResponseHeader* requestResponseHeader)
 {
-    PROFILE_SCOPE();
-
-    // The sending buffer may queue multiple messages, each of which may need to transmitted in many small packets.
-    if (peer->tcp4Protocol && peer->isConnectedAccepted && !peer->isClosing)
+    const unsigned int messageIndex = transmitMessagePool.add(requestResponseHeader);
+    if (messageIndex == TransmitMessagePool::invalidMessageIndex)
     {
-        if (peer->dataToTransmitSize + requestResponseHeader->size() > BUFFER_SIZE)
+        _InterlockedIncrement64(&numberOfDroppedTransmitMessages);
+        const unsigned int oldestMessageIndex = transmitMessagePool.getOldestMessage();
+        for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
         {
-            // Buffer is full, which indicates a problem
-#ifndef NDEBUG
+            if (peers[i].transmitQueue.contains(oldestMessageIndex))
             {
+#ifndef NDEBUG
                 CHAR16 debugMessage[256];
-                setText(debugMessage, L"Warning: Peer transmit buffer overflow. IP: ");
-                appendIPv4Address(debugMessage, peer->address);
-                appendText(debugMessage, L" | dataToTransmitSize: ");
-                appendNumber(debugMessage, peer->dataToTransmitSize, true);
-                appendText(debugMessage, L" | requestResponseHeader->size(): ");
-                appendNumber(debugMessage, requestResponseHeader->size(), true);
+                setText(debugMessage, L"Warning: Transmit message pool is full, closing peer blocking it. IP: ");
+                appendIPv4Address(debugMessage, peers[i].address);
                 addDebugMessage(debugMessage);
+#endif
+                closePeer(&peers[i]);
             }
+        }
+    }
+    return messageIndex;
+}
+
+// Add reference to message in shared pool to transmit queue of specific peer, can only called from main thread (not thread-safe).
+// If the queue is full, older broadcasts of lower priority or the new message are dropped instead of closing the peer.
+// Messages sent only to this peer (isDroppable false) are never dropped alone, because that would truncate a response.
+// If such a message doesn't fit, the peer is closed.
+static void pushMessageReference(Peer* peer, unsigned int messageIndex, TransmitPriority priority, bool isDroppable)
+{
+    if (peer->transmitQueue.push(transmitMessagePool, messageIndex, priority, isDroppable, BUFFER_SIZE, numberOfDroppedOutgoingMessages))
+    {
+        const RequestResponseHeader* header = transmitMessagePool.getMessage(messageIndex);
+        const unsigned int dejavu = header->dejavu();
+        peer->trackDejavu(dejavu);
+        peer->knownDejavus.add(dejavu);
+        messageTypeStatistics.recordSent(header->type(), header->size());
+        _InterlockedIncrement64(&numberOfDisseminatedRequests);
+    }
+    else
+    {
+#ifndef NDEBUG
+        CHAR16 debugMessage[256];
+        setText(debugMessage, L"Warning: Peer transmit queue full, dropping message. IP: ");
+        appendIPv4Address(debugMessage, peer->address);
+        appendText(debugMessage, L" | waitingBytes: ");
+        appendNumber(debugMessage, peer->transmitQueue.waitingBytes(), true);
+        appendText(debugMessage, L" | priority: ");
+        appendNumber(debugMessage, priority, false);
+        addDebugMessage(debugMessage);
 #endif
+        if (!isDroppable)
+        {
             closePeer(peer);
         }
-        else
+    }
+}
+
+static bool canPushToPeer(const Peer* peer)
+{
+    return peer->tcp4Protocol && peer->isConnectedAccepted && !peer->isClosing;
+}
+
+// Add message to sending buffer of specific peer, can only called from main thread (not thread-safe).
+static void push(Peer* peer, RequestResponseHeader* requestResponseHeader, TransmitPriority priority)
+{
+    PROFILE_SCOPE();
+
+    // The transmit queue may hold multiple messages, each of which may need to transmitted in many small packets.
+    if (canPushToPeer(peer))
+    {
+        const unsigned int messageIndex = addToTransmitMessagePool(requestResponseHeader);
+        if (messageIndex == TransmitMessagePool::invalidMessageIndex)
+        {
+            // shared pool full: close instead of sending an incomplete response
+            closePeer(peer);
+            return;
+        }
+        if (canPushToPeer(peer))
         {
-            // Add message to buffer
-            copyMem(&peer->dataToTransmit[peer->dataToTransmitSize], requestResponseHeader, requestResponseHeader->size());
-            peer->dataToTransmitSize += requestResponseHeader->size();
-            peer->trackDejavu(requestResponseHeader->dejavu());
-            _InterlockedIncrement64(&numberOfDisseminatedRequests);
+            pushMessageReference(peer, messageIndex, priority, false);
         }
+        transmitMessagePool.release(messageIndex);
     }
 }
 
 // Add message to sending buffer of custom filtered (and random) peer, can only called from main thread (not thread-safe).
-static void pushCustom(RequestResponseHeader* requestResponseHeader, int numberOfReceivers, bool filterFullNode)
+// The message is copied into the shared pool only once, no matter how many peers receive it. Peers that recently
+// sent us the message or received it from us (same dejavu) are skipped, so the receivers are chosen among the peers
+// that don't have it yet.
+static void pushCustom(RequestResponseHeader* requestResponseHeader, int numberOfReceivers, bool filterFullNode, TransmitPriority priority)
 {
+    const unsigned int dejavu = requestResponseHeader->dejavu();
     unsigned short suitablePeerIndices[NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS];
-    unsigned short numberOfSuitablePeers = 0;
+    unsigned short numberOfSuitablePeers = 0, numberOfPeersKnowingMessage = 0;
     for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
     {
         if (peers[i].tcp4Protocol && peers[i].isConnectedAccepted && peers[i].exchangedPublicPeers && !peers[i].isClosing)
         {
             if ((filterFullNode && peers[i].isFullNode()) || (!filterFullNode))
             {
-                suitablePeerIndices[numberOfSuitablePeers++] = i;
+                if (peers[i].knownDejavus.contains(dejavu))
+                {
+                    numberOfPeersKnowingMessage++;
+                }
+                else
+                {
+                    suitablePeerIndices[numberOfSuitablePeers++] = i;
+                }
             }
         }
     }
+    if (numberOfPeersKnowingMessage && numberOfReceivers > 0)
+    {
+        numberOfGossipPeersSkipped += numberOfPeersKnowingMessage;
+        const int receiversWithoutSkipping = (numberOfSuitablePeers + numberOfPeersKnowingMessage < numberOfReceivers) ? numberOfSuitablePeers + numberOfPeersKnowingMessage : numberOfReceivers;
+        const int receivers = (numberOfSuitablePeers < numberOfReceivers) ? numberOfSuitablePeers : numberOfReceivers;
+        numberOfGossipSendsSaved += receiversWithoutSkipping - receivers;
+    }
+    if (!numberOfReceivers || !numberOfSuitablePeers)
+    {
+        return;
+    }
+    const unsigned int messageIndex = addToTransmitMessagePool(requestResponseHeader);
+    if (messageIndex == TransmitMessagePool::invalidMessageIndex)
+    {
+        return;
+    }
     unsigned short numberOfRemainingSuitablePeers = numberOfReceivers;
     while (numberOfRemainingSuitablePeers-- && numberOfSuitablePeers)
     {
         const unsigned short index = random(numberOfSuitablePeers);
-        push(&peers[suitablePeerIndices[index]], requestResponseHeader);
+        Peer* peer = &peers[suitablePeerIndices[index]];
+        if (canPushToPeer(peer))
+        {
+            pushMessageReference(peer, messageIndex, priority, true);
+        }
         suitablePeerIndices[index] = suitablePeerIndices[--numberOfSuitablePeers];
     }
+    transmitMessagePool.release(messageIndex);
 }
 
 // Add message to sending buffer of random peer, can only called from main thread (not thread-safe).
-static void pushToAny(RequestResponseHeader* requestResponseHeader)
+static void pushToAny(RequestResponseHeader* requestResponseHeader, TransmitPriority priority)
 {
     PROFILE_SCOPE();
     const bool filterFullNode = false;
-    pushCustom(requestResponseHeader, 1, filterFullNode);
+    pushCustom(requestResponseHeader, 1, filterFullNode, priority);
 }
 
 // Add message to sending buffer of some(DISSEMINATION_MULTIPLIER) random peers, can only called from main thread (not thread-safe).
-static void pushToSeveral(RequestResponseHeader* requestResponseHeader)
+static void pushToSeveral(RequestResponseHeader* requestResponseHeader, TransmitPriority priority)
 {
     PROFILE_SCOPE();
     const bool filterFullNode = false;
-    pushCustom(requestResponseHeader, DISSEMINATION_MULTIPLIER, filterFullNode);
+    pushCustom(requestResponseHeader, DISSEMINATION_MULTIPLIER, filterFullNode, priority);
 }
 
 // Add message to sending buffer of any full node peer, can only called from main thread (not thread-safe).
-static void pushToAnyFullNode(RequestResponseHeader* requestResponseHeader)
+static void pushToAnyFullNode(RequestResponseHeader* requestResponseHeader, TransmitPriority priority)
 {
     PROFILE_SCOPE();
     const bool filterFullNode = true;
-    pushCustom(requestResponseHeader, 1, filterFullNode);
+    pushCustom(requestResponseHeader, 1, filterFullNode, priority);
 }
 
 // Add message to sending buffer of some full node peers, can only called from main thread (not thread-safe).
-static void pushToSeveralFullNode(RequestResponseHeader* requestResponseHeader)
+static void pushToSeveralFullNode(RequestResponseHeader* requestResponseHeader, TransmitPriority priority)
 {
     PROFILE_SCOPE();
     const bool filterFullNode = true;
-    pushCustom(requestResponseHeader, DISSEMINATION_MULTIPLIER, filterFullNode);
+    pushCustom(requestResponseHeader, DISSEMINATION_MULTIPLIER, filterFullNode, priority);
 }
 
 // Add message to sending buffer of some (limit by DISSEMINATION_MULTIPLIER) full node peer, can only called from main thread (not thread-safe).
-static void pushToFullNodes(RequestResponseHeader* requestResponseHeader, int numberOfReceivers)
+static void pushToFullNodes(RequestResponseHeader* requestResponseHeader, int numberOfReceivers, TransmitPriority priority)
 {
     PROFILE_SCOPE();
     if (numberOfReceivers > DISSEMINATION_MULTIPLIER)
     {
-        pushToSeveralFullNode(requestResponseHeader);
+        pushToSeveralFullNode(requestResponseHeader, priority);
     }
     else
     {
         const bool filterFullNode = true;
-        pushCustom(requestResponseHeader, numberOfReceivers, filterFullNode);
+        pushCustom(requestResponseHeader, numberOfReceivers, filterFullNode, priority);
     }
 }
 
@@ -411,37 +564,36 @@ static bool isBogonAddress(const IPv4Address& address)
         || (address.u8[0] == 255);
 }
 
-/**
-* checks if a given address was manually set in the initial list of known public peers
-*
-* @param address the ip address to be checked
-* @return true if the ip address is in the Known Public Peers or false if not
-*/
-static bool isAddressInKnownPublicPeers(const IPv4Address& address)
+// Change score of public peer, publicPeersLock must be acquired
+static void changePublicPeerScore(PublicPeer& publicPeer, int delta)
 {
-    // keep this exception to avoid bogon addresses kept for outgoing connections
-    if (isBogonAddress(address))
-        return false;
+    int score = publicPeer.score + delta;
+    if (score < PUBLIC_PEER_SCORE_MIN)
+    {
+        score = PUBLIC_PEER_SCORE_MIN;
+    }
+    if (score > PUBLIC_PEER_SCORE_MAX)
+    {
+        score = PUBLIC_PEER_SCORE_MAX;
+    }
+    publicPeer.score = score;
+}
 
-    for (unsigned int i = 0; i < sizeof(knownPublicPeers) / sizeof(knownPublicPeers[0]); i++)
+// Remove public peer with index i by moving the last one to its place, publicPeersLock must be acquired
+static void removePublicPeer(unsigned int i)
+{
+    publicPeerIndex.remove(publicPeers[i].address);
+    if (i != --numberOfPublicPeers)
     {
-        const IPv4Address& peer_ip = *reinterpret_cast<const IPv4Address*>(knownPublicPeers[i]);
-        if (peer_ip == address)
-            return true;
+        copyMem(&publicPeers[i], &publicPeers[numberOfPublicPeers], sizeof(PublicPeer));
+        publicPeerIndex.set(publicPeers[i].address, i);
     }
-    return false;
 }
 
 
 // Forget public peer (no matter if verified or not) if we have more than the minium number of peers
 static void forgetPublicPeer(const IPv4Address& address)
 {
-    // if address is one of our initial peers we don't forget it
-    if (isAddressInKnownPublicPeers(address))
-    {
-        return;
-    }
-
     if (listOfPeersIsStatic)
     {
         return;
@@ -449,43 +601,37 @@ static void forgetPublicPeer(const IPv4Address& address)
 
     ACQUIRE(publicPeersLock);
 
-    for (unsigned int i = 0; numberOfPublicPeers > NUMBER_OF_PUBLIC_PEERS_TO_KEEP && i < numberOfPublicPeers; i++)
-    {
-        if (publicPeers[i].address == address)
-        {
-            if (i != --numberOfPublicPeers)
-            {
-                copyMem(&publicPeers[i], &publicPeers[numberOfPublicPeers], sizeof(PublicPeer));
-            }
+    const unsigned int i = publicPeerIndex.find(address);
 
-            break;
-        }
+    // if address is one of our initial peers we don't forget it
+    if (i != publicPeerIndex.invalidValue && !publicPeers[i].isKnown && numberOfPublicPeers > NUMBER_OF_PUBLIC_PEERS_TO_KEEP)
+    {
+        removePublicPeer(i);
     }
 
     RELEASE(publicPeersLock);
 }
 
-// Penalize rejected connection by setting verified peer to non-verified or forgetting a non-verified peer
+// Penalize rejected connection by lowering the score and setting verified peer to non-verified or forgetting a
+// non-verified peer
 static void penalizePublicPeerRejectedConnection(const IPv4Address& address)
 {
     bool forgetPeer = false;
 
     ACQUIRE(publicPeersLock);
 
-    for (unsigned int i = 0; i < numberOfPublicPeers; i++)
+    const unsigned int i = publicPeerIndex.find(address);
+    if (i != publicPeerIndex.invalidValue)
     {
-        if (publicPeers[i].address == address)
+        changePublicPeerScore(publicPeers[i], -PUBLIC_PEER_SCORE_REJECTION_PENALTY);
+        if (publicPeers[i].isHandshaked || publicPeers[i].isFullnode)
         {
-            if (publicPeers[i].isHandshaked || publicPeers[i].isFullnode)
-            {
-                publicPeers[i].isHandshaked = false;
-                publicPeers[i].isFullnode = false;
-            }
-            else
-            {
-                forgetPeer = true;
-            }
-            break;
+            publicPeers[i].isHandshaked = false;
+            publicPeers[i].isFullnode = false;
+        }
+        else
+        {
+            forgetPeer = true;
         }
     }
 
@@ -497,8 +643,24 @@ static void penalizePublicPeerRejectedConnection(const IPv4Address& address)
     }
 }
 
+// Set public peer to verified and raise its score after receiving ExchangePublicPeers on a connection to it
+static void rewardPublicPeerHandshake(const IPv4Address& address)
+{
+    ACQUIRE(publicPeersLock);
 
-static void addPublicPeer(const IPv4Address& address)
+    const unsigned int i = publicPeerIndex.find(address);
+    if (i != publicPeerIndex.invalidValue)
+    {
+        publicPeers[i].isHandshaked = true;
+        changePublicPeerScore(publicPeers[i], PUBLIC_PEER_SCORE_HANDSHAKE_REWARD);
+    }
+
+    RELEASE(publicPeersLock);
+}
+
+
+// Add public peer if it isn't in the list yet. Known public peers are added as verified and are never forgotten.
+static void addPublicPeer(const IPv4Address& address, bool isKnown = false)
 {
     if (isBogonAddress(address)) // not add bogon ip
     {
@@ -508,24 +670,56 @@ static void addPublicPeer(const IPv4Address& address)
     {
         return;
     }
-    for (unsigned int i = 0; i < numberOfPublicPeers; i++)
+
+    ACQUIRE(publicPeersLock);
+
+    const unsigned int i = publicPeerIndex.find(address);
+    if (i != publicPeerIndex.invalidValue)
     {
-        if (address == publicPeers[i].address)
+        if (isKnown)
         {
-            return;
+            publicPeers[i].isHandshaked = true;
+            publicPeers[i].isFullnode = true;
+            publicPeers[i].isKnown = true;
         }
     }
+    else if (numberOfPublicPeers < MAX_NUMBER_OF_PUBLIC_PEERS)
+    {
+        publicPeers[numberOfPublicPeers].isHandshaked = isKnown;
+        publicPeers[numberOfPublicPeers].isFullnode = isKnown;
+        publicPeers[numberOfPublicPeers].isKnown = isKnown;
+        publicPeers[numberOfPublicPeers].score = 0;
+        publicPeers[numberOfPublicPeers].address = address;
+        publicPeerIndex.set(address, numberOfPublicPeers);
+        numberOfPublicPeers++;
+    }
+
+    RELEASE(publicPeersLock);
+}
+
+// Select public peer for outgoing connection: the one with the best score of some random candidates, so reliable
+// peers are preferred while all peers keep a chance to be tried. Return address 0 if there are no public peers.
+static IPv4Address selectPublicPeerForOutgoingConnection()
+{
+    IPv4Address address;
+    address.u32 = 0;
+    int bestScore = PUBLIC_PEER_SCORE_MIN - 1;
 
     ACQUIRE(publicPeersLock);
 
-    if (numberOfPublicPeers < MAX_NUMBER_OF_PUBLIC_PEERS)
+    for (unsigned int c = 0; c < PUBLIC_PEER_SELECTION_CANDIDATES && numberOfPublicPeers; c++)
     {
-        publicPeers[numberOfPublicPeers].isHandshaked = false;
-        publicPeers[numberOfPublicPeers].isFullnode = false;
-        publicPeers[numberOfPublicPeers++].address = address;
+        const PublicPeer& candidate = publicPeers[random(numberOfPublicPeers)];
+        if (candidate.score > bestScore)
+        {
+            bestScore = candidate.score;
+            address = candidate.address;
+        }
     }
 
     RELEASE(publicPeersLock);
+
+    return address;
 }
 
 static bool peerConnectionNewlyEstablished(unsigned int i)
@@ -641,7 +835,7 @@ static bool peerConnectionNewlyEstablished(unsigned int i)
 
 // This function process all data that arrive in FragmentBuffer.
 // based on RequestResponseHeader to determine whether the received packet is completed or not
-// if it receives a completed packet, it will copy the packet to requestQueueElements to process later in requestProcessors
+// if it receives a completed packet, it will copy the packet to requestQueue to process later in requestProcessors
 static void processReceivedData(unsigned int i, unsigned int salt)
 {
     PROFILE_SCOPE();
@@ -699,29 +893,36 @@ static void processReceivedData(unsigned int i, unsigned int salt)
                                 KangarooTwelve(requestResponseHeader, header & 0xFFFFFF, &saltedId, sizeof(saltedId));
                                 *((unsigned int*)requestResponseHeader) = header;
 
+                                // the peer has this message, so it doesn't need to get it from us
+                                peers[i].knownDejavus.add(requestResponseHeader->dejavu());
+                                messageTypeStatistics.recordReceived(requestResponseHeader->type(), requestResponseHeader->size());
+
                                 // Initiate transfer of already received packet to processing thread
                                 // (or drop it without processing if Dejavu filter tells to ignore it)
                                 if (!((dejavu0[saltedId >> 6] | dejavu1[saltedId >> 6]) & (1ULL << (saltedId & 63))))
                                 {
-                                    if ((requestQueueBufferHead >= requestQueueBufferTail || requestQueueBufferHead + requestResponseHeader->size() < requestQueueBufferTail)
-                                        && (unsigned short)(requestQueueElementHead + 1) != requestQueueElementTail)
+                                    const RequestCostClass costClass = getRequestCostClass(requestResponseHeader->type());
+                                    const unsigned long long now = __rdtsc();
+                                    requestQueue.releaseFinished();
+                                    const unsigned int queuedRequests = getNumberOfQueuedRequests();
+                                    requestAdmission.update(now, numberOfProcessedRequests, queuedRequests, requestAdmissionLimits);
+                                    if (!peers[i].requestCost.admit(costClass, now, peerRequestLimits))
                                     {
-                                        dejavu0[saltedId >> 6] |= (1ULL << (saltedId & 63));
+                                        // peer has used up its budget of request processing
+                                        numberOfRateLimitedRequests[costClass]++;
 
-                                        ASSERT(requestQueueElementHead < REQUEST_QUEUE_LENGTH);
-                                        ASSERT(requestQueueBufferHead < REQUEST_QUEUE_BUFFER_SIZE);
-                                        ASSERT(requestQueueBufferHead + requestResponseHeader->size() < REQUEST_QUEUE_BUFFER_SIZE);
+                                        enqueueResponse(&peers[i], 0, TryAgain::type, requestResponseHeader->dejavu(), NULL);
+                                    }
+                                    else if (!requestAdmission.admit(costClass, queuedRequests, getRequestQueueFillPercent(), requestAdmissionLimits))
+                                    {
+                                        // request processors are overloaded, shed low-value requests before the queue is full
+                                        messageTypeStatistics.recordShed(requestResponseHeader->type());
 
-                                        requestQueueElements[requestQueueElementHead].offset = requestQueueBufferHead;
-                                        copyMem(&requestQueueBuffer[requestQueueBufferHead], peers[i].receiveBuffer, requestResponseHeader->size());
-                                        requestQueueBufferHead += requestResponseHeader->size();
-                                        requestQueueElements[requestQueueElementHead].peer = &peers[i];
-                                        if (requestQueueBufferHead > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                                        {
-                                            requestQueueBufferHead = 0;
-                                        }
-                                        // TODO: Place a fence
-                                        requestQueueElementHead++;
+                                        enqueueResponse(&peers[i], 0, TryAgain::type, requestResponseHeader->dejavu(), NULL);
+                                    }
+                                    else if (requestQueue.add(requestResponseHeader, &peers[i], now))
+                                    {
+                                        dejavu0[saltedId >> 6] |= (1ULL << (saltedId & 63));
 
                                         if (!(--dejavuSwapCounter))
                                         {
@@ -815,6 +1016,9 @@ static void processTransmittedData(unsigned int i, unsigned int salt)
         if (peers[i].transmitToken.CompletionToken.Status != -1)
         {
             peers[i].isTransmitting = FALSE;
+
+            // the TCP stack doesn't access the messages anymore
+            peers[i].transmitQueue.endTransmit(transmitMessagePool);
             if (peers[i].transmitToken.CompletionToken.Status)
             {
                 // transmission error
@@ -846,7 +1050,7 @@ static void transmitData(unsigned int i, unsigned int salt)
     EFI_STATUS status;
     if (((unsigned long long)peers[i].tcp4Protocol) > 1)
     {
-        if (peers[i].dataToTransmitSize && !peers[i].isTransmitting && peers[i].isConnectedAccepted && !peers[i].isClosing)
+        if (peers[i].transmitQueue.numberOfWaiting() && !peers[i].isTransmitting && peers[i].isConnectedAccepted && !peers[i].isClosing)
         {
             EFI_TCP4_CONNECTION_STATE state;
             if ((status = peers[i].tcp4Protocol->GetModeData(peers[i].tcp4Protocol, &state, NULL, NULL, NULL, NULL))
@@ -856,9 +1060,20 @@ static void transmitData(unsigned int i, unsigned int salt)
             }
             else
             {
-                // initiate transmission
-                copyMem(peers[i].transmitData.FragmentTable[0].FragmentBuffer, peers[i].dataToTransmit, peers[i].transmitData.DataLength = peers[i].transmitData.FragmentTable[0].FragmentLength = peers[i].dataToTransmitSize);
-                peers[i].dataToTransmitSize = 0;
+                // initiate transmission, passing the waiting messages in the shared pool as fragments without copying
+                // (highest priority first)
+                unsigned int messageIndices[MAX_NUMBER_OF_TRANSMIT_FRAGMENTS];
+                const unsigned int numberOfFragments = peers[i].transmitQueue.beginTransmit(transmitMessagePool, MAX_NUMBER_OF_TRANSMIT_FRAGMENTS, messageIndices, numberOfDeferredOutgoingMessages);
+                EFI_TCP4_FRAGMENT_DATA* fragments = peers[i].transmitData.FragmentTable;
+                unsigned int dataLength = 0;
+                for (unsigned int j = 0; j < numberOfFragments; j++)
+                {
+                    fragments[j].FragmentBuffer = transmitMessagePool.getMessage(messageIndices[j]);
+                    fragments[j].FragmentLength = transmitMessagePool.getMessageSize(messageIndices[j]);
+                    dataLength += fragments[j].FragmentLength;
+                }
+                peers[i].transmitData.FragmentCount = numberOfFragments;
+                peers[i].transmitData.DataLength = dataLength;
                 if (status = peers[i].tcp4Protocol->Transmit(peers[i].tcp4Protocol, &peers[i].transmitToken))
                 {
                     logStatusToConsole(L"EFI_TCP4_PROTOCOL.Transmit() fails", status, __LINE__);
@@ -903,7 +1118,7 @@ static void peerReconnectIfInactive(unsigned int i, unsigned short port)
             // outgoing connection:
             // randomly select public peer and try to connect if we do not
             // yet have an outgoing connection to it
-            peers[i].address = publicPeers[random(numberOfPublicPeers)].address;
+            peers[i].address = selectPublicPeerForOutgoingConnection();
             peers[i].isIncommingConnection = FALSE;
 
             if (peers[i].address.u32 != 0)
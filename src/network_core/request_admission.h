@@ -0,0 +1,105 @@
+#pragma once
+
+#include "peer_request_cost.h"
+
+
+// Thresholds of the request queue per RequestCostClass. A request is shed (not queued) if the queue is filled by
+// maxFillPercent or more (by number of requests or by bytes), or if the estimated wait time of the queue exceeds
+// maxWaitMilliseconds (0 disables the wait limit). Setting lower limits for queries than for gossip makes the node
+// drop queries first under overload, keeping space for votes and tick data that are needed for reaching consensus.
+struct RequestAdmissionLimits
+{
+    unsigned int maxFillPercent[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long maxWaitMilliseconds[NUMBER_OF_REQUEST_COST_CLASSES];
+    unsigned long long frequency; // time stamp counter ticks per second
+};
+
+// Admission control of the request queue. It estimates the processing rate of the request processors and sheds
+// requests of low-value classes when the queue grows.
+//
+// The rate is measured in intervals of 100 ms and smoothed with an exponential moving average. Intervals in which
+// the queue has been seen empty are skipped, because they show the rate of incoming requests rather than the
+// capacity of the processors. Until the rate has been measured, only the fill limits apply. Once measured, the rate
+// doesn't drop below 1 request per second, so if the processors stall, the estimated wait time grows and the wait
+// limits keep shedding requests instead of being disabled like for an unknown rate.
+//
+// Only to be used by the main thread.
+class RequestAdmissionControl
+{
+public:
+    void reset(unsigned long long now)
+    {
+        lastUpdateTime = now;
+        lastNumberOfProcessed = 0;
+        wasIdle = true;
+        processingRate = 0;
+        for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; c++)
+        {
+            numberOfShedRequests[c] = 0;
+        }
+    }
+
+    // Update estimate of the processing rate, called with the total number of processed requests and the current
+    // number of queued requests. Cheap if called more often than the measurement interval.
+    void update(unsigned long long now, unsigned long long numberOfProcessed, unsigned int queuedRequests, const RequestAdmissionLimits& limits)
+    {
+        if (!queuedRequests)
+        {
+            wasIdle = true;
+        }
+        if (!limits.frequency || now < lastUpdateTime + limits.frequency / 10)
+        {
+            return;
+        }
+        if (!wasIdle && numberOfProcessed >= lastNumberOfProcessed)
+        {
+            const unsigned long long elapsed = now - lastUpdateTime;
+            const unsigned long long rate = (numberOfProcessed - lastNumberOfProcessed) * limits.frequency / elapsed;
+            processingRate = processingRate ? (processingRate * 3 + rate) / 4 : rate;
+            if (!processingRate)
+            {
+                processingRate = 1;
+            }
+        }
+        lastUpdateTime = now;
+        lastNumberOfProcessed = numberOfProcessed;
+        wasIdle = (queuedRequests == 0);
+    }
+
+    // Return if request of given class may be added to the queue, which is filled by fillPercent (max of requests
+    // and bytes) with queuedRequests requests
+    bool admit(RequestCostClass costClass, unsigned int queuedRequests, unsigned int fillPercent, const RequestAdmissionLimits& limits)
+    {
+        if (fillPercent >= limits.maxFillPercent[costClass]
+            || (limits.maxWaitMilliseconds[costClass] && getEstimatedWaitMilliseconds(queuedRequests) > limits.maxWaitMilliseconds[costClass]))
+        {
+            numberOfShedRequests[costClass]++;
+            return false;
+        }
+        return true;
+    }
+
+    // Return estimated time until the last of queuedRequests requests is processed, or 0 if the rate is unknown
+    unsigned long long getEstimatedWaitMilliseconds(unsigned int queuedRequests) const
+    {
+        return processingRate ? queuedRequests * 1000ULL / processingRate : 0;
+    }
+
+    // Return estimated number of requests that the request processors can process per second (0 if unknown)
+    unsigned long long getProcessingRate() const
+    {
+        return processingRate;
+    }
+
+    unsigned long long getNumberOfShedRequests(RequestCostClass costClass) const
+    {
+        return numberOfShedRequests[costClass];
+    }
+
+private:
+    unsigned long long lastUpdateTime;
+    unsigned long long lastNumberOfProcessed;
+    bool wasIdle;
+    unsigned long long processingRate;
+    unsigned long long numberOfShedRequests[NUMBER_OF_REQUEST_COST_CLASSES];
+};
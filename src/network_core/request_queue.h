@@ -0,0 +1,220 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/assert.h"
+
+#include "network_messages/header.h"
+
+
+// Queue of received requests, filled by the main thread and processed by the request processors. Requests are
+// processed in place in the ring buffer: a processor only holds the lock for claiming the index of the next request,
+// and the space of a request is released after it has been processed. Requests are claimed in order, but finished
+// in any order, so space is reused when the oldest requests have been finished (like SharedMessagePool).
+//
+// Threads: add(), releaseFinished(), and the getters of the filling state are main thread only. claim(), the request
+// getters, and finish() can be called by any thread.
+template <unsigned long long bufferSize, unsigned int length, typename Context>
+class RequestQueue
+{
+public:
+    static_assert(length > 0 && (length & (length - 1)) == 0, "length must be a power of 2");
+
+    static constexpr unsigned int invalidRequestIndex = 0xFFFFFFFF;
+
+    bool init()
+    {
+        if (!allocPoolWithErrorLog(L"requestQueueBuffer", bufferSize, (void**)&buffer, __LINE__)
+            || !allocPoolWithErrorLog(L"requestQueueElements", sizeof(Element) * length, (void**)&elements, __LINE__))
+        {
+            deinit();
+            return false;
+        }
+        reset();
+        return true;
+    }
+
+    void deinit()
+    {
+        if (buffer)
+        {
+            freePool(buffer);
+            buffer = nullptr;
+        }
+        if (elements)
+        {
+            freePool(elements);
+            elements = nullptr;
+        }
+    }
+
+    // Drop all requests, which must not be in process
+    void reset()
+    {
+        bufferHead = bufferTail = 0;
+        head = claimed = tail = 0;
+        setMem((void*)elements, sizeof(Element) * length, 0);
+    }
+
+    // Copy request into queue. Returns false if the queue is full.
+    bool add(const RequestResponseHeader* header, Context* context, unsigned long long enqueueTick)
+    {
+        const unsigned int size = header->size();
+        ASSERT(size >= sizeof(RequestResponseHeader));
+        if (head - tail == length || size > bufferSize)
+        {
+            return false;
+        }
+
+        // used space is [bufferTail, bufferHead) or [bufferTail, end) + [0, bufferHead) if wrapped around
+        unsigned long long offset;
+        if (head == tail)
+        {
+            bufferHead = bufferTail = 0;
+            offset = 0;
+        }
+        else if (bufferHead >= bufferTail)
+        {
+            if (bufferHead + size <= bufferSize)
+                offset = bufferHead;
+            else if (size < bufferTail)
+                offset = 0;
+            else
+                return false;
+        }
+        else
+        {
+            if (bufferHead + size < bufferTail)
+                offset = bufferHead;
+            else
+                return false;
+        }
+
+        copyMem(buffer + offset, header, size);
+        bufferHead = offset + size;
+
+        Element& element = elements[head & (length - 1)];
+        element.offset = offset;
+        element.size = size;
+        element.context = context;
+        element.enqueueTick = enqueueTick;
+        element.isFinished = 0;
+
+        // publish request to processors after writing it
+        _mm_sfence();
+        head++;
+        return true;
+    }
+
+    // Reuse space of the oldest requests that have been finished
+    void releaseFinished()
+    {
+        while (tail != claimed && elements[tail & (length - 1)].isFinished)
+        {
+            tail++;
+        }
+        if (tail == head)
+        {
+            bufferHead = bufferTail = 0;
+        }
+        else
+        {
+            bufferTail = elements[tail & (length - 1)].offset;
+        }
+    }
+
+    // Claim oldest request that hasn't been claimed yet. Returns its index or invalidRequestIndex if there is no
+    // waiting request. The request stays valid until finish() is called.
+    unsigned int claim()
+    {
+        if (claimed == head)
+        {
+            return invalidRequestIndex;
+        }
+        unsigned int requestIndex = invalidRequestIndex;
+        ACQUIRE(claimLock);
+        if (claimed != head)
+        {
+            requestIndex = claimed & (length - 1);
+            claimed++;
+        }
+        RELEASE(claimLock);
+        return requestIndex;
+    }
+
+    RequestResponseHeader* getRequest(unsigned int requestIndex) const
+    {
+        ASSERT(requestIndex < length);
+        return (RequestResponseHeader*)(buffer + elements[requestIndex].offset);
+    }
+
+    Context* getContext(unsigned int requestIndex) const
+    {
+        ASSERT(requestIndex < length);
+        return elements[requestIndex].context;
+    }
+
+    unsigned long long getEnqueueTick(unsigned int requestIndex) const
+    {
+        ASSERT(requestIndex < length);
+        return elements[requestIndex].enqueueTick;
+    }
+
+    // Mark claimed request as processed, so its space can be reused
+    void finish(unsigned int requestIndex)
+    {
+        ASSERT(requestIndex < length && !elements[requestIndex].isFinished);
+        elements[requestIndex].isFinished = 1;
+    }
+
+    // Number of requests that haven't been claimed yet
+    unsigned int getNumberOfWaitingRequests() const
+    {
+        return head - claimed;
+    }
+
+    // Number of elements used by waiting, claimed, and finished but not released requests
+    unsigned int getNumberOfUsedElements() const
+    {
+        return head - tail;
+    }
+
+    // Bytes of buffer used by waiting, claimed, and finished but not released requests
+    unsigned long long getNumberOfUsedBytes() const
+    {
+        if (head == tail)
+            return 0;
+        return (bufferHead > bufferTail) ? bufferHead - bufferTail : bufferSize - bufferTail + bufferHead;
+    }
+
+    static constexpr unsigned long long getBufferSize()
+    {
+        return bufferSize;
+    }
+
+    static constexpr unsigned int getLength()
+    {
+        return length;
+    }
+
+private:
+    struct Element
+    {
+        unsigned long long offset;
+        unsigned long long enqueueTick; // for measuring queue wait time
+        Context* context; // usually the peer that sent the request
+        unsigned int size;
+        volatile char isFinished;
+    };
+
+    unsigned char* buffer = nullptr;
+    Element* elements = nullptr;
+    unsigned long long bufferHead = 0, bufferTail = 0;
+
+    // running counters of requests (element index is counter & (length - 1)): head is the next to add, claimed the
+    // next to process, and tail the oldest that has not been released
+    volatile unsigned int head = 0;
+    volatile unsigned int claimed = 0;
+    unsigned int tail = 0;
+    volatile char claimLock = 0;
+};
@@ -0,0 +1,509 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/assert.h"
+
+#include "network_messages/header.h"
+
+
+// Pool of outgoing messages shared by all peers. A message is copied into the pool once and then referenced by the
+// transmit queues of all peers it is sent to, so broadcasting to several peers doesn't copy the message for each
+// peer. The buffers of the messages are passed to the TCP stack directly as fragments (scatter-gather), so there is
+// no further copy before transmission. A message is freed when the last reference has been released.
+//
+// Messages are allocated in a ring buffer in the order of adding. Freeing happens in a different order, because
+// peers transmit with different speed. Space is reused when the oldest messages have been freed. So a message that
+// is not released for a long time (for example by a peer that doesn't receive) blocks reusing the space of all newer
+// messages. getOldestMessage() allows to find the peers that block the pool.
+//
+// Not thread-safe, only to be used by the main thread.
+template <unsigned long long bufferSize, unsigned int maxNumberOfMessages>
+class SharedMessagePool
+{
+public:
+    static_assert(maxNumberOfMessages > 0 && (maxNumberOfMessages & (maxNumberOfMessages - 1)) == 0, "maxNumberOfMessages must be a power of 2");
+    static_assert(bufferSize > 2ULL * RequestResponseHeader::max_size, "Buffer must be able to hold the largest message");
+
+    static constexpr unsigned int invalidMessageIndex = 0xFFFFFFFF;
+
+    bool init()
+    {
+        if (!allocPoolWithErrorLog(L"sharedMessagePoolBuffer", bufferSize, (void**)&buffer, __LINE__)
+            || !allocPoolWithErrorLog(L"sharedMessagePoolMessages", sizeof(Message) * maxNumberOfMessages, (void**)&messages, __LINE__))
+        {
+            deinit();
+            return false;
+        }
+        reset();
+        return true;
+    }
+
+    void deinit()
+    {
+        if (buffer)
+        {
+            freePool(buffer);
+            buffer = nullptr;
+        }
+        if (messages)
+        {
+            freePool(messages);
+            messages = nullptr;
+        }
+    }
+
+    // Free all messages, which must not be referenced anymore
+    void reset()
+    {
+        bufferHead = bufferTail = 0;
+        messageHead = messageTail = 0;
+        numberOfCopiedBytes = 0;
+        numberOfAddedMessages = 0;
+    }
+
+    // Copy message into pool. Returns the index of the message with reference count 1 (owned by the caller, who must
+    // call release() after adding the references of the receivers), or invalidMessageIndex if the pool is full.
+    unsigned int add(const RequestResponseHeader* header)
+    {
+        const unsigned int size = header->size();
+        ASSERT(size >= sizeof(RequestResponseHeader));
+        if (messageHead - messageTail == maxNumberOfMessages)
+        {
+            return invalidMessageIndex;
+        }
+
+        // used space is [bufferTail, bufferHead) or [bufferTail, end) + [0, bufferHead) if wrapped around
+        unsigned long long offset;
+        if (messageHead == messageTail)
+        {
+            bufferHead = bufferTail = 0;
+            offset = 0;
+        }
+        else if (bufferHead >= bufferTail)
+        {
+            if (bufferHead + size <= bufferSize)
+                offset = bufferHead;
+            else if (size < bufferTail)
+                offset = 0;
+            else
+                return invalidMessageIndex;
+        }
+        else
+        {
+            if (bufferHead + size < bufferTail)
+                offset = bufferHead;
+            else
+                return invalidMessageIndex;
+        }
+
+        copyMem(buffer + offset, header, size);
+        bufferHead = offset + size;
+        numberOfCopiedBytes += size;
+        numberOfAddedMessages++;
+
+        const unsigned int messageIndex = messageHead & (maxNumberOfMessages - 1);
+        messages[messageIndex].offset = offset;
+        messages[messageIndex].size = size;
+        messages[messageIndex].referenceCount = 1;
+        messageHead++;
+        return messageIndex;
+    }
+
+    void addReference(unsigned int messageIndex)
+    {
+        ASSERT(messageIndex < maxNumberOfMessages && messages[messageIndex].referenceCount > 0);
+        messages[messageIndex].referenceCount++;
+    }
+
+    // Release one reference. If it was the last one and the message is the oldest, the space of all freed messages at
+    // the beginning of the ring is reused.
+    void release(unsigned int messageIndex)
+    {
+        ASSERT(messageIndex < maxNumberOfMessages && messages[messageIndex].referenceCount > 0);
+        if (--messages[messageIndex].referenceCount)
+        {
+            return;
+        }
+        while (messageTail != messageHead && !messages[messageTail & (maxNumberOfMessages - 1)].referenceCount)
+        {
+            messageTail++;
+        }
+        if (messageTail == messageHead)
+        {
+            bufferHead = bufferTail = 0;
+        }
+        else
+        {
+            bufferTail = messages[messageTail & (maxNumberOfMessages - 1)].offset;
+        }
+    }
+
+    RequestResponseHeader* getMessage(unsigned int messageIndex) const
+    {
+        ASSERT(messageIndex < maxNumberOfMessages);
+        return (RequestResponseHeader*)(buffer + messages[messageIndex].offset);
+    }
+
+    unsigned int getMessageSize(unsigned int messageIndex) const
+    {
+        ASSERT(messageIndex < maxNumberOfMessages);
+        return messages[messageIndex].size;
+    }
+
+    // Return index of oldest message that is still referenced (the one that blocks reusing space), or
+    // invalidMessageIndex if the pool is empty.
+    unsigned int getOldestMessage() const
+    {
+        return (messageTail == messageHead) ? invalidMessageIndex : (messageTail & (maxNumberOfMessages - 1));
+    }
+
+    // Number of messages from the oldest to the newest one, including freed messages that cannot be reused yet
+    unsigned int getNumberOfMessages() const
+    {
+        return messageHead - messageTail;
+    }
+
+    // Bytes between oldest and newest message, including space of freed messages that cannot be reused yet
+    unsigned long long getUsedBytes() const
+    {
+        if (messageTail == messageHead)
+            return 0;
+        return (bufferHead >= bufferTail) ? bufferHead - bufferTail : bufferSize - bufferTail + bufferHead;
+    }
+
+    // Total number of bytes copied into the pool since reset()
+    unsigned long long getNumberOfCopiedBytes() const
+    {
+        return numberOfCopiedBytes;
+    }
+
+    unsigned long long getNumberOfAddedMessages() const
+    {
+        return numberOfAddedMessages;
+    }
+
+private:
+    struct Message
+    {
+        unsigned long long offset;
+        unsigned int size;
+        unsigned int referenceCount;
+    };
+
+    unsigned char* buffer = nullptr;
+    Message* messages = nullptr;
+    unsigned long long bufferHead, bufferTail;
+    unsigned int messageHead, messageTail; // messages[messageTail & mask] is the oldest one, wrapping around at 2^32
+    unsigned long long numberOfCopiedBytes;
+    unsigned long long numberOfAddedMessages;
+};
+
+// Queue of references to messages in a SharedMessagePool that are waiting to be transmitted to one peer. The first
+// numberOfTransmitting messages have been passed to the TCP stack and must stay valid until the transmission has
+// completed.
+template <unsigned int length>
+struct MessageReferenceQueue
+{
+    static_assert(length > 0 && length <= 0x8000 && (length & (length - 1)) == 0, "length must be a power of 2 that fits in unsigned short");
+
+    enum MessageFlags : unsigned char
+    {
+        MessageDroppable = 1, // may be dropped if the queue is full (broadcast, not part of a response)
+        MessageDeferred = 2,  // has already been counted as deferred
+    };
+
+    unsigned int messageIndices[length];
+    unsigned char messageFlags[length];
+    unsigned short head, tail;
+    unsigned short numberOfTransmitting;
+
+    // Number of bytes of the messages that are not transmitting yet
+    unsigned int waitingBytes;
+
+    void reset()
+    {
+        head = tail = 0;
+        numberOfTransmitting = 0;
+        waitingBytes = 0;
+    }
+
+    unsigned int size() const
+    {
+        return (unsigned short)(head - tail);
+    }
+
+    bool isFull() const
+    {
+        return size() == length;
+    }
+
+    unsigned int numberOfWaiting() const
+    {
+        return size() - numberOfTransmitting;
+    }
+
+    // Append reference to message, which has to be added to the message in the pool by the caller
+    void push(unsigned int messageIndex, unsigned int messageSize, unsigned char flags = 0)
+    {
+        ASSERT(!isFull());
+        messageFlags[head & (length - 1)] = flags;
+        messageIndices[head++ & (length - 1)] = messageIndex;
+        waitingBytes += messageSize;
+    }
+
+    // Get i-th waiting message (0 is the next to be transmitted)
+    unsigned int getWaiting(unsigned int i) const
+    {
+        ASSERT(i < numberOfWaiting());
+        return messageIndices[(unsigned short)(tail + numberOfTransmitting + i) & (length - 1)];
+    }
+
+    // Return position of the oldest waiting message that is droppable or -1 if there is none
+    int findOldestDroppableWaiting() const
+    {
+        for (unsigned int i = 0; i < numberOfWaiting(); i++)
+        {
+            if (messageFlags[(unsigned short)(tail + numberOfTransmitting + i) & (length - 1)] & MessageDroppable)
+                return i;
+        }
+        return -1;
+    }
+
+    // Flag the waiting messages as deferred. Returns how many haven't been deferred before.
+    unsigned int markDeferred()
+    {
+        unsigned int count = 0;
+        for (unsigned int i = 0; i < numberOfWaiting(); i++)
+        {
+            unsigned char& flags = messageFlags[(unsigned short)(tail + numberOfTransmitting + i) & (length - 1)];
+            if (!(flags & MessageDeferred))
+            {
+                flags |= MessageDeferred;
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Mark the first count waiting messages as transmitting
+    void beginTransmit(unsigned int count, unsigned int bytes)
+    {
+        ASSERT(count <= numberOfWaiting() && bytes <= waitingBytes);
+        numberOfTransmitting += count;
+        waitingBytes -= bytes;
+    }
+
+    // Release the references of the transmitted messages
+    template <typename Pool>
+    void endTransmit(Pool& pool)
+    {
+        while (numberOfTransmitting)
+        {
+            pool.release(messageIndices[tail++ & (length - 1)]);
+            numberOfTransmitting--;
+        }
+    }
+
+    // Remove the oldest message that is not transmitting yet and release its reference. Returns its size.
+    template <typename Pool>
+    unsigned int dropOldestWaiting(Pool& pool)
+    {
+        return dropWaiting(pool, 0);
+    }
+
+    // Remove the i-th waiting message and release its reference. Returns its size.
+    template <typename Pool>
+    unsigned int dropWaiting(Pool& pool, unsigned int i)
+    {
+        ASSERT(i < numberOfWaiting());
+        const unsigned short position = tail + numberOfTransmitting + i;
+        const unsigned int messageIndex = messageIndices[position & (length - 1)];
+
+        // move the older messages (transmitting ones and waiting ones before position) forward to close the gap
+        for (unsigned short j = position; j != tail; j--)
+        {
+            messageIndices[j & (length - 1)] = messageIndices[(unsigned short)(j - 1) & (length - 1)];
+            messageFlags[j & (length - 1)] = messageFlags[(unsigned short)(j - 1) & (length - 1)];
+        }
+        tail++;
+
+        const unsigned int messageSize = pool.getMessageSize(messageIndex);
+        waitingBytes -= messageSize;
+        pool.release(messageIndex);
+        return messageSize;
+    }
+
+    // Release the references of the messages that are not transmitting yet
+    template <typename Pool>
+    void releaseWaiting(Pool& pool)
+    {
+        while (numberOfWaiting())
+        {
+            pool.release(messageIndices[--head & (length - 1)]);
+        }
+        waitingBytes = 0;
+    }
+
+    // Release all references (transmitting and waiting)
+    template <typename Pool>
+    void releaseAll(Pool& pool)
+    {
+        while (head != tail)
+        {
+            pool.release(messageIndices[tail++ & (length - 1)]);
+        }
+        numberOfTransmitting = 0;
+        waitingBytes = 0;
+    }
+
+    // Return if message is referenced by queue
+    bool contains(unsigned int messageIndex) const
+    {
+        for (unsigned short i = tail; i != head; i++)
+        {
+            if (messageIndices[i & (length - 1)] == messageIndex)
+                return true;
+        }
+        return false;
+    }
+};
+
+
+enum TransmitPriority
+{
+    TransmitPriorityConsensus = 0,      // tick votes, computor list, handshake
+    TransmitPriorityTickData = 1,       // other broadcasts and requests needed to catch up with the ticks
+    TransmitPriorityQueryResponse = 2,  // responses to requests of a single peer
+};
+#define NUMBER_OF_TRANSMIT_PRIORITIES 3
+
+// Outgoing messages of one peer in one MessageReferenceQueue per priority class. Messages of higher priority
+// overtake messages of lower priority that are waiting, but the order within a class is kept, so a response
+// consisting of several messages doesn't get mixed up.
+//
+// The waiting messages of all classes are limited by maxWaitingBytes and each class by the queue length. If a new
+// message doesn't fit (because the peer is slow or there is a burst), the oldest waiting droppable messages of the
+// lowest class are dropped (only classes with the same or lower priority than the new message). Only broadcasts are
+// droppable, because dropping a message of a response to a single peer would truncate the response while its
+// EndResponse may still be sent. If there is nothing to drop, the new message is dropped, which the caller has to
+// handle by closing the connection if the message is part of a response. So a peer isn't disconnected because of a
+// burst of broadcasts and consensus messages aren't held up by large query responses.
+template <unsigned int length>
+struct PriorityMessageReferenceQueue
+{
+    MessageReferenceQueue<length> queues[NUMBER_OF_TRANSMIT_PRIORITIES];
+
+    void reset()
+    {
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            queues[p].reset();
+    }
+
+    unsigned int numberOfWaiting() const
+    {
+        unsigned int count = 0;
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            count += queues[p].numberOfWaiting();
+        return count;
+    }
+
+    unsigned long long waitingBytes() const
+    {
+        unsigned long long bytes = 0;
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            bytes += queues[p].waitingBytes;
+        return bytes;
+    }
+
+    // Add reference to message (reference count is incremented), dropping the oldest waiting droppable messages of
+    // lower or the same priority if there is no space. The number of dropped messages is added to droppedMessages per
+    // class. Returns false if the new message has been dropped.
+    template <typename Pool>
+    bool push(Pool& pool, unsigned int messageIndex, TransmitPriority priority, bool isDroppable,
+        unsigned long long maxWaitingBytes, unsigned long long* droppedMessages)
+    {
+        ASSERT(priority < NUMBER_OF_TRANSMIT_PRIORITIES);
+        const unsigned int messageSize = pool.getMessageSize(messageIndex);
+        unsigned long long bytes = waitingBytes();
+        while (queues[priority].isFull() || bytes + messageSize > maxWaitingBytes)
+        {
+            int dropPriority = -1, dropPosition = -1;
+            const int lowestPriority = queues[priority].isFull() ? priority : NUMBER_OF_TRANSMIT_PRIORITIES - 1;
+            for (int p = lowestPriority; p >= (int)priority; p--)
+            {
+                dropPosition = queues[p].findOldestDroppableWaiting();
+                if (dropPosition >= 0)
+                {
+                    dropPriority = p;
+                    break;
+                }
+            }
+            if (dropPriority < 0)
+            {
+                droppedMessages[priority]++;
+                return false;
+            }
+            bytes -= queues[dropPriority].dropWaiting(pool, dropPosition);
+            droppedMessages[dropPriority]++;
+        }
+        pool.addReference(messageIndex);
+        queues[priority].push(messageIndex, messageSize, isDroppable ? MessageReferenceQueue<length>::MessageDroppable : 0);
+        return true;
+    }
+
+    // Mark up to maxCount waiting messages as transmitting, taking them in order of priority, and write their indices
+    // to messageIndices. The number of messages that keep waiting is added to deferredMessages per class (each message
+    // is counted once, even if it is deferred several times). Returns the number of selected messages.
+    template <typename Pool>
+    unsigned int beginTransmit(const Pool& pool, unsigned int maxCount, unsigned int* messageIndices,
+        unsigned long long* deferredMessages)
+    {
+        unsigned int count = 0;
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+        {
+            const unsigned int waiting = queues[p].numberOfWaiting();
+            unsigned int selected = 0, bytes = 0;
+            while (count < maxCount && selected < waiting)
+            {
+                messageIndices[count] = queues[p].getWaiting(selected);
+                bytes += pool.getMessageSize(messageIndices[count]);
+                count++;
+                selected++;
+            }
+            queues[p].beginTransmit(selected, bytes);
+            deferredMessages[p] += queues[p].markDeferred();
+        }
+        return count;
+    }
+
+    template <typename Pool>
+    void endTransmit(Pool& pool)
+    {
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            queues[p].endTransmit(pool);
+    }
+
+    template <typename Pool>
+    void releaseWaiting(Pool& pool)
+    {
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            queues[p].releaseWaiting(pool);
+    }
+
+    template <typename Pool>
+    void releaseAll(Pool& pool)
+    {
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+            queues[p].releaseAll(pool);
+    }
+
+    bool contains(unsigned int messageIndex) const
+    {
+        for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+        {
+            if (queues[p].contains(messageIndex))
+                return true;
+        }
+        return false;
+    }
+};
@@ -37,3 +37,53 @@ struct RespondedEntity
 };
 
 static_assert(sizeof(RespondedEntity) == sizeof(::Entity) + 4 + 4 + 32 * SPECTRUM_DEPTH, "Something is wrong with the struct size.");
+
+
+// Request balances of up to maxNumberOfEntities entities with one message. The number of entities is derived from
+// the payload size, so only the used part of publicKeys is sent.
+struct RequestEntities
+{
+    static constexpr unsigned int maxNumberOfEntities = 128;
+
+    m256i publicKeys[maxNumberOfEntities];
+
+    enum {
+        type = 64,
+    };
+};
+
+static_assert(sizeof(RequestEntities) == 32 * RequestEntities::maxNumberOfEntities, "Something is wrong with the struct size.");
+
+
+// Response to RequestEntities, all entities are read from the same spectrum state. The message consists of:
+// - RespondEntities
+// - numberOfEntities x RespondedEntitiesEntry, in the order of the request
+// - numberOfSiblings x m256i, the Merkle multiproof of all found entities against spectrumDigest
+//
+// The multiproof contains each sibling that is not computable from the entities in the response only once. It is
+// ordered level by level from the leafs to the root and within each level by ascending node index. For verifying it,
+// start with the sorted unique spectrum indices of the found entities and their leaf digests. In each level, pair
+// node i with node i ^ 1 if it is also known, otherwise take the next sibling. Then continue with the parents i >> 1.
+// The last remaining digest must be spectrumDigest.
+struct RespondEntities
+{
+    m256i spectrumDigest;
+    unsigned int tick;
+    unsigned short numberOfEntities;
+    unsigned short numberOfSiblings;
+
+    enum {
+        type = 65,
+    };
+};
+
+static_assert(sizeof(RespondEntities) == 32 + 4 + 2 + 2, "Something is wrong with the struct size.");
+
+struct RespondedEntitiesEntry
+{
+    ::Entity entity;
+    int spectrumIndex; // -1 if entity is not in spectrum (entity then only has publicKey set)
+    unsigned int padding;
+};
+
+static_assert(sizeof(RespondedEntitiesEntry) == sizeof(::Entity) + 4 + 4, "Something is wrong with the struct size.");
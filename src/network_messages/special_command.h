@@ -85,4 +85,79 @@ struct SpecialCommandSetConsoleLoggingModeRequestAndResponse
     unsigned char padding[7];
 };
 
+#define SPECIAL_COMMAND_GET_CONTRACT_EXECUTION_STATS 18ULL
+struct SpecialCommandGetContractExecutionStatsRequest
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int contractIndex;
+    unsigned int padding;
+};
+
+// Accumulated execution statistics of one entry point of a contract (counted since node start, including nested calls)
+struct ContractEntryPointStatistics
+{
+    unsigned long long numberOfCalls;
+    unsigned long long totalExecutionTicks; // CPU ticks (TSC), see frequency in response
+    unsigned long long maxExecutionTicks;
+    unsigned long long numberOfSpectrumOperations;
+    unsigned long long numberOfUniverseOperations;
+    unsigned int maxLocalsStackSize; // max bytes of contract locals stack used by one call (input, output, locals)
+    unsigned short inputType; // SystemProcedureID if kind is 0
+    unsigned char kind; // 0 system procedure, 1 user procedure, 2 user function
+    unsigned char padding;
+};
+
+template<unsigned int maxNumberOfEntryPoints>
+struct SpecialCommandGetContractExecutionStatsResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int contractIndex;
+    unsigned int numberOfEntryPoints;
+    unsigned long long frequency; // CPU ticks per second
+    ContractEntryPointStatistics entryPoints[maxNumberOfEntryPoints];
+};
+
+#define SPECIAL_COMMAND_GET_MESSAGE_TYPE_STATS 19ULL
+
+// Traffic and latency statistics of one message type (counted since node start)
+struct MessageTypeStatistics
+{
+    unsigned long long numberOfReceived; // complete messages received from peers, including duplicates
+    unsigned long long bytesReceived;
+    unsigned long long numberOfSent; // messages added to transmit queues of peers
+    unsigned long long bytesSent;
+    unsigned long long numberOfProcessed; // messages processed by request processors
+    unsigned long long queueWaitTicks; // CPU ticks (TSC) in request queue, see frequency in response
+    unsigned long long maxQueueWaitTicks;
+    unsigned long long processingTicks;
+    unsigned long long maxProcessingTicks;
+    unsigned long long numberOfShed; // messages not queued by admission control of request queue because of overload
+    unsigned char type;
+    unsigned char padding[7];
+};
+
+// Response contains entries of message types that have been seen only (request is SpecialCommand)
+struct SpecialCommandGetMessageTypeStatsResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int numberOfTypes;
+    unsigned int padding;
+    unsigned long long frequency; // CPU ticks per second
+    MessageTypeStatistics types[256];
+};
+
+#define SPECIAL_COMMAND_GET_PROJECTED_REVENUE 20ULL
+
+// Revenue that each computor would get if the epoch ended after the given tick (request is SpecialCommand)
+struct SpecialCommandGetProjectedRevenueResponse
+{
+    unsigned long long everIncreasingNonceAndCommandType;
+    unsigned int epoch;
+    unsigned int tick; // last tick included in the projection, 0 if no tick has been processed in the epoch yet
+    unsigned long long txScore[NUMBER_OF_COMPUTORS];
+    unsigned long long voteScore[NUMBER_OF_COMPUTORS];
+    unsigned long long customMiningScore[NUMBER_OF_COMPUTORS];
+    long long revenue[NUMBER_OF_COMPUTORS];
+};
+
 #pragma pack(pop)
@@ -4,6 +4,8 @@
 #include "platform/assert.h"
 #ifdef NO_UEFI
 #include <cstdio>
+#include <thread>
+#include <chrono>
 #endif
 #include <lib/platform_common/processor.h>
 #include <lib/platform_efi/uefi.h>
@@ -20,9 +22,12 @@
 #define FILE_CHUNK_SIZE (209715200ULL) // for large file saving
 #define VOLUME_LABEL L"Qubic"
 
-// Size of buffer for non-blocking save, this size will divided into ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS.
+// Size of buffer for non-blocking save, this size will divided into ASYNC_FILE_IO_MAX_QUEUE_ITEMS slots.
+// Non-blocking saves of files larger than a slot or while all slots are in use fall back to blocking save.
+// The slots of 64 KB fit the revenue components file (about 43 KB), which is the only file saved non-blocking.
+// Increase if larger files shall be saved non-blocking.
 // Can set by zeros to save memory and don't use non-block save
-static constexpr unsigned long long ASYNC_FILE_IO_WRITE_QUEUE_BUFFER_SIZE = 0;//8 * 1024 * 1024 * 1024ULL; // Set 0 if don't need non-blocking save
+static constexpr unsigned long long ASYNC_FILE_IO_WRITE_QUEUE_BUFFER_SIZE = 16 * 64 * 1024ULL; // Set 0 if don't need non-blocking save
 static constexpr int ASYNC_FILE_IO_BLOCKING_MAX_QUEUE_ITEMS_2FACTOR = 10;
 static constexpr int ASYNC_FILE_IO_MAX_QUEUE_ITEMS_2FACTOR = 4;
 static constexpr int ASYNC_FILE_IO_MAX_FILE_NAME = 64;
@@ -397,6 +402,119 @@ static long long save(const CHAR16* fileName, unsigned long long totalSize, cons
 #endif
 }
 
+// Overwrite the pages of an existing file whose bit is set in pageFlags (bit p of pageFlags[p / 64] for the bytes
+// [p * pageSize, (p + 1) * pageSize) of buffer), keeping the rest of the file. Consecutive pages are written at once.
+// Returns the number of bytes written, or -1 if the file doesn't exist, its size isn't totalSize, or writing fails
+// (the file may be partially written in this case).
+static long long savePages(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, unsigned long long pageSize,
+    const unsigned long long* pageFlags, const CHAR16* directory = NULL)
+{
+#ifdef NO_UEFI
+    if (directory)
+    {
+        logToConsole(L"Argument directory not implemented for NO_UEFI savePages()! Pass full path as fileName!");
+        return -1;
+    }
+    FILE* file = nullptr;
+    if (_wfopen_s(&file, fileName, L"r+b") != 0 || !file)
+    {
+        // file doesn't exist (not an error, the caller saves the whole file)
+        return -1;
+    }
+    if (_fseeki64(file, 0, SEEK_END) != 0 || (unsigned long long)_ftelli64(file) != totalSize)
+    {
+        fclose(file);
+        return -1;
+    }
+#else
+    EFI_STATUS status;
+    EFI_FILE_PROTOCOL* file = NULL;
+    EFI_FILE_PROTOCOL* directoryProtocol = NULL;
+    if (NULL != directory)
+    {
+        if (status = root->Open(root, (void**)&directoryProtocol, (CHAR16*)directory, EFI_FILE_MODE_READ, 0))
+        {
+            logStatusToConsole(L"FileIOSavePages:OpenDir EFI_FILE_PROTOCOL.Open() fails", status, __LINE__);
+            return -1;
+        }
+        status = directoryProtocol->Open(directoryProtocol, (void**)&file, (CHAR16*)fileName, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+        directoryProtocol->Close(directoryProtocol);
+    }
+    else
+    {
+        status = root->Open(root, (void**)&file, (CHAR16*)fileName, EFI_FILE_MODE_READ | EFI_FILE_MODE_WRITE, 0);
+    }
+    if (status)
+    {
+        // file doesn't exist (not an error, the caller saves the whole file)
+        return -1;
+    }
+
+    // setting the position to 0xFFFFFFFFFFFFFFFF moves it to the end of the file
+    unsigned long long fileSize = 0;
+    if (file->SetPosition(file, 0xFFFFFFFFFFFFFFFF) || file->GetPosition(file, &fileSize) || fileSize != totalSize)
+    {
+        file->Close(file);
+        return -1;
+    }
+#endif
+
+    const unsigned long long numberOfPages = (totalSize + pageSize - 1) / pageSize;
+    unsigned long long writtenSize = 0;
+    for (unsigned long long page = 0; page < numberOfPages; )
+    {
+        if (!((pageFlags[page >> 6] >> (page & 63)) & 1))
+        {
+            page++;
+            continue;
+        }
+        unsigned long long endPage = page + 1;
+        while (endPage < numberOfPages && ((pageFlags[endPage >> 6] >> (endPage & 63)) & 1))
+        {
+            endPage++;
+        }
+        const unsigned long long offset = page * pageSize;
+        const unsigned long long endOffset = (endPage * pageSize < totalSize) ? endPage * pageSize : totalSize;
+#ifdef NO_UEFI
+        if (_fseeki64(file, offset, SEEK_SET) != 0 || fwrite(buffer + offset, 1, endOffset - offset, file) != endOffset - offset)
+        {
+            wprintf(L"Error writting %llu bytes to %s!\n", endOffset - offset, fileName);
+            fclose(file);
+            return -1;
+        }
+#else
+        if (status = file->SetPosition(file, offset))
+        {
+            logStatusToConsole(L"EFI_FILE_PROTOCOL.SetPosition() fails", status, __LINE__);
+            file->Close(file);
+            return -1;
+        }
+        for (unsigned long long chunkOffset = offset; chunkOffset < endOffset; )
+        {
+            unsigned long long size = (WRITING_CHUNK_SIZE <= (endOffset - chunkOffset) ? WRITING_CHUNK_SIZE : (endOffset - chunkOffset));
+            const unsigned long long expectedSize = size;
+            status = file->Write(file, &size, (void*)&buffer[chunkOffset]);
+            if (status || size != expectedSize)
+            {
+                logStatusToConsole(L"EFI_FILE_PROTOCOL.Write() fails", status, __LINE__);
+                file->Close(file);
+                return -1;
+            }
+            chunkOffset += size;
+        }
+#endif
+        writtenSize += endOffset - offset;
+        page = endPage;
+    }
+
+#ifdef NO_UEFI
+    fclose(file);
+#else
+    file->Close(file);
+#endif
+    return writtenSize;
+}
+
 #pragma optimize("", off)
 
 struct FileItem
@@ -574,20 +692,27 @@ public:
         }
     }
 
+    // Claim a free slot without locking. The state is switched from kFree to kFillingData atomically, so
+    // concurrent callers never get the same slot.
     FileItem* requestFreeSlot(unsigned long long requestedSize)
     {
         for (int i = 0; i < maxItems; i++)
         {
             long long index = ATOMIC_INC64(mCurrentIdx) & (maxItems - 1);
-            if (FileItem::kFree == mFileItems[index].mState)
+            if (_InterlockedCompareExchange8(&mFileItems[index].mState, FileItem::kFillingData, FileItem::kFree) == FileItem::kFree)
             {
-                mFileItems[index].mState = FileItem::kFillingData;
                 mFileItems[index].mSize = requestedSize;
                 return &mFileItems[index];
             }
         }
         return NULL;
     }
+
+    // Return size of the write buffer of each slot (0 if no buffer is provided)
+    unsigned long long slotBufferSize() const
+    {
+        return (mFileItems[0].mpBuffer != NULL) ? mFileItems[0].mReservedSize : 0;
+    }
 protected:
     // Real write happen here. This function expected call in main thread only. Need to flush all data in queue
     int flushIO(bool isSave, int numberOfProcessedItems = 0)
@@ -723,6 +848,18 @@ public:
     }
 };
 
+// Counters of AsyncFileIO for monitoring backpressure on the file system queues
+struct AsyncFileIOStats
+{
+    long long nonBlockingSaves;     // saves copied to the write buffer, caller continued immediately
+    long long blockingSaves;        // saves that waited until the file was written
+    long long loads;                // loads that waited until the file was read
+    long long queueFull;            // non-blocking saves rejected because all slots of the write buffer were in use
+    long long bufferFull;           // non-blocking saves rejected because the file is larger than a slot of the write buffer
+    long long pendingItems;         // number of items still waiting after the last flush
+    long long maxPendingItems;      // max of pendingItems since init
+};
+
 class AsyncFileIO
 {
 public:
@@ -793,6 +930,9 @@ public:
         mCreateDirQueueCount = 0;
         mCreateDirQueueLock = 0;
 
+        mFlushLock = 0;
+        setMem(&mStats, sizeof(mStats), 0);
+
         return true;
     }
 
@@ -801,12 +941,64 @@ public:
         // Deinit happen. Does not accept any new jobs
         mIsStop = true;
 
+#ifdef NO_UEFI
+        stopWorker();
+#endif
+
         // Flush all remained tasks
         flush();
-        if (mpSaveBuffer == NULL)
+        if (mpSaveBuffer != NULL)
         {
             freePool(mpSaveBuffer);
+            mpSaveBuffer = NULL;
+        }
+    }
+
+#ifdef NO_UEFI
+    // Start a thread that drains the queues in the background, so other threads don't need to wait for flush() calls
+    // of the main loop. Only available without UEFI, because the UEFI file protocol must only be used by the
+    // bootstrap processor.
+    void startWorker()
+    {
+        if (mpWorker)
+        {
+            return;
         }
+        mStopWorker = false;
+        mpWorker = new std::thread([this]()
+            {
+                while (!mStopWorker)
+                {
+                    if (flush(1) <= 0)
+                    {
+                        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    }
+                }
+            });
+    }
+
+    void stopWorker()
+    {
+        if (mpWorker)
+        {
+            mStopWorker = true;
+            mpWorker->join();
+            delete mpWorker;
+            mpWorker = NULL;
+        }
+    }
+#endif
+
+    // Get a copy of the backpressure counters
+    void getStats(AsyncFileIOStats& stats)
+    {
+        stats.nonBlockingSaves = ATOMIC_LOAD64(mStats.nonBlockingSaves);
+        stats.blockingSaves = ATOMIC_LOAD64(mStats.blockingSaves);
+        stats.loads = ATOMIC_LOAD64(mStats.loads);
+        stats.queueFull = ATOMIC_LOAD64(mStats.queueFull);
+        stats.bufferFull = ATOMIC_LOAD64(mStats.bufferFull);
+        stats.pendingItems = ATOMIC_LOAD64(mStats.pendingItems);
+        stats.maxPendingItems = ATOMIC_LOAD64(mStats.maxPendingItems);
     }
 
     bool isMainThread()
@@ -841,22 +1033,25 @@ public:
             return kUnsupported;
         }
 
-        FileItem* pFileItem = mFileWriteQueue.requestFreeSlot(totalSize);
-        if (pFileItem == NULL)
+        if (mFileWriteQueue.slotBufferSize() < totalSize)
         {
-            return kQueueFull;
+            ATOMIC_INC64(mStats.bufferFull);
+            return kBufferFull;
         }
 
-        if (pFileItem->mReservedSize < totalSize)
+        FileItem* pFileItem = mFileWriteQueue.requestFreeSlot(totalSize);
+        if (pFileItem == NULL)
         {
-            return kBufferFull;
+            ATOMIC_INC64(mStats.queueFull);
+            return kQueueFull;
         }
 
         // Non-blocking. Copy data and the write operation happend later
         pFileItem->set(fileName, totalSize, directory);
         copyMem(pFileItem->mpBuffer, buffer, totalSize);
         pFileItem->mpConstBuffer = pFileItem->mpBuffer;
-        pFileItem->mState = FileItem::kWait;
+        pFileItem->setState(FileItem::kWait);
+        ATOMIC_INC64(mStats.nonBlockingSaves);
         return (long long)totalSize;
     }
 
@@ -877,12 +1072,16 @@ public:
         // Blocking just steal the buffer
         pFileItem->set(fileName, totalSize, directory);
         pFileItem->mpConstBuffer = buffer;
-        pFileItem->mState = FileItem::kBlockingWait;
+        pFileItem->setState(FileItem::kBlockingWait);
+        ATOMIC_INC64(mStats.blockingSaves);
 
-        // Mainthread. Flush the save queue immediately
+        // Mainthread. Flush the save queue immediately (under the flush lock, because the queue may be flushed by
+        // another thread at the same time)
         if (isMainThread())
         {
+            ACQUIRE(mFlushLock);
             mFileBlockingWriteQueue.flushWrite();
+            RELEASE(mFlushLock);
             return (long long)totalSize;
         }
 
@@ -916,7 +1115,8 @@ public:
         // Get the buffer. Load operation will be execute later in main thread
         pFileItem->set(fileName, totalSize, directory);
         pFileItem->mpBuffer = buffer;
-        pFileItem->mState = FileItem::kBlockingWait;
+        pFileItem->setState(FileItem::kBlockingWait);
+        ATOMIC_INC64(mStats.loads);
 
         // In case of main thread. Read immediately.
         if (mainThread)
@@ -1019,8 +1219,14 @@ public:
         }
     }
 
+    // Process queued items. Returns the number of items still waiting. If another thread is flushing already
+    // (worker thread without UEFI), nothing is done and 0 is returned.
     int flush(int numberOfItemsPerQueue = 0)
     {
+        if (!TRY_ACQUIRE(mFlushLock))
+        {
+            return 0;
+        }
         int remainedItems = 0;
         remainedItems = remainedItems + mFileBlockingReadQueue.flushRead(numberOfItemsPerQueue);
         remainedItems = remainedItems + mFileBlockingWriteQueue.flushWrite(numberOfItemsPerQueue);
@@ -1030,6 +1236,14 @@ public:
         }
         flushRem();
         flushCreateDir();
+
+        const long long pendingItems = (remainedItems > 0) ? remainedItems : 0;
+        ATOMIC_STORE64(mStats.pendingItems, pendingItems);
+        if (pendingItems > mStats.maxPendingItems)
+        {
+            ATOMIC_STORE64(mStats.maxPendingItems, pendingItems);
+        }
+        RELEASE(mFlushLock);
         return remainedItems;
     }
 
@@ -1058,6 +1272,16 @@ private:
     CHAR16 mCreateDirQueue[1024][1024];
     int mCreateDirQueueCount;
     volatile char mCreateDirQueueLock;
+
+    // Only one thread processes the queues at a time
+    volatile char mFlushLock;
+
+    AsyncFileIOStats mStats;
+
+#ifdef NO_UEFI
+    std::thread* mpWorker;
+    volatile bool mStopWorker;
+#endif
 };
 
 #pragma optimize("", on)
@@ -1065,7 +1289,8 @@ private:
 // Asynchorous save file
 // This function can be called from any thread and have blocking and non blocking mode
 // - Blocking mode: to avoid lock and the actual save happen, flushAsyncFileIOBuffer must be called in main thread
-// - non-blocking mode: return immediately, the save operation happen in flushAsyncFileIOBuffer
+// - non-blocking mode: return immediately, the save operation happen in flushAsyncFileIOBuffer. If the write buffer
+//   is full or too small for the file, it falls back to blocking mode (counted in AsyncFileIOStats).
 static long long asyncSave(const CHAR16* fileName, unsigned long long totalSize, const unsigned char* buffer, const CHAR16* directory = NULL, bool blocking = true)
 {
     if (gAsyncFileIO)
@@ -1076,7 +1301,12 @@ static long long asyncSave(const CHAR16* fileName, unsigned long long totalSize,
         }
         else
         {
-            return gAsyncFileIO->asyncSave(fileName, totalSize, buffer, directory);
+            long long sts = gAsyncFileIO->asyncSave(fileName, totalSize, buffer, directory);
+            if (sts == AsyncFileIO::kQueueFull || sts == AsyncFileIO::kBufferFull || sts == AsyncFileIO::kUnsupported)
+            {
+                sts = gAsyncFileIO->asyncBlockingSave(fileName, totalSize, buffer, directory);
+            }
+            return sts;
         }
     }
 
@@ -1280,6 +1510,25 @@ static int flushAsyncFileIOBuffer(int numberOfItemsPerQueue = 0)
     }
     return 0;
 }
+
+#ifdef NO_UEFI
+// Process the file system queues in a background thread instead of calling flushAsyncFileIOBuffer() in a loop
+static void startAsyncFileIOWorker()
+{
+    if (gAsyncFileIO)
+    {
+        gAsyncFileIO->startWorker();
+    }
+}
+
+static void stopAsyncFileIOWorker()
+{
+    if (gAsyncFileIO)
+    {
+        gAsyncFileIO->stopWorker();
+    }
+}
+#endif
 #pragma optimize("", on)
 
 // add epoch number as an extension to a filename
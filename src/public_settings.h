@@ -16,6 +16,11 @@
 // is MAX_NUMBER_OF_PROCESSORS - 1.
 #define NUMBER_OF_CONTRACT_EXECUTION_BUFFERS 10
 
+// Keep a checkpoint copy of all contract states that is updated page by page at the end of each tick. This doubles the
+// RAM used for contract states, but snapshots only need to write the pages of contract files that have changed since
+// the last snapshot.
+#define CONTRACT_STATE_CHECKPOINTS 1
+
 #define USE_SCORE_CACHE 1
 #define SCORE_CACHE_SIZE 2000000 // the larger the better
 #define SCORE_CACHE_COLLISION_RETRIES 20 // number of retries to find entry in cache in case of hash collision
@@ -39,6 +44,24 @@
                                          // This will lead to zero `expectedNextTickTransactionDigest` in consensus
              
 #define PEER_REFRESHING_PERIOD 120000ULL
+
+// Limits of the request processing time that a single peer can use per second (in microseconds, per class of
+// requests), and of the bytes of responses per second sent to a single peer. Up to PEER_REQUEST_BURST_SECONDS of
+// budget can be used at once. Requests exceeding the limits are answered with TryAgain. Set to 0 to disable a limit.
+#define PEER_REQUEST_CPU_LIMIT_TICK_DATA 200000
+#define PEER_REQUEST_CPU_LIMIT_QUERY 100000
+#define PEER_REQUEST_CPU_LIMIT_CONTRACT_FUNCTION 100000
+#define PEER_RESPONSE_BYTES_LIMIT 33554432
+#define PEER_REQUEST_BURST_SECONDS 4
+
+// Admission control of the request queue: queries and contract function calls are shed if the request queue is
+// filled by REQUEST_QUEUE_MAX_FILL_PERCENT_QUERY percent or the estimated wait in the queue is longer than
+// REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_QUERY, tick data requests with the TICK_DATA limits. Votes, tick data, and
+// other gossip are only dropped if the queue is full. Shed requests are answered with TryAgain.
+#define REQUEST_QUEUE_MAX_FILL_PERCENT_TICK_DATA 80
+#define REQUEST_QUEUE_MAX_FILL_PERCENT_QUERY 50
+#define REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_TICK_DATA 5000
+#define REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_QUERY 1000
 #if AUTO_FORCE_NEXT_TICK_THRESHOLD != 0
 static_assert(NEXT_TICK_TIMEOUT_THRESHOLD < AUTO_FORCE_NEXT_TICK_THRESHOLD, "Timeout threshold must be smaller than auto F5 threshold");
 static_assert(AUTO_FORCE_NEXT_TICK_THRESHOLD* TARGET_TICK_DURATION >= PEER_REFRESHING_PERIOD, "AutoF5 threshold must be greater than PEER_REFRESHING_PERIOD");
@@ -70,10 +93,14 @@ static unsigned short SYSTEM_FILE_NAME[] = L"system";
 static unsigned short SYSTEM_END_OF_EPOCH_FILE_NAME[] = L"system.eoe";
 static unsigned short SPECTRUM_FILE_NAME[] = L"spectrum.???";
 static unsigned short UNIVERSE_FILE_NAME[] = L"universe.???";
+static unsigned short SPECTRUM_DIGESTS_FILE_NAME[] = L"spectrum_digests.???";
+static unsigned short SPECTRUM_DIGESTS_HEADER_FILE_NAME[] = L"spectrum_digests_header.???";
+static unsigned short UNIVERSE_DIGESTS_FILE_NAME[] = L"universe_digests.???";
+static unsigned short UNIVERSE_DIGESTS_HEADER_FILE_NAME[] = L"universe_digests_header.???";
 static unsigned short SCORE_CACHE_FILE_NAME[] = L"score.???";
 static unsigned short CONTRACT_FILE_NAME[] = L"contract????.???";
 static unsigned short CUSTOM_MINING_REVENUE_END_OF_EPOCH_FILE_NAME[] = L"custom_revenue.eoe";
-static unsigned short CUSTOM_MINING_CACHE_FILE_NAME[] = L"custom_mining_cache???.???";
+static unsigned short CUSTOM_MINING_CACHE_FILE_NAME[] = L"custom_mining_cache_v2_???.???"; // v2: probing within shards of CustomMininingCache
 
 static constexpr unsigned long long NUMBER_OF_INPUT_NEURONS = 256;     // K
 static constexpr unsigned long long NUMBER_OF_OUTPUT_NEURONS = 256;    // L
@@ -55,6 +55,9 @@
 #include "logging/net_msg_impl.h"
 
 #include "ticking/ticking.h"
+#include "ticking/digest_set.h"
+#include "ticking/salted_vote_digest_cache.h"
+#include "ticking/pending_transaction_candidates.h"
 #include "contract_core/qpi_ticking_impl.h"
 #include "vote_counter.h"
 
@@ -68,6 +71,7 @@
 #include "oracles/oracle_machines.h"
 
 #include "revenue.h"
+#include "merkle_tree.h"
 
 ////////// Qubic \\\\\\\\\\
 
@@ -93,7 +97,6 @@ struct Processor : public CustomStack
     Type type;
     EFI_EVENT event;
     Peer* peer;
-    void* buffer;
 };
 
 
@@ -132,6 +135,13 @@ static TickData nextTickData;
 
 static m256i uniqueNextTickTransactionDigests[NUMBER_OF_COMPUTORS];
 static unsigned int uniqueNextTickTransactionDigestCounters[NUMBER_OF_COMPUTORS];
+static DigestIndexSet<NUMBER_OF_COMPUTORS> uniqueNextTickTransactionDigestSet;
+// Index of broadcastedComputors.computors.publicKeys, rebuilt by updateComputorPublicKeyIndex() whenever the list changes.
+// The index is built in the table not in use and published by switching the pointer.
+static DigestIndexSet<NUMBER_OF_COMPUTORS> computorPublicKeyIndexTables[2];
+static DigestIndexSet<NUMBER_OF_COMPUTORS>* volatile computorPublicKeyIndex = &computorPublicKeyIndexTables[0];
+static volatile char computorPublicKeyIndexLock = 0;
+static SaltedVoteDigestCache<NUMBER_OF_COMPUTORS> saltedVoteDigestCache;
 
 static unsigned int resourceTestingDigest = 0;
 
@@ -139,10 +149,11 @@ static unsigned int numberOfTransactions = 0;
 static volatile char entityPendingTransactionsLock = 0;
 static unsigned char* entityPendingTransactions = NULL;
 static unsigned char* entityPendingTransactionDigests = NULL;
-static unsigned int entityPendingTransactionIndices[SPECTRUM_CAPACITY]; // [SPECTRUM_CAPACITY] must be >= than [NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR]
+static PendingTransactionCandidates<SPECTRUM_CAPACITY, MAX_TRANSACTION_SIZE> entityPendingTransactionCandidates; // for tick data of the next tick led by this node
 static volatile char computorPendingTransactionsLock = 0;
 static unsigned char* computorPendingTransactions = NULL;
 static unsigned char* computorPendingTransactionDigests = NULL;
+static PendingTransactionCandidates<NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR, MAX_TRANSACTION_SIZE> computorPendingTransactionCandidates;
 static unsigned long long spectrumChangeFlags[SPECTRUM_CAPACITY / (sizeof(unsigned long long) * 8)];
 
 static unsigned long long mainLoopNumerator = 0, mainLoopDenominator = 0;
@@ -204,9 +215,15 @@ static unsigned long long K12MeasurementsCount = 0;
 static unsigned long long K12MeasurementsSum = 0;
 static volatile char minerScoreArrayLock = 0;
 static SpecialCommandGetMiningScoreRanking<MAX_NUMBER_OF_MINERS> requestMiningScoreRanking;
+static volatile char contractExecutionStatsResponseLock = 0;
+typedef SpecialCommandGetContractExecutionStatsResponse<ContractEntryPointStatsTableType::capacityPerContract> ContractExecutionStatsResponse;
+static ContractExecutionStatsResponse contractExecutionStatsResponse;
+static volatile char messageTypeStatsResponseLock = 0;
+static SpecialCommandGetMessageTypeStatsResponse messageTypeStatsResponse;
+static SpecialCommandGetProjectedRevenueResponse projectedRevenueResponse; // protected by gProjectedRevenueLock
 
 // Custom mining related variables and constants
-static unsigned int gCustomMiningSharesCount[NUMBER_OF_COMPUTORS] = { 0 };
+static CustomMiningSharesCountShards gCustomMiningSharesCount;
 static CustomMiningSharesCounter gCustomMiningSharesCounter;
 
 // variables and declare for persisting state
@@ -236,7 +253,7 @@ struct
     unsigned char customMiningSharesCounterData[CustomMiningSharesCounter::_customMiningSolutionCounterDataSize];
 } nodeStateBuffer;
 #endif
-static bool saveComputer(CHAR16* directory = NULL);
+static bool saveComputer(CHAR16* directory = NULL, bool skipUnchangedContracts = false);
 static bool saveSystem(CHAR16* directory = NULL);
 static bool loadComputer(CHAR16* directory = NULL, bool forceLoadFromFile = false);
 static bool saveRevenueComponents(CHAR16* directory = NULL);
@@ -359,14 +376,33 @@ static void logToConsole(const CHAR16* message)
 #endif
 }
 
+// Rebuild computorPublicKeyIndex after broadcastedComputors.computors.publicKeys has been changed. May be called by
+// several request processors at the same time (when a new computor list floods in), so rebuilds are serialized. The
+// new index is built in the table that isn't in use and published afterwards, so lookups running concurrently use the
+// complete previous index. It is only reset again by the next rebuild, which happens at most a few times per epoch.
+static void updateComputorPublicKeyIndex()
+{
+    ACQUIRE(computorPublicKeyIndexLock);
+    DigestIndexSet<NUMBER_OF_COMPUTORS>* newIndex = (computorPublicKeyIndex == &computorPublicKeyIndexTables[0])
+        ? &computorPublicKeyIndexTables[1] : &computorPublicKeyIndexTables[0];
+    newIndex->reset();
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        newIndex->findOrInsert(broadcastedComputors.computors.publicKeys, broadcastedComputors.computors.publicKeys[i], i);
+    }
+
+    // publish index after writing it
+    _mm_sfence();
+    computorPublicKeyIndex = newIndex;
+    RELEASE(computorPublicKeyIndexLock);
+}
+
 static int computorIndex(m256i computor)
 {
-    for (int computorIndex = 0; computorIndex < NUMBER_OF_COMPUTORS; computorIndex++)
+    const unsigned int computorIndex = computorPublicKeyIndex->find(broadcastedComputors.computors.publicKeys, computor);
+    if (computorIndex < NUMBER_OF_COMPUTORS)
     {
-        if (broadcastedComputors.computors.publicKeys[computorIndex] == computor)
-        {
-            return computorIndex;
-        }
+        return computorIndex;
     }
 
     return -1;
@@ -388,11 +424,58 @@ static void enableAVX()
         ));
 }
 
+// Work items shared by the processors running parallelFor()
+struct ParallelForJob
+{
+    void (*processItem)(void* context, unsigned int itemIndex);
+    void* context;
+    unsigned int numberOfItems;
+    volatile long long nextItem;
+};
+
+static void parallelForProcessor(void* job)
+{
+    enableAVX();
+
+    ParallelForJob* parallelForJob = (ParallelForJob*)job;
+    unsigned long long itemIndex;
+    while ((itemIndex = _InterlockedIncrement64(&parallelForJob->nextItem) - 1) < parallelForJob->numberOfItems)
+    {
+        parallelForJob->processItem(parallelForJob->context, (unsigned int)itemIndex);
+    }
+}
+
+// ParallelForFunction using all application processors that are idle, which is only the case during startup (before
+// the node's processor functions are launched). Otherwise, StartupAllAPs() fails and the main processor processes
+// all items. processItem must not use file IO or console output, which are only available in the main processor.
+static void parallelFor(unsigned int numberOfItems, void (*processItem)(void* context, unsigned int itemIndex), void* context)
+{
+    ParallelForJob job;
+    job.processItem = processItem;
+    job.context = context;
+    job.numberOfItems = numberOfItems;
+    job.nextItem = 0;
+
+    if (mpServicesProtocol)
+    {
+        // blocking mode: returns after all application processors have finished
+        mpServicesProtocol->StartupAllAPs(mpServicesProtocol, parallelForProcessor, FALSE, NULL, 0, &job, NULL);
+    }
+
+    // process remaining items (all if the application processors are busy)
+    parallelForProcessor(&job);
+}
+
 // Should only be called from tick processor to avoid concurrent state changes, which can cause race conditions as detailed in FIXME below.
 static void getComputerDigest(m256i& digest)
 {
     PROFILE_SCOPE();
 
+#if CONTRACT_STATE_CHECKPOINTS
+    // Update checkpoint of changed contracts before the change flags are cleared below
+    contractStateCheckpoint.update(contractStateChangeFlags);
+#endif
+
     unsigned int digestIndex;
     for (digestIndex = 0; digestIndex < MAX_NUMBER_OF_CONTRACTS; digestIndex++)
     {
@@ -462,15 +545,7 @@ static void processExchangePublicPeers(Peer* peer, RequestResponseHeader* header
         // Set isHandshaked if sExchangePublicPeers was received on outgoing connection
         if (peer->address.u32)
         {
-            for (unsigned int j = 0; j < numberOfPublicPeers; j++)
-            {
-                if (peer->address == publicPeers[j].address)
-                {
-                    publicPeers[j].isHandshaked = true;
-
-                    break;
-                }
-            }
+            rewardPublicPeerHandshake(peer->address);
         }
     }
 
@@ -557,76 +632,70 @@ static void processBroadcastMessage(const unsigned long long processorNumber, Re
                 }
                 else if (messagePayloadSize == sizeof(CustomMiningSolution))
                 {
-                    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+                    if (computorIndex(request->sourcePublicKey) >= 0)
                     {
-                        if (request->sourcePublicKey == broadcastedComputors.computors.publicKeys[i])
+                        // Compute the gamming key to get the sub-type of message
+                        unsigned char sharedKeyAndGammingNonce[64];
+                        setMem(sharedKeyAndGammingNonce, 32, 0);
+                        copyMem(&sharedKeyAndGammingNonce[32], &request->gammingNonce, 32);
+                        unsigned char gammingKey[32];
+                        KangarooTwelve64To32(sharedKeyAndGammingNonce, gammingKey);
+
+                        if (recordCustomMining && gammingKey[0] == MESSAGE_TYPE_CUSTOM_MINING_SOLUTION)
                         {
-                            // Compute the gamming key to get the sub-type of message
-                            unsigned char sharedKeyAndGammingNonce[64];
-                            setMem(sharedKeyAndGammingNonce, 32, 0);
-                            copyMem(&sharedKeyAndGammingNonce[32], &request->gammingNonce, 32);
-                            unsigned char gammingKey[32];
-                            KangarooTwelve64To32(sharedKeyAndGammingNonce, gammingKey);
+                            // Record the solution
+                            bool isSolutionGood = false;
+                            const CustomMiningSolution* solution = ((CustomMiningSolution*)((unsigned char*)request + sizeof(BroadcastMessage)));
+
+                            int partId = customMiningGetPartitionID(solution->firstComputorIndex, solution->lastComputorIndex);
 
-                            if (recordCustomMining && gammingKey[0] == MESSAGE_TYPE_CUSTOM_MINING_SOLUTION)
+                            // TODO: taskIndex can use for detect for-sure stale shares
+                            if (partId >= 0 && solution->taskIndex > 0)
                             {
-                                // Record the solution
-                                bool isSolutionGood = false;
-                                const CustomMiningSolution* solution = ((CustomMiningSolution*)((unsigned char*)request + sizeof(BroadcastMessage)));
+                                CustomMiningSolutionCacheEntry cacheEntry;
+                                cacheEntry.set(solution);
 
-                                int partId = customMiningGetPartitionID(solution->firstComputorIndex, solution->lastComputorIndex);
+                                unsigned int cacheIndex = 0;
+                                int sts = gSystemCustomMiningSolutionCache[partId].tryFetching(cacheEntry, cacheIndex);
 
-                                // TODO: taskIndex can use for detect for-sure stale shares
-                                if (partId >= 0 && solution->taskIndex > 0)
+                                // Check for duplicated solution
+                                if (sts == CUSTOM_MINING_CACHE_MISS)
                                 {
-                                    CustomMiningSolutionCacheEntry cacheEntry;
-                                    cacheEntry.set(solution);
-
-                                    unsigned int cacheIndex = 0;
-                                    int sts = gSystemCustomMiningSolutionCache[partId].tryFetching(cacheEntry, cacheIndex);
-
-                                    // Check for duplicated solution
-                                    if (sts == CUSTOM_MINING_CACHE_MISS)
-                                    {
-                                        gSystemCustomMiningSolutionCache[partId].addEntry(cacheEntry, cacheIndex);
-                                        isSolutionGood = true;
-                                    }
+                                    gSystemCustomMiningSolutionCache[partId].addEntry(cacheEntry, cacheIndex);
+                                    isSolutionGood = true;
+                                }
 
-                                    if (isSolutionGood)
+                                if (isSolutionGood)
+                                {
+                                    // Check the computor idx of this solution.
+                                    unsigned short computorID = customMiningGetComputorID(solution->nonce, partId);
+                                    if (computorID <= gTaskPartition[partId].lastComputorIdx)
                                     {
-                                        // Check the computor idx of this solution.
-                                        unsigned short computorID = customMiningGetComputorID(solution->nonce, partId);
-                                        if (computorID <= gTaskPartition[partId].lastComputorIdx)
-                                        {
 
-                                            ACQUIRE(gCustomMiningSharesCountLock);
-                                            gCustomMiningSharesCount[computorID]++;
-                                            RELEASE(gCustomMiningSharesCountLock);
+                                        gCustomMiningSharesCount.increment(computorID);
 
-                                            CustomMiningSolutionStorageEntry solutionStorageEntry;
-                                            solutionStorageEntry.taskIndex = solution->taskIndex;
-                                            solutionStorageEntry.nonce = solution->nonce;
-                                            solutionStorageEntry.cacheEntryIndex = cacheIndex;
+                                        CustomMiningSolutionStorageEntry solutionStorageEntry;
+                                        solutionStorageEntry.taskIndex = solution->taskIndex;
+                                        solutionStorageEntry.nonce = solution->nonce;
+                                        solutionStorageEntry.cacheEntryIndex = cacheIndex;
 
-                                            ACQUIRE(gCustomMiningSolutionStorageLock);
-                                            gCustomMiningStorage._solutionStorage[partId].addData(&solutionStorageEntry);
-                                            RELEASE(gCustomMiningSolutionStorageLock);
+                                        ACQUIRE(gCustomMiningSolutionStorageLock);
+                                        gCustomMiningStorage._solutionStorage[partId].addData(&solutionStorageEntry);
+                                        RELEASE(gCustomMiningSolutionStorageLock);
 
-                                        }
                                     }
+                                }
 
-                                    // Record stats
-                                    const unsigned int hitCount = gSystemCustomMiningSolutionCache[partId].hitCount();
-                                    const unsigned int missCount = gSystemCustomMiningSolutionCache[partId].missCount();
-                                    const unsigned int collision = gSystemCustomMiningSolutionCache[partId].collisionCount();
+                                // Record stats
+                                const unsigned int hitCount = gSystemCustomMiningSolutionCache[partId].hitCount();
+                                const unsigned int missCount = gSystemCustomMiningSolutionCache[partId].missCount();
+                                const unsigned int collision = gSystemCustomMiningSolutionCache[partId].collisionCount();
 
-                                    ATOMIC_STORE64(gCustomMiningStats.phase[partId].shares, missCount);
-                                    ATOMIC_STORE64(gCustomMiningStats.phase[partId].duplicated, hitCount);
-                                    ATOMIC_MAX64(gCustomMiningStats.maxCollisionShareCount, collision);
+                                ATOMIC_STORE64(gCustomMiningStats.phase[partId].shares, missCount);
+                                ATOMIC_STORE64(gCustomMiningStats.phase[partId].duplicated, hitCount);
+                                ATOMIC_MAX64(gCustomMiningStats.maxCollisionShareCount, collision);
 
-                                }
                             }
-                            break;
                         }
                     }
                 }
@@ -770,6 +839,7 @@ static void processBroadcastComputors(Peer* peer, RequestResponseHeader* header)
 
             // Copy computor list
             copyMem(&broadcastedComputors.computors, &request->computors, sizeof(Computors));
+            updateComputorPublicKeyIndex();
 
             // Update ownComputorIndices and minerPublicKeys
             if (request->computors.epoch == system.epoch)
@@ -882,23 +952,9 @@ static void processBroadcastFutureTickData(Peer* peer, RequestResponseHeader* he
         && request->tickData.millisecond <= 999
         && ms(request->tickData.year, request->tickData.month, request->tickData.day, request->tickData.hour, request->tickData.minute, request->tickData.second, request->tickData.millisecond) <= ms(utcTime.Year - 2000, utcTime.Month, utcTime.Day, utcTime.Hour, utcTime.Minute, utcTime.Second, utcTime.Nanosecond / 1000000) + TIME_ACCURACY)
     {
-        bool ok = true;
-        for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK && ok; i++)
-        {
-            if (!isZero(request->tickData.transactionDigests[i]))
-            {
-                // Check if same transactionDigest is present twice
-                for (unsigned int j = 0; j < i; j++)
-                {
-                    if (request->tickData.transactionDigests[i] == request->tickData.transactionDigests[j])
-                    {
-                        ok = false;
-
-                        break;
-                    }
-                }
-            }
-        }
+        // Check if same transactionDigest is present twice (hash set instead of comparing all pairs, because this runs
+        // for every message from every peer before checking the signature)
+        const bool ok = !containsDuplicateNonZeroDigest<NUMBER_OF_TRANSACTIONS_PER_TICK>(request->tickData.transactionDigests, NUMBER_OF_TRANSACTIONS_PER_TICK);
         if (ok)
         {
             unsigned char digest[32];
@@ -988,8 +1044,10 @@ static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* heade
                 if (((Transaction*)&computorPendingTransactions[computorIndex * offset * MAX_TRANSACTION_SIZE])->tick < request->tick
                     && request->tick < system.initialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH)
                 {
+                    computorPendingTransactionCandidates.beginAdd(computorIndex * offset);
                     copyMem(&computorPendingTransactions[computorIndex * offset * MAX_TRANSACTION_SIZE], request, transactionSize);
                     KangarooTwelve(request, transactionSize, &computorPendingTransactionDigests[computorIndex * offset * 32ULL], 32);
+                    computorPendingTransactionCandidates.endAdd(computorIndex * offset, request->tick);
                 }
 
                 RELEASE(computorPendingTransactionsLock);
@@ -1008,8 +1066,10 @@ static void processBroadcastTransaction(Peer* peer, RequestResponseHeader* heade
                     if (((Transaction*)&entityPendingTransactions[spectrumIndex * MAX_TRANSACTION_SIZE])->tick < request->tick
                         && request->tick < system.initialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH)
                     {
+                        entityPendingTransactionCandidates.beginAdd(spectrumIndex);
                         copyMem(&entityPendingTransactions[spectrumIndex * MAX_TRANSACTION_SIZE], request, transactionSize);
                         KangarooTwelve(request, transactionSize, &entityPendingTransactionDigests[spectrumIndex * 32ULL], 32);
+                        entityPendingTransactionCandidates.endAdd(spectrumIndex, request->tick);
                     }
 
                     RELEASE(entityPendingTransactionsLock);
@@ -1248,31 +1308,86 @@ static void processRequestEntity(Peer* peer, RequestResponseHeader* header)
     RespondedEntity respondedEntity;
 
     RequestedEntity* request = header->getPayload<RequestedEntity>();
-    respondedEntity.entity.publicKey = request->publicKey;
-    // Inside spectrumIndex already have acquire/release lock
-    respondedEntity.spectrumIndex = spectrumIndex(respondedEntity.entity.publicKey);
-    respondedEntity.tick = system.tick;
+
+    // Read entity and siblings without acquiring spectrumLock, so balance queries don't wait for the transactions
+    // of the tick being processed (see beginSpectrumRead())
+    long long sequence;
+    do
+    {
+        sequence = beginSpectrumRead();
+        respondedEntity.spectrumIndex = spectrumIndexWithoutLocking(request->publicKey);
+        respondedEntity.tick = system.tick;
+        if (respondedEntity.spectrumIndex >= 0)
+        {
+            copyMem(&respondedEntity.entity, &spectrum[respondedEntity.spectrumIndex], sizeof(::Entity));
+            getSiblings<SPECTRUM_DEPTH>(respondedEntity.spectrumIndex, spectrumDigests, respondedEntity.siblings);
+        }
+    } while (!endSpectrumRead(sequence));
+
     if (respondedEntity.spectrumIndex < 0)
     {
-        respondedEntity.entity.incomingAmount = 0;
-        respondedEntity.entity.outgoingAmount = 0;
-        respondedEntity.entity.numberOfIncomingTransfers = 0;
-        respondedEntity.entity.numberOfOutgoingTransfers = 0;
-        respondedEntity.entity.latestIncomingTransferTick = 0;
-        respondedEntity.entity.latestOutgoingTransferTick = 0;
+        setMem(&respondedEntity.entity, sizeof(::Entity), 0);
+        respondedEntity.entity.publicKey = request->publicKey;
 
         setMem(respondedEntity.siblings, sizeof(respondedEntity.siblings), 0);
     }
-    else
+
+
+    enqueueResponse(peer, sizeof(respondedEntity), RESPOND_ENTITY, header->dejavu(), &respondedEntity);
+}
+
+static void processRequestEntities(Peer* peer, RequestResponseHeader* header)
+{
+    const unsigned int payloadSize = header->size() - sizeof(RequestResponseHeader);
+    if (!payloadSize || payloadSize > sizeof(RequestEntities) || payloadSize % sizeof(m256i))
     {
-        copyMem(&respondedEntity.entity, &spectrum[respondedEntity.spectrumIndex], sizeof(::Entity));
-        ACQUIRE(spectrumLock);
-        getSiblings<SPECTRUM_DEPTH>(respondedEntity.spectrumIndex, spectrumDigests, respondedEntity.siblings);
-        RELEASE(spectrumLock);
+        return;
     }
+    const unsigned int numberOfEntities = payloadSize / sizeof(m256i);
+    const RequestEntities* request = header->getPayload<RequestEntities>();
 
+    // Response is built on the stack of the request processor (about 100 KB if all entities are found), with the
+    // siblings directly following the used entries
+    unsigned char responseBuffer[sizeof(RespondEntities) + sizeof(RespondedEntitiesEntry) * RequestEntities::maxNumberOfEntities
+        + sizeof(m256i) * RequestEntities::maxNumberOfEntities * SPECTRUM_DEPTH];
+    RespondEntities* response = (RespondEntities*)responseBuffer;
+    RespondedEntitiesEntry* entries = (RespondedEntitiesEntry*)(response + 1);
+    m256i* siblings = (m256i*)(entries + numberOfEntities);
+    unsigned int foundIndices[RequestEntities::maxNumberOfEntities];
+    unsigned int numberOfSiblings;
 
-    enqueueResponse(peer, sizeof(respondedEntity), RESPOND_ENTITY, header->dejavu(), &respondedEntity);
+    // Look up all entities and compute the proof in one consistent state of the spectrum. This doesn't acquire
+    // spectrumLock but repeats if the spectrum has been changed meanwhile (see beginSpectrumRead()).
+    long long sequence;
+    do
+    {
+        sequence = beginSpectrumRead();
+        unsigned int numberOfFoundIndices = 0;
+        for (unsigned int i = 0; i < numberOfEntities; ++i)
+        {
+            entries[i].spectrumIndex = spectrumIndexWithoutLocking(request->publicKeys[i]);
+            entries[i].padding = 0;
+            if (entries[i].spectrumIndex < 0)
+            {
+                setMem(&entries[i].entity, sizeof(::Entity), 0);
+                entries[i].entity.publicKey = request->publicKeys[i];
+            }
+            else
+            {
+                copyMem(&entries[i].entity, &spectrum[entries[i].spectrumIndex], sizeof(::Entity));
+                foundIndices[numberOfFoundIndices++] = entries[i].spectrumIndex;
+            }
+        }
+        numberOfFoundIndices = sortUniqueIndices(foundIndices, numberOfFoundIndices);
+        numberOfSiblings = getMerkleMultiproofSiblings<SPECTRUM_DEPTH>(foundIndices, numberOfFoundIndices, spectrumDigests, siblings);
+        response->spectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+        response->tick = system.tick;
+    } while (!endSpectrumRead(sequence));
+
+    response->numberOfEntities = (unsigned short)numberOfEntities;
+    response->numberOfSiblings = (unsigned short)numberOfSiblings;
+    enqueueResponse(peer, sizeof(RespondEntities) + numberOfEntities * sizeof(RespondedEntitiesEntry) + numberOfSiblings * sizeof(m256i),
+        RespondEntities::type, header->dejavu(), responseBuffer);
 }
 
 static void processRequestContractIPO(Peer* peer, RequestResponseHeader* header)
@@ -1314,11 +1429,25 @@ static void processRequestContractFunction(Peer* peer, const unsigned long long
     }
     else
     {
+        // Return cached output if the same function has been called with the same input since the last state change
+        const unsigned char* input = ((unsigned char*)request) + sizeof(RequestContractFunction);
+        const long long cacheVersion = contractFunctionResultCache.currentVersion();
+        m256i inputDigest;
+        ContractFunctionResultCacheType::computeInputDigest(input, request->inputSize, inputDigest);
+        unsigned char cachedOutput[ContractFunctionResultCacheType::maxCachedOutputSize];
+        unsigned short cachedOutputSize = 0;
+        if (contractFunctionResultCache.tryGet(request->contractIndex, request->inputType, request->inputSize, inputDigest, cacheVersion, cachedOutput, cachedOutputSize))
+        {
+            enqueueResponse(peer, cachedOutputSize, RespondContractFunction::type, header->dejavu(), cachedOutput);
+            return;
+        }
+
         QpiContextUserFunctionCall qpiContext(request->contractIndex);
-        auto errorCode = qpiContext.call(request->inputType, (((unsigned char*)request) + sizeof(RequestContractFunction)), request->inputSize);
+        auto errorCode = qpiContext.call(request->inputType, input, request->inputSize);
         if (errorCode == NoContractError)
         {
-            // success: respond with function output
+            // success: store and respond with function output
+            contractFunctionResultCache.put(request->contractIndex, request->inputType, request->inputSize, inputDigest, cacheVersion, qpiContext.outputBuffer, qpiContext.outputSize);
             enqueueResponse(peer, qpiContext.outputSize, RespondContractFunction::type, header->dejavu(), qpiContext.outputBuffer);
         }
         else
@@ -1410,9 +1539,7 @@ static void processRequestedCustomMiningSolutionVerificationRequest(Peer* peer,
                     // Reduce the share of this nonce if it is invalid
                     if (0 == request->isValid)
                     {
-                        ACQUIRE(gCustomMiningSharesCountLock);
-                        gCustomMiningSharesCount[computorID] = gCustomMiningSharesCount[computorID] > 0 ? gCustomMiningSharesCount[computorID] - 1 : 0;
-                        RELEASE(gCustomMiningSharesCountLock);
+                        gCustomMiningSharesCount.decrement(computorID);
 
                         // Save the number of invalid share count
                         ATOMIC_INC64(gCustomMiningStats.phase[partId].invalid);
@@ -1696,6 +1823,57 @@ static void processSpecialCommand(Peer* peer, RequestResponseHeader* header)
             }
             break;
 
+            case SPECIAL_COMMAND_GET_CONTRACT_EXECUTION_STATS:
+            {
+                const auto* _request = header->getPayload<SpecialCommandGetContractExecutionStatsRequest>();
+                ACQUIRE(contractExecutionStatsResponseLock);
+                contractExecutionStatsResponse.everIncreasingNonceAndCommandType = _request->everIncreasingNonceAndCommandType;
+                contractExecutionStatsResponse.contractIndex = _request->contractIndex;
+                contractExecutionStatsResponse.frequency = frequency;
+                contractExecutionStatsResponse.numberOfEntryPoints = (_request->contractIndex < contractCount)
+                    ? contractEntryPointStats.getStatistics(_request->contractIndex, contractExecutionStatsResponse.entryPoints)
+                    : 0;
+                enqueueResponse(peer,
+                    offsetof(ContractExecutionStatsResponse, entryPoints)
+                    + sizeof(ContractEntryPointStatistics) * contractExecutionStatsResponse.numberOfEntryPoints,
+                    SpecialCommand::type,
+                    header->dejavu(),
+                    &contractExecutionStatsResponse);
+                RELEASE(contractExecutionStatsResponseLock);
+            }
+            break;
+
+            case SPECIAL_COMMAND_GET_MESSAGE_TYPE_STATS:
+            {
+                ACQUIRE(messageTypeStatsResponseLock);
+                messageTypeStatsResponse.everIncreasingNonceAndCommandType = request->everIncreasingNonceAndCommandType;
+                messageTypeStatsResponse.frequency = frequency;
+                messageTypeStatsResponse.numberOfTypes = messageTypeStatistics.getStatistics(messageTypeStatsResponse.types);
+                enqueueResponse(peer,
+                    offsetof(SpecialCommandGetMessageTypeStatsResponse, types)
+                    + sizeof(MessageTypeStatistics) * messageTypeStatsResponse.numberOfTypes,
+                    SpecialCommand::type,
+                    header->dejavu(),
+                    &messageTypeStatsResponse);
+                RELEASE(messageTypeStatsResponseLock);
+            }
+            break;
+
+            case SPECIAL_COMMAND_GET_PROJECTED_REVENUE:
+            {
+                ACQUIRE(gProjectedRevenueLock);
+                projectedRevenueResponse.everIncreasingNonceAndCommandType = request->everIncreasingNonceAndCommandType;
+                projectedRevenueResponse.epoch = system.epoch;
+                projectedRevenueResponse.tick = gProjectedRevenueTick;
+                copyMem(projectedRevenueResponse.txScore, gProjectedRevenueComponents.txScore, sizeof(projectedRevenueResponse.txScore));
+                copyMem(projectedRevenueResponse.voteScore, gProjectedRevenueComponents.voteScore, sizeof(projectedRevenueResponse.voteScore));
+                copyMem(projectedRevenueResponse.customMiningScore, gProjectedRevenueComponents.customMiningScore, sizeof(projectedRevenueResponse.customMiningScore));
+                copyMem(projectedRevenueResponse.revenue, gProjectedRevenueComponents.revenue, sizeof(projectedRevenueResponse.revenue));
+                enqueueResponse(peer, sizeof(projectedRevenueResponse), SpecialCommand::type, header->dejavu(), &projectedRevenueResponse);
+                RELEASE(gProjectedRevenueLock);
+            }
+            break;
+
             case SPECIAL_COMMAND_SET_CONSOLE_LOGGING_MODE:
             {
                 const auto* _request = header->getPayload<SpecialCommandSetConsoleLoggingModeRequestAndResponse>();
@@ -1950,8 +2128,6 @@ static void requestProcessor(void* ProcedureArgument)
 
     const unsigned long long processorNumber = getRunningProcessorID();
 
-    Processor* processor = (Processor*)ProcedureArgument;
-    RequestResponseHeader* header = (RequestResponseHeader*)processor->buffer;
     while (!shutDownNode)
     {
         checkinTime(processorNumber);
@@ -1963,27 +2139,10 @@ static void requestProcessor(void* ProcedureArgument)
             {
                 {
                     // to avoid potential overflow: consume the queue without processing requests
-                    ACQUIRE(requestQueueTailLock);
-                    if (requestQueueElementTail == requestQueueElementHead)
-                    {
-                        RELEASE(requestQueueTailLock);
-                    }
-                    else
+                    const unsigned int requestIndex = requestQueue.claim();
+                    if (requestIndex != requestQueue.invalidRequestIndex)
                     {
-                        {
-                            RequestResponseHeader* requestHeader = (RequestResponseHeader*)&requestQueueBuffer[requestQueueElements[requestQueueElementTail].offset];
-                            copyMem(header, requestHeader, requestHeader->size());
-                            requestQueueBufferTail += requestHeader->size();
-                        }
-
-                        Peer* peer = requestQueueElements[requestQueueElementTail].peer;
-
-                        if (requestQueueBufferTail > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                        {
-                            requestQueueBufferTail = 0;
-                        }
-                        requestQueueElementTail++;
-                        RELEASE(requestQueueTailLock);
+                        requestQueue.finish(requestIndex);
                     }
                 }
             }
@@ -1997,39 +2156,26 @@ static void requestProcessor(void* ProcedureArgument)
             PROFILE_NAMED_SCOPE("requestProcessor(): solution processing");
             score->tryProcessSolution(processorNumber);
         }
+
+        // help collecting the pending transactions for the tick data of the next tick led by this node
+        computorPendingTransactionCandidates.tryScanChunk();
+        entityPendingTransactionCandidates.tryScanChunk();
         
-        if (requestQueueElementTail == requestQueueElementHead)
-        {
-            _mm_pause();
-        }
-        else
         {
-            ACQUIRE(requestQueueTailLock);
-
-            if (requestQueueElementTail == requestQueueElementHead)
+            // the request is processed in place in the queue, which only reuses its space after finish()
+            const unsigned int requestIndex = requestQueue.claim();
+            if (requestIndex == requestQueue.invalidRequestIndex)
             {
-                RELEASE(requestQueueTailLock);
+                _mm_pause();
             }
             else
             {
                 PROFILE_NAMED_SCOPE("requestProcessor(): request processing");
                 const unsigned long long beginningTick = __rdtsc();
+                const unsigned long long enqueueTick = requestQueue.getEnqueueTick(requestIndex);
+                RequestResponseHeader* header = requestQueue.getRequest(requestIndex);
+                Peer* peer = requestQueue.getContext(requestIndex);
 
-                {
-                    RequestResponseHeader* requestHeader = (RequestResponseHeader*)&requestQueueBuffer[requestQueueElements[requestQueueElementTail].offset];
-                    copyMem(header, requestHeader, requestHeader->size());
-                    requestQueueBufferTail += requestHeader->size();
-                }
-
-                Peer* peer = requestQueueElements[requestQueueElementTail].peer;
-
-                if (requestQueueBufferTail > REQUEST_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
-                {
-                    requestQueueBufferTail = 0;
-                }
-                requestQueueElementTail++;
-
-                RELEASE(requestQueueTailLock);
                 switch (header->type())
                 {
                 case ExchangePublicPeers::type:
@@ -2116,6 +2262,12 @@ static void requestProcessor(void* ProcedureArgument)
                 }
                 break;
 
+                case RequestEntities::type:
+                {
+                    processRequestEntities(peer, header);
+                }
+                break;
+
                 case RequestContractIPO::type:
                 {
                     processRequestContractIPO(peer, header);
@@ -2211,12 +2363,32 @@ static void requestProcessor(void* ProcedureArgument)
                     processRequestConfirmedTx(processorNumber, peer, header);
                 }
                 break;
+
+                case REQUEST_TX_STATUS_OF_DIGEST:
+                {
+                    processRequestTxStatusOfDigest(peer, header);
+                }
+                break;
+
+                case REQUEST_TX_STATUS_OF_DIGESTS:
+                {
+                    processRequestTxStatusOfDigests(peer, header);
+                }
+                break;
 #endif
 
                 }
 
-                queueProcessingNumerator += __rdtsc() - beginningTick;
+                const unsigned long long processingTicks = __rdtsc() - beginningTick;
+                queueProcessingNumerator += processingTicks;
                 queueProcessingDenominator++;
+                messageTypeStatistics.recordProcessed((unsigned int)processorNumber, header->type(),
+                    (beginningTick > enqueueTick) ? beginningTick - enqueueTick : 0, processingTicks);
+                if (peer)
+                {
+                    peer->requestCost.chargeCycles(getRequestCostClass(header->type()), processingTicks, peerRequestLimits);
+                }
+                requestQueue.finish(requestIndex);
 
                 _InterlockedIncrement64(&numberOfProcessedRequests);
             }
@@ -2930,6 +3102,45 @@ static bool makeAndBroadcastCustomMiningTransaction(int i, BroadcastFutureTickDa
     return false;
 }
 
+// Add revenue points of the processed tick and the current vote and custom mining counts to the running revenue scores,
+// and update the projection of the revenue of the epoch
+static void updateRunningRevenue(unsigned int tick, const TickData& td)
+{
+    if (td.epoch == system.epoch)
+    {
+        unsigned int numberOfTransactions = 0;
+        for (unsigned int transactionIndex = 0; transactionIndex < NUMBER_OF_TRANSACTIONS_PER_TICK; transactionIndex++)
+        {
+            if (!isZero(td.transactionDigests[transactionIndex]))
+            {
+                numberOfTransactions++;
+            }
+        }
+        addRunningTxScore(tick, numberOfTransactions);
+    }
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        setRunningVoteScore(i, voteCounter.getVoteCount(i));
+        setRunningCustomMiningScore(i, gCustomMiningSharesCounter.getSharesCount(i));
+    }
+    ACQUIRE(gProjectedRevenueLock);
+    computeRunningRevenue(gProjectedRevenueComponents);
+    gProjectedRevenueTick = tick;
+    RELEASE(gProjectedRevenueLock);
+}
+
+// Recompute running revenue scores from all ticks of the epoch processed so far, for example after loading a snapshot
+static void rebuildRunningRevenue()
+{
+    resetRunningRevenueScores();
+    for (unsigned int tick = system.initialTick; tick < system.tick; tick++)
+    {
+        ts.tickData.acquireLock();
+        updateRunningRevenue(tick, ts.tickData.getByTickInCurrentEpoch(tick));
+        ts.tickData.releaseLock();
+    }
+}
+
 #pragma optimize("", off)
 static void processTick(unsigned long long processorNumber)
 {
@@ -3082,6 +3293,10 @@ static void processTick(unsigned long long processorNumber)
         PROFILE_SCOPE_END();
     }
 
+    PROFILE_NAMED_SCOPE_BEGIN("processTick(): update running revenue");
+    updateRunningRevenue(system.tick, nextTickData);
+    PROFILE_SCOPE_END();
+
     PROFILE_NAMED_SCOPE_BEGIN("processTick(): END_TICK");
     logger.registerNewTx(system.tick, logger.SC_END_TICK_TX);
     contractProcessorPhase = END_TICK;
@@ -3092,6 +3307,7 @@ static void processTick(unsigned long long processorNumber)
     PROFILE_NAMED_SCOPE_BEGIN("processTick(): get spectrum digest");
     unsigned int digestIndex;
     ACQUIRE(spectrumLock);
+    beginSpectrumWrite();
     for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
     {
         if (spectrum[digestIndex].latestIncomingTransferTick == system.tick || spectrum[digestIndex].latestOutgoingTransferTick == system.tick)
@@ -3120,6 +3336,7 @@ static void processTick(unsigned long long processorNumber)
     spectrumChangeFlags[0] = 0;
 
     etalonTick.saltedSpectrumDigest = spectrumDigests[(SPECTRUM_CAPACITY * 2 - 1) - 1];
+    endSpectrumWrite();
     RELEASE(spectrumLock);
     PROFILE_SCOPE_END();
 
@@ -3134,28 +3351,19 @@ static void processTick(unsigned long long processorNumber)
         if (getTickInMiningPhaseCycle() == 0)
         {
             PROFILE_NAMED_SCOPE("processTick(): prepare custom mining shares tx");            
-            long long customMiningCountOverflow = 0;
-            for (unsigned int i = 0; i < numberOfOwnComputorIndices; i++)
-            {
-                // Update the custom mining share counter
-                ACQUIRE(gCustomMiningSharesCountLock);
-                for (int k = 0; k < NUMBER_OF_COMPUTORS; k++)
-                {
-                    if (gCustomMiningSharesCount[k] > CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL)
-                    {
-                        // Save the max of overflow case
-                        if (gCustomMiningSharesCount[k] > customMiningCountOverflow)
-                        {
-                            customMiningCountOverflow = gCustomMiningSharesCount[k];
-                        }
 
-                        // Threshold the value
-                        gCustomMiningSharesCount[k] = CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL;
-                    }
-                }
-                gCustomMiningSharesCounter.registerNewShareCount(gCustomMiningSharesCount);
-                RELEASE(gCustomMiningSharesCountLock);
+            // Take the thresholded share counts of the phase and reset the phase counter
+            unsigned int sharesCount[NUMBER_OF_COMPUTORS];
+            long long customMiningCountOverflow = gCustomMiningSharesCount.snapshotAndReset(sharesCount, CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL);
+
+            // Update the custom mining share counter
+            if (numberOfOwnComputorIndices > 0)
+            {
+                gCustomMiningSharesCounter.registerNewShareCount(sharesCount);
+            }
 
+            for (unsigned int i = 0; i < numberOfOwnComputorIndices; i++)
+            {
                 // Save the transaction to be broadcasted
                 auto& payload = gCustomMiningBroadcastTxBuffer[i].payload;
                 payload.transaction.sourcePublicKey = computorPublicKeys[ownComputorIndicesMapping[i]];
@@ -3171,11 +3379,6 @@ static void processTick(unsigned long long processorNumber)
 
             // Keep the max of overflow case
             ATOMIC_MAX64(gCustomMiningStats.maxOverflowShareCount, customMiningCountOverflow);
-
-            // reset the phase counter
-            ACQUIRE(gCustomMiningSharesCountLock);
-            setMem(gCustomMiningSharesCount, sizeof(gCustomMiningSharesCount), 0);
-            RELEASE(gCustomMiningSharesCountLock);
         }
     }
 
@@ -3213,27 +3416,34 @@ static void processTick(unsigned long long processorNumber)
                     KangarooTwelve(timelockPreimage, sizeof(timelockPreimage), &broadcastedFutureTickData.tickData.timelock, sizeof(broadcastedFutureTickData.tickData.timelock));
 
                     unsigned int j = 0;
+                    const unsigned int scheduledTick = system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET;
 
-                    ACQUIRE(computorPendingTransactionsLock);
-
-                    // Get indices of pending computor transactions that are scheduled to be included in tickData
-                    unsigned int numberOfEntityPendingTransactionIndices = 0;
-                    for (unsigned int k = 0; k < NUMBER_OF_COMPUTORS * MAX_NUMBER_OF_PENDING_TRANSACTIONS_PER_COMPUTOR; k++)
+                    // Pending transactions scheduled for the tick have usually been collected by the request processors
+                    // since the previous tick (see below), help with the rest of the scan
+                    if (!computorPendingTransactionCandidates.isStarted(scheduledTick))
                     {
-                        const Transaction* tx = ((Transaction*)&computorPendingTransactions[k * MAX_TRANSACTION_SIZE]);
-                        if (tx->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET)
-                        {
-                            entityPendingTransactionIndices[numberOfEntityPendingTransactionIndices++] = k;
-                        }
+                        computorPendingTransactionCandidates.start(scheduledTick);
+                    }
+                    if (!entityPendingTransactionCandidates.isStarted(scheduledTick))
+                    {
+                        entityPendingTransactionCandidates.start(scheduledTick);
                     }
+                    while (!computorPendingTransactionCandidates.isComplete() || !entityPendingTransactionCandidates.isComplete())
+                    {
+                        computorPendingTransactionCandidates.tryScanChunk();
+                        entityPendingTransactionCandidates.tryScanChunk();
+                    }
+
+                    ACQUIRE(computorPendingTransactionsLock);
 
                     // Randomly select computor tx scheduled for the tick until tick is full or all pending tx are included
-                    while (j < NUMBER_OF_TRANSACTIONS_PER_TICK && numberOfEntityPendingTransactionIndices)
+                    while (j < NUMBER_OF_TRANSACTIONS_PER_TICK && computorPendingTransactionCandidates.getNumberOfCandidates())
                     {
-                        const unsigned int index = random(numberOfEntityPendingTransactionIndices);
+                        const unsigned int index = random(computorPendingTransactionCandidates.getNumberOfCandidates());
+                        const unsigned int slot = computorPendingTransactionCandidates.getCandidate(index);
 
-                        const Transaction* pendingTransaction = ((Transaction*)&computorPendingTransactions[entityPendingTransactionIndices[index] * MAX_TRANSACTION_SIZE]);
-                        ASSERT(pendingTransaction->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET);
+                        const Transaction* pendingTransaction = ((Transaction*)&computorPendingTransactions[slot * MAX_TRANSACTION_SIZE]);
+                        if (pendingTransaction->tick == scheduledTick) // may have been replaced by tx for later tick after collecting
                         {
                             ASSERT(pendingTransaction->checkValidity());
                             const unsigned int transactionSize = pendingTransaction->totalSize();
@@ -3244,7 +3454,7 @@ static void processTick(unsigned long long processorNumber)
                                 {
                                     ts.tickTransactionOffsets(pendingTransaction->tick, j) = ts.nextTickTransactionOffset;
                                     copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), (void*)pendingTransaction, transactionSize);
-                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &computorPendingTransactionDigests[entityPendingTransactionIndices[index] * 32ULL];
+                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &computorPendingTransactionDigests[slot * 32ULL];
                                     j++;
                                     ts.nextTickTransactionOffset += transactionSize;
                                 }
@@ -3252,31 +3462,22 @@ static void processTick(unsigned long long processorNumber)
                             }
                         }
 
-                        entityPendingTransactionIndices[index] = entityPendingTransactionIndices[--numberOfEntityPendingTransactionIndices];
+                        computorPendingTransactionCandidates.removeCandidate(index);
                     }
+                    computorPendingTransactionCandidates.stop();
 
                     RELEASE(computorPendingTransactionsLock);
 
                     ACQUIRE(entityPendingTransactionsLock);
 
-                    // Get indices of pending non-computor transactions that are scheduled to be included in tickData
-                    numberOfEntityPendingTransactionIndices = 0;
-                    for (unsigned int k = 0; k < SPECTRUM_CAPACITY; k++)
-                    {
-                        const Transaction* tx = ((Transaction*)&entityPendingTransactions[k * MAX_TRANSACTION_SIZE]);
-                        if (tx->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET)
-                        {
-                            entityPendingTransactionIndices[numberOfEntityPendingTransactionIndices++] = k;
-                        }
-                    }
-
                     // Randomly select non-computor tx scheduled for the tick until tick is full or all pending tx are included
-                    while (j < NUMBER_OF_TRANSACTIONS_PER_TICK && numberOfEntityPendingTransactionIndices)
+                    while (j < NUMBER_OF_TRANSACTIONS_PER_TICK && entityPendingTransactionCandidates.getNumberOfCandidates())
                     {
-                        const unsigned int index = random(numberOfEntityPendingTransactionIndices);
+                        const unsigned int index = random(entityPendingTransactionCandidates.getNumberOfCandidates());
+                        const unsigned int slot = entityPendingTransactionCandidates.getCandidate(index);
 
-                        const Transaction* pendingTransaction = ((Transaction*)&entityPendingTransactions[entityPendingTransactionIndices[index] * MAX_TRANSACTION_SIZE]);
-                        ASSERT(pendingTransaction->tick == system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET);
+                        const Transaction* pendingTransaction = ((Transaction*)&entityPendingTransactions[slot * MAX_TRANSACTION_SIZE]);
+                        if (pendingTransaction->tick == scheduledTick) // may have been replaced by tx for later tick after collecting
                         {
                             ASSERT(pendingTransaction->checkValidity());
                             const unsigned int transactionSize = pendingTransaction->totalSize();
@@ -3287,7 +3488,7 @@ static void processTick(unsigned long long processorNumber)
                                 {
                                     ts.tickTransactionOffsets(pendingTransaction->tick, j) = ts.nextTickTransactionOffset;
                                     copyMem(ts.tickTransactions(ts.nextTickTransactionOffset), (void*)pendingTransaction, transactionSize);
-                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &entityPendingTransactionDigests[entityPendingTransactionIndices[index] * 32ULL];
+                                    broadcastedFutureTickData.tickData.transactionDigests[j] = &entityPendingTransactionDigests[slot * 32ULL];
                                     j++;
                                     ts.nextTickTransactionOffset += transactionSize;
                                 }
@@ -3295,8 +3496,9 @@ static void processTick(unsigned long long processorNumber)
                             }
                         }
 
-                        entityPendingTransactionIndices[index] = entityPendingTransactionIndices[--numberOfEntityPendingTransactionIndices];
+                        entityPendingTransactionCandidates.removeCandidate(index);
                     }
+                    entityPendingTransactionCandidates.stop();
 
                     RELEASE(entityPendingTransactionsLock);
 
@@ -3334,6 +3536,22 @@ static void processTick(unsigned long long processorNumber)
         }
     }
 
+    // If node is MAIN and has ID of tickleader for the tick after, start collecting the pending transactions for its
+    // tickData, so they are ready in the next tick (scanning the pending transaction pools is done by the request
+    // processors in the meantime)
+    if (isMainMode())
+    {
+        for (unsigned int i = 0; i < numberOfOwnComputorIndices; i++)
+        {
+            if ((system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET + 1) % NUMBER_OF_COMPUTORS == ownComputorIndices[i])
+            {
+                computorPendingTransactionCandidates.start(system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET + 1);
+                entityPendingTransactionCandidates.start(system.tick + TICK_TRANSACTIONS_PUBLICATION_OFFSET + 1);
+                break;
+            }
+        }
+    }
+
     if (isMainMode())
     {
         // Publish solutions that were sent via BroadcastMessage as MiningSolutionTransaction
@@ -3438,6 +3656,9 @@ static void processTick(unsigned long long processorNumber)
     if ((system.tick & 7) == 0)
         updateAndAnalzeEntityCategoryPopulations();
     logger.updateTick(system.tick);
+
+    // Contract states, spectrum, and universe have changed -> outputs of contract functions may be outdated
+    contractFunctionResultCache.invalidate();
 }
 
 #pragma optimize("", on)
@@ -3445,7 +3666,7 @@ static void processTick(unsigned long long processorNumber)
 static void resetCustomMining()
 {
     gCustomMiningSharesCounter.init();
-    setMem(gCustomMiningSharesCount, sizeof(gCustomMiningSharesCount), 0);
+    gCustomMiningSharesCount.reset();
 
     for (int i = 0; i < NUMBER_OF_TASK_PARTITIONS; i++)
     {
@@ -3475,12 +3696,14 @@ static void beginEpoch()
         broadcastedComputors.computors.publicKeys[i].setRandomValue();
     }
     setMem(&broadcastedComputors.computors.signature, sizeof(broadcastedComputors.computors.signature), 0);
+    updateComputorPublicKeyIndex();
 
 #ifndef NDEBUG
     ts.checkStateConsistencyWithAssert();
 #endif
     ts.beginEpoch(system.initialTick);
     voteCounter.init();
+    resetRunningRevenueScores();
 #ifndef NDEBUG
     ts.checkStateConsistencyWithAssert();
 #endif
@@ -3508,6 +3731,11 @@ static void beginEpoch()
     UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 3] = (system.epoch % 100) / 10 + L'0';
     UNIVERSE_FILE_NAME[sizeof(UNIVERSE_FILE_NAME) / sizeof(UNIVERSE_FILE_NAME[0]) - 2] = system.epoch % 10 + L'0';
 
+    addEpochToFileName(SPECTRUM_DIGESTS_FILE_NAME, sizeof(SPECTRUM_DIGESTS_FILE_NAME) / sizeof(SPECTRUM_DIGESTS_FILE_NAME[0]), system.epoch);
+    addEpochToFileName(SPECTRUM_DIGESTS_HEADER_FILE_NAME, sizeof(SPECTRUM_DIGESTS_HEADER_FILE_NAME) / sizeof(SPECTRUM_DIGESTS_HEADER_FILE_NAME[0]), system.epoch);
+    addEpochToFileName(UNIVERSE_DIGESTS_FILE_NAME, sizeof(UNIVERSE_DIGESTS_FILE_NAME) / sizeof(UNIVERSE_DIGESTS_FILE_NAME[0]), system.epoch);
+    addEpochToFileName(UNIVERSE_DIGESTS_HEADER_FILE_NAME, sizeof(UNIVERSE_DIGESTS_HEADER_FILE_NAME) / sizeof(UNIVERSE_DIGESTS_HEADER_FILE_NAME[0]), system.epoch);
+
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 4] = system.epoch / 100 + L'0';
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 3] = (system.epoch % 100) / 10 + L'0';
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 2] = system.epoch % 10 + L'0';
@@ -3545,6 +3773,8 @@ static void beginEpoch()
 #endif
 
     logger.reset(system.initialTick);
+
+    contractFunctionResultCache.invalidate();
 }
 
 
@@ -3674,14 +3904,18 @@ static void endEpoch()
     // Reorganize spectrum hash map (also updates spectrumInfo)
     {
         ACQUIRE(spectrumLock);
+        beginSpectrumWrite();
 
         reorganizeSpectrum();
 
+        endSpectrumWrite();
         RELEASE(spectrumLock);
     }
 
     assetsEndEpoch();
 
+    contractFunctionResultCache.invalidate();
+
     logger.updateTick(system.tick);
 #if PAUSE_BEFORE_CLEAR_MEMORY
     // re-open request processors for other services to query
@@ -3866,9 +4100,23 @@ static bool saveAllNodeStates()
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 4] = L'0';
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 3] = L'0';
     CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 2] = L'0';
+#if CONTRACT_STATE_CHECKPOINTS
+    // The tick processor is waiting, so the checkpoint can be brought up to date. Files of unchanged contracts in the
+    // snapshot directory of the current epoch can be kept, but the directory of a new epoch doesn't have them yet.
+    static unsigned short lastContractSnapshotEpoch = 0;
+    contractStateCheckpoint.update(contractStateChangeFlags);
+    if (lastContractSnapshotEpoch != system.epoch)
+    {
+        for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+        {
+            contractStateCheckpoint.markAllPagesUnsaved(contractIndex);
+        }
+        lastContractSnapshotEpoch = system.epoch;
+    }
+#endif
     setText(message, L"Saving computer files");
     logToConsole(message);
-    if (!saveComputer(directory))
+    if (!saveComputer(directory, CONTRACT_STATE_CHECKPOINTS))
     {
         logToConsole(L"Failed to save computer");
         return false;
@@ -3911,6 +4159,7 @@ static bool saveAllNodeStates()
         return false;
     }
     
+    // Merkle trees are saved as they are, hashing them (and the leafs) for a header would stall the main loop
     CHAR16 SPECTRUM_DIGEST_FILE_NAME[] = L"snapshotSpectrumDigest";
     savedSize = save(SPECTRUM_DIGEST_FILE_NAME, spectrumDigestsSizeInByte, (unsigned char*)spectrumDigests, directory);
     logToConsole(L"Saving spectrum digests");
@@ -4034,6 +4283,7 @@ static bool loadAllNodeStates()
     copyMem((void*)solutionPublicationTicks, nodeStateBuffer.solutionPublicationTicks, sizeof(solutionPublicationTicks));
     copyMem((void*)faultyComputorFlags, nodeStateBuffer.faultyComputorFlags, sizeof(faultyComputorFlags));
     copyMem((void*)&broadcastedComputors, &nodeStateBuffer.broadcastedComputors, sizeof(broadcastedComputors));
+    updateComputorPublicKeyIndex();
     copyMem(&resourceTestingDigest, &nodeStateBuffer.resourceTestingDigest, sizeof(resourceTestingDigest));
     numberOfMiners = nodeStateBuffer.numberOfMiners;
     initialRandomSeedFromPersistingState = nodeStateBuffer.currentRandomSeed;
@@ -4065,16 +4315,18 @@ static bool loadAllNodeStates()
         return false;
     }
     updateNumberOfTickTransactions();
+    rebuildRunningRevenue();
 
     setMem(assetChangeFlags, sizeof(assetChangeFlags), 0);
     setMem(spectrumChangeFlags, sizeof(spectrumChangeFlags), 0);
+    // Merkle trees are saved with the snapshot they belong to; if they cannot be loaded, they are recomputed
     CHAR16 SPECTRUM_DIGEST_FILE_NAME[] = L"snapshotSpectrumDigest";
     loadedSize = load(SPECTRUM_DIGEST_FILE_NAME, spectrumDigestsSizeInByte, (unsigned char*)spectrumDigests, directory);
     logToConsole(L"Loading spectrum digests");
     if (loadedSize != spectrumDigestsSizeInByte)
     {
-        logToConsole(L"Failed to load spectrum digest");
-        return false;
+        logToConsole(L"Failed to load spectrum digests, recomputing them");
+        computeMerkleTree(spectrum, sizeof(::Entity), SPECTRUM_DEPTH, spectrumDigests, parallelFor);
     }
 
     CHAR16 UNIVERSE_DIGEST_FILE_NAME[] = L"snapshotUniverseDigest";
@@ -4082,8 +4334,8 @@ static bool loadAllNodeStates()
     logToConsole(L"Loading universe digests");
     if (loadedSize != assetDigestsSizeInBytes)
     {
-        logToConsole(L"Failed to load universe digest");
-        return false;
+        logToConsole(L"Failed to load universe digests, recomputing them");
+        computeMerkleTree(assets, sizeof(AssetRecord), ASSETS_DEPTH, assetDigests, parallelFor);
     }
 
     CHAR16 COMPUTER_DIGEST_FILE_NAME[] = L"snapshotComputerDigest";
@@ -4149,18 +4401,13 @@ static void findNextTickDataDigestFromNextTickVotes()
     const Tick* tsCompTicks = ts.ticks.getByTickIndex(nextTickIndex);
     unsigned int numberOfEmptyNextTickTransactionDigest = 0;
     unsigned int numberOfUniqueNextTickTransactionDigests = 0;
+    uniqueNextTickTransactionDigestSet.reset();
     for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
     {
         if (tsCompTicks[i].epoch == system.epoch)
         {
-            unsigned int j;
-            for (j = 0; j < numberOfUniqueNextTickTransactionDigests; j++)
-            {
-                if (tsCompTicks[i].transactionDigest == uniqueNextTickTransactionDigests[j])
-                {
-                    break;
-                }
-            }
+            // Hash set lookup for index of digest in uniqueNextTickTransactionDigests (O(1) instead of O(n))
+            const unsigned int j = uniqueNextTickTransactionDigestSet.findOrInsert(uniqueNextTickTransactionDigests, tsCompTicks[i].transactionDigest, numberOfUniqueNextTickTransactionDigests);
             if (j == numberOfUniqueNextTickTransactionDigests)
             {
                 uniqueNextTickTransactionDigests[numberOfUniqueNextTickTransactionDigests] = tsCompTicks[i].transactionDigest;
@@ -4211,18 +4458,13 @@ static void findNextTickDataDigestFromCurrentTickVotes()
     const Tick* tsCompTicks = ts.ticks.getByTickIndex(currentTickIndex);
     unsigned int numberOfEmptyNextTickTransactionDigest = 0;
     unsigned int numberOfUniqueNextTickTransactionDigests = 0;
+    uniqueNextTickTransactionDigestSet.reset();
     for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
     {
         if (tsCompTicks[i].epoch == system.epoch)
         {
-            unsigned int j;
-            for (j = 0; j < numberOfUniqueNextTickTransactionDigests; j++)
-            {
-                if (tsCompTicks[i].expectedNextTickTransactionDigest == uniqueNextTickTransactionDigests[j])
-                {
-                    break;
-                }
-            }
+            // Hash set lookup for index of digest in uniqueNextTickTransactionDigests (O(1) instead of O(n))
+            const unsigned int j = uniqueNextTickTransactionDigestSet.findOrInsert(uniqueNextTickTransactionDigests, tsCompTicks[i].expectedNextTickTransactionDigest, numberOfUniqueNextTickTransactionDigests);
             if (j == numberOfUniqueNextTickTransactionDigests)
             {
                 uniqueNextTickTransactionDigests[numberOfUniqueNextTickTransactionDigests] = tsCompTicks[i].expectedNextTickTransactionDigest;
@@ -4550,23 +4792,13 @@ static void broadcastTickVotes()
     {
         broadcastTick.tick.computorIndex = ownComputorIndices[i] ^ BroadcastTick::type;
         broadcastTick.tick.epoch = system.epoch;
-        m256i saltedData[2];
-        saltedData[0] = computorPublicKeys[ownComputorIndicesMapping[i]];
-        saltedData[1].m256i_u32[0] = resourceTestingDigest;
-        KangarooTwelve(saltedData, 32 + sizeof(resourceTestingDigest), &broadcastTick.tick.saltedResourceTestingDigest, sizeof(broadcastTick.tick.saltedResourceTestingDigest));
-
-        saltedData[1] = etalonTick.saltedSpectrumDigest;
-        KangarooTwelve64To32(saltedData, &broadcastTick.tick.saltedSpectrumDigest);
-
-        saltedData[1] = etalonTick.saltedUniverseDigest;
-        KangarooTwelve64To32(saltedData, &broadcastTick.tick.saltedUniverseDigest);
-
-        saltedData[1] = etalonTick.saltedComputerDigest;
-        KangarooTwelve64To32(saltedData, &broadcastTick.tick.saltedComputerDigest);
-
-        saltedData[1] = m256i::zero();
-        saltedData[1].m256i_u32[0] = etalonTick.saltedTransactionBodyDigest;
-        KangarooTwelve(saltedData, 32 + sizeof(etalonTick.saltedTransactionBodyDigest), &broadcastTick.tick.saltedTransactionBodyDigest, sizeof(broadcastTick.tick.saltedTransactionBodyDigest));
+        SaltedVoteDigests salted;
+        computeSaltedVoteDigests(computorPublicKeys[ownComputorIndicesMapping[i]], resourceTestingDigest, etalonTick, salted);
+        broadcastTick.tick.saltedResourceTestingDigest = salted.saltedResourceTestingDigest;
+        broadcastTick.tick.saltedSpectrumDigest = salted.saltedSpectrumDigest;
+        broadcastTick.tick.saltedUniverseDigest = salted.saltedUniverseDigest;
+        broadcastTick.tick.saltedComputerDigest = salted.saltedComputerDigest;
+        broadcastTick.tick.saltedTransactionBodyDigest = salted.saltedTransactionBodyDigest;
 
         unsigned char digest[32];
         KangarooTwelve(&broadcastTick.tick, sizeof(Tick) - SIGNATURE_SIZE, digest, sizeof(digest));
@@ -4605,24 +4837,15 @@ static void updateVotesCount(unsigned int& tickNumberOfComputors, unsigned int&
                 && tick->prevComputerDigest == etalonTick.prevComputerDigest
                 && tick->transactionDigest == etalonTick.transactionDigest)
             {
-                m256i saltedData[2];
-                m256i saltedDigest;
-                saltedData[0] = broadcastedComputors.computors.publicKeys[tick->computorIndex];
-                saltedData[1].m256i_u32[0] = resourceTestingDigest;
-                KangarooTwelve(saltedData, 32 + sizeof(resourceTestingDigest), &saltedDigest, sizeof(resourceTestingDigest));
-                if (tick->saltedResourceTestingDigest == saltedDigest.m256i_u32[0])
+                // Salted digests are only recomputed if the salts of this node or the computor list have changed
+                const SaltedVoteDigests& salted = saltedVoteDigestCache.get(tick->computorIndex, broadcastedComputors.computors.publicKeys[tick->computorIndex], resourceTestingDigest, etalonTick);
+                if (tick->saltedResourceTestingDigest == salted.saltedResourceTestingDigest)
                 {
-                    saltedData[1] = etalonTick.saltedSpectrumDigest;
-                    KangarooTwelve64To32(saltedData, &saltedDigest);
-                    if (tick->saltedSpectrumDigest == saltedDigest)
+                    if (tick->saltedSpectrumDigest == salted.saltedSpectrumDigest)
                     {
-                        saltedData[1] = etalonTick.saltedUniverseDigest;
-                        KangarooTwelve64To32(saltedData, &saltedDigest);
-                        if (tick->saltedUniverseDigest == saltedDigest)
+                        if (tick->saltedUniverseDigest == salted.saltedUniverseDigest)
                         {
-                            saltedData[1] = etalonTick.saltedComputerDigest;
-                            KangarooTwelve64To32(saltedData, &saltedDigest);
-                            if (tick->saltedComputerDigest == saltedDigest)
+                            if (tick->saltedComputerDigest == salted.saltedComputerDigest)
                             {
                                 // expectedNextTickTransactionDigest and txBodyDigest is ignored to find consensus of current tick
                                 tickNumberOfComputors++;
@@ -4630,10 +4853,7 @@ static void updateVotesCount(unsigned int& tickNumberOfComputors, unsigned int&
                                 // Vote of a node is only counting if txBodyDigest is matching with the version of the node
                                 if (!isZero(etalonTick.expectedNextTickTransactionDigest))
                                 {
-                                    saltedData[1] = m256i::zero();
-                                    saltedData[1].m256i_u32[0] = etalonTick.saltedTransactionBodyDigest;
-                                    KangarooTwelve(saltedData, 32 + sizeof(etalonTick.saltedTransactionBodyDigest), &saltedDigest, sizeof(etalonTick.saltedTransactionBodyDigest));
-                                    if(tick->saltedTransactionBodyDigest == saltedDigest.m256i_u32[0])
+                                    if(tick->saltedTransactionBodyDigest == salted.saltedTransactionBodyDigest)
                                     {
                                         // to avoid submitting invalid votes (eg: all zeroes with valid signature)
                                         // only count votes that matched etalonTick
@@ -5111,6 +5331,9 @@ static void tickProcessor(void*)
 
                                 updateNumberOfTickTransactions();
 
+                                // Tick and time have changed -> outputs of contract functions may be outdated
+                                contractFunctionResultCache.invalidate();
+
                                 short tickEpoch = 0;
                                 TimeDate currentTickDate;
                                 ts.tickData.acquireLock();
@@ -5278,7 +5501,7 @@ static bool loadComputer(CHAR16* directory, bool forceLoadFromFile)
     return true;
 }
 
-static bool saveComputer(CHAR16* directory)
+static bool saveComputer(CHAR16* directory, bool skipUnchangedContracts)
 {
     logToConsole(L"Saving contract files...");
 
@@ -5286,14 +5509,43 @@ static bool saveComputer(CHAR16* directory)
 
     bool ok = true;
     unsigned long long totalSize = 0;
+    unsigned int skippedContracts = 0;
+    unsigned int partiallySavedContracts = 0;
 
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
+#if CONTRACT_STATE_CHECKPOINTS
+        // State equals the checkpoint, which has no pages changed since the file was saved last time
+        if (skipUnchangedContracts && contractStateCheckpoint.isInitialized() && contractDescriptions[contractIndex].stateSize
+            && !contractStateCheckpoint.getNumberOfUnsavedPages(contractIndex))
+        {
+            skippedContracts++;
+            continue;
+        }
+#endif
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 9] = contractIndex / 1000 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 8] = (contractIndex % 1000) / 100 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 7] = (contractIndex % 100) / 10 + L'0';
         CONTRACT_FILE_NAME[sizeof(CONTRACT_FILE_NAME) / sizeof(CONTRACT_FILE_NAME[0]) - 6] = contractIndex % 10 + L'0';
         contractStateLock[contractIndex].acquireRead();
+#if CONTRACT_STATE_CHECKPOINTS
+        // State equals the checkpoint, so only the pages changed since the file was saved last time need to be written.
+        // If the file is missing or has another size, it is saved completely.
+        if (skipUnchangedContracts && contractStateCheckpoint.isInitialized() && contractDescriptions[contractIndex].stateSize
+            && contractStateCheckpoint.getNumberOfUnsavedPages(contractIndex) < contractStateCheckpoint.getNumberOfPages(contractDescriptions[contractIndex].stateSize))
+        {
+            long long writtenSize = savePages(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex],
+                contractStateCheckpoint.pageSize, contractStateCheckpoint.getUnsavedPageFlags(contractIndex), directory);
+            if (writtenSize >= 0)
+            {
+                contractStateLock[contractIndex].releaseRead();
+                totalSize += writtenSize;
+                partiallySavedContracts++;
+                contractStateCheckpoint.markSaved(contractIndex);
+                continue;
+            }
+        }
+#endif
         long long savedSize = save(CONTRACT_FILE_NAME, contractDescriptions[contractIndex].stateSize, contractStates[contractIndex], directory);
         contractStateLock[contractIndex].releaseRead();
         totalSize += savedSize;
@@ -5303,6 +5555,12 @@ static bool saveComputer(CHAR16* directory)
 
             break;
         }
+#if CONTRACT_STATE_CHECKPOINTS
+        if (skipUnchangedContracts)
+        {
+            contractStateCheckpoint.markSaved(contractIndex);
+        }
+#endif
     }
 
     if (ok)
@@ -5311,6 +5569,18 @@ static bool saveComputer(CHAR16* directory)
         appendText(message, L" bytes of the computer data are saved (");
         appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
         appendText(message, L" microseconds).");
+        if (skippedContracts)
+        {
+            appendText(message, L" Files of ");
+            appendNumber(message, skippedContracts, TRUE);
+            appendText(message, L" unchanged contracts are kept.");
+        }
+        if (partiallySavedContracts)
+        {
+            appendText(message, L" Only changed pages of ");
+            appendNumber(message, partiallySavedContracts, TRUE);
+            appendText(message, L" contracts are written.");
+        }
         logToConsole(message);
         return true;
     }
@@ -5338,8 +5608,10 @@ static bool saveSystem(CHAR16* directory)
 
 static bool saveRevenueComponents(CHAR16* directory)
 {
+    static_assert(sizeof(gRevenueComponents) <= ASYNC_FILE_IO_WRITE_QUEUE_BUFFER_SIZE / ASYNC_FILE_IO_MAX_QUEUE_ITEMS,
+        "Revenue components don't fit in a slot of the non-blocking save buffer");
     CHAR16* fn = CUSTOM_MINING_REVENUE_END_OF_EPOCH_FILE_NAME;
-    long long savedSize = asyncSave(fn, sizeof(gRevenueComponents), (unsigned char*)&gRevenueComponents, directory);
+    long long savedSize = asyncSave(fn, sizeof(gRevenueComponents), (unsigned char*)&gRevenueComponents, directory, false);
     if (savedSize == sizeof(gRevenueComponents))
     {
         return true;
@@ -5405,6 +5677,12 @@ static bool initialize()
         {
             return false;
         }
+
+        if (!entityPendingTransactionCandidates.init(entityPendingTransactions, &entityPendingTransactionsLock) ||
+            !computorPendingTransactionCandidates.init(computorPendingTransactions, &computorPendingTransactionsLock))
+        {
+            return false;
+        }
         
 
         setMem(spectrumChangeFlags, sizeof(spectrumChangeFlags), 0);
@@ -5506,26 +5784,22 @@ static bool initialize()
             {
                 const unsigned long long beginningTick = __rdtsc();
 
-                unsigned int digestIndex;
-                for (digestIndex = 0; digestIndex < SPECTRUM_CAPACITY; digestIndex++)
+                // use Merkle tree saved at previous start if it matches the spectrum, otherwise compute and save it
+                if (loadMerkleTree(SPECTRUM_DIGESTS_FILE_NAME, SPECTRUM_DIGESTS_HEADER_FILE_NAME, spectrum, sizeof(::Entity), SPECTRUM_DEPTH, spectrumDigests, NULL, parallelFor))
                 {
-                    KangarooTwelve64To32(&spectrum[digestIndex], &spectrumDigests[digestIndex]);
+                    setNumber(message, spectrumDigestsSizeInByte, TRUE);
+                    appendText(message, L" bytes of the spectrum digests are loaded and verified (");
                 }
-                unsigned int previousLevelBeginning = 0;
-                unsigned int numberOfLeafs = SPECTRUM_CAPACITY;
-                while (numberOfLeafs > 1)
+                else
                 {
-                    for (unsigned int i = 0; i < numberOfLeafs; i += 2)
+                    computeMerkleTree(spectrum, sizeof(::Entity), SPECTRUM_DEPTH, spectrumDigests, parallelFor);
+                    if (!saveMerkleTree(SPECTRUM_DIGESTS_FILE_NAME, SPECTRUM_DIGESTS_HEADER_FILE_NAME, spectrum, sizeof(::Entity), SPECTRUM_DEPTH, spectrumDigests, NULL, parallelFor))
                     {
-                        KangarooTwelve64To32(&spectrumDigests[previousLevelBeginning + i], &spectrumDigests[digestIndex++]);
+                        logToConsole(L"Failed to save spectrum digests");
                     }
-
-                    previousLevelBeginning += numberOfLeafs;
-                    numberOfLeafs >>= 1;
+                    setNumber(message, SPECTRUM_CAPACITY * sizeof(::Entity), TRUE);
+                    appendText(message, L" bytes of the spectrum data are hashed (");
                 }
-
-                setNumber(message, SPECTRUM_CAPACITY * sizeof(::Entity), TRUE);
-                appendText(message, L" bytes of the spectrum data are hashed (");
                 appendNumber(message, (__rdtsc() - beginningTick) * 1000000 / frequency, TRUE);
                 appendText(message, L" microseconds).");
                 logToConsole(message);
@@ -5545,6 +5819,16 @@ static bool initialize()
             logToConsole(L"Loading universe file ...");
             if (!loadUniverse())
                 return false;
+            if (!loadMerkleTree(UNIVERSE_DIGESTS_FILE_NAME, UNIVERSE_DIGESTS_HEADER_FILE_NAME, assets, sizeof(AssetRecord), ASSETS_DEPTH, assetDigests, NULL, parallelFor))
+            {
+                computeMerkleTree(assets, sizeof(AssetRecord), ASSETS_DEPTH, assetDigests, parallelFor);
+                if (!saveMerkleTree(UNIVERSE_DIGESTS_FILE_NAME, UNIVERSE_DIGESTS_HEADER_FILE_NAME, assets, sizeof(AssetRecord), ASSETS_DEPTH, assetDigests, NULL, parallelFor))
+                {
+                    logToConsole(L"Failed to save universe digests");
+                }
+            }
+            // all asset digests are up to date, so getUniverseDigest() doesn't need to hash anything
+            setMem(assetChangeFlags, ASSETS_CAPACITY / 8, 0);
             m256i universeDigest;
             {
                 setText(message, L"Universe digest = ");
@@ -5582,6 +5866,20 @@ static bool initialize()
 
     initializeContracts();
 
+#if CONTRACT_STATE_CHECKPOINTS
+    {
+        unsigned long long stateSizes[contractCount];
+        for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+        {
+            stateSizes[contractIndex] = contractDescriptions[contractIndex].stateSize;
+        }
+        if (!contractStateCheckpoint.init(contractStates, stateSizes))
+        {
+            return false;
+        }
+    }
+#endif
+
     if (loadMiningSeedFromFile)
     {
         score->initMiningData(initialRandomSeedFromPersistingState);
@@ -5604,23 +5902,47 @@ static bool initialize()
     setMem((void*)dejavu0, 536870912, 0);
     setMem((void*)dejavu1, 536870912, 0);
 
-    if ((!allocPoolWithErrorLog(L"requestQueueBuffer", REQUEST_QUEUE_BUFFER_SIZE, (void**)&requestQueueBuffer, __LINE__)) ||
+    if (!requestQueue.init() ||
         (!allocPoolWithErrorLog(L"respondQueueBuffer", RESPONSE_QUEUE_BUFFER_SIZE, (void**)&responseQueueBuffer, __LINE__)))
     {
         return false;
     }
 
+    if (!transmitMessagePool.init())
+    {
+        return false;
+    }
+
+    peerRequestLimits.cpuMicrosecondsPerSecond[RequestCostClassGossip] = 0;
+    peerRequestLimits.cpuMicrosecondsPerSecond[RequestCostClassTickData] = PEER_REQUEST_CPU_LIMIT_TICK_DATA;
+    peerRequestLimits.cpuMicrosecondsPerSecond[RequestCostClassQuery] = PEER_REQUEST_CPU_LIMIT_QUERY;
+    peerRequestLimits.cpuMicrosecondsPerSecond[RequestCostClassContractFunction] = PEER_REQUEST_CPU_LIMIT_CONTRACT_FUNCTION;
+    peerRequestLimits.responseBytesPerSecond = PEER_RESPONSE_BYTES_LIMIT;
+    peerRequestLimits.burstSeconds = PEER_REQUEST_BURST_SECONDS;
+    peerRequestLimits.frequency = frequency;
+
+    requestAdmissionLimits.maxFillPercent[RequestCostClassGossip] = 100;
+    requestAdmissionLimits.maxFillPercent[RequestCostClassTickData] = REQUEST_QUEUE_MAX_FILL_PERCENT_TICK_DATA;
+    requestAdmissionLimits.maxFillPercent[RequestCostClassQuery] = REQUEST_QUEUE_MAX_FILL_PERCENT_QUERY;
+    requestAdmissionLimits.maxFillPercent[RequestCostClassContractFunction] = REQUEST_QUEUE_MAX_FILL_PERCENT_QUERY;
+    requestAdmissionLimits.maxWaitMilliseconds[RequestCostClassGossip] = 0;
+    requestAdmissionLimits.maxWaitMilliseconds[RequestCostClassTickData] = REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_TICK_DATA;
+    requestAdmissionLimits.maxWaitMilliseconds[RequestCostClassQuery] = REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_QUERY;
+    requestAdmissionLimits.maxWaitMilliseconds[RequestCostClassContractFunction] = REQUEST_QUEUE_MAX_WAIT_MILLISECONDS_QUERY;
+    requestAdmissionLimits.frequency = frequency;
+    requestAdmission.reset(__rdtsc());
+
     for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
     {
         peers[i].receiveData.FragmentCount = 1;
-        peers[i].transmitData.FragmentCount = 1;
 
-        if ((!allocPoolWithErrorLog(L"receiveBuffer", BUFFER_SIZE, &peers[i].receiveBuffer, __LINE__))  ||
-            (!allocPoolWithErrorLog(L"FragmentBuffer", BUFFER_SIZE, &peers[i].transmitData.FragmentTable[0].FragmentBuffer, __LINE__)) ||
-            (!allocPoolWithErrorLog(L"dataToTransmit", BUFFER_SIZE, (void**)&peers[i].dataToTransmit, __LINE__)))
+        void* knownDejavusBuffer;
+        if (!allocPoolWithErrorLog(L"receiveBuffer", BUFFER_SIZE, &peers[i].receiveBuffer, __LINE__)
+            || !allocPoolWithErrorLog(L"knownDejavus", PeerDejavuFilter::bufferSize, &knownDejavusBuffer, __LINE__))
         {
             return false;
         }
+        peers[i].knownDejavus.setBuffer(knownDejavusBuffer);
 
         if ((status = createEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, emptyCallback, NULL, &peers[i].connectAcceptToken.CompletionToken.Event))
             || (status = createEvent(EVT_NOTIFY_SIGNAL, TPL_CALLBACK, emptyCallback, NULL, &peers[i].receiveToken.CompletionToken.Event))
@@ -5652,12 +5974,7 @@ static bool initialize()
     for (unsigned int i = 0; i < sizeof(knownPublicPeers) / sizeof(knownPublicPeers[0]) && numberOfPublicPeers < MAX_NUMBER_OF_PUBLIC_PEERS; i++)
     {
         const IPv4Address& peer_ip = *reinterpret_cast<const IPv4Address*>(knownPublicPeers[i]);
-        addPublicPeer(peer_ip);
-        if (numberOfPublicPeers > 0)
-        {
-            publicPeers[numberOfPublicPeers - 1].isHandshaked = true;
-            publicPeers[numberOfPublicPeers - 1].isFullnode = true;
-        }
+        addPublicPeer(peer_ip, true);
     }
     if (numberOfPublicPeers < 4)
     {
@@ -5720,6 +6037,9 @@ static void deinitialize()
     deinitTxStatusRequestAddOn();
 #endif
 
+#if CONTRACT_STATE_CHECKPOINTS
+    contractStateCheckpoint.deinit();
+#endif
     deinitContractExec();
     for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
     {
@@ -5729,6 +6049,8 @@ static void deinitialize()
         }
     }
 
+    computorPendingTransactionCandidates.deinit();
+    entityPendingTransactionCandidates.deinit();
     if (computorPendingTransactionDigests)
     {
         freePool(computorPendingTransactionDigests);
@@ -5765,46 +6087,151 @@ static void deinitialize()
         freePool((void*)dejavu1);
     }
 
-    if (requestQueueBuffer)
-    {
-        freePool(requestQueueBuffer);
-    }
+    requestQueue.deinit();
     if (responseQueueBuffer)
     {
         freePool(responseQueueBuffer);
     }
 
-    for (unsigned int processorIndex = 0; processorIndex < MAX_NUMBER_OF_PROCESSORS; processorIndex++)
+    for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
     {
-        if (processors[processorIndex].buffer)
+        if (peers[i].knownDejavus.getBuffer())
         {
-            freePool(processors[processorIndex].buffer);
+            freePool(peers[i].knownDejavus.getBuffer());
+            peers[i].knownDejavus.setBuffer(nullptr);
         }
-    }
-
-    for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
-    {
         if (peers[i].receiveBuffer)
         {
             freePool(peers[i].receiveBuffer);
-        }
-        if (peers[i].transmitData.FragmentTable[0].FragmentBuffer)
-        {
-            freePool(peers[i].transmitData.FragmentTable[0].FragmentBuffer);
-        }
-        if (peers[i].dataToTransmit)
-        {
-            freePool(peers[i].dataToTransmit);
 
             closeEvent(peers[i].connectAcceptToken.CompletionToken.Event);
             closeEvent(peers[i].receiveToken.CompletionToken.Event);
             closeEvent(peers[i].transmitToken.CompletionToken.Event);
         }
     }
+    transmitMessagePool.deinit();
 
     customMiningDeinitialize();
 }
 
+// Log the contract entry points with the highest total execution time
+static void logContractEntryPointsWithHighestExecutionTime()
+{
+    constexpr unsigned int numberOfTopEntryPoints = 3;
+    static ContractEntryPointStatistics entryPointStats[ContractEntryPointStatsTableType::capacityPerContract];
+    ContractEntryPointStatistics topEntryPoints[numberOfTopEntryPoints];
+    unsigned int topContractIndices[numberOfTopEntryPoints];
+    setMem(topEntryPoints, sizeof(topEntryPoints), 0);
+    setMem(topContractIndices, sizeof(topContractIndices), 0);
+    for (unsigned int contractIndex = 0; contractIndex < contractCount; contractIndex++)
+    {
+        const unsigned int numberOfEntryPoints = contractEntryPointStats.getStatistics(contractIndex, entryPointStats);
+        for (unsigned int i = 0; i < numberOfEntryPoints; i++)
+        {
+            // insert into sorted top list if total execution time is higher than the lowest in the list
+            unsigned int j = numberOfTopEntryPoints;
+            while (j > 0 && entryPointStats[i].totalExecutionTicks > topEntryPoints[j - 1].totalExecutionTicks)
+            {
+                if (j < numberOfTopEntryPoints)
+                {
+                    topEntryPoints[j] = topEntryPoints[j - 1];
+                    topContractIndices[j] = topContractIndices[j - 1];
+                }
+                j--;
+            }
+            if (j < numberOfTopEntryPoints)
+            {
+                topEntryPoints[j] = entryPointStats[i];
+                topContractIndices[j] = contractIndex;
+            }
+        }
+    }
+
+    setText(message, L"Top contract entry points:");
+    for (unsigned int j = 0; j < numberOfTopEntryPoints && topEntryPoints[j].numberOfCalls; j++)
+    {
+        const ContractEntryPointStatistics& stats = topEntryPoints[j];
+        appendText(message, (j == 0) ? L" " : L" | ");
+        appendNumber(message, topContractIndices[j], FALSE);
+        appendText(message, (stats.kind == ContractEntryPointSystemProcedure) ? L".S" : ((stats.kind == ContractEntryPointUserProcedure) ? L".P" : L".F"));
+        appendNumber(message, stats.inputType, FALSE);
+        appendText(message, L" ");
+        appendNumber(message, stats.numberOfCalls, TRUE);
+        appendText(message, L" calls ");
+        appendNumber(message, stats.totalExecutionTicks * 1000 / frequency, TRUE);
+        appendText(message, L" ms (max ");
+        appendNumber(message, stats.maxExecutionTicks * 1000000 / frequency, TRUE);
+        appendText(message, L" mcs, ");
+        appendNumber(message, stats.maxLocalsStackSize, TRUE);
+        appendText(message, L" B stack, ");
+        appendNumber(message, stats.numberOfSpectrumOperations, TRUE);
+        appendText(message, L"/");
+        appendNumber(message, stats.numberOfUniverseOperations, TRUE);
+        appendText(message, L" spectrum/universe ops)");
+    }
+    logToConsole(message);
+}
+
+// Log the message types with the highest processing time since the last call
+static void logMessageTypesWithHighestProcessingTime()
+{
+    constexpr unsigned int numberOfTopTypes = 3;
+    static MessageTypeStatistics prevStats[MessageTypeStatisticsTable<MAX_NUMBER_OF_PROCESSORS>::numberOfTypes];
+    MessageTypeStatistics topTypes[numberOfTopTypes];
+    setMem(topTypes, sizeof(topTypes), 0);
+    for (unsigned int type = 0; type < MessageTypeStatisticsTable<MAX_NUMBER_OF_PROCESSORS>::numberOfTypes; type++)
+    {
+        MessageTypeStatistics stats;
+        messageTypeStatistics.getStatistics((unsigned char)type, stats);
+
+        // difference to previous call, max values are kept since node start
+        MessageTypeStatistics delta = stats;
+        delta.numberOfReceived -= prevStats[type].numberOfReceived;
+        delta.bytesReceived -= prevStats[type].bytesReceived;
+        delta.numberOfSent -= prevStats[type].numberOfSent;
+        delta.bytesSent -= prevStats[type].bytesSent;
+        delta.numberOfProcessed -= prevStats[type].numberOfProcessed;
+        delta.queueWaitTicks -= prevStats[type].queueWaitTicks;
+        delta.processingTicks -= prevStats[type].processingTicks;
+        prevStats[type] = stats;
+
+        // insert into sorted top list if processing time is higher than the lowest in the list
+        unsigned int j = numberOfTopTypes;
+        while (j > 0 && delta.processingTicks > topTypes[j - 1].processingTicks)
+        {
+            if (j < numberOfTopTypes)
+            {
+                topTypes[j] = topTypes[j - 1];
+            }
+            j--;
+        }
+        if (j < numberOfTopTypes)
+        {
+            topTypes[j] = delta;
+        }
+    }
+
+    setText(message, L"Top message types:");
+    for (unsigned int j = 0; j < numberOfTopTypes && topTypes[j].numberOfProcessed; j++)
+    {
+        const MessageTypeStatistics& stats = topTypes[j];
+        appendText(message, (j == 0) ? L" " : L" | ");
+        appendNumber(message, stats.type, FALSE);
+        appendText(message, L": ");
+        appendNumber(message, stats.numberOfProcessed, TRUE);
+        appendText(message, L" processed ");
+        appendNumber(message, stats.processingTicks * 1000 / frequency, TRUE);
+        appendText(message, L" ms (avg wait ");
+        appendNumber(message, (stats.queueWaitTicks / stats.numberOfProcessed) * 1000000 / frequency, TRUE);
+        appendText(message, L" mcs, ");
+        appendNumber(message, stats.bytesReceived / 1024, TRUE);
+        appendText(message, L"/");
+        appendNumber(message, stats.bytesSent / 1024, TRUE);
+        appendText(message, L" KiB in/out)");
+    }
+    logToConsole(message);
+}
+
 static void logInfo()
 {
     if (consoleLoggingLevel == 0)
@@ -5813,12 +6240,19 @@ static void logInfo()
     }
 
     unsigned long long numberOfWaitingBytes = 0;
+    const Peer* mostExpensivePeer = nullptr;
 
     for (unsigned int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; i++)
     {
         if (peers[i].tcp4Protocol)
         {
-            numberOfWaitingBytes += peers[i].dataToTransmitSize;
+            numberOfWaitingBytes += peers[i].transmitQueue.waitingBytes();
+
+            if (peers[i].requestCost.getTotalCycles()
+                && (!mostExpensivePeer || peers[i].requestCost.getTotalCycles() > mostExpensivePeer->requestCost.getTotalCycles()))
+            {
+                mostExpensivePeer = &peers[i];
+            }
         }
     }
 
@@ -5879,7 +6313,44 @@ static void logInfo()
     appendText(message, L" -");
     appendNumber(message, numberOfTransmittedBytes - prevNumberOfTransmittedBytes, TRUE);
     appendText(message, L" ..."); appendNumber(message, numberOfWaitingBytes, TRUE);
-    appendText(message, L").");
+    appendText(message, L"). Outgoing dropped ");
+    for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+    {
+        if (p)
+            appendText(message, L"/");
+        appendNumber(message, numberOfDroppedOutgoingMessages[p], TRUE);
+    }
+    appendText(message, L", deferred ");
+    for (unsigned int p = 0; p < NUMBER_OF_TRANSMIT_PRIORITIES; p++)
+    {
+        if (p)
+            appendText(message, L"/");
+        appendNumber(message, numberOfDeferredOutgoingMessages[p], TRUE);
+    }
+    appendText(message, L", pool full ");
+    appendNumber(message, numberOfDroppedTransmitMessages, TRUE);
+    appendText(message, L". Gossip skipped ");
+    appendNumber(message, numberOfGossipPeersSkipped, TRUE);
+    appendText(message, L" peers, saved ");
+    appendNumber(message, numberOfGossipSendsSaved, TRUE);
+    appendText(message, L" sends. Rate limited ");
+    for (unsigned int c = RequestCostClassTickData; c < NUMBER_OF_REQUEST_COST_CLASSES; c++)
+    {
+        if (c != RequestCostClassTickData)
+            appendText(message, L"/");
+        appendNumber(message, numberOfRateLimitedRequests[c], TRUE);
+    }
+    if (mostExpensivePeer)
+    {
+        appendText(message, L", top cost ");
+        appendIPv4Address(message, mostExpensivePeer->address);
+        appendText(message, L" (");
+        appendNumber(message, mostExpensivePeer->requestCost.getTotalCycles() * 1000 / frequency, TRUE);
+        appendText(message, L" ms, ");
+        appendNumber(message, mostExpensivePeer->requestCost.getResponseBytes(), TRUE);
+        appendText(message, L" B)");
+    }
+    appendText(message, L".");
 #if USE_SCORE_CACHE
     appendText(message, L" Score cache: Hit ");
     appendNumber(message, score->scoreCache.hitCount(), TRUE);
@@ -6000,9 +6471,10 @@ static void logInfo()
     appendText(message, L" pending transactions.");
     logToConsole(message);
 
-    unsigned int filledRequestQueueBufferSize = (requestQueueBufferHead >= requestQueueBufferTail) ? (requestQueueBufferHead - requestQueueBufferTail) : (REQUEST_QUEUE_BUFFER_SIZE - (requestQueueBufferTail - requestQueueBufferHead));
+    requestQueue.releaseFinished();
+    unsigned long long filledRequestQueueBufferSize = requestQueue.getNumberOfUsedBytes();
     unsigned int filledResponseQueueBufferSize = (responseQueueBufferHead >= responseQueueBufferTail) ? (responseQueueBufferHead - responseQueueBufferTail) : (RESPONSE_QUEUE_BUFFER_SIZE - (responseQueueBufferTail - responseQueueBufferHead));
-    unsigned int filledRequestQueueLength = (requestQueueElementHead >= requestQueueElementTail) ? (requestQueueElementHead - requestQueueElementTail) : (REQUEST_QUEUE_LENGTH - (requestQueueElementTail - requestQueueElementHead));
+    unsigned int filledRequestQueueLength = requestQueue.getNumberOfUsedElements();
     unsigned int filledResponseQueueLength = (responseQueueElementHead >= responseQueueElementTail) ? (responseQueueElementHead - responseQueueElementTail) : (RESPONSE_QUEUE_LENGTH - (responseQueueElementTail - responseQueueElementHead));
     setNumber(message, filledRequestQueueBufferSize, TRUE);
     appendText(message, L" (");
@@ -6029,6 +6501,28 @@ static void logInfo()
     appendText(message, L" ms.");
     logToConsole(message);
 
+    logContractEntryPointsWithHighestExecutionTime();
+    logMessageTypesWithHighestProcessingTime();
+
+    const unsigned int queuedRequests = getNumberOfQueuedRequests();
+    setText(message, L"Request queue: ");
+    appendNumber(message, queuedRequests, TRUE);
+    appendText(message, L" queued (");
+    appendNumber(message, getRequestQueueFillPercent(), FALSE);
+    appendText(message, L"%), ");
+    appendNumber(message, requestAdmission.getProcessingRate(), TRUE);
+    appendText(message, L" processed/s, est. wait ");
+    appendNumber(message, requestAdmission.getEstimatedWaitMilliseconds(queuedRequests), TRUE);
+    appendText(message, L" ms. Shed ");
+    for (unsigned int c = RequestCostClassTickData; c < NUMBER_OF_REQUEST_COST_CLASSES; c++)
+    {
+        if (c != RequestCostClassTickData)
+            appendText(message, L"/");
+        appendNumber(message, requestAdmission.getNumberOfShedRequests((RequestCostClass)c), TRUE);
+    }
+    appendText(message, L" tick data/query/contract function requests.");
+    logToConsole(message);
+
     // Log infomation about custom mining
     setText(message, L"CustomMining: ");
 
@@ -6200,6 +6694,61 @@ static void logHealthStatus()
     appendNumber(message, contractLocalsStackLockWaitingCountMax, TRUE);
     logToConsole(message);
 
+    setText(message, L"Contract function cache: hits ");
+    appendNumber(message, contractFunctionResultCache.hitCount(), TRUE);
+    appendText(message, L" | misses ");
+    appendNumber(message, contractFunctionResultCache.missCount(), TRUE);
+    appendText(message, L" | stores ");
+    appendNumber(message, contractFunctionResultCache.storeCount(), TRUE);
+    logToConsole(message);
+
+    unsigned long long functionScratchpadRequests = 0, functionScratchpadFailures = 0, functionScratchpadMaxSize = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_CONTRACT_EXECUTION_BUFFERS; ++i)
+    {
+        functionScratchpadRequests += contractFunctionScratchpads[i].numberOfRequests;
+        functionScratchpadFailures += contractFunctionScratchpads[i].numberOfFailedRequests;
+        if (contractFunctionScratchpads[i].maxRequestedSize > functionScratchpadMaxSize)
+            functionScratchpadMaxSize = contractFunctionScratchpads[i].maxRequestedSize;
+    }
+    setText(message, L"Scratchpad: procedures ");
+    appendNumber(message, reorgScratchpad.numberOfRequests, TRUE);
+    appendText(message, L" requests (");
+    appendNumber(message, reorgScratchpad.numberOfFailedRequests, TRUE);
+    appendText(message, L" failed, max size ");
+    appendNumber(message, reorgScratchpad.maxRequestedSize, TRUE);
+    appendText(message, L") | functions ");
+    appendNumber(message, functionScratchpadRequests, TRUE);
+    appendText(message, L" requests (");
+    appendNumber(message, functionScratchpadFailures, TRUE);
+    appendText(message, L" failed, max size ");
+    appendNumber(message, functionScratchpadMaxSize, TRUE);
+    appendText(message, L" of ");
+    appendNumber(message, CONTRACT_FUNCTION_SCRATCHPAD_SIZE, TRUE);
+    appendText(message, L")");
+    logToConsole(message);
+
+    if (gAsyncFileIO)
+    {
+        AsyncFileIOStats fileIOStats;
+        gAsyncFileIO->getStats(fileIOStats);
+        setText(message, L"File IO: non-blocking saves ");
+        appendNumber(message, fileIOStats.nonBlockingSaves, TRUE);
+        appendText(message, L" | blocking saves ");
+        appendNumber(message, fileIOStats.blockingSaves, TRUE);
+        appendText(message, L" | loads ");
+        appendNumber(message, fileIOStats.loads, TRUE);
+        appendText(message, L" | queue full ");
+        appendNumber(message, fileIOStats.queueFull, TRUE);
+        appendText(message, L" | buffer full ");
+        appendNumber(message, fileIOStats.bufferFull, TRUE);
+        appendText(message, L" | pending ");
+        appendNumber(message, fileIOStats.pendingItems, TRUE);
+        appendText(message, L" (max ");
+        appendNumber(message, fileIOStats.maxPendingItems, TRUE);
+        appendText(message, L")");
+        logToConsole(message);
+    }
+
     setText(message, L"Connections:");
     for (int i = 0; i < NUMBER_OF_OUTGOING_CONNECTIONS + NUMBER_OF_INCOMING_CONNECTIONS; ++i)
     {
@@ -6221,7 +6770,7 @@ static void logHealthStatus()
             if (peers[i].isTransmitting)
             {
                 appendText(message, L"t");
-                appendNumber(message, peers[i].dataToTransmitSize, FALSE);
+                appendNumber(message, peers[i].transmitQueue.waitingBytes(), FALSE);
             }
             appendText(message, L"]");
         }
@@ -6616,6 +7165,39 @@ static void processKeyPresses()
     }
 }
 
+// Priority of message sent to random peers (see enqueueResponse() with peer NULL). Votes and computor list are
+// needed for reaching consensus and must not wait behind other messages.
+static TransmitPriority getBroadcastTransmitPriority(unsigned char type)
+{
+    switch (type)
+    {
+    case BroadcastTick::type:
+    case BroadcastComputors::type:
+        return TransmitPriorityConsensus;
+    default:
+        return TransmitPriorityTickData;
+    }
+}
+
+// Priority of response sent to a single peer. Votes, computor list, and tick data requested by a node catching up
+// must not wait behind broadcasts and query responses. EndResponse is kept in the lowest class, so it is transmitted
+// after the messages of the response that it terminates.
+static TransmitPriority getResponseTransmitPriority(unsigned char type)
+{
+    switch (type)
+    {
+    case BroadcastTick::type:
+    case BroadcastComputors::type:
+    case ExchangePublicPeers::type:
+        return TransmitPriorityConsensus;
+    case BroadcastFutureTickData::type:
+    case BROADCAST_TRANSACTION:
+        return TransmitPriorityTickData;
+    default:
+        return TransmitPriorityQueryResponse;
+    }
+}
+
 EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
 {
     ih = imageHandle;
@@ -6633,16 +7215,18 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
     appendText(message, L" is launched.");
     logToConsole(message);
 
+    // locate MP services before initialize(), which uses the idle application processors for hashing the state
+    EFI_GUID mpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
+    bs->LocateProtocol(&mpServiceProtocolGuid, NULL, (void**)&mpServicesProtocol);
+    mpServicesProtocol->WhoAmI(mpServicesProtocol, &mainThreadProcessorID); // get the proc Id of main thread (for later use)
+
     if (initialize())
     {
         logToConsole(L"Setting up multiprocessing ...");
 
         unsigned int computingProcessorNumber;
-        EFI_GUID mpServiceProtocolGuid = EFI_MP_SERVICES_PROTOCOL_GUID;
-        bs->LocateProtocol(&mpServiceProtocolGuid, NULL, (void**)&mpServicesProtocol);
         unsigned long long numberOfAllProcessors, numberOfEnabledProcessors;
         mpServicesProtocol->GetNumberOfProcessors(mpServicesProtocol, &numberOfAllProcessors, &numberOfEnabledProcessors);
-        mpServicesProtocol->WhoAmI(mpServicesProtocol, &mainThreadProcessorID); // get the proc Id of main thread (for later use)
 
         registerAsynFileIO(mpServicesProtocol);
         
@@ -6667,12 +7251,6 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
             mpServicesProtocol->GetProcessorInfo(mpServicesProtocol, i, &processorInformation);
             if (processorInformation.StatusFlag == (PROCESSOR_ENABLED_BIT | PROCESSOR_HEALTH_STATUS_BIT))
             {
-                if (!allocPoolWithErrorLog(L"processor[i]", BUFFER_SIZE, &processors[numberOfProcessors].buffer, __LINE__))
-                {
-                    numberOfProcessors = 0;
-
-                    break;
-                }
                 if (!processors[numberOfProcessors].alloc(STACK_SIZE))
                 {
                     logToConsole(L"Failed to allocate stack for processor!");
@@ -6830,7 +7408,12 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                     {
                         // new connection established:
                         // prepare and send ExchangePublicPeers message
-                        ExchangePublicPeers* request = (ExchangePublicPeers*)&peers[i].dataToTransmit[sizeof(RequestResponseHeader)];
+                        struct
+                        {
+                            RequestResponseHeader header;
+                            ExchangePublicPeers payload;
+                        } exchangePublicPeersMessage;
+                        ExchangePublicPeers* request = &exchangePublicPeersMessage.payload;
                         bool noVerifiedPublicPeers = true;
                         for (unsigned int k = 0; k < numberOfPublicPeers; k++)
                         {
@@ -6851,10 +7434,10 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                             else
                             {
                                 // randomly select verified public peers
-                                const unsigned int publicPeerIndex = random(numberOfPublicPeers);
-                                if (publicPeers[publicPeerIndex].isHandshaked /*&& publicPeers[publicPeerIndex].isFullnode*/)
+                                const unsigned int randomPeerIndex = random(numberOfPublicPeers);
+                                if (publicPeers[randomPeerIndex].isHandshaked /*&& publicPeers[randomPeerIndex].isFullnode*/)
                                 {
-                                    request->peers[j] = publicPeers[publicPeerIndex].address;
+                                    request->peers[j] = publicPeers[randomPeerIndex].address;
                                 }
                                 else
                                 {
@@ -6863,21 +7446,17 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                             }
                         }
 
-                        RequestResponseHeader* requestHeader = (RequestResponseHeader*)peers[i].dataToTransmit;
-                        requestHeader->setSize<sizeof(RequestResponseHeader) + sizeof(ExchangePublicPeers)>();
-                        requestHeader->randomizeDejavu();
-                        requestHeader->setType(ExchangePublicPeers::type);
-                        peers[i].dataToTransmitSize = requestHeader->size();
-                        _InterlockedIncrement64(&numberOfDisseminatedRequests);
+                        exchangePublicPeersMessage.header.setSize<sizeof(exchangePublicPeersMessage)>();
+                        exchangePublicPeersMessage.header.randomizeDejavu();
+                        exchangePublicPeersMessage.header.setType(ExchangePublicPeers::type);
+                        push(&peers[i], &exchangePublicPeersMessage.header, TransmitPriorityConsensus);
 
                         // send RequestComputors message at beginning of epoch
                         if (!broadcastedComputors.computors.epoch
                             || broadcastedComputors.computors.epoch != system.epoch)
                         {
                             requestedComputors.header.randomizeDejavu();
-                            copyMem(&peers[i].dataToTransmit[peers[i].dataToTransmitSize], &requestedComputors, requestedComputors.header.size());
-                            peers[i].dataToTransmitSize += requestedComputors.header.size();
-                            _InterlockedIncrement64(&numberOfDisseminatedRequests);
+                            push(&peers[i], &requestedComputors.header, TransmitPriorityConsensus);
                         }
                     }
 
@@ -6957,8 +7536,8 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                                 requestedQuorumTick.requestQuorumTick.quorumTick.voteFlags[i >> 3] |= (1 << (i & 7));
                             }
                         }
-                        pushToAny(&requestedQuorumTick.header);
-                        pushToAnyFullNode(&requestedQuorumTick.header);
+                        pushToAny(&requestedQuorumTick.header, TransmitPriorityTickData);
+                        pushToAnyFullNode(&requestedQuorumTick.header, TransmitPriorityTickData);
                     }
                     tickRequestingIndicator = gTickTotalNumberOfComputors;
                     if (futureTickRequestingIndicator == gFutureTickTotalNumberOfComputors
@@ -6975,8 +7554,8 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                                 requestedQuorumTick.requestQuorumTick.quorumTick.voteFlags[i >> 3] |= (1 << (i & 7));
                             }
                         }
-                        pushToAny(&requestedQuorumTick.header);
-                        pushToAnyFullNode(&requestedQuorumTick.header);
+                        pushToAny(&requestedQuorumTick.header, TransmitPriorityTickData);
+                        pushToAnyFullNode(&requestedQuorumTick.header, TransmitPriorityTickData);
                     }
                     futureTickRequestingIndicator = gFutureTickTotalNumberOfComputors;
 
@@ -6990,22 +7569,22 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                         // targetNextTickDataDigestIsKnown == false means there is no consensus on next tick data yet
                         requestedTickData.header.randomizeDejavu();
                         requestedTickData.requestTickData.requestedTickData.tick = system.tick + 1;
-                        pushToAny(&requestedTickData.header);
-                        pushToAnyFullNode(&requestedTickData.header);
+                        pushToAny(&requestedTickData.header, TransmitPriorityTickData);
+                        pushToAnyFullNode(&requestedTickData.header, TransmitPriorityTickData);
                     }
                     if (ts.tickData[system.tick + 2 - system.initialTick].epoch != system.epoch && isNewTickPlus2)
                     {
                         requestedTickData.header.randomizeDejavu();
                         requestedTickData.requestTickData.requestedTickData.tick = system.tick + 2;
-                        pushToAny(&requestedTickData.header);
-                        pushToAnyFullNode(&requestedTickData.header);
+                        pushToAny(&requestedTickData.header, TransmitPriorityTickData);
+                        pushToAnyFullNode(&requestedTickData.header, TransmitPriorityTickData);
                     }
 
                     if (requestedTickTransactions.requestedTickTransactions.tick)
                     {
                         requestedTickTransactions.header.randomizeDejavu();
-                        pushToAny(&requestedTickTransactions.header);
-                        pushToAnyFullNode(&requestedTickTransactions.header);
+                        pushToAny(&requestedTickTransactions.header, TransmitPriorityTickData);
+                        pushToAnyFullNode(&requestedTickTransactions.header, TransmitPriorityTickData);
 
                         requestedTickTransactions.requestedTickTransactions.tick = 0;
                     }
@@ -7020,11 +7599,12 @@ EFI_STATUS efi_main(EFI_HANDLE imageHandle, EFI_SYSTEM_TABLE* systemTable)
                         RequestResponseHeader* responseHeader = (RequestResponseHeader*)&responseQueueBuffer[responseQueueElements[responseQueueElementTail].offset];
                         if (responseQueueElements[responseQueueElementTail].peer)
                         {
-                            push(responseQueueElements[responseQueueElementTail].peer, responseHeader);
+                            responseQueueElements[responseQueueElementTail].peer->requestCost.chargeResponseBytes(responseHeader->size());
+                            push(responseQueueElements[responseQueueElementTail].peer, responseHeader, getResponseTransmitPriority(responseHeader->type()));
                         }
                         else
                         {
-                            pushToSeveral(responseHeader);
+                            pushToSeveral(responseHeader, getBroadcastTransmitPriority(responseHeader->type()));
                         }
                         responseQueueBufferTail += responseHeader->size();
                         if (responseQueueBufferTail > RESPONSE_QUEUE_BUFFER_SIZE - BUFFER_SIZE)
@@ -2,6 +2,7 @@
 
 #include "platform/memory.h"
 #include "platform/assert.h"
+#include "platform/concurrency.h"
 #include "network_messages/common_def.h"
 #include "vote_counter.h"
 #include "public_settings.h"
@@ -158,3 +159,191 @@ static void computeRevenue(
 }
 
 
+
+// Scores of one revenue component (tx, vote, or custom mining) of all computors, kept together with the ranking of
+// computors in descending order of score. The quorum score is available in O(1), so revenue factors can be computed
+// every tick. Because scores only grow during the epoch, updating a score moves the computor up by the number of
+// computors it overtakes, which is small compared to sorting all scores.
+struct RevenueScoreRanking
+{
+    unsigned long long score[NUMBER_OF_COMPUTORS];
+    unsigned long long sortedScore[NUMBER_OF_COMPUTORS];    // descending
+    unsigned short sortedComputorIndex[NUMBER_OF_COMPUTORS]; // computor index of sortedScore[rank]
+    unsigned short rank[NUMBER_OF_COMPUTORS];                // rank of computor index
+
+    void reset()
+    {
+        setMem(score, sizeof(score), 0);
+        setMem(sortedScore, sizeof(sortedScore), 0);
+        for (unsigned short i = 0; i < NUMBER_OF_COMPUTORS; i++)
+        {
+            sortedComputorIndex[i] = i;
+            rank[i] = i;
+        }
+    }
+
+    // Set score of computor, moving it up (or down if the score has decreased) in the ranking.
+    void set(unsigned int computorIndex, unsigned long long newScore)
+    {
+        ASSERT(computorIndex < NUMBER_OF_COMPUTORS);
+        unsigned int r = rank[computorIndex];
+        while (r > 0 && sortedScore[r - 1] < newScore)
+        {
+            sortedScore[r] = sortedScore[r - 1];
+            sortedComputorIndex[r] = sortedComputorIndex[r - 1];
+            rank[sortedComputorIndex[r]] = r;
+            r--;
+        }
+        while (r + 1 < NUMBER_OF_COMPUTORS && sortedScore[r + 1] > newScore)
+        {
+            sortedScore[r] = sortedScore[r + 1];
+            sortedComputorIndex[r] = sortedComputorIndex[r + 1];
+            rank[sortedComputorIndex[r]] = r;
+            r++;
+        }
+        sortedScore[r] = newScore;
+        sortedComputorIndex[r] = computorIndex;
+        rank[computorIndex] = r;
+        score[computorIndex] = newScore;
+    }
+
+    void add(unsigned int computorIndex, unsigned long long points)
+    {
+        set(computorIndex, score[computorIndex] + points);
+    }
+
+    // Same as getQuorumScore(score), the QUORUM-th highest score or 1 if it is 0
+    unsigned long long getQuorumScore() const
+    {
+        return (sortedScore[QUORUM - 1]) ? sortedScore[QUORUM - 1] : 1;
+    }
+};
+
+// Same as computeRevFactor(), but with known quorum score. Computors with zero score or score of at least the quorum
+// score are handled 4 at a time with AVX2, only the remaining ones need a division.
+static void computeRevFactorWithQuorumScore(
+    const unsigned long long* score,
+    const unsigned long long scalingThreshold,
+    const unsigned long long quorumScore,
+    unsigned long long* outputScoreFactor)
+{
+    static_assert(NUMBER_OF_COMPUTORS % 4 == 0, "Computors are processed in groups of 4");
+    ASSERT(scalingThreshold > 0 && quorumScore > 0);
+
+    // AVX2 only has signed 64-bit comparison, so flip the sign bit of both sides for comparing unsigned values
+    const __m256i signBit = _mm256_set1_epi64x(0x8000000000000000LL);
+    const __m256i quorumScoreMinusOne = _mm256_xor_si256(_mm256_set1_epi64x(quorumScore - 1), signBit);
+    const __m256i threshold = _mm256_set1_epi64x(scalingThreshold);
+    for (unsigned int computorIndex = 0; computorIndex < NUMBER_OF_COMPUTORS; computorIndex += 4)
+    {
+        const __m256i scores = _mm256_loadu_si256((const __m256i*)(score + computorIndex));
+        const __m256i atLeastQuorum = _mm256_cmpgt_epi64(_mm256_xor_si256(scores, signBit), quorumScoreMinusOne);
+        const __m256i zeroScore = _mm256_cmpeq_epi64(scores, _mm256_setzero_si256());
+        _mm256_storeu_si256((__m256i*)(outputScoreFactor + computorIndex), _mm256_and_si256(atLeastQuorum, threshold));
+
+        int belowQuorum = ~_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_or_si256(atLeastQuorum, zeroScore))) & 0xf;
+        while (belowQuorum)
+        {
+            const unsigned int i = computorIndex + _tzcnt_u32(belowQuorum);
+            ASSERT(0xFFFFFFFFFFFFFFFFULL / scalingThreshold >= score[i]);
+            outputScoreFactor[i] = scalingThreshold * score[i] / quorumScore;
+            belowQuorum &= belowQuorum - 1;
+        }
+    }
+}
+
+// Combine the score factors to the revenue of each computor, same as the last step of computeRevenue(). Since the
+// scaling thresholds are powers of 2, the divisions are one shift. All factors fit into 32 bits, so the products can
+// be computed 4 computors at a time with 32x32->64 bit multiplications.
+static void computeRevenueFromFactors(
+    const unsigned long long* txScoreFactor,
+    const unsigned long long* voteScoreFactor,
+    const unsigned long long* customMiningScoreFactor,
+    long long* revenue)
+{
+    constexpr unsigned long long issuancePerComputor = ISSUANCE_RATE / NUMBER_OF_COMPUTORS;
+    static_assert(issuancePerComputor <= 0xFFFFFFFFULL, "Issuance per computor must fit into 32 bits");
+    static_assert(gTxScoreScalingThreshold == (1ULL << 10) && gVoteScoreScalingThreshold == (1ULL << 10) && gCustomMiningScoreScalingThreshold == (1ULL << 10),
+        "Division by scaling thresholds is implemented as shift");
+    static_assert(gTxScoreScalingThreshold * gVoteScoreScalingThreshold * gCustomMiningScoreScalingThreshold <= 0xFFFFFFFFULL, "Combined factor must fit into 32 bits");
+
+    const __m256i issuance = _mm256_set1_epi64x(issuancePerComputor);
+    for (unsigned int computorIndex = 0; computorIndex < NUMBER_OF_COMPUTORS; computorIndex += 4)
+    {
+        const __m256i txFactor = _mm256_loadu_si256((const __m256i*)(txScoreFactor + computorIndex));
+        const __m256i voteFactor = _mm256_loadu_si256((const __m256i*)(voteScoreFactor + computorIndex));
+        const __m256i customFactor = _mm256_loadu_si256((const __m256i*)(customMiningScoreFactor + computorIndex));
+        __m256i combined = _mm256_mul_epu32(_mm256_mul_epu32(txFactor, voteFactor), customFactor);
+        combined = _mm256_srli_epi64(_mm256_mul_epu32(combined, issuance), 30);
+        _mm256_storeu_si256((__m256i*)(revenue + computorIndex), combined);
+    }
+}
+
+// Running revenue scores of the current epoch, updated after each tick for a live projection of the revenue that
+// computeRevenue() will yield at the end of the epoch
+static struct
+{
+    RevenueScoreRanking txScore;
+    RevenueScoreRanking voteScore;
+    RevenueScoreRanking customMiningScore;
+} gRunningRevenueScores;
+
+// Projection of gRevenueComponents if the epoch would end after gProjectedRevenueTick, written by the tick processor and
+// read by request processors (SPECIAL_COMMAND_GET_PROJECTED_REVENUE) with gProjectedRevenueLock held
+static RevenueComponents gProjectedRevenueComponents;
+static unsigned int gProjectedRevenueTick = 0;
+static volatile char gProjectedRevenueLock = 0;
+
+static void resetRunningRevenueScores()
+{
+    gRunningRevenueScores.txScore.reset();
+    gRunningRevenueScores.voteScore.reset();
+    gRunningRevenueScores.customMiningScore.reset();
+    ACQUIRE(gProjectedRevenueLock);
+    setMem(&gProjectedRevenueComponents, sizeof(gProjectedRevenueComponents), 0);
+    gProjectedRevenueTick = 0;
+    RELEASE(gProjectedRevenueLock);
+}
+
+// Add the tx revenue points of a tick with numberOfTransactions transactions to the tick leader
+static void addRunningTxScore(unsigned int tick, unsigned int numberOfTransactions)
+{
+    ASSERT(numberOfTransactions < sizeof(gTxRevenuePoints) / sizeof(gTxRevenuePoints[0]));
+    gRunningRevenueScores.txScore.add(tick % NUMBER_OF_COMPUTORS, gTxRevenuePoints[numberOfTransactions]);
+}
+
+static void setRunningVoteScore(unsigned int computorIndex, unsigned long long voteCount)
+{
+    if (gRunningRevenueScores.voteScore.score[computorIndex] != voteCount)
+    {
+        gRunningRevenueScores.voteScore.set(computorIndex, voteCount);
+    }
+}
+
+static void setRunningCustomMiningScore(unsigned int computorIndex, unsigned long long sharesCount)
+{
+    if (gRunningRevenueScores.customMiningScore.score[computorIndex] != sharesCount)
+    {
+        gRunningRevenueScores.customMiningScore.set(computorIndex, sharesCount);
+    }
+}
+
+// Compute revenue components from the running scores. Gives the same result as calling computeRevenue() with the
+// scores, without sorting.
+static void computeRunningRevenue(RevenueComponents& output)
+{
+    const RevenueScoreRanking& tx = gRunningRevenueScores.txScore;
+    const RevenueScoreRanking& vote = gRunningRevenueScores.voteScore;
+    const RevenueScoreRanking& customMining = gRunningRevenueScores.customMiningScore;
+
+    copyMem(output.txScore, tx.score, sizeof(output.txScore));
+    computeRevFactorWithQuorumScore(tx.score, gTxScoreScalingThreshold, tx.getQuorumScore(), output.txScoreFactor);
+
+    copyMem(output.voteScore, vote.score, sizeof(output.voteScore));
+    computeRevFactorWithQuorumScore(vote.score, gVoteScoreScalingThreshold, vote.getQuorumScore(), output.voteScoreFactor);
+
+    copyMem(output.customMiningScore, customMining.score, sizeof(output.customMiningScore));
+    computeRevFactorWithQuorumScore(customMining.score, gCustomMiningScoreScalingThreshold, customMining.getQuorumScore(), output.customMiningScoreFactor);
+
+    computeRevenueFromFactors(output.txScoreFactor, output.voteScoreFactor, output.customMiningScoreFactor, output.revenue);
+}
@@ -18,6 +18,12 @@
 #include "common_buffers.h"
 
 GLOBAL_VAR_DECL volatile char spectrumLock GLOBAL_VAR_INIT(0);
+
+// Sequence counter for reading the spectrum without acquiring spectrumLock (seqlock). Writers hold spectrumLock and
+// increment it before and after changing spectrum or spectrumDigests, so it is odd while a change is in progress.
+// Readers retry if it is odd or has changed while reading, see beginSpectrumRead() and endSpectrumRead().
+GLOBAL_VAR_DECL volatile long long spectrumWriteSequence GLOBAL_VAR_INIT(0);
+
 GLOBAL_VAR_DECL ::Entity* spectrum GLOBAL_VAR_INIT(nullptr);
 GLOBAL_VAR_DECL struct SpectrumInfo {
     unsigned int numberOfEntities = 0;  // Number of entities in the spectrum hash map, may include entries with balance == 0
@@ -34,6 +40,40 @@ static constexpr unsigned long long spectrumDigestsSizeInByte = (SPECTRUM_CAPACI
 GLOBAL_VAR_DECL unsigned long long spectrumReorgTotalExecutionTicks GLOBAL_VAR_INIT(0);
 
 
+// Begin changing spectrum or spectrumDigests. Assumes spectrumLock is acquired by the caller.
+static void beginSpectrumWrite()
+{
+    ATOMIC_INC64(spectrumWriteSequence);
+}
+
+// End change started with beginSpectrumWrite(). Assumes spectrumLock is acquired by the caller.
+static void endSpectrumWrite()
+{
+    ATOMIC_INC64(spectrumWriteSequence);
+}
+
+// Begin reading spectrum and spectrumDigests without acquiring spectrumLock. Waits while a change is in progress.
+// The data read is only valid if endSpectrumRead() returns true for the returned sequence number, otherwise the
+// read has to be repeated. Data read before may be inconsistent, so any index derived from it has to be range-checked.
+static long long beginSpectrumRead()
+{
+    long long sequence = spectrumWriteSequence;
+    while (sequence & 1)
+    {
+        _mm_pause();
+        sequence = spectrumWriteSequence;
+    }
+    _mm_lfence();
+    return sequence;
+}
+
+// Return if the data read since beginSpectrumRead() is consistent, that is, no change has happened in between.
+static bool endSpectrumRead(long long sequence)
+{
+    _mm_lfence();
+    return spectrumWriteSequence == sequence;
+}
+
 // Update SpectrumInfo data (exensive, because it iterates the whole spectrum), acquire no lock
 static void updateSpectrumInfo(SpectrumInfo& si = spectrumInfo)
 {
@@ -195,7 +235,10 @@ static void reorganizeSpectrum()
     spectrumReorgTotalExecutionTicks += __rdtsc() - spectrumReorgStartTick;
 }
 
-static int spectrumIndex(const m256i& publicKey)
+// Return index of entity with publicKey in spectrum or -1 if it is not found. Doesn't synchronize, so the caller
+// either has to hold spectrumLock or has to check the result with beginSpectrumRead() / endSpectrumRead(). The
+// probing is limited to SPECTRUM_CAPACITY slots, so it terminates even if it reads a spectrum in the middle of a change.
+static int spectrumIndexWithoutLocking(const m256i& publicKey)
 {
     if (isZero(publicKey))
     {
@@ -203,31 +246,63 @@ static int spectrumIndex(const m256i& publicKey)
     }
 
     unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    for (unsigned int probes = 0; probes < SPECTRUM_CAPACITY; ++probes)
+    {
+        if (spectrum[index].publicKey == publicKey)
+        {
+            return index;
+        }
+        if (isZero(spectrum[index].publicKey))
+        {
+            return -1;
+        }
+        index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    }
+    return -1;
+}
 
-    ACQUIRE(spectrumLock);
+// Return index of entity with publicKey in spectrum or -1 if it is not found. Doesn't block while the spectrum
+// is locked, only while it is changed.
+static int spectrumIndex(const m256i& publicKey)
+{
+    if (isZero(publicKey))
+    {
+        return -1;
+    }
 
-iteration:
-    if (spectrum[index].publicKey == publicKey)
+    int index;
+    long long sequence;
+    do
     {
-        RELEASE(spectrumLock);
+        sequence = beginSpectrumRead();
+        index = spectrumIndexWithoutLocking(publicKey);
+    } while (!endSpectrumRead(sequence));
 
-        return index;
-    }
-    else
+    return index;
+}
+
+// Copy entity with publicKey from spectrum, without acquiring spectrumLock. Returns the index of the entity or -1
+// if it is not found (entity is zeroed except for publicKey in this case).
+static int readEntity(const m256i& publicKey, ::Entity& entity)
+{
+    int index;
+    long long sequence;
+    do
     {
-        if (isZero(spectrum[index].publicKey))
+        sequence = beginSpectrumRead();
+        index = spectrumIndexWithoutLocking(publicKey);
+        if (index >= 0)
         {
-            RELEASE(spectrumLock);
-
-            return -1;
+            copyMem(&entity, &spectrum[index], sizeof(::Entity));
         }
-        else
-        {
-            index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+    } while (!endSpectrumRead(sequence));
 
-            goto iteration;
-        }
+    if (index < 0)
+    {
+        setMem(&entity, sizeof(::Entity), 0);
+        entity.publicKey = publicKey;
     }
+    return index;
 }
 
 static long long energy(const int index)
@@ -235,121 +310,212 @@ static long long energy(const int index)
     return spectrum[index].incomingAmount - spectrum[index].outgoingAmount;
 }
 
-// Increase balance of entity.
-static void increaseEnergy(const m256i& publicKey, long long amount)
+// Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast.
+// Assumes spectrumLock is acquired by the caller.
+static void burnDustIfSpectrumIsFull()
 {
-    if (!isZero(publicKey) && amount >= 0)
+    if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
     {
-        unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
-
-        ACQUIRE(spectrumLock);
-
-        // Anti-dust feature: prevent that spectrum fills to more than 75% of capacity to keep hash map lookup fast
-        if (spectrumInfo.numberOfEntities >= (SPECTRUM_CAPACITY / 2) + (SPECTRUM_CAPACITY / 4))
-        {
-            // Update anti-dust burn thresholds (and log spectrum stats before burning)
-            updateAndAnalzeEntityCategoryPopulations();
+        // Update anti-dust burn thresholds (and log spectrum stats before burning)
+        updateAndAnalzeEntityCategoryPopulations();
 #if LOG_SPECTRUM
-            logSpectrumStats();
+        logSpectrumStats();
 #endif
 #if LOG_SPECTRUM
-            DustBurnLogger dbl;
+        DustBurnLogger dbl;
 #endif
 
-            if (dustThresholdBurnAll > 0)
+        if (dustThresholdBurnAll > 0)
+        {
+            // Burn every balance with balance < dustThresholdBurnAll
+            for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
             {
-                // Burn every balance with balance < dustThresholdBurnAll
-                for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+                const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+                if (balance <= dustThresholdBurnAll && balance)
                 {
-                    const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
-                    if (balance <= dustThresholdBurnAll && balance)
-                    {
-                        spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                    spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
 #if LOG_SPECTRUM
-                        dbl.addDustBurn(spectrum[i].publicKey, balance);
+                    dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
-                    }
                 }
             }
+        }
 
-            if (dustThresholdBurnHalf > 0)
+        if (dustThresholdBurnHalf > 0)
+        {
+            // Burn every second balance with balance < dustThresholdBurnHalf
+            unsigned int countBurnCanadiates = 0;
+            for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
             {
-                // Burn every second balance with balance < dustThresholdBurnHalf
-                unsigned int countBurnCanadiates = 0;
-                for (unsigned int i = 0; i < SPECTRUM_CAPACITY; i++)
+                const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
+                if (balance <= dustThresholdBurnHalf && balance)
                 {
-                    const unsigned long long balance = spectrum[i].incomingAmount - spectrum[i].outgoingAmount;
-                    if (balance <= dustThresholdBurnHalf && balance)
+                    if (++countBurnCanadiates & 1)
                     {
-                        if (++countBurnCanadiates & 1)
-                        {
-                            spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
+                        spectrum[i].outgoingAmount = spectrum[i].incomingAmount;
 #if LOG_SPECTRUM
-                            dbl.addDustBurn(spectrum[i].publicKey, balance);
+                        dbl.addDustBurn(spectrum[i].publicKey, balance);
 #endif
-                        }
                     }
                 }
             }
+        }
 
 #if LOG_SPECTRUM
-            // Finished dust burning (pass message to log)
-            dbl.finished();
+        // Finished dust burning (pass message to log)
+        dbl.finished();
 #endif
 
-            // Remove entries with balance zero from hash map
-            reorganizeSpectrum();
+        // Remove entries with balance zero from hash map
+        reorganizeSpectrum();
 
 #if LOG_SPECTRUM
-            // Log spectrum stats after burning (before increasing energy / potenitally creating entity)
-            updateAndAnalzeEntityCategoryPopulations();
-            logSpectrumStats();
+        // Log spectrum stats after burning (before increasing energy / potenitally creating entity)
+        updateAndAnalzeEntityCategoryPopulations();
+        logSpectrumStats();
 #endif
-        }
+    }
+}
 
-    iteration:
-        if (spectrum[index].publicKey == publicKey)
+// Increase balance of entity, creating the entity if it does not exist yet. Runs anti-dust if needed.
+// Requires a non-zero public key and amount >= 0. Assumes spectrumLock is acquired by the caller.
+static void increaseEnergyOfLockedSpectrum(const m256i& publicKey, long long amount)
+{
+    burnDustIfSpectrumIsFull();
+
+    unsigned int index = publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+
+iteration:
+    if (spectrum[index].publicKey == publicKey)
+    {
+        spectrum[index].incomingAmount += amount;
+        spectrum[index].numberOfIncomingTransfers++;
+        spectrum[index].latestIncomingTransferTick = system.tick;
+
+        spectrumInfo.totalAmount += amount;
+    }
+    else
+    {
+        if (isZero(spectrum[index].publicKey))
         {
-            spectrum[index].incomingAmount += amount;
-            spectrum[index].numberOfIncomingTransfers++;
+            spectrum[index].publicKey = publicKey;
+            spectrum[index].incomingAmount = amount;
+            spectrum[index].numberOfIncomingTransfers = 1;
             spectrum[index].latestIncomingTransferTick = system.tick;
 
+            spectrumInfo.numberOfEntities++;
             spectrumInfo.totalAmount += amount;
+
+#if LOG_SPECTRUM
+            if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
+            {
+                // Log spectrum stats when the number of entities hits the next half million
+                // (== 1 is to avoid duplicate when anti-dust is triggered)
+                updateAndAnalzeEntityCategoryPopulations();
+                logSpectrumStats();
+            }
+#endif
         }
         else
         {
-            if (isZero(spectrum[index].publicKey))
-            {
-                spectrum[index].publicKey = publicKey;
-                spectrum[index].incomingAmount = amount;
-                spectrum[index].numberOfIncomingTransfers = 1;
-                spectrum[index].latestIncomingTransferTick = system.tick;
+            index = (index + 1) & (SPECTRUM_CAPACITY - 1);
 
-                spectrumInfo.numberOfEntities++;
-                spectrumInfo.totalAmount += amount;
+            goto iteration;
+        }
+    }
+}
 
-#if LOG_SPECTRUM
-                if ((spectrumInfo.numberOfEntities & 0x7ffff) == 1)
-                {
-                    // Log spectrum stats when the number of entities hits the next half million
-                    // (== 1 is to avoid duplicate when anti-dust is triggered)
-                    updateAndAnalzeEntityCategoryPopulations();
-                    logSpectrumStats();
-                }
-#endif
-            }
-            else
-            {
-                index = (index + 1) & (SPECTRUM_CAPACITY - 1);
+// Increase balance of entity.
+static void increaseEnergy(const m256i& publicKey, long long amount)
+{
+    if (!isZero(publicKey) && amount >= 0)
+    {
+        ACQUIRE(spectrumLock);
+        beginSpectrumWrite();
 
-                goto iteration;
-            }
-        }
+        increaseEnergyOfLockedSpectrum(publicKey, amount);
 
+        endSpectrumWrite();
         RELEASE(spectrumLock);
     }
 }
 
+// Balance increase of one entity, element of the batch passed to increaseEnergyBatch()
+struct EnergyIncrease
+{
+    m256i publicKey;
+    long long amount;
+};
+
+// Return if a is processed before b in increaseEnergyBatch(): order by hash map start index, then by public key.
+// Being a strict total order on distinct keys, the resulting spectrum does not depend on the sorting algorithm.
+static inline bool energyIncreaseLess(const EnergyIncrease& a, const EnergyIncrease& b)
+{
+    const unsigned int indexA = a.publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    const unsigned int indexB = b.publicKey.m256i_u32[0] & (SPECTRUM_CAPACITY - 1);
+    if (indexA != indexB)
+        return indexA < indexB;
+    for (int i = 3; i >= 0; --i)
+    {
+        if (a.publicKey.m256i_u64[i] != b.publicKey.m256i_u64[i])
+            return a.publicKey.m256i_u64[i] < b.publicKey.m256i_u64[i];
+    }
+    return false;
+}
+
+// Sort batch of balance increases in place with heap sort (no extra memory, O(n log n) worst case).
+static void sortEnergyIncreases(EnergyIncrease* increases, unsigned int count)
+{
+    // Sift element down in the max-heap increases[0..end)
+    auto siftDown = [increases](unsigned int root, unsigned int end)
+    {
+        while (2 * root + 1 < end)
+        {
+            unsigned int child = 2 * root + 1;
+            if (child + 1 < end && energyIncreaseLess(increases[child], increases[child + 1]))
+                ++child;
+            if (!energyIncreaseLess(increases[root], increases[child]))
+                return;
+            const EnergyIncrease tmp = increases[root];
+            increases[root] = increases[child];
+            increases[child] = tmp;
+            root = child;
+        }
+    };
+
+    for (unsigned int i = count / 2; i-- > 0; )
+        siftDown(i, count);
+    for (unsigned int end = count; end-- > 1; )
+    {
+        const EnergyIncrease tmp = increases[0];
+        increases[0] = increases[end];
+        increases[end] = tmp;
+        siftDown(0, end);
+    }
+}
+
+// Increase balances of many entities with a single acquisition of spectrumLock. The increases are sorted in place
+// by hash map index before being applied, which keeps the hash map accesses local. Entries with zero public key or
+// negative amount are skipped, like in increaseEnergy().
+static void increaseEnergyBatch(EnergyIncrease* increases, unsigned int count)
+{
+    sortEnergyIncreases(increases, count);
+
+    ACQUIRE(spectrumLock);
+    beginSpectrumWrite();
+
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!isZero(increases[i].publicKey) && increases[i].amount >= 0)
+        {
+            increaseEnergyOfLockedSpectrum(increases[i].publicKey, increases[i].amount);
+        }
+    }
+
+    endSpectrumWrite();
+    RELEASE(spectrumLock);
+}
+
 // Decrease balance of entity if it is high enough. Does NOT check if index is valid.
 static bool decreaseEnergy(const int index, long long amount)
 {
@@ -359,9 +525,11 @@ static bool decreaseEnergy(const int index, long long amount)
 
         if (energy(index) >= amount)
         {
+            beginSpectrumWrite();
             spectrum[index].outgoingAmount += amount;
             spectrum[index].numberOfOutgoingTransfers++;
             spectrum[index].latestOutgoingTransferTick = system.tick;
+            endSpectrumWrite();
 
             spectrumInfo.totalAmount -= amount;
 
@@ -421,6 +589,7 @@ static bool initSpectrum()
         return false;
     }
     spectrumLock = 0;
+    spectrumWriteSequence = 0;
 
     return true;
 }
@@ -0,0 +1,119 @@
+#pragma once
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/assert.h"
+#include "platform/random.h"
+
+
+// Hash set of indices into an external array of 256-bit digests, for finding unique or duplicate digests in O(n)
+// instead of comparing all pairs. It uses open addressing with linear probing and a hash table of at least
+// twice the capacity. The hash function mixes all 256 bits with a random key that is drawn in reset(), so an
+// attacker cannot craft digests that collide in the hash table (a plain prefix of the digest would allow this).
+template <unsigned int capacity>
+class DigestIndexSet
+{
+public:
+    static_assert(capacity > 0 && capacity < 0xffff, "Indices are stored as unsigned short");
+
+    // Smallest power of 2 that is at least twice the capacity (load factor <= 0.5)
+    static constexpr unsigned int hashTableSize = []()
+    {
+        unsigned int size = 1;
+        while (size < 2 * capacity)
+            size <<= 1;
+        return size;
+    }();
+
+    // Remove all elements and draw new random hash key.
+    void reset()
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            random64(&hashKey[i]);
+        }
+        setMem(slots, sizeof(slots), 0);
+        population = 0;
+    }
+
+    // Look up digest in set, using digests[idx] for comparing with element idx. If the digest is found, its index is
+    // returned. Otherwise, newIndex is inserted and returned. The caller has to make sure that digests[newIndex]
+    // holds the digest before the next call. If the set is full, the digest is not inserted and newIndex is returned.
+    unsigned int findOrInsert(const m256i* digests, const m256i& digest, unsigned int newIndex)
+    {
+        ASSERT(newIndex < capacity);
+        unsigned int slotIdx = hash(digest);
+        while (slots[slotIdx])
+        {
+            const unsigned int idx = slots[slotIdx] - 1;
+            if (digests[idx] == digest)
+            {
+                return idx;
+            }
+            slotIdx = (slotIdx + 1) & (hashTableSize - 1);
+        }
+        if (population < capacity)
+        {
+            slots[slotIdx] = (unsigned short)(newIndex + 1);
+            ++population;
+        }
+        return newIndex;
+    }
+
+    // Look up digest in set, using digests[idx] for comparing with element idx. Returns the index if the digest is
+    // found and capacity otherwise. Only reads the set, so it may run concurrently with other calls of find().
+    unsigned int find(const m256i* digests, const m256i& digest) const
+    {
+        unsigned int slotIdx = hash(digest);
+        while (slots[slotIdx])
+        {
+            const unsigned int idx = slots[slotIdx] - 1;
+            if (digests[idx] == digest)
+            {
+                return idx;
+            }
+            slotIdx = (slotIdx + 1) & (hashTableSize - 1);
+        }
+        return capacity;
+    }
+
+    // Return number of elements in set.
+    unsigned int size() const
+    {
+        return population;
+    }
+
+private:
+    unsigned int hash(const m256i& digest) const
+    {
+        unsigned long long h = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            h = (h ^ digest.m256i_u64[i] ^ hashKey[i]) * 0x9E3779B97F4A7C15ULL;
+            h ^= h >> 29;
+        }
+        return (unsigned int)(h & (hashTableSize - 1));
+    }
+
+    unsigned long long hashKey[4];
+    unsigned short slots[hashTableSize]; // 0 means empty, otherwise index + 1
+    unsigned int population;
+};
+
+// Return if any non-zero digest occurs more than once in digests[0..count). Zero digests (empty slots) are ignored.
+// Runs in O(count) with a DigestIndexSet on the stack (about 2 bytes * 4 * capacity).
+template <unsigned int capacity>
+static bool containsDuplicateNonZeroDigest(const m256i* digests, unsigned int count)
+{
+    ASSERT(count <= capacity);
+    DigestIndexSet<capacity> set;
+    set.reset();
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!isZero(digests[i]) && set.findOrInsert(digests, digests[i], i) != i)
+        {
+            return true;
+        }
+    }
+    return false;
+}
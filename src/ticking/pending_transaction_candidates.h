@@ -0,0 +1,180 @@
+#pragma once
+
+#include "platform/memory_util.h"
+#include "platform/concurrency.h"
+#include "platform/assert.h"
+
+#include "network_messages/transactions.h"
+
+
+// Slots of a pending transaction pool that contain transactions scheduled for a target tick, collected ahead of
+// time for the tick leader. Finding them requires a scan of the whole pool (SPECTRUM_CAPACITY slots of
+// MAX_TRANSACTION_SIZE bytes for the entity pool), which used to take most of the time of leader ticks. The tick
+// processor starts the scan a tick early, the pool is split into chunks that are scanned in parallel by the request
+// processors, and the tick processor helps with the remaining chunks when it needs the result.
+//
+// Transactions added to the pool for the target tick after their chunk has been scanned are appended by the thread
+// adding them, so the candidates are complete without duplicates. A slot may be overwritten by a transaction with a
+// higher tick after it has been collected, so the tick of a candidate has to be checked when it is used.
+//
+// The pool lock protecting the pending transactions must be held by threads adding transactions (around
+// beginAdd() and endAdd()) and when accessing the candidates. start() acquires it.
+template <unsigned long long numberOfSlots, unsigned long long slotSize, unsigned int chunkSize = 16384>
+class PendingTransactionCandidates
+{
+public:
+    static constexpr unsigned int numberOfChunks = (unsigned int)((numberOfSlots + chunkSize - 1) / chunkSize);
+
+    bool init(const unsigned char* pendingTransactions, volatile char* pendingTransactionsLock)
+    {
+        pool = pendingTransactions;
+        poolLock = pendingTransactionsLock;
+        if (!allocPoolWithErrorLog(L"pendingTransactionCandidates", sizeof(unsigned int) * numberOfSlots, (void**)&candidates, __LINE__))
+        {
+            return false;
+        }
+        targetTick = 0;
+        numberOfCandidates = 0;
+        nextChunk = numberOfChunks;
+        numberOfScannedChunks = numberOfChunks;
+        setMem((void*)chunkLocks, sizeof(chunkLocks), 0);
+        setMem((void*)isChunkScanned, sizeof(isChunkScanned), 0);
+        return true;
+    }
+
+    void deinit()
+    {
+        if (candidates)
+        {
+            freePool(candidates);
+            candidates = nullptr;
+        }
+    }
+
+    // Start collecting candidates for tick, dropping the previous ones. Called by the tick processor.
+    void start(unsigned int tick)
+    {
+        ASSERT(tick);
+
+        // a scan still running for a previous tick is finished first, because scanning threads do not check the tick
+        // before claiming a chunk
+        while (!isComplete())
+        {
+            tryScanChunk();
+        }
+
+        ACQUIRE(*poolLock);
+        targetTick = tick;
+        numberOfCandidates = 0;
+        setMem((void*)isChunkScanned, sizeof(isChunkScanned), 0);
+        numberOfScannedChunks = 0;
+        _mm_sfence();
+        nextChunk = 0;
+        RELEASE(*poolLock);
+    }
+
+    // Stop collecting candidates, called with pool lock held after the candidates have been used
+    void stop()
+    {
+        ASSERT(isComplete());
+        targetTick = 0;
+    }
+
+    // Return whether candidates are collected for tick (the scan may still be running)
+    bool isStarted(unsigned int tick) const
+    {
+        return tick && targetTick == tick;
+    }
+
+    // Return whether the whole pool has been scanned
+    bool isComplete() const
+    {
+        return numberOfScannedChunks == numberOfChunks;
+    }
+
+    // Scan the next chunk of the pool if the scan is running, can be called by any processor
+    void tryScanChunk()
+    {
+        if (nextChunk >= numberOfChunks)
+        {
+            return;
+        }
+        const unsigned int chunk = (unsigned int)_InterlockedIncrement(&nextChunk) - 1;
+        if (chunk >= numberOfChunks)
+        {
+            return;
+        }
+
+        const unsigned int tick = targetTick;
+        const unsigned long long beginSlot = (unsigned long long)chunk * chunkSize;
+        const unsigned long long endSlot = (beginSlot + chunkSize < numberOfSlots) ? beginSlot + chunkSize : numberOfSlots;
+        ACQUIRE(chunkLocks[chunk]);
+        for (unsigned long long slot = beginSlot; slot < endSlot; slot++)
+        {
+            if (((const Transaction*)&pool[slot * slotSize])->tick == tick)
+            {
+                appendCandidate((unsigned int)slot);
+            }
+        }
+        isChunkScanned[chunk] = 1;
+        RELEASE(chunkLocks[chunk]);
+        _InterlockedIncrement(&numberOfScannedChunks);
+    }
+
+    // Call before writing a transaction to slot, with pool lock held
+    void beginAdd(unsigned long long slot)
+    {
+        ASSERT(slot < numberOfSlots);
+        ACQUIRE(chunkLocks[slot / chunkSize]);
+    }
+
+    // Call after writing a transaction scheduled for tick to slot, with pool lock held
+    void endAdd(unsigned long long slot, unsigned int tick)
+    {
+        ASSERT(slot < numberOfSlots);
+        const unsigned int chunk = (unsigned int)(slot / chunkSize);
+        if (tick == targetTick && isChunkScanned[chunk])
+        {
+            // the scan of the chunk has missed the transaction
+            appendCandidate((unsigned int)slot);
+        }
+        RELEASE(chunkLocks[chunk]);
+    }
+
+    // Number of collected slots, to be called with pool lock held after the scan is complete
+    unsigned int getNumberOfCandidates() const
+    {
+        return (unsigned int)numberOfCandidates;
+    }
+
+    unsigned int getCandidate(unsigned int index) const
+    {
+        ASSERT(index < (unsigned int)numberOfCandidates);
+        return candidates[index];
+    }
+
+    // Remove candidate by moving the last one to its place
+    void removeCandidate(unsigned int index)
+    {
+        ASSERT(index < (unsigned int)numberOfCandidates);
+        candidates[index] = candidates[--numberOfCandidates];
+    }
+
+private:
+    void appendCandidate(unsigned int slot)
+    {
+        const unsigned int index = (unsigned int)_InterlockedIncrement(&numberOfCandidates) - 1;
+        ASSERT(index < numberOfSlots);
+        candidates[index] = slot;
+    }
+
+    const unsigned char* pool = nullptr;
+    volatile char* poolLock = nullptr;
+    unsigned int* candidates = nullptr;
+    volatile unsigned int targetTick = 0;
+    volatile long numberOfCandidates = 0;
+    volatile long nextChunk = 0;
+    volatile long numberOfScannedChunks = 0;
+    volatile char chunkLocks[numberOfChunks];
+    volatile char isChunkScanned[numberOfChunks];
+};
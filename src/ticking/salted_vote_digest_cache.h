@@ -0,0 +1,113 @@
+#pragma once
+
+#include "platform/m256.h"
+#include "platform/memory_util.h"
+#include "platform/assert.h"
+
+#include "network_messages/tick.h"
+
+#include "kangaroo_twelve.h"
+
+
+// Salted digests that a tick vote of a computor must contain in order to match the etalonTick of this node
+struct SaltedVoteDigests
+{
+    unsigned int saltedResourceTestingDigest;
+    unsigned int saltedTransactionBodyDigest;
+    m256i saltedSpectrumDigest;
+    m256i saltedUniverseDigest;
+    m256i saltedComputerDigest;
+};
+
+// Compute the salted digests expected in the tick vote of the computor with the given public key.
+static void computeSaltedVoteDigests(const m256i& computorPublicKey, unsigned int resourceTestingDigest, const Tick& etalon, SaltedVoteDigests& salted)
+{
+    m256i saltedData[2];
+    m256i saltedDigest;
+    saltedData[0] = computorPublicKey;
+    saltedData[1] = m256i::zero();
+    saltedData[1].m256i_u32[0] = resourceTestingDigest;
+    KangarooTwelve(saltedData, 32 + sizeof(resourceTestingDigest), &saltedDigest, sizeof(resourceTestingDigest));
+    salted.saltedResourceTestingDigest = saltedDigest.m256i_u32[0];
+
+    saltedData[1] = etalon.saltedSpectrumDigest;
+    KangarooTwelve64To32(saltedData, &salted.saltedSpectrumDigest);
+
+    saltedData[1] = etalon.saltedUniverseDigest;
+    KangarooTwelve64To32(saltedData, &salted.saltedUniverseDigest);
+
+    saltedData[1] = etalon.saltedComputerDigest;
+    KangarooTwelve64To32(saltedData, &salted.saltedComputerDigest);
+
+    saltedData[1] = m256i::zero();
+    saltedData[1].m256i_u32[0] = etalon.saltedTransactionBodyDigest;
+    KangarooTwelve(saltedData, 32 + sizeof(etalon.saltedTransactionBodyDigest), &saltedDigest, sizeof(etalon.saltedTransactionBodyDigest));
+    salted.saltedTransactionBodyDigest = saltedDigest.m256i_u32[0];
+}
+
+// Per-computor cache of the salted digests expected in tick votes, used by updateVotesCount().
+//
+// The expected digests only depend on the computor's public key and the salts of this node (resourceTestingDigest
+// and the salted digests of the etalonTick), but not on the content of the received vote. So they are computed
+// at most once per computor and salt change, instead of in every call of updateVotesCount() while the tick
+// processor is waiting for the quorum. The whole cache is invalidated if any salt changes, an entry is also
+// invalidated if the public key of the computor changes (new epoch / computor list).
+//
+// Not thread-safe, only to be used by the tick processor.
+template <unsigned int numberOfComputors>
+class SaltedVoteDigestCache
+{
+public:
+    // Invalidate all cached digests.
+    void reset()
+    {
+        setMem(&salts, sizeof(salts), 0);
+        ++generation;
+    }
+
+    // Return the salted digests expected in the vote of the given computor. Computes the digests only if they
+    // are not cached for the current salts yet.
+    const SaltedVoteDigests& get(unsigned int computorIndex, const m256i& computorPublicKey,
+        unsigned int resourceTestingDigest, const Tick& etalon)
+    {
+        ASSERT(computorIndex < numberOfComputors);
+
+        if (resourceTestingDigest != salts.resourceTestingDigest
+            || etalon.saltedTransactionBodyDigest != salts.saltedTransactionBodyDigest
+            || etalon.saltedSpectrumDigest != salts.saltedSpectrumDigest
+            || etalon.saltedUniverseDigest != salts.saltedUniverseDigest
+            || etalon.saltedComputerDigest != salts.saltedComputerDigest)
+        {
+            // Salts have changed -> invalidate all entries
+            salts.resourceTestingDigest = resourceTestingDigest;
+            salts.saltedTransactionBodyDigest = etalon.saltedTransactionBodyDigest;
+            salts.saltedSpectrumDigest = etalon.saltedSpectrumDigest;
+            salts.saltedUniverseDigest = etalon.saltedUniverseDigest;
+            salts.saltedComputerDigest = etalon.saltedComputerDigest;
+            ++generation;
+        }
+
+        if (cachedGeneration[computorIndex] != generation || cachedPublicKeys[computorIndex] != computorPublicKey)
+        {
+            computeSaltedVoteDigests(computorPublicKey, resourceTestingDigest, etalon, entries[computorIndex]);
+            cachedGeneration[computorIndex] = generation;
+            cachedPublicKeys[computorIndex] = computorPublicKey;
+        }
+
+        return entries[computorIndex];
+    }
+
+private:
+    struct
+    {
+        unsigned int resourceTestingDigest;
+        unsigned int saltedTransactionBodyDigest;
+        m256i saltedSpectrumDigest;
+        m256i saltedUniverseDigest;
+        m256i saltedComputerDigest;
+    } salts;
+    unsigned long long generation = 1;
+    unsigned long long cachedGeneration[numberOfComputors] = { 0 };
+    m256i cachedPublicKeys[numberOfComputors];
+    SaltedVoteDigests entries[numberOfComputors];
+};
@@ -1,4 +1,5 @@
 #pragma once
+#include <lib/platform_common/qintrin.h>
 #include "platform/memory.h"
 #include "network_messages/transactions.h"
 #define VOTE_COUNTER_INPUT_TYPE 1
@@ -6,7 +7,12 @@
 #define VOTE_COUNTER_NUM_BIT_PER_COMP 10
 static_assert((1<< VOTE_COUNTER_NUM_BIT_PER_COMP) >= NUMBER_OF_COMPUTORS, "Invalid number of bit per datum");
 static_assert(VOTE_COUNTER_DATA_SIZE_IN_BYTES * 8 >= NUMBER_OF_COMPUTORS * VOTE_COUNTER_NUM_BIT_PER_COMP, "Invalid data size");
+// 8 values are packed to 10 bytes with one 16-byte load/store, the remaining values are handled one by one
+static_assert((NUMBER_OF_COMPUTORS / 8 - 1) * 10 + 16 <= VOTE_COUNTER_DATA_SIZE_IN_BYTES, "SIMD access of vote packet out of bounds");
 
+// Vote counts are only packed to 10 bit per computor in the vote packets that are sent with transactions. Internally,
+// counts are processed as 32-bit integers (buffer), which allows to unpack, validate, and accumulate a packet with
+// SIMD instructions, 8 computors at a time.
 class VoteCounter
 {
 private:
@@ -47,6 +53,67 @@ protected:
 		accumulatedVoteCount[computorIdx] += value;
 	}
 
+	// Unpack NUMBER_OF_COMPUTORS 10-bit values from data, same encoding as extract10Bit(). Each group of 4 values is
+	// stored big-endian in 5 bytes, so value idx is in the 16-bit big-endian word at byte idx + idx / 4, shifted
+	// left by 2 * (3 - idx % 4) bits. 8 values (10 bytes) are unpacked at once: the bytes of each word are shuffled
+	// into a 16-bit lane, the lane is shifted left to put the value in the highest 10 bits, and then right by 6.
+	void unpack10BitValues(const unsigned char* data, unsigned int* values)
+	{
+		const __m128i wordShuffle = _mm_setr_epi8(1, 0, 2, 1, 3, 2, 4, 3, 6, 5, 7, 6, 8, 7, 9, 8);
+		const __m128i shiftLeftFactors = _mm_setr_epi16(1, 4, 16, 64, 1, 4, 16, 64);
+		unsigned int idx = 0;
+		for (; idx + 8 <= NUMBER_OF_COMPUTORS; idx += 8)
+		{
+			__m128i words = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + idx + (idx >> 2))), wordShuffle);
+			words = _mm_srli_epi16(_mm_mullo_epi16(words, shiftLeftFactors), 6);
+			_mm256_storeu_si256((__m256i*)(values + idx), _mm256_cvtepu16_epi32(words));
+		}
+		for (; idx < NUMBER_OF_COMPUTORS; idx++)
+		{
+			values[idx] = extract10Bit(data, idx);
+		}
+	}
+
+	// Pack NUMBER_OF_COMPUTORS values to 10 bit each, same encoding as update10Bit(). Values are truncated to 10 bit.
+	// Bytes of data after the packed values are set to 0.
+	void pack10BitValues(const unsigned int* values, unsigned char* data)
+	{
+		const __m128i highByteShuffle = _mm_setr_epi8(1, 3, 5, 7, -1, 9, 11, 13, 15, -1, -1, -1, -1, -1, -1, -1);
+		const __m128i lowByteShuffle = _mm_setr_epi8(-1, 0, 2, 4, 6, -1, 8, 10, 12, 14, -1, -1, -1, -1, -1, -1);
+		const __m128i shiftLeftFactors = _mm_setr_epi16(64, 16, 4, 1, 64, 16, 4, 1);
+		const __m128i valueMask = _mm_set1_epi16(0x3ff);
+		setMem(data, VOTE_COUNTER_DATA_SIZE_IN_BYTES, 0);
+		unsigned int idx = 0;
+		for (; idx + 8 <= NUMBER_OF_COMPUTORS; idx += 8)
+		{
+			__m128i words = _mm_packus_epi32(_mm_loadu_si128((const __m128i*)(values + idx)), _mm_loadu_si128((const __m128i*)(values + idx + 4)));
+			words = _mm_mullo_epi16(_mm_and_si128(words, valueMask), shiftLeftFactors);
+			// Neighboring values share one byte, the 6 bytes after the group are written with 0 (overwritten by next group)
+			__m128i bytes = _mm_or_si128(_mm_shuffle_epi8(words, highByteShuffle), _mm_shuffle_epi8(words, lowByteShuffle));
+			_mm_storeu_si128((__m128i*)(data + idx + (idx >> 2)), bytes);
+		}
+		for (; idx < NUMBER_OF_COMPUTORS; idx++)
+		{
+			update10Bit(data, idx, values[idx] & 0x3ff);
+		}
+	}
+
+	// Add values of all computors to accumulatedVoteCount
+	void accumulateVoteCounts(const unsigned int* values)
+	{
+		unsigned int idx = 0;
+		for (; idx + 4 <= NUMBER_OF_COMPUTORS; idx += 4)
+		{
+			__m256i acc = _mm256_loadu_si256((const __m256i*)(accumulatedVoteCount + idx));
+			acc = _mm256_add_epi64(acc, _mm256_cvtepu32_epi64(_mm_loadu_si128((const __m128i*)(values + idx))));
+			_mm256_storeu_si256((__m256i*)(accumulatedVoteCount + idx), acc);
+		}
+		for (; idx < NUMBER_OF_COMPUTORS; idx++)
+		{
+			accumulateVoteCount(idx, values[idx]);
+		}
+	}
+
 public:
 	static constexpr unsigned int VoteCounterDataSize = sizeof(votes) + sizeof(accumulatedVoteCount);
 	void init()
@@ -64,12 +131,20 @@ public:
 	// get and compress number of votes of 676 computors to 676x10 bit numbers between [fromTick, toTick)
 	void compressNewVotesPacket(unsigned int fromTick, unsigned int toTick, unsigned int computorIdx, unsigned char votePacket[VOTE_COUNTER_DATA_SIZE_IN_BYTES])
 	{
-		setMem(votePacket, sizeof(votePacket), 0);
 		setMem(buffer, sizeof(buffer), 0);
 		for (unsigned int i = fromTick; i < toTick; i++)
 		{
 			unsigned int slotId = i % (NUMBER_OF_COMPUTORS * 2);
-			for (int j = 0; j < NUMBER_OF_COMPUTORS; j++)
+			const __m256i tick = _mm256_set1_epi32(i);
+			int j = 0;
+			for (; j + 8 <= NUMBER_OF_COMPUTORS; j += 8)
+			{
+				// compare result is -1 for each vote of tick i
+				__m256i count = _mm256_loadu_si256((const __m256i*)(buffer + j));
+				count = _mm256_sub_epi32(count, _mm256_cmpeq_epi32(_mm256_loadu_si256((const __m256i*)(votes[slotId] + j)), tick));
+				_mm256_storeu_si256((__m256i*)(buffer + j), count);
+			}
+			for (; j < NUMBER_OF_COMPUTORS; j++)
 			{
 				if (votes[slotId][j] == i)
 				{
@@ -78,23 +153,22 @@ public:
 			}
 		}
 		buffer[computorIdx] = 0; // remove self-report
-		for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
-		{
-			update10Bit(votePacket, i, buffer[i]);
-		}
+		pack10BitValues(buffer, votePacket);
 	}
 
 	bool validateNewVotesPacket(const unsigned char* votePacket, unsigned int computorIdx)
 	{
+		unpack10BitValues(votePacket, buffer);
 		unsigned long long sum = 0;
+		unsigned int maxVotes = 0;
 		for (int i = 0; i < NUMBER_OF_COMPUTORS; i++)
 		{
-			buffer[i] = extract10Bit(votePacket, i);
-			if (buffer[i] > NUMBER_OF_COMPUTORS)
-			{
-				return false;
-			}
 			sum += buffer[i];
+			maxVotes = (buffer[i] > maxVotes) ? buffer[i] : maxVotes;
+		}
+		if (maxVotes > NUMBER_OF_COMPUTORS)
+		{
+			return false;
 		}
 		// check #0: sum of all vote must be >= 675*451 (vote of the tick leader is removed)
 		if (sum < (NUMBER_OF_COMPUTORS - 1) * QUORUM)
@@ -111,13 +185,10 @@ public:
 
 	void addVotes(const unsigned char* newVotePacket, unsigned int computorIdx)
 	{
+		// validation unpacks the vote counts to buffer
 		if (validateNewVotesPacket(newVotePacket, computorIdx))
 		{
-			for (int i = 0; i < NUMBER_OF_COMPUTORS; i++)
-			{
-				unsigned int vote_count = extract10Bit(newVotePacket, i);
-				accumulateVoteCount(i, vote_count);
-			}
+			accumulateVoteCounts(buffer);
 		}
 	}
 
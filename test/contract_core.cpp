@@ -5,6 +5,7 @@
 #define TRACK_MAX_STACK_BUFFER_SIZE
 #include "../src/contract_core/stack_buffer.h"
 #include "../src/contract_core/contract_action_tracker.h"
+#include "../src/contract_core/contract_entry_point_stats.h"
 
 TEST(TestCoreContractCore, StackBuffer)
 {
@@ -50,6 +51,17 @@ TEST(TestCoreContractCore, StackBuffer)
     EXPECT_EQ(s1.failedAllocAttempts(), 6);
     EXPECT_FALSE(s1.free());
 
+    // peak size can be reset for measuring a section of code
+    EXPECT_EQ(s1.peakSize(), 104);
+    EXPECT_NE(s1.allocate(10), nullptr);
+    s1.resetPeakSize();
+    EXPECT_EQ(s1.peakSize(), 11);
+    EXPECT_NE(s1.allocate(20), nullptr);
+    EXPECT_TRUE(s1.free());
+    EXPECT_TRUE(s1.free());
+    EXPECT_EQ(s1.peakSize(), 32);
+    EXPECT_EQ(s1.maxSizeObserved(), 104);
+
     char* p;
     EXPECT_NE(p = s1.allocate(70), nullptr);    // success
     *p = 100;
@@ -165,3 +177,65 @@ TEST(TestCoreContractCore, ContractActionTracker)
 
     at.freeBuffer();
 }
+
+TEST(TestCoreContractCore, ContractEntryPointStatsTable)
+{
+    typedef ContractEntryPointStatsTable<3, 8> StatsTable;
+    static StatsTable table;
+    table.reset();
+    EXPECT_EQ(StatsTable::capacityPerContract, 4);
+
+    ContractEntryPointStatistics stats[StatsTable::capacityPerContract];
+    EXPECT_EQ(table.getStatistics(1, stats), 0);
+
+    // same input type with different kind is a different entry point, registering twice is no problem
+    EXPECT_TRUE(table.registerEntryPoint(1, ContractEntryPointSystemProcedure, 3));
+    EXPECT_TRUE(table.registerEntryPoint(1, ContractEntryPointUserProcedure, 3));
+    EXPECT_TRUE(table.registerEntryPoint(1, ContractEntryPointUserFunction, 3));
+    EXPECT_TRUE(table.registerEntryPoint(1, ContractEntryPointUserFunction, 3));
+    EXPECT_TRUE(table.registerEntryPoint(1, ContractEntryPointUserFunction, 1000));
+    EXPECT_FALSE(table.registerEntryPoint(1, ContractEntryPointUserFunction, 1001)); // full
+    EXPECT_TRUE(table.registerEntryPoint(2, ContractEntryPointUserFunction, 1001));
+
+    table.record(1, ContractEntryPointUserFunction, 3, 100, 500, 1, 2);
+    table.record(1, ContractEntryPointUserFunction, 3, 300, 200, 3, 4);
+    table.record(1, ContractEntryPointUserProcedure, 3, 50, 1000, 5, 6);
+    table.record(1, ContractEntryPointUserFunction, 1001, 1000, 1000, 1000, 1000); // not registered -> ignored
+    table.record(0, ContractEntryPointUserFunction, 3, 1000, 1000, 1000, 1000); // not registered -> ignored
+
+    EXPECT_EQ(table.getStatistics(0, stats), 0);
+    EXPECT_EQ(table.getStatistics(2, stats), 1);
+    EXPECT_EQ(stats[0].numberOfCalls, 0);
+    EXPECT_EQ(table.getStatistics(1, stats), 4);
+    bool found[4] = { false, false, false, false };
+    for (unsigned int i = 0; i < 4; ++i)
+    {
+        if (stats[i].kind == ContractEntryPointUserFunction && stats[i].inputType == 3)
+        {
+            EXPECT_EQ(stats[i].numberOfCalls, 2);
+            EXPECT_EQ(stats[i].totalExecutionTicks, 400);
+            EXPECT_EQ(stats[i].maxExecutionTicks, 300);
+            EXPECT_EQ(stats[i].maxLocalsStackSize, 500);
+            EXPECT_EQ(stats[i].numberOfSpectrumOperations, 4);
+            EXPECT_EQ(stats[i].numberOfUniverseOperations, 6);
+            found[0] = true;
+        }
+        else if (stats[i].kind == ContractEntryPointUserProcedure && stats[i].inputType == 3)
+        {
+            EXPECT_EQ(stats[i].numberOfCalls, 1);
+            EXPECT_EQ(stats[i].totalExecutionTicks, 50);
+            EXPECT_EQ(stats[i].maxExecutionTicks, 50);
+            EXPECT_EQ(stats[i].maxLocalsStackSize, 1000);
+            EXPECT_EQ(stats[i].numberOfSpectrumOperations, 5);
+            EXPECT_EQ(stats[i].numberOfUniverseOperations, 6);
+            found[1] = true;
+        }
+        else
+        {
+            EXPECT_EQ(stats[i].numberOfCalls, 0);
+            found[(stats[i].kind == ContractEntryPointSystemProcedure) ? 2 : 3] = true;
+        }
+    }
+    for (unsigned int i = 0; i < 4; ++i)
+        EXPECT_TRUE(found[i]);
+}
@@ -0,0 +1,97 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_function_cache.h"
+
+
+typedef ContractFunctionResultCache<64, 32> TestCache;
+
+static void putOutput(TestCache& cache, unsigned int contractIndex, unsigned short inputType, const m256i& input, long long version, unsigned char outputValue, unsigned short outputSize = 32)
+{
+    m256i digest;
+    TestCache::computeInputDigest(&input, sizeof(input), digest);
+    unsigned char output[64];
+    setMem(output, sizeof(output), outputValue);
+    cache.put(contractIndex, inputType, sizeof(input), digest, version, output, outputSize);
+}
+
+static bool getOutput(TestCache& cache, unsigned int contractIndex, unsigned short inputType, const m256i& input, long long version, unsigned char& outputValue)
+{
+    m256i digest;
+    TestCache::computeInputDigest(&input, sizeof(input), digest);
+    unsigned char output[TestCache::maxCachedOutputSize];
+    unsigned short outputSize = 0;
+    if (!cache.tryGet(contractIndex, inputType, sizeof(input), digest, version, output, outputSize))
+        return false;
+    EXPECT_EQ(outputSize, 32);
+    for (unsigned int i = 1; i < outputSize; ++i)
+        EXPECT_EQ(output[i], output[0]);
+    outputValue = output[0];
+    return true;
+}
+
+TEST(TestCoreContractFunctionCache, HitMissAndInvalidation)
+{
+    static TestCache cache;
+    cache.reset();
+
+    const m256i input1(1, 2, 3, 4);
+    const m256i input2(5, 6, 7, 8);
+    unsigned char value = 0;
+
+    long long version = cache.currentVersion();
+    EXPECT_FALSE(getOutput(cache, 1, 1, input1, version, value));
+    putOutput(cache, 1, 1, input1, version, 11);
+    EXPECT_TRUE(getOutput(cache, 1, 1, input1, version, value));
+    EXPECT_EQ(value, 11);
+
+    // Key consists of contract index, input type, and input
+    EXPECT_FALSE(getOutput(cache, 2, 1, input1, version, value));
+    EXPECT_FALSE(getOutput(cache, 1, 2, input1, version, value));
+    EXPECT_FALSE(getOutput(cache, 1, 1, input2, version, value));
+
+    // Outputs larger than the cache entries are not stored
+    putOutput(cache, 1, 1, input2, version, 22, 33);
+    EXPECT_FALSE(getOutput(cache, 1, 1, input2, version, value));
+
+    EXPECT_EQ(cache.hitCount(), 1);
+    EXPECT_EQ(cache.missCount(), 5);
+    EXPECT_EQ(cache.storeCount(), 1);
+
+    // After invalidation, nothing is returned
+    cache.invalidate();
+    long long newVersion = cache.currentVersion();
+    EXPECT_NE(newVersion, version);
+    EXPECT_FALSE(getOutput(cache, 1, 1, input1, newVersion, value));
+
+    // Output of execution that started before invalidation is not stored
+    putOutput(cache, 1, 1, input1, version, 33);
+    EXPECT_FALSE(getOutput(cache, 1, 1, input1, newVersion, value));
+    putOutput(cache, 1, 1, input1, newVersion, 44);
+    EXPECT_TRUE(getOutput(cache, 1, 1, input1, newVersion, value));
+    EXPECT_EQ(value, 44);
+}
+
+TEST(TestCoreContractFunctionCache, ManyKeysNeverReturnWrongOutput)
+{
+    static TestCache cache;
+    cache.reset();
+    const long long version = cache.currentVersion();
+
+    // More keys than entries: entries are replaced, but a hit always returns the output stored for the key
+    for (unsigned int i = 0; i < 1000; ++i)
+        putOutput(cache, i % 7, i % 5, m256i(i, 0, 0, 0), version, (unsigned char)i);
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < 1000; ++i)
+    {
+        unsigned char value = 0;
+        if (getOutput(cache, i % 7, i % 5, m256i(i, 0, 0, 0), version, value))
+        {
+            EXPECT_EQ(value, (unsigned char)i);
+            ++hits;
+        }
+    }
+    EXPECT_GT(hits, 0u);
+    EXPECT_LE(hits, 64u);
+}
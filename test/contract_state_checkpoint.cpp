@@ -0,0 +1,152 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/contract_core/contract_state_checkpoint.h"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+typedef ContractStateCheckpoint<4> TestCheckpoint;
+static constexpr unsigned long long pageSize = TestCheckpoint::pageSize;
+
+static void setChangeFlag(unsigned long long* changeFlags, unsigned int contractIndex)
+{
+    changeFlags[contractIndex >> 6] |= (1ULL << (contractIndex & 63));
+}
+
+TEST(TestCoreContractStateCheckpoint, UpdateAndRestoreChangedPages)
+{
+    // different sizes, including partial last page and no state
+    std::vector<unsigned char> stateData[4];
+    const unsigned long long stateSizes[4] = { 10 * pageSize, 3 * pageSize + 100, 0, 50 };
+    unsigned char* states[4];
+    std::mt19937_64 gen64(42);
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        stateData[i].resize(stateSizes[i] + 1);
+        for (auto& byte : stateData[i])
+            byte = (unsigned char)gen64();
+        states[i] = stateData[i].data();
+    }
+
+    TestCheckpoint* checkpoint = new TestCheckpoint;
+    EXPECT_TRUE(checkpoint->init(states, stateSizes));
+    EXPECT_EQ(checkpoint->getCheckpoint(2), nullptr);
+    for (unsigned int i = 0; i < 4; i++)
+    {
+        EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(i), TestCheckpoint::getNumberOfPages(stateSizes[i]));
+        if (stateSizes[i])
+            EXPECT_EQ(memcmp(checkpoint->getCheckpoint(i), states[i], stateSizes[i]), 0);
+        checkpoint->markSaved(i);
+        EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(i), 0);
+    }
+
+    // change pages 2 and 7 of contract 0 and the partial last page of contract 1
+    states[0][2 * pageSize + 5] ^= 1;
+    states[0][7 * pageSize + pageSize - 1] ^= 0x80;
+    states[1][3 * pageSize + 99] ^= 4;
+    const std::vector<unsigned char> changedState0(states[0], states[0] + stateSizes[0]);
+    const std::vector<unsigned char> changedState1(states[1], states[1] + stateSizes[1]);
+
+    // contracts without change flag are not looked at
+    unsigned long long changeFlags[1] = { 0 };
+    setChangeFlag(changeFlags, 1);
+    EXPECT_EQ(checkpoint->update(changeFlags), 1);
+    EXPECT_TRUE(checkpoint->isPageUnsaved(1, 3));
+    EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(0), 0);
+
+    setChangeFlag(changeFlags, 0);
+    setChangeFlag(changeFlags, 2);
+    setChangeFlag(changeFlags, 3);
+    EXPECT_EQ(checkpoint->update(changeFlags), 2);
+    EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(0), 2);
+    EXPECT_TRUE(checkpoint->isPageUnsaved(0, 2));
+    EXPECT_TRUE(checkpoint->isPageUnsaved(0, 7));
+    EXPECT_FALSE(checkpoint->isPageUnsaved(0, 3));
+    EXPECT_EQ(memcmp(checkpoint->getCheckpoint(0), states[0], stateSizes[0]), 0);
+    EXPECT_EQ(memcmp(checkpoint->getCheckpoint(1), states[1], stateSizes[1]), 0);
+    EXPECT_EQ(checkpoint->getNumberOfCopiedPages(), 3);
+
+    // checkpoint without changes copies nothing
+    EXPECT_EQ(checkpoint->update(changeFlags), 0);
+
+    // failed procedure changing state of contract 0 is rolled back, other contracts are kept
+    for (unsigned long long i = pageSize; i < 4 * pageSize; i++)
+        states[0][i] = 0xff;
+    states[0][9 * pageSize] ^= 1;
+    states[1][0] ^= 1;
+    EXPECT_EQ(checkpoint->restore(0), 4);
+    EXPECT_EQ(memcmp(states[0], changedState0.data(), stateSizes[0]), 0);
+    EXPECT_NE(memcmp(states[1], changedState1.data(), stateSizes[1]), 0);
+    EXPECT_EQ(checkpoint->restore(0), 0);
+    EXPECT_EQ(checkpoint->restore(2), 0);
+
+    // bytes after the end of state are neither compared nor copied
+    states[3][stateSizes[3]] ^= 1;
+    EXPECT_EQ(checkpoint->update(changeFlags), 1); // state[1][0]
+    EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(3), 0);
+
+    checkpoint->markAllPagesUnsaved(0);
+    EXPECT_EQ(checkpoint->getNumberOfUnsavedPages(0), 10);
+
+    checkpoint->deinit();
+    EXPECT_FALSE(checkpoint->isInitialized());
+    EXPECT_EQ(checkpoint->update(changeFlags), 0);
+    delete checkpoint;
+}
+
+TEST(TestCoreContractStateCheckpoint, CheckpointCostByStateSize)
+{
+    // Cost of a checkpoint at the end of a tick in which 1 of 32 contracts has changed a few pages, compared to copying
+    // all states as done for each snapshot
+    constexpr unsigned int numberOfContracts = 32;
+    typedef ContractStateCheckpoint<numberOfContracts> BenchmarkCheckpoint;
+    std::mt19937_64 gen64(1234);
+    for (unsigned long long stateSize = 1ULL << 18; stateSize <= (1ULL << 22); stateSize <<= 2)
+    {
+        std::vector<unsigned char> stateData(numberOfContracts * stateSize, 7);
+        std::vector<unsigned char> fullCopy(numberOfContracts * stateSize, 0);
+        unsigned char* states[numberOfContracts];
+        unsigned long long stateSizes[numberOfContracts];
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+        {
+            states[i] = stateData.data() + i * stateSize;
+            stateSizes[i] = stateSize;
+        }
+        BenchmarkCheckpoint* checkpoint = new BenchmarkCheckpoint;
+        ASSERT_TRUE(checkpoint->init(states, stateSizes));
+
+        auto startTime = std::chrono::high_resolution_clock::now();
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+            copyMem(fullCopy.data() + i * stateSize, states[i], stateSize);
+        auto fullCopyDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+        std::cout << numberOfContracts << " states of " << (stateSize >> 10) << " KB: full copy " << fullCopyDuration.count() << " us";
+
+        for (unsigned int dirtyPages : { 0u, 4u, 16u })
+        {
+            const unsigned int changedContract = (unsigned int)(gen64() % numberOfContracts);
+            const unsigned long long numberOfPages = BenchmarkCheckpoint::getNumberOfPages(stateSize);
+            for (unsigned int i = 0; i < dirtyPages; i++)
+                states[changedContract][(i * numberOfPages / dirtyPages) * pageSize] ^= 1;
+            unsigned long long changeFlags[1] = { 0 };
+            setChangeFlag(changeFlags, changedContract);
+
+            startTime = std::chrono::high_resolution_clock::now();
+            const unsigned long long copiedPages = checkpoint->update(changeFlags);
+            auto duration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+            EXPECT_EQ(copiedPages, dirtyPages);
+            std::cout << ", checkpoint with " << copiedPages << " dirty pages " << duration.count() << " us";
+        }
+        std::cout << std::endl;
+        for (unsigned int i = 0; i < numberOfContracts; i++)
+            EXPECT_EQ(memcmp(checkpoint->getCheckpoint(i), states[i], stateSize), 0);
+
+        checkpoint->deinit();
+        delete checkpoint;
+    }
+}
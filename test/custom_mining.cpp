@@ -15,6 +15,14 @@
 #endif
 
 #include "src/mining/mining.h"
+#include "src/ticking/digest_set.h"
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
 
 TEST(CustomMining, TaskStorageGeneral)
 {
@@ -277,3 +285,213 @@ TEST(CustomMining, SolutionsStorageOverflow)
 
     storage.deinit();
 }
+
+template <unsigned int numberOfShards>
+using TestSolutionCache = CustomMininingCache<CustomMiningSolutionCacheEntry, 1 << 16, 20, numberOfShards>;
+
+template <unsigned int numberOfShards>
+static void checkSolutionCache(TestSolutionCache<numberOfShards>& cache)
+{
+    constexpr unsigned int NUMBER_OF_SOLS = (1 << 16) / 2;
+    cache.init();
+
+    // First pass: each solution is new (miss) unless probing failed (collision)
+    unsigned int added = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_SOLS; i++)
+    {
+        CustomMiningSolutionCacheEntry entry;
+        entry.set(i + 1, i * 7, 0, 1);
+        unsigned int cacheIndex = 0;
+        int sts = cache.tryFetching(entry, cacheIndex);
+        EXPECT_NE(sts, CUSTOM_MINING_CACHE_HIT);
+        if (sts == CUSTOM_MINING_CACHE_MISS)
+        {
+            EXPECT_LT(cacheIndex, cache.capacity());
+            cache.addEntry(entry, cacheIndex);
+            added++;
+        }
+    }
+    EXPECT_EQ(cache.missCount(), added);
+    EXPECT_EQ(cache.missCount() + cache.collisionCount(), NUMBER_OF_SOLS);
+    EXPECT_EQ(cache.hitCount(), 0);
+
+    // Second pass: each added solution is a hit and stored at the returned index
+    unsigned int hits = 0;
+    for (unsigned int i = 0; i < NUMBER_OF_SOLS; i++)
+    {
+        CustomMiningSolutionCacheEntry entry;
+        entry.set(i + 1, i * 7, 0, 1);
+        unsigned int cacheIndex = 0;
+        if (cache.tryFetching(entry, cacheIndex) == CUSTOM_MINING_CACHE_HIT)
+        {
+            CustomMiningSolutionCacheEntry stored;
+            cache.getEntry(stored, cacheIndex);
+            EXPECT_TRUE(stored.isMatched(entry));
+            hits++;
+        }
+    }
+    EXPECT_EQ(hits, added);
+    EXPECT_EQ(cache.hitCount(), added);
+
+    // Solutions never added are not found, updating only happens on matching condition
+    CustomMiningSolutionCacheEntry entry;
+    entry.set(NUMBER_OF_SOLS + 1, 1, 0, 1);
+    EXPECT_NE(cache.tryFetchingAndUpdate(entry, CUSTOM_MINING_CACHE_HIT), CUSTOM_MINING_CACHE_HIT);
+    EXPECT_NE(cache.tryFetchingAndUpdate(entry, CUSTOM_MINING_CACHE_HIT), CUSTOM_MINING_CACHE_HIT);
+
+    cache.reset();
+    EXPECT_EQ(cache.hitCount() + cache.missCount() + cache.collisionCount(), 0);
+    unsigned int cacheIndex = 0;
+    entry.set(1, 0, 0, 1);
+    EXPECT_EQ(cache.tryFetching(entry, cacheIndex), CUSTOM_MINING_CACHE_MISS);
+}
+
+TEST(CustomMining, SolutionCacheSharded)
+{
+    std::unique_ptr<TestSolutionCache<1>> cache1(new TestSolutionCache<1>);
+    std::unique_ptr<TestSolutionCache<64>> cache64(new TestSolutionCache<64>);
+    std::unique_ptr<TestSolutionCache<7>> cache7(new TestSolutionCache<7>);
+    checkSolutionCache(*cache1);
+    checkSolutionCache(*cache64);
+    checkSolutionCache(*cache7);
+}
+
+TEST(CustomMining, SharesCountShards)
+{
+    std::unique_ptr<CustomMiningSharesCountShards> counts(new CustomMiningSharesCountShards);
+    counts->reset();
+
+    unsigned int expected[NUMBER_OF_COMPUTORS] = { 0 };
+    std::mt19937 gen(42);
+    for (int i = 0; i < 100000; i++)
+    {
+        const unsigned int computorIndex = gen() % NUMBER_OF_COMPUTORS;
+        if (gen() % 4)
+        {
+            counts->increment(computorIndex);
+            expected[computorIndex]++;
+        }
+        else
+        {
+            counts->decrement(computorIndex);
+            expected[computorIndex] = expected[computorIndex] > 0 ? expected[computorIndex] - 1 : 0;
+        }
+    }
+    for (int i = 0; i < 3000; i++)
+        counts->increment(NUMBER_OF_COMPUTORS - 1);
+    expected[NUMBER_OF_COMPUTORS - 1] += 3000;
+
+    unsigned int maxOverflow = 0;
+    for (unsigned int k = 0; k < NUMBER_OF_COMPUTORS; k++)
+    {
+        if (expected[k] > CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL && expected[k] > maxOverflow)
+            maxOverflow = expected[k];
+    }
+
+    unsigned int sharesCount[NUMBER_OF_COMPUTORS];
+    EXPECT_EQ(counts->snapshotAndReset(sharesCount, CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL), maxOverflow);
+    for (unsigned int k = 0; k < NUMBER_OF_COMPUTORS; k++)
+    {
+        const unsigned int clamped = expected[k] > CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL ? CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL : expected[k];
+        EXPECT_EQ(sharesCount[k], clamped);
+    }
+
+    // Counts are zero after snapshot
+    EXPECT_EQ(counts->snapshotAndReset(sharesCount, CUSTOM_MINING_SOLUTION_SHARES_COUNT_MAX_VAL), 0);
+    for (unsigned int k = 0; k < NUMBER_OF_COMPUTORS; k++)
+        EXPECT_EQ(sharesCount[k], 0);
+}
+
+// Simulate the custom mining solution path of processBroadcastMessage(): look up the computor index of the sender,
+// check the solution for duplicates in the cache, and count the share. Each thread stands for a request processor.
+template <unsigned int numberOfShards>
+static void runSolutionThroughput(const char* name, bool indexedLookup, unsigned int numberOfThreads)
+{
+    typedef CustomMininingCache<CustomMiningSolutionCacheEntry, 1 << 20, 20, numberOfShards> BenchmarkSolutionCache;
+    const unsigned int SOLS_PER_THREAD = (1 << 19) / numberOfThreads;
+    static m256i publicKeys[NUMBER_OF_COMPUTORS];
+    static DigestIndexSet<NUMBER_OF_COMPUTORS> publicKeyIndex;
+    std::mt19937_64 gen64(1);
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+        publicKeys[i] = m256i(gen64(), gen64(), gen64(), gen64());
+    publicKeyIndex.reset();
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+        publicKeyIndex.findOrInsert(publicKeys, publicKeys[i], i);
+
+    std::unique_ptr<BenchmarkSolutionCache> cache(new BenchmarkSolutionCache);
+    std::unique_ptr<CustomMiningSharesCountShards> counts(new CustomMiningSharesCountShards);
+    cache->init();
+    counts->reset();
+    volatile char singleCountLock = 0;
+    static unsigned int singleCounts[NUMBER_OF_COMPUTORS];
+    setMem(singleCounts, sizeof(singleCounts), 0);
+
+    auto worker = [&](unsigned int threadIndex)
+    {
+        for (unsigned int i = 0; i < SOLS_PER_THREAD; i++)
+        {
+            const m256i& sender = publicKeys[(threadIndex * 31 + i) % NUMBER_OF_COMPUTORS];
+            int computorIndex = -1;
+            if (indexedLookup)
+            {
+                const unsigned int idx = publicKeyIndex.find(publicKeys, sender);
+                computorIndex = idx < NUMBER_OF_COMPUTORS ? idx : -1;
+            }
+            else
+            {
+                for (unsigned int k = 0; k < NUMBER_OF_COMPUTORS; k++)
+                {
+                    if (publicKeys[k] == sender)
+                    {
+                        computorIndex = k;
+                        break;
+                    }
+                }
+            }
+            if (computorIndex < 0)
+                continue;
+
+            CustomMiningSolutionCacheEntry entry;
+            entry.set(threadIndex * SOLS_PER_THREAD + i + 1, i, 0, 1);
+            unsigned int cacheIndex = 0;
+            if (cache->tryFetching(entry, cacheIndex) == CUSTOM_MINING_CACHE_MISS)
+            {
+                cache->addEntry(entry, cacheIndex);
+                if (indexedLookup)
+                {
+                    counts->increment(computorIndex);
+                }
+                else
+                {
+                    ACQUIRE(singleCountLock);
+                    singleCounts[computorIndex]++;
+                    RELEASE(singleCountLock);
+                }
+            }
+        }
+    };
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    std::vector<std::unique_ptr<std::thread>> threadVec(numberOfThreads);
+    for (unsigned int t = 0; t < numberOfThreads; t++)
+        threadVec[t].reset(new std::thread(worker, t));
+    for (unsigned int t = 0; t < numberOfThreads; t++)
+        threadVec[t]->join();
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+    EXPECT_EQ(cache->hitCount(), 0);
+    EXPECT_EQ(cache->missCount() + cache->collisionCount(), numberOfThreads * SOLS_PER_THREAD);
+    std::cout << name << ": " << numberOfThreads * SOLS_PER_THREAD << " solutions with " << numberOfThreads
+        << " threads in " << duration.count() << " ms" << std::endl;
+}
+
+TEST(CustomMining, PerformanceSolutionThroughput)
+{
+    unsigned int numberOfThreads = std::thread::hardware_concurrency();
+    if (numberOfThreads < 2)
+        numberOfThreads = 2;
+    if (numberOfThreads > 16)
+        numberOfThreads = 16;
+    runSolutionThroughput<1>("Linear computor lookup, single lock", false, numberOfThreads);
+    runSolutionThroughput<CUSTOM_MINING_SOLUTION_CACHE_SHARDS>("Indexed computor lookup, sharded locks", true, numberOfThreads);
+}
@@ -0,0 +1,217 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/public_settings.h"
+#include "../src/ticking/digest_set.h"
+#include "../src/ticking/salted_vote_digest_cache.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+
+// Reference implementation: quadratic search for first occurrence
+static unsigned int findFirstOccurrence(const m256i* digests, unsigned int count, const m256i& digest)
+{
+    for (unsigned int i = 0; i < count; ++i)
+    {
+        if (digests[i] == digest)
+            return i;
+    }
+    return count;
+}
+
+TEST(TestCoreDigestSet, UniqueDigestTallyMatchesQuadraticSearch)
+{
+    std::mt19937_64 gen64(42);
+    static DigestIndexSet<NUMBER_OF_COMPUTORS> set;
+    m256i votes[NUMBER_OF_COMPUTORS];
+    m256i uniqueDigests[NUMBER_OF_COMPUTORS];
+    unsigned int counters[NUMBER_OF_COMPUTORS];
+
+    for (int rep = 0; rep < 100; ++rep)
+    {
+        // Generate votes with a varying number of different digests (1 to NUMBER_OF_COMPUTORS)
+        const unsigned int numberOfDifferentDigests = 1 + (unsigned int)(gen64() % NUMBER_OF_COMPUTORS);
+        for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; ++i)
+        {
+            const unsigned long long v = gen64() % numberOfDifferentDigests;
+            votes[i] = (v == 0) ? m256i::zero() : m256i(v, v * 3, v * 7, v * 11);
+        }
+
+        // Tally with hash set, same as in findNextTickDataDigestFromNextTickVotes()
+        set.reset();
+        unsigned int numberOfUniqueDigests = 0;
+        for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; ++i)
+        {
+            const unsigned int j = set.findOrInsert(uniqueDigests, votes[i], numberOfUniqueDigests);
+            EXPECT_EQ(j, findFirstOccurrence(uniqueDigests, numberOfUniqueDigests, votes[i]));
+            if (j == numberOfUniqueDigests)
+            {
+                uniqueDigests[numberOfUniqueDigests] = votes[i];
+                counters[numberOfUniqueDigests++] = 1;
+            }
+            else
+            {
+                counters[j]++;
+            }
+        }
+        EXPECT_EQ(set.size(), numberOfUniqueDigests);
+        EXPECT_LE(numberOfUniqueDigests, numberOfDifferentDigests);
+
+        // Check counters against quadratic reference
+        unsigned int sum = 0;
+        for (unsigned int j = 0; j < numberOfUniqueDigests; ++j)
+        {
+            unsigned int expectedCount = 0;
+            for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; ++i)
+                expectedCount += (votes[i] == uniqueDigests[j]) ? 1 : 0;
+            EXPECT_EQ(counters[j], expectedCount);
+            sum += counters[j];
+        }
+        EXPECT_EQ(sum, NUMBER_OF_COMPUTORS);
+    }
+}
+
+TEST(TestCoreDigestSet, SaltedVoteDigestCache)
+{
+    static SaltedVoteDigestCache<NUMBER_OF_COMPUTORS> cache;
+    cache.reset();
+
+    Tick etalon;
+    memset(&etalon, 0, sizeof(etalon));
+    etalon.saltedSpectrumDigest = m256i(1, 2, 3, 4);
+    etalon.saltedUniverseDigest = m256i(5, 6, 7, 8);
+    etalon.saltedComputerDigest = m256i(9, 10, 11, 12);
+    etalon.saltedTransactionBodyDigest = 13;
+    unsigned int resourceTestingDigest = 14;
+
+    auto checkComputor = [&](unsigned int computorIndex, const m256i& publicKey)
+    {
+        SaltedVoteDigests expected;
+        computeSaltedVoteDigests(publicKey, resourceTestingDigest, etalon, expected);
+        const SaltedVoteDigests& cached = cache.get(computorIndex, publicKey, resourceTestingDigest, etalon);
+        EXPECT_EQ(cached.saltedResourceTestingDigest, expected.saltedResourceTestingDigest);
+        EXPECT_EQ(cached.saltedTransactionBodyDigest, expected.saltedTransactionBodyDigest);
+        EXPECT_EQ(cached.saltedSpectrumDigest, expected.saltedSpectrumDigest);
+        EXPECT_EQ(cached.saltedUniverseDigest, expected.saltedUniverseDigest);
+        EXPECT_EQ(cached.saltedComputerDigest, expected.saltedComputerDigest);
+    };
+
+    // Cached values always equal freshly computed ones, also after changing salts or public keys
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; ++i)
+        checkComputor(i, m256i(i, 1, 2, 3));
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; ++i)
+        checkComputor(i, m256i(i, 1, 2, 3));
+
+    resourceTestingDigest = 15;
+    checkComputor(0, m256i(0, 1, 2, 3));
+    etalon.saltedTransactionBodyDigest = 16;
+    checkComputor(0, m256i(0, 1, 2, 3));
+    etalon.saltedSpectrumDigest = m256i(17, 2, 3, 4);
+    checkComputor(0, m256i(0, 1, 2, 3));
+    etalon.saltedUniverseDigest = m256i(18, 6, 7, 8);
+    checkComputor(0, m256i(0, 1, 2, 3));
+    etalon.saltedComputerDigest = m256i(19, 10, 11, 12);
+    checkComputor(0, m256i(0, 1, 2, 3));
+    checkComputor(0, m256i(20, 1, 2, 3));
+    checkComputor(0, m256i(20, 1, 2, 3));
+}
+
+// Reference implementation: quadratic pairwise check as formerly used in processBroadcastFutureTickData()
+static bool containsDuplicateNonZeroDigestQuadratic(const m256i* digests, unsigned int count)
+{
+    for (unsigned int i = 0; i < count; i++)
+    {
+        if (!isZero(digests[i]))
+        {
+            for (unsigned int j = 0; j < i; j++)
+            {
+                if (digests[i] == digests[j])
+                    return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Adversarial tick data: all digests share the same first 192 bits (would collide in a hash on a digest prefix),
+// optionally with zero digests and one duplicate non-zero digest injected at a random position.
+static void generateAdversarialTickDigests(std::mt19937_64& gen64, m256i* digests, bool withZeros, bool withDuplicate)
+{
+    const unsigned long long prefix = gen64();
+    for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK; ++i)
+    {
+        digests[i] = m256i(prefix, prefix, prefix, i);
+        if (withZeros && gen64() % 4 == 0)
+            digests[i] = m256i::zero();
+    }
+    if (withDuplicate)
+    {
+        const unsigned int i = (unsigned int)(gen64() % NUMBER_OF_TRANSACTIONS_PER_TICK);
+        unsigned int j = (unsigned int)(gen64() % NUMBER_OF_TRANSACTIONS_PER_TICK);
+        if (j == i)
+            j = (j + 1) % NUMBER_OF_TRANSACTIONS_PER_TICK;
+        // never duplicate a zero digest, which doesn't count as duplicate
+        digests[i] = digests[j] = m256i(prefix, prefix, prefix, i);
+    }
+}
+
+TEST(TestCoreDigestSet, FuzzDuplicateTickDigestsAgainstQuadraticCheck)
+{
+    std::mt19937_64 gen64(1234);
+    static m256i digests[NUMBER_OF_TRANSACTIONS_PER_TICK];
+    for (int rep = 0; rep < 2000; ++rep)
+    {
+        const bool withZeros = rep & 1;
+        const bool withDuplicate = rep & 2;
+        if (rep & 4)
+        {
+            generateAdversarialTickDigests(gen64, digests, withZeros, withDuplicate);
+        }
+        else
+        {
+            // random digests from a small value range, so duplicates also happen by chance
+            const unsigned long long range = 1 + gen64() % (4 * NUMBER_OF_TRANSACTIONS_PER_TICK);
+            for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK; ++i)
+            {
+                const unsigned long long v = gen64() % range;
+                digests[i] = (withZeros && v == 0) ? m256i::zero() : m256i(v, v ^ 0xff, v << 3, ~v);
+            }
+        }
+
+        const bool expected = containsDuplicateNonZeroDigestQuadratic(digests, NUMBER_OF_TRANSACTIONS_PER_TICK);
+        EXPECT_EQ(containsDuplicateNonZeroDigest<NUMBER_OF_TRANSACTIONS_PER_TICK>(digests, NUMBER_OF_TRANSACTIONS_PER_TICK), expected);
+        if (withDuplicate && (rep & 4))
+            EXPECT_TRUE(expected);
+    }
+
+    // All zero (empty tick) never contains duplicates
+    for (unsigned int i = 0; i < NUMBER_OF_TRANSACTIONS_PER_TICK; ++i)
+        digests[i] = m256i::zero();
+    EXPECT_FALSE(containsDuplicateNonZeroDigest<NUMBER_OF_TRANSACTIONS_PER_TICK>(digests, NUMBER_OF_TRANSACTIONS_PER_TICK));
+}
+
+TEST(TestCoreDigestSet, PerformanceDuplicateTickDigestsAdversarial)
+{
+    std::mt19937_64 gen64(5678);
+    static m256i digests[NUMBER_OF_TRANSACTIONS_PER_TICK];
+    generateAdversarialTickDigests(gen64, digests, false, false);
+    constexpr int repetitions = 1000;
+    unsigned int found = 0;
+
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (int rep = 0; rep < repetitions; ++rep)
+        found += containsDuplicateNonZeroDigestQuadratic(digests, NUMBER_OF_TRANSACTIONS_PER_TICK) ? 1 : 0;
+    auto quadraticDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+    startTime = std::chrono::high_resolution_clock::now();
+    for (int rep = 0; rep < repetitions; ++rep)
+        found += containsDuplicateNonZeroDigest<NUMBER_OF_TRANSACTIONS_PER_TICK>(digests, NUMBER_OF_TRANSACTIONS_PER_TICK) ? 1 : 0;
+    auto hashSetDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+
+    EXPECT_EQ(found, 0);
+    std::cout << "Duplicate check of " << repetitions << " adversarial tick data: pairwise " << quadraticDuration
+        << ", hash set " << hashSetDuration << std::endl;
+}
@@ -321,9 +321,13 @@ bool verifyResult(int id, bool largeFile = false)
     return testPass;
 }
 
-int runTestAsyncSaveFile(bool blocking, bool largeFile, bool limitItem)
+int runTestAsyncSaveFile(bool blocking, bool largeFile, bool limitItem, bool useWorker = false)
 {
     fileSystem.initTestData();
+    if (useWorker)
+    {
+        startAsyncFileIOWorker();
+    }
 
     // Run the test
     std::vector<std::unique_ptr<std::thread>> threadVec(THREAD_COUNT);
@@ -338,7 +342,11 @@ int runTestAsyncSaveFile(bool blocking, bool largeFile, bool limitItem)
     while (readyCount < THREAD_COUNT)
     {
         // Don't flush right away. Wait sometimes for simulate
-        if (limitItem)
+        if (useWorker)
+        {
+            // Queues are processed by the worker thread
+        }
+        else if (limitItem)
         {
             flushAsyncFileIOBuffer(2);
         }
@@ -372,6 +380,11 @@ int runTestAsyncSaveFile(bool blocking, bool largeFile, bool limitItem)
         }
     }
 
+    if (useWorker)
+    {
+        stopAsyncFileIOWorker();
+    }
+
     // Non blocking, need to flush all data
     if (!blocking)
     {
@@ -522,6 +535,24 @@ TEST(TestAsyncFileIO, AsyncSaveLargeFileWithLimitItems)
     EXPECT_EQ(runTestAsyncSaveFile(true, true, true), THREAD_COUNT);
 }
 
+TEST(TestAsyncFileIO, AsyncSaveFileWithWorker)
+{
+    AsyncFileIOStats statsBefore, statsAfter;
+    gAsyncFileIO->getStats(statsBefore);
+    EXPECT_EQ(runTestAsyncSaveFile(true, false, false, true), THREAD_COUNT);
+    EXPECT_EQ(runTestAsyncSaveFile(false, false, false, true), THREAD_COUNT);
+    gAsyncFileIO->getStats(statsAfter);
+
+    // Each small file is saved once blocking and once non-blocking (or blocking as fallback if the buffer is full)
+    const long long numberOfFiles = THREAD_COUNT * sizeof(threadData[0].dataPos) / sizeof(threadData[0].dataPos[0]);
+    const long long blockingSaves = statsAfter.blockingSaves - statsBefore.blockingSaves;
+    const long long nonBlockingSaves = statsAfter.nonBlockingSaves - statsBefore.nonBlockingSaves;
+    const long long rejectedNonBlockingSaves = statsAfter.queueFull - statsBefore.queueFull + statsAfter.bufferFull - statsBefore.bufferFull;
+    EXPECT_EQ(blockingSaves + nonBlockingSaves, 2 * numberOfFiles);
+    EXPECT_EQ(nonBlockingSaves + rejectedNonBlockingSaves, numberOfFiles);
+    EXPECT_EQ(statsAfter.pendingItems, 0);
+}
+
 TEST(TestAsyncFileIO, AsyncLoadFile)
 {
     EXPECT_EQ(runTestAsyncLoadFile(true, false, false), THREAD_COUNT);
@@ -542,6 +573,39 @@ TEST(TestAsyncFileIO, AsyncLoadLargeFileWithLimitItems)
     EXPECT_EQ(runTestAsyncLoadFile(true, true, true), THREAD_COUNT);
 }
 
+TEST(TestAsyncFileIO, SavePages)
+{
+    // 5 pages, the last one partial
+    constexpr unsigned long long pageSize = 4096;
+    constexpr unsigned long long fileSize = 4 * pageSize + 100;
+    std::vector<unsigned char> data(fileSize);
+    for (unsigned long long i = 0; i < fileSize; i++)
+        data[i] = (unsigned char)(i * 7);
+    CHAR16 fileName[32];
+    setText(fileName, L"tmp_file_pages");
+    ASSERT_EQ(save(fileName, fileSize, data.data()), fileSize);
+
+    // only flagged pages are written, consecutive pages at once
+    std::vector<unsigned char> changedData = data;
+    changedData[pageSize + 1] ^= 1;
+    changedData[2 * pageSize] ^= 1;
+    changedData[3 * pageSize] ^= 1;
+    changedData[fileSize - 1] ^= 1;
+    unsigned long long pageFlags[1] = { (1ULL << 1) | (1ULL << 2) | (1ULL << 4) };
+    EXPECT_EQ(savePages(fileName, fileSize, changedData.data(), pageSize, pageFlags), 2 * pageSize + 100);
+
+    std::vector<char> loadedData(fileSize + 1);
+    EXPECT_EQ(loadFile(fileName, fileSize, loadedData.data()), fileSize);
+    std::vector<unsigned char> expectedData = changedData;
+    expectedData[3 * pageSize] = data[3 * pageSize];
+    EXPECT_EQ(memcmp(loadedData.data(), expectedData.data(), fileSize), 0);
+
+    // file of other size or no file needs to be saved completely
+    EXPECT_EQ(savePages(fileName, fileSize + 1, changedData.data(), pageSize, pageFlags), -1);
+    setText(fileName, L"tmp_file_pages_missing");
+    EXPECT_EQ(savePages(fileName, fileSize, changedData.data(), pageSize, pageFlags), -1);
+}
+
 TEST(TestAsyncFileIO, FindKLargest)
 {
     constexpr int NUMBER_OF_ELEMENTS = 2025;
@@ -0,0 +1,138 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/ipv4_address_index.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <unordered_map>
+#include <vector>
+
+
+static IPv4Address makeAddress(unsigned int u32)
+{
+    IPv4Address address;
+    address.u32 = u32;
+    return address;
+}
+
+TEST(TestCoreIPv4AddressIndex, SetFindRemove)
+{
+    IPv4AddressIndex<8> index;
+    index.reset();
+    EXPECT_EQ(index.find(makeAddress(1)), index.invalidValue);
+    EXPECT_FALSE(index.remove(makeAddress(1)));
+
+    // address 0 cannot be stored
+    EXPECT_FALSE(index.set(makeAddress(0), 1));
+    EXPECT_EQ(index.find(makeAddress(0)), index.invalidValue);
+
+    // fill up to capacity - 1
+    for (unsigned int i = 1; i < 8; ++i)
+        EXPECT_TRUE(index.set(makeAddress(i * 0x01010101), i));
+    EXPECT_EQ(index.getPopulation(), 7u);
+    EXPECT_FALSE(index.set(makeAddress(0x12345678), 8));
+
+    // update existing
+    EXPECT_TRUE(index.set(makeAddress(3 * 0x01010101), 33));
+    EXPECT_EQ(index.find(makeAddress(3 * 0x01010101)), 33u);
+    EXPECT_EQ(index.getPopulation(), 7u);
+
+    // remove all but one, the rest stays findable
+    for (unsigned int i = 1; i < 7; ++i)
+    {
+        EXPECT_TRUE(index.remove(makeAddress(i * 0x01010101)));
+        EXPECT_EQ(index.find(makeAddress(i * 0x01010101)), index.invalidValue);
+        for (unsigned int j = i + 1; j < 8; ++j)
+            EXPECT_NE(index.find(makeAddress(j * 0x01010101)), index.invalidValue);
+    }
+    EXPECT_EQ(index.getPopulation(), 1u);
+    EXPECT_EQ(index.find(makeAddress(7 * 0x01010101)), 7u);
+}
+
+// Random churn compared with std::unordered_map, with a small capacity for many collisions and wrap-arounds
+TEST(TestCoreIPv4AddressIndex, RandomChurn)
+{
+    IPv4AddressIndex<64> index;
+    index.reset();
+    std::unordered_map<unsigned int, unsigned int> reference;
+    std::mt19937 gen32(42);
+
+    for (unsigned int step = 0; step < 200000; ++step)
+    {
+        const unsigned int address = 1 + gen32() % 100;
+        switch (gen32() % 3)
+        {
+        case 0:
+        {
+            const bool inserted = index.set(makeAddress(address), step);
+            if (reference.count(address) || reference.size() < 63)
+            {
+                EXPECT_TRUE(inserted);
+                reference[address] = step;
+            }
+            else
+            {
+                EXPECT_FALSE(inserted);
+            }
+            break;
+        }
+        case 1:
+            EXPECT_EQ(index.remove(makeAddress(address)), reference.erase(address) == 1);
+            break;
+        default:
+            auto it = reference.find(address);
+            EXPECT_EQ(index.find(makeAddress(address)), (it == reference.end()) ? index.invalidValue : it->second);
+            break;
+        }
+        ASSERT_EQ(index.getPopulation(), reference.size());
+    }
+}
+
+TEST(TestCoreIPv4AddressIndex, CompareWithLinearScan)
+{
+    constexpr unsigned int numberOfAddresses = 1024;
+    constexpr unsigned int numberOfLookups = 1000000;
+    static IPv4AddressIndex<2 * numberOfAddresses> index;
+    std::vector<IPv4Address> addresses(numberOfAddresses);
+    std::mt19937 gen32(1234);
+    for (unsigned int i = 0; i < numberOfAddresses; ++i)
+    {
+        addresses[i] = makeAddress(gen32() | 1);
+        index.set(addresses[i], i);
+    }
+
+    std::vector<IPv4Address> lookups(numberOfLookups);
+    for (auto& lookup : lookups)
+        lookup = (gen32() & 1) ? addresses[gen32() % numberOfAddresses] : makeAddress(gen32() | 1);
+
+    auto t0 = std::chrono::high_resolution_clock::now();
+    unsigned long long foundScan = 0;
+    for (const auto& lookup : lookups)
+    {
+        for (unsigned int i = 0; i < numberOfAddresses; ++i)
+        {
+            if (addresses[i] == lookup)
+            {
+                ++foundScan;
+                break;
+            }
+        }
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+    unsigned long long foundIndex = 0;
+    for (const auto& lookup : lookups)
+    {
+        const unsigned int i = index.find(lookup);
+        if (i != index.invalidValue && addresses[i] == lookup)
+            ++foundIndex;
+    }
+    auto t2 = std::chrono::high_resolution_clock::now();
+
+    EXPECT_EQ(foundScan, foundIndex);
+    std::cout << numberOfLookups << " lookups in " << numberOfAddresses << " addresses: linear scan "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t1 - t0).count() << " ms, index "
+        << std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() << " ms" << std::endl;
+}
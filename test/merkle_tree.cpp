@@ -0,0 +1,204 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/merkle_tree.h"
+
+#include <random>
+#include <thread>
+#include <vector>
+
+
+static void initK12()
+{
+#if defined (__AVX512F__) && !GENERIC_K12
+    initAVX512KangarooTwelveConstants();
+#endif
+}
+
+// Reference implementation: level by level, as formerly done in initialize() for the spectrum
+static void computeMerkleTreeReference(const unsigned char* leafs, unsigned int leafSize, unsigned int depth, m256i* digests)
+{
+    const unsigned int numberOfLeafs = 1U << depth;
+    unsigned int digestIndex;
+    for (digestIndex = 0; digestIndex < numberOfLeafs; digestIndex++)
+    {
+        KangarooTwelve(leafs + digestIndex * leafSize, leafSize, &digests[digestIndex], 32);
+    }
+    unsigned int previousLevelBeginning = 0;
+    unsigned int levelSize = numberOfLeafs;
+    while (levelSize > 1)
+    {
+        for (unsigned int i = 0; i < levelSize; i += 2)
+        {
+            KangarooTwelve64To32(&digests[previousLevelBeginning + i], &digests[digestIndex++]);
+        }
+        previousLevelBeginning += levelSize;
+        levelSize >>= 1;
+    }
+}
+
+// ParallelForFunction distributing the items over 4 threads
+static void threadedFor(unsigned int numberOfItems, void (*processItem)(void* context, unsigned int itemIndex), void* context)
+{
+    std::vector<std::thread> threads;
+    for (unsigned int t = 0; t < 4; ++t)
+    {
+        threads.emplace_back([=]()
+            {
+                for (unsigned int i = t; i < numberOfItems; i += 4)
+                    processItem(context, i);
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+}
+
+static void checkMerkleTree(unsigned int leafSize, unsigned int depth, ParallelForFunction parallelFor)
+{
+    std::mt19937_64 gen64(depth * 1000 + leafSize);
+    std::vector<unsigned char> leafs((size_t(1) << depth) * leafSize);
+    for (auto& byte : leafs)
+        byte = (unsigned char)gen64();
+
+    const size_t numberOfDigests = (size_t(2) << depth) - 1;
+    std::vector<m256i> expected(numberOfDigests);
+    std::vector<m256i> digests(numberOfDigests, m256i::zero());
+    computeMerkleTreeReference(leafs.data(), leafSize, depth, expected.data());
+    computeMerkleTree(leafs.data(), leafSize, depth, digests.data(), parallelFor);
+    for (size_t i = 0; i < numberOfDigests; ++i)
+        EXPECT_EQ(digests[i], expected[i]);
+}
+
+TEST(TestCoreMerkleTree, ComputeMatchesLevelByLevelReference)
+{
+    initK12();
+
+    // entities of spectrum (64 bytes) and records of universe (48 bytes), smaller and larger than one subtree
+    checkMerkleTree(64, 3, sequentialFor);
+    checkMerkleTree(48, 3, sequentialFor);
+    checkMerkleTree(64, MERKLE_SUBTREE_DEPTH, sequentialFor);
+    checkMerkleTree(64, MERKLE_SUBTREE_DEPTH + 3, sequentialFor);
+    checkMerkleTree(48, MERKLE_SUBTREE_DEPTH + 2, threadedFor);
+    checkMerkleTree(64, MERKLE_SUBTREE_DEPTH + 4, threadedFor);
+}
+
+TEST(TestCoreMerkleTree, FileHeaderDetectsChangedLeafsAndTree)
+{
+    initK12();
+
+    constexpr unsigned int depth = MERKLE_SUBTREE_DEPTH + 2;
+    constexpr unsigned int leafSize = 64;
+    std::mt19937_64 gen64(42);
+    std::vector<unsigned char> leafs((size_t(1) << depth) * leafSize);
+    for (auto& byte : leafs)
+        byte = (unsigned char)gen64();
+    std::vector<m256i> digests((size_t(2) << depth) - 1);
+    computeMerkleTree(leafs.data(), leafSize, depth, digests.data());
+
+    MerkleTreeFileHeader header, parallelHeader, otherHeader;
+    computeMerkleTreeFileHeader(leafs.data(), leafSize, depth, digests.data(), header);
+    computeMerkleTreeFileHeader(leafs.data(), leafSize, depth, digests.data(), parallelHeader, threadedFor);
+    EXPECT_EQ(header.numberOfLeafs, 1ULL << depth);
+    EXPECT_EQ(header.leafSize, leafSize);
+    EXPECT_EQ(header.leafDataDigest, parallelHeader.leafDataDigest);
+    EXPECT_EQ(header.treeDigest, parallelHeader.treeDigest);
+
+    // state data changed after saving the tree (such as saving the spectrum file again)
+    leafs[12345] ^= 1;
+    computeMerkleTreeFileHeader(leafs.data(), leafSize, depth, digests.data(), otherHeader);
+    EXPECT_NE(header.leafDataDigest, otherHeader.leafDataDigest);
+    EXPECT_EQ(header.treeDigest, otherHeader.treeDigest);
+    leafs[12345] ^= 1;
+
+    // corrupted tree file
+    digests[digests.size() / 2].m256i_u8[7] ^= 0x80;
+    computeMerkleTreeFileHeader(leafs.data(), leafSize, depth, digests.data(), otherHeader);
+    EXPECT_EQ(header.leafDataDigest, otherHeader.leafDataDigest);
+    EXPECT_NE(header.treeDigest, otherHeader.treeDigest);
+}
+
+TEST(TestCoreMerkleTree, LargeDigestOfChunks)
+{
+    initK12();
+
+    // Small data is hashed as one chunk
+    std::vector<unsigned char> data(1000, 7);
+    m256i digest, chunkDigest, expected;
+    computeLargeDigest(data.data(), data.size(), digest);
+    KangarooTwelve(data.data(), (unsigned int)data.size(), &chunkDigest, 32);
+    KangarooTwelve(&chunkDigest, sizeof(chunkDigest), &expected, 32);
+    EXPECT_EQ(digest, expected);
+
+    // Data larger than one chunk gives the same digest in parallel, and changes with any byte
+    data.resize(3 * LARGE_DIGEST_MIN_CHUNK_SIZE + 100, 3);
+    computeLargeDigest(data.data(), data.size(), digest);
+    computeLargeDigest(data.data(), data.size(), expected, threadedFor);
+    EXPECT_EQ(digest, expected);
+    data.back() = 4;
+    computeLargeDigest(data.data(), data.size(), expected, threadedFor);
+    EXPECT_NE(digest, expected);
+}
+
+TEST(TestCoreMerkleTree, MultiproofOfSeveralLeafs)
+{
+    initK12();
+
+    constexpr unsigned int depth = 10;
+    constexpr unsigned int leafSize = 64;
+    std::mt19937_64 gen64(1234);
+    std::vector<unsigned char> leafs((size_t(1) << depth) * leafSize);
+    for (auto& byte : leafs)
+        byte = (unsigned char)gen64();
+    std::vector<m256i> digests((size_t(2) << depth) - 1);
+    computeMerkleTree(leafs.data(), leafSize, depth, digests.data());
+    const m256i root = digests.back();
+
+    // neighbors, duplicates, leafs sharing upper levels, first and last leaf
+    std::vector<unsigned int> requested = { 7, 6, 100, 7, 0, 1023, 101, 512, 513, 515, 300 };
+    for (unsigned int i = 0; i < 50; ++i)
+        requested.push_back((unsigned int)(gen64() & ((1 << depth) - 1)));
+
+    for (size_t count = 1; count <= requested.size(); ++count)
+    {
+        std::vector<unsigned int> indices(requested.begin(), requested.begin() + count);
+        const unsigned int numberOfIndices = sortUniqueIndices(indices.data(), (unsigned int)count);
+        indices.resize(numberOfIndices);
+        for (unsigned int i = 1; i < numberOfIndices; ++i)
+            EXPECT_LT(indices[i - 1], indices[i]);
+
+        std::vector<unsigned int> proofIndices(indices);
+        std::vector<m256i> siblings(numberOfIndices * depth);
+        const unsigned int numberOfSiblings = getMerkleMultiproofSiblings<depth>(proofIndices.data(), numberOfIndices, digests.data(), siblings.data());
+        EXPECT_LE(numberOfSiblings, numberOfIndices * depth);
+        if (count == 1)
+            EXPECT_EQ(numberOfSiblings, depth);
+
+        // each individual proof is contained in the multiproof, so the root is reconstructed from the leafs
+        std::vector<unsigned int> verifyIndices(indices);
+        std::vector<m256i> nodeDigests(numberOfIndices);
+        for (unsigned int i = 0; i < numberOfIndices; ++i)
+            computeMerkleLeafDigest(leafs.data() + indices[i] * leafSize, leafSize, nodeDigests[i]);
+        m256i computedRoot;
+        EXPECT_TRUE(computeMerkleRootFromMultiproof<depth>(verifyIndices.data(), nodeDigests.data(), numberOfIndices, siblings.data(), numberOfSiblings, computedRoot));
+        EXPECT_EQ(computedRoot, root);
+
+        // changed leaf or wrong number of siblings is detected
+        verifyIndices = indices;
+        for (unsigned int i = 0; i < numberOfIndices; ++i)
+            computeMerkleLeafDigest(leafs.data() + indices[i] * leafSize, leafSize, nodeDigests[i]);
+        nodeDigests[numberOfIndices / 2].m256i_u8[0] ^= 1;
+        EXPECT_TRUE(computeMerkleRootFromMultiproof<depth>(verifyIndices.data(), nodeDigests.data(), numberOfIndices, siblings.data(), numberOfSiblings, computedRoot));
+        EXPECT_NE(computedRoot, root);
+        if (numberOfSiblings)
+        {
+            verifyIndices = indices;
+            EXPECT_FALSE(computeMerkleRootFromMultiproof<depth>(verifyIndices.data(), nodeDigests.data(), numberOfIndices, siblings.data(), numberOfSiblings - 1, computedRoot));
+        }
+    }
+
+    // siblings shared by neighbors are only included once
+    unsigned int pair[2] = { 6, 7 };
+    m256i pairSiblings[2 * depth];
+    EXPECT_EQ((getMerkleMultiproofSiblings<depth>(pair, 2, digests.data(), pairSiblings)), depth - 1);
+}
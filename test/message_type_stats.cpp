@@ -0,0 +1,70 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/message_type_stats.h"
+
+#include <thread>
+#include <vector>
+
+
+static MessageTypeStatisticsTable<8> table;
+
+TEST(TestCoreMessageTypeStats, RecordAndMerge)
+{
+    table.reset();
+    MessageTypeStatistics stats[MessageTypeStatisticsTable<8>::numberOfTypes];
+    EXPECT_EQ(table.getStatistics(stats), 0u);
+
+    // main thread
+    table.recordReceived(3, 100);
+    table.recordReceived(3, 100);
+    table.recordReceived(8, 5000);
+    table.recordSent(3, 100);
+    table.recordSent(255, 8);
+
+    // processors writing their own counters concurrently
+    constexpr unsigned int numberOfRequests = 100000;
+    std::vector<std::thread> threads;
+    for (unsigned int p = 0; p < 8; ++p)
+    {
+        threads.emplace_back([p]()
+            {
+                for (unsigned int i = 0; i < numberOfRequests; ++i)
+                    table.recordProcessed(p, 3, p * 10 + i % 10, 5);
+            });
+    }
+    for (auto& thread : threads)
+        thread.join();
+
+    ASSERT_EQ(table.getStatistics(stats), 3u);
+    EXPECT_EQ(stats[0].type, 3);
+    EXPECT_EQ(stats[0].numberOfReceived, 2ull);
+    EXPECT_EQ(stats[0].bytesReceived, 200ull);
+    EXPECT_EQ(stats[0].numberOfSent, 1ull);
+    EXPECT_EQ(stats[0].bytesSent, 100ull);
+    EXPECT_EQ(stats[0].numberOfProcessed, 8ull * numberOfRequests);
+    EXPECT_EQ(stats[0].processingTicks, 8ull * numberOfRequests * 5);
+    EXPECT_EQ(stats[0].maxProcessingTicks, 5ull);
+    EXPECT_EQ(stats[0].maxQueueWaitTicks, 79ull);
+    unsigned long long expectedWait = 0;
+    for (unsigned int p = 0; p < 8; ++p)
+        expectedWait += (p * 10 + 4.5) * numberOfRequests;
+    EXPECT_EQ(stats[0].queueWaitTicks, expectedWait);
+
+    EXPECT_EQ(stats[1].type, 8);
+    EXPECT_EQ(stats[1].numberOfReceived, 1ull);
+    EXPECT_EQ(stats[1].bytesReceived, 5000ull);
+    EXPECT_EQ(stats[1].numberOfProcessed, 0ull);
+
+    EXPECT_EQ(stats[2].type, 255);
+    EXPECT_EQ(stats[2].numberOfSent, 1ull);
+
+    // single type
+    MessageTypeStatistics single;
+    table.getStatistics(8, single);
+    EXPECT_EQ(single.bytesReceived, 5000ull);
+    table.getStatistics(9, single);
+    EXPECT_EQ(single.type, 9);
+    EXPECT_EQ(single.numberOfReceived, 0ull);
+}
@@ -0,0 +1,81 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "network_simulator.h"
+
+
+TEST(TestCoreNetworkSimulator, TicksProgress)
+{
+    NetworkSimulationConfig config;
+    config.numberOfTicks = 10;
+    NetworkSimulator simulator(config);
+    for (unsigned int n = 0; n < config.numberOfNodes; ++n)
+        EXPECT_GE(simulator.getNumberOfNeighbors(n), 2u);
+
+    NetworkSimulationReport report = simulator.run();
+    report.print(std::cout);
+
+    EXPECT_EQ(report.completedTicks, config.numberOfTicks);
+    EXPECT_EQ(report.messagesLost, 0ull);
+    EXPECT_LE(report.messagesDelivered, report.messagesSent); // some may be in flight at the end
+    EXPECT_EQ(report.tickDuration.count, (unsigned long long)config.numberOfNodes * config.numberOfTicks);
+
+    // each vote and tick data is sent by every node at most disseminationMultiplier times
+    EXPECT_GT(report.messagesPerType[BroadcastTick::type], 0ull);
+    EXPECT_LE(report.messagesPerType[BroadcastTick::type],
+        (unsigned long long)(config.numberOfTicks + 1) * config.numberOfComputors * config.numberOfNodes * config.disseminationMultiplier);
+
+    // a tick cannot be faster than processing plus the delay of tick data and votes
+    EXPECT_GE(report.tickDuration.average(), config.tickProcessingMicroseconds + 2 * config.latencyMicroseconds);
+
+    // deterministic for same seed
+    NetworkSimulator simulator2(config);
+    NetworkSimulationReport report2 = simulator2.run();
+    EXPECT_EQ(report.simulatedMicroseconds, report2.simulatedMicroseconds);
+    EXPECT_EQ(report.messagesSent, report2.messagesSent);
+}
+
+TEST(TestCoreNetworkSimulator, LossIsRecoveredBySyncRequests)
+{
+    NetworkSimulationConfig config;
+    config.numberOfTicks = 5;
+    config.lossPerMille = 100;
+    config.disseminationMultiplier = 2;
+    config.syncRequestIntervalMicroseconds = 500000;
+    NetworkSimulator simulator(config);
+    NetworkSimulationReport report = simulator.run();
+    report.print(std::cout);
+
+    EXPECT_EQ(report.completedTicks, config.numberOfTicks);
+    EXPECT_GT(report.messagesLost, 0ull);
+}
+
+TEST(TestCoreNetworkSimulator, DejavuAwareGossipSavesBandwidth)
+{
+    NetworkSimulationConfig config;
+    config.numberOfTicks = 5;
+    config.numberOfNodes = 32;
+    config.connectionsPerNode = 6;
+    config.relayDelayMicroseconds = 20000; // some duplicates from other neighbors arrive before relaying
+
+    config.dejavuAwareGossip = false;
+    NetworkSimulationReport randomReport = NetworkSimulator(config).run();
+    config.dejavuAwareGossip = true;
+    NetworkSimulationReport filteredReport = NetworkSimulator(config).run();
+
+    std::cout << "Random gossip:" << std::endl;
+    randomReport.print(std::cout);
+    std::cout << "Dejavu-aware gossip:" << std::endl;
+    filteredReport.print(std::cout);
+
+    EXPECT_EQ(randomReport.completedTicks, config.numberOfTicks);
+    EXPECT_EQ(filteredReport.completedTicks, config.numberOfTicks);
+    EXPECT_GT(filteredReport.gossipPeersSkipped, 0ull);
+
+    // neighbors that already sent the message are skipped, so fewer messages are sent without slowing down ticks
+    EXPECT_LT(filteredReport.messagesSent, randomReport.messagesSent);
+    EXPECT_LT(filteredReport.redundantSends, randomReport.redundantSends);
+    EXPECT_LT(filteredReport.duplicatesReceived, randomReport.duplicatesReceived);
+    EXPECT_LE(filteredReport.simulatedMicroseconds, randomReport.simulatedMicroseconds * 11 / 10);
+}
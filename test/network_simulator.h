@@ -0,0 +1,620 @@
+#pragma once
+
+// In-process simulation of a network of nodes for evaluating dissemination, dejavu filtering, and tick
+// synchronization off the UEFI target.
+//
+// The simulation is discrete-event: nothing runs in real time, so simulating a network of many nodes for several ticks
+// takes less than a second and the results are deterministic for a given seed. Nodes exchange real RequestResponseHeader-based
+// messages (BroadcastTick, BroadcastFutureTickData, RequestQuorumTick, RequestTickData) with the sizes of the real
+// structs over an in-memory transport. Each directed link has latency, jitter, loss, and bandwidth; messages on a
+// link are serialized, so large tick data delays the following votes.
+//
+// This is a model, not the node code: qubic.cpp cannot be instantiated several times in one process and peers.h is
+// bound to the global peer table and the TCP stack, so no code of qubic.cpp and peers.h runs here. Peer selection of
+// pushCustom(), the per-peer priority queues (PriorityMessageReferenceQueue), the SharedMessagePool, and the request
+// processors are replaced by the simplified behavior described below. The only node code used is PeerDejavuFilter.
+// Results show the effect of changes to the modeled dissemination and tick synchronization, but changes to the real
+// queueing and selection code have to be mirrored here to be evaluated. All nodes run in one process; there is no
+// mode with nodes in several processes.
+//
+// The node logic is a model of the tick loop of qubic.cpp, reduced to what matters for the network:
+// - When a node enters tick t, the tick leader (computor t % numberOfComputors) broadcasts the tick data of t
+//   after tickProcessingMicroseconds.
+// - When a node has entered tick t and has its tick data, the computors hosted by the node broadcast their votes.
+// - A node enters tick t + 1 when it has the tick data and a quorum of votes of tick t.
+// - Broadcasts are relayed to disseminationMultiplier neighbors like pushToSeveral(), skipping duplicates with the
+//   dejavu. Relaying happens relayDelayMicroseconds after receiving, modeling the request queue and processing.
+//   With dejavuAwareGossip, neighbors that are known to have the message are skipped (PeerDejavuFilter).
+// - If a node doesn't make progress for syncRequestIntervalMicroseconds, it requests the missing votes and tick data
+//   from a random neighbor, which answers with direct responses (dejavu 0, not relayed).
+
+#include "network_messages/all.h"
+#include "network_core/peer_dejavu_filter.h"
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+
+struct NetworkSimulationConfig
+{
+    unsigned int numberOfNodes = 16;
+    unsigned int connectionsPerNode = 8;
+    unsigned int numberOfComputors = NUMBER_OF_COMPUTORS;
+    unsigned int disseminationMultiplier = DISSEMINATION_MULTIPLIER_DEFAULT;
+    bool dejavuAwareGossip = true;
+
+    // link properties (per direction)
+    unsigned long long latencyMicroseconds = 30000;
+    unsigned long long jitterMicroseconds = 10000;
+    unsigned int lossPerMille = 0;
+    unsigned long long bandwidthBytesPerSecond = 12500000; // 100 Mbit/s
+
+    // node behavior
+    unsigned long long tickProcessingMicroseconds = 50000;
+    unsigned long long relayDelayMicroseconds = 2000;
+    unsigned long long syncRequestIntervalMicroseconds = 1000000;
+
+    unsigned int numberOfTicks = 10;
+    unsigned long long maxSimulatedMicroseconds = 3600ULL * 1000000;
+    unsigned long long seed = 42;
+
+    static constexpr unsigned int DISSEMINATION_MULTIPLIER_DEFAULT = 6;
+};
+
+// Average and maximum of a latency
+struct LatencyStatistics
+{
+    unsigned long long count = 0;
+    unsigned long long sum = 0;
+    unsigned long long max = 0;
+
+    void add(unsigned long long value)
+    {
+        count++;
+        sum += value;
+        if (value > max)
+            max = value;
+    }
+
+    unsigned long long average() const
+    {
+        return count ? sum / count : 0;
+    }
+};
+
+struct NetworkSimulationReport
+{
+    unsigned int completedTicks = 0;         // ticks completed by all nodes
+    unsigned long long simulatedMicroseconds = 0;
+    double ticksPerSecond = 0;
+
+    unsigned long long messagesSent = 0;
+    unsigned long long bytesSent = 0;
+    unsigned long long messagesLost = 0;
+    unsigned long long messagesDelivered = 0;
+    unsigned long long duplicatesReceived = 0;  // broadcasts received again (dropped by dejavu)
+    unsigned long long redundantSends = 0;      // broadcasts sent to a node that already had them at sending time
+    unsigned long long gossipPeersSkipped = 0;  // neighbors skipped by dejavu-aware gossip
+    unsigned long long syncRequests = 0;
+    unsigned long long messagesPerType[256] = { 0 };
+
+    LatencyStatistics linkQueueing;    // time a message waits for the link to be free
+    LatencyStatistics tickData;        // node entered tick -> node has tick data
+    LatencyStatistics voteCollection;  // node has tick data -> node has quorum
+    LatencyStatistics tickDuration;    // node entered tick -> node entered next tick
+
+    void print(std::ostream& out) const
+    {
+        out << "Simulated " << simulatedMicroseconds / 1000 << " ms, " << completedTicks << " ticks, "
+            << ticksPerSecond << " ticks/s" << std::endl;
+        out << "Messages: " << messagesSent << " sent (" << bytesSent << " bytes), " << messagesDelivered
+            << " delivered, " << messagesLost << " lost, " << duplicatesReceived << " duplicates, " << redundantSends << " redundant, "
+            << gossipPeersSkipped << " gossip peers skipped, " << syncRequests << " sync requests" << std::endl;
+        out << "  votes " << messagesPerType[BroadcastTick::type] << ", tick data " << messagesPerType[BroadcastFutureTickData::type]
+            << ", quorum requests " << messagesPerType[RequestQuorumTick::type] << ", tick data requests "
+            << messagesPerType[RequestTickData::type] << std::endl;
+        printLatency(out, "link queueing", linkQueueing);
+        printLatency(out, "tick data", tickData);
+        printLatency(out, "vote collection", voteCollection);
+        printLatency(out, "tick duration", tickDuration);
+    }
+
+private:
+    static void printLatency(std::ostream& out, const char* name, const LatencyStatistics& latency)
+    {
+        out << "  " << name << ": avg " << latency.average() / 1000.0 << " ms, max " << latency.max / 1000.0 << " ms" << std::endl;
+    }
+};
+
+class NetworkSimulator
+{
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char>> Message;
+
+    explicit NetworkSimulator(const NetworkSimulationConfig& config) : config(config), random(config.seed)
+    {
+        createTopology();
+        for (unsigned int computorIndex = 0; computorIndex < config.numberOfComputors; computorIndex++)
+            nodes[computorIndex % config.numberOfNodes].computorIndices.push_back(computorIndex);
+    }
+
+    NetworkSimulationReport run()
+    {
+        for (unsigned int n = 0; n < nodes.size(); n++)
+            enterTick(n, 1);
+
+        while (!events.empty())
+        {
+            Event event = events.top();
+            events.pop();
+            if (event.time > config.maxSimulatedMicroseconds)
+                break;
+            now = event.time;
+            switch (event.kind)
+            {
+            case Event::Delivery:
+                receive(event.node, event.from, event.message);
+                break;
+            case Event::TickProcessed:
+                tickProcessed(event.node, event.tick);
+                break;
+            case Event::SyncCheck:
+                syncCheck(event.node, event.tick);
+                break;
+            case Event::Relay:
+                gossip(event.node, event.message, neighborIndex(event.node, event.from));
+                break;
+            }
+            if (minimumTick() > config.numberOfTicks)
+                break;
+        }
+
+        report.completedTicks = minimumTick() - 1;
+        report.simulatedMicroseconds = now;
+        report.ticksPerSecond = now ? report.completedTicks * 1000000.0 / now : 0;
+        return report;
+    }
+
+    unsigned int getNumberOfNeighbors(unsigned int node) const
+    {
+        return (unsigned int)nodes[node].neighbors.size();
+    }
+
+private:
+    struct Event
+    {
+        enum Kind { Delivery, TickProcessed, SyncCheck, Relay };
+        unsigned long long time;
+        unsigned long long sequence; // keeps order of events at the same time deterministic
+        Kind kind;
+        unsigned int node;
+        unsigned int from;
+        unsigned int tick;
+        Message message;
+
+        bool operator>(const Event& other) const
+        {
+            return time > other.time || (time == other.time && sequence > other.sequence);
+        }
+    };
+
+    struct Neighbor
+    {
+        unsigned int node;
+        unsigned long long linkFreeTime; // outgoing link busy until this time
+        std::vector<unsigned char> knownDejavusBuffer;
+        PeerDejavuFilter knownDejavus;
+    };
+
+    struct TickState
+    {
+        std::vector<Message> votes; // by computor index, empty if not received yet
+        unsigned int numberOfVotes = 0;
+        Message tickData;
+    };
+
+    struct Node
+    {
+        std::vector<Neighbor> neighbors;
+        std::vector<unsigned int> computorIndices;
+        std::unordered_set<unsigned int> seenDejavus;
+        std::unordered_map<unsigned int, TickState> ticks; // kept for all ticks like the tick storage of the epoch
+        unsigned int tick = 0;
+        bool tickProcessed = false;
+        bool voted = false;
+        unsigned long long tickEnteredTime = 0;
+        unsigned long long tickDataTime = 0;
+    };
+
+    const NetworkSimulationConfig config;
+    std::mt19937_64 random;
+    std::vector<Node> nodes;
+    std::priority_queue<Event, std::vector<Event>, std::greater<Event>> events;
+    unsigned long long now = 0;
+    unsigned long long eventSequence = 0;
+    NetworkSimulationReport report;
+
+    void createTopology()
+    {
+        nodes.resize(config.numberOfNodes);
+        auto connected = [&](unsigned int a, unsigned int b)
+        {
+            for (const Neighbor& neighbor : nodes[a].neighbors)
+                if (neighbor.node == b)
+                    return true;
+            return false;
+        };
+        auto connect = [&](unsigned int a, unsigned int b)
+        {
+            for (unsigned int direction = 0; direction < 2; direction++)
+            {
+                Node& node = nodes[direction ? b : a];
+                node.neighbors.emplace_back();
+                node.neighbors.back().node = direction ? a : b;
+            }
+        };
+
+        // ring for connectivity, then random connections
+        if (config.numberOfNodes > 1)
+        {
+            for (unsigned int n = 0; n < config.numberOfNodes; n++)
+            {
+                const unsigned int next = (n + 1) % config.numberOfNodes;
+                if (!connected(n, next) && n != next)
+                    connect(n, next);
+            }
+        }
+        const unsigned int maxConnections = std::min(config.connectionsPerNode, config.numberOfNodes - 1);
+        for (unsigned int n = 0; n < config.numberOfNodes; n++)
+        {
+            for (unsigned int attempt = 0; nodes[n].neighbors.size() < maxConnections && attempt < 100 * maxConnections; attempt++)
+            {
+                const unsigned int other = (unsigned int)(random() % config.numberOfNodes);
+                if (other != n && !connected(n, other) && nodes[other].neighbors.size() < maxConnections + 2)
+                    connect(n, other);
+            }
+        }
+
+        // buffers of filters can only be set after the vectors don't grow anymore
+        for (Node& node : nodes)
+        {
+            for (Neighbor& neighbor : node.neighbors)
+            {
+                neighbor.knownDejavusBuffer.resize(PeerDejavuFilter::bufferSize);
+                neighbor.knownDejavus.setBuffer(neighbor.knownDejavusBuffer.data());
+            }
+        }
+    }
+
+    void schedule(Event::Kind kind, unsigned long long time, unsigned int node, unsigned int from, unsigned int tick, Message message)
+    {
+        Event event;
+        event.time = time;
+        event.sequence = eventSequence++;
+        event.kind = kind;
+        event.node = node;
+        event.from = from;
+        event.tick = tick;
+        event.message = std::move(message);
+        events.push(event);
+    }
+
+    unsigned int minimumTick() const
+    {
+        unsigned int tick = 0xFFFFFFFF;
+        for (const Node& node : nodes)
+            tick = std::min(tick, node.tick);
+        return tick;
+    }
+
+    unsigned int randomDejavu()
+    {
+        unsigned int dejavu;
+        do
+        {
+            dejavu = (unsigned int)random();
+        } while (!dejavu);
+        return dejavu;
+    }
+
+    template <typename Payload>
+    Message makeMessage(const Payload& payload, unsigned char type, unsigned int dejavu)
+    {
+        auto bytes = std::make_shared<std::vector<unsigned char>>(sizeof(RequestResponseHeader) + sizeof(Payload));
+        RequestResponseHeader* header = (RequestResponseHeader*)bytes->data();
+        header->checkAndSetSize((unsigned int)bytes->size());
+        header->setType(type);
+        header->setDejavu(dejavu);
+        copyMem(bytes->data() + sizeof(RequestResponseHeader), &payload, sizeof(Payload));
+        return bytes;
+    }
+
+    static const RequestResponseHeader* header(const Message& message)
+    {
+        return (const RequestResponseHeader*)message->data();
+    }
+
+    template <typename Payload>
+    static const Payload* payload(const Message& message)
+    {
+        return (const Payload*)(message->data() + sizeof(RequestResponseHeader));
+    }
+
+    // Transmit message over link from node to neighbor, modeling serialization on the link, latency, and loss
+    void send(unsigned int node, Neighbor& neighbor, const Message& message)
+    {
+        const unsigned long long size = message->size();
+        report.messagesSent++;
+        report.bytesSent += size;
+        report.messagesPerType[header(message)->type()]++;
+        const unsigned int dejavu = header(message)->dejavu();
+        if (dejavu && nodes[neighbor.node].seenDejavus.count(dejavu))
+            report.redundantSends++;
+        neighbor.knownDejavus.add(dejavu);
+
+        const unsigned long long start = std::max(now, neighbor.linkFreeTime);
+        report.linkQueueing.add(start - now);
+        neighbor.linkFreeTime = start + size * 1000000 / config.bandwidthBytesPerSecond;
+        if (config.lossPerMille && random() % 1000 < config.lossPerMille)
+        {
+            report.messagesLost++;
+            return;
+        }
+        const unsigned long long jitter = config.jitterMicroseconds ? random() % (config.jitterMicroseconds + 1) : 0;
+        schedule(Event::Delivery, neighbor.linkFreeTime + config.latencyMicroseconds + jitter, neighbor.node, node, 0, message);
+    }
+
+    // Relay broadcast to random neighbors like pushToSeveral(), excluding the neighbor it came from
+    void gossip(unsigned int node, const Message& message, int excludedNeighbor)
+    {
+        const unsigned int dejavu = header(message)->dejavu();
+        std::vector<unsigned int> candidates;
+        for (unsigned int i = 0; i < nodes[node].neighbors.size(); i++)
+        {
+            if ((int)i == excludedNeighbor)
+                continue;
+            if (config.dejavuAwareGossip && nodes[node].neighbors[i].knownDejavus.contains(dejavu))
+            {
+                report.gossipPeersSkipped++;
+                continue;
+            }
+            candidates.push_back(i);
+        }
+        for (unsigned int r = 0; r < config.disseminationMultiplier && !candidates.empty(); r++)
+        {
+            const unsigned int index = (unsigned int)(random() % candidates.size());
+            send(node, nodes[node].neighbors[candidates[index]], message);
+            candidates[index] = candidates.back();
+            candidates.pop_back();
+        }
+    }
+
+    int neighborIndex(unsigned int node, unsigned int other) const
+    {
+        for (unsigned int i = 0; i < nodes[node].neighbors.size(); i++)
+            if (nodes[node].neighbors[i].node == other)
+                return i;
+        return -1;
+    }
+
+    TickState& tickState(unsigned int node, unsigned int tick)
+    {
+        TickState& state = nodes[node].ticks[tick];
+        if (state.votes.empty())
+            state.votes.resize(config.numberOfComputors);
+        return state;
+    }
+
+    void enterTick(unsigned int n, unsigned int tick)
+    {
+        Node& node = nodes[n];
+        if (node.tick)
+            report.tickDuration.add(now - node.tickEnteredTime);
+        node.tick = tick;
+        node.tickProcessed = false;
+        node.voted = false;
+        node.tickEnteredTime = now;
+        node.tickDataTime = 0;
+        schedule(Event::TickProcessed, now + config.tickProcessingMicroseconds, n, n, tick, nullptr);
+        schedule(Event::SyncCheck, now + config.syncRequestIntervalMicroseconds, n, n, tick, nullptr);
+    }
+
+    void tickProcessed(unsigned int n, unsigned int tick)
+    {
+        Node& node = nodes[n];
+        if (node.tick != tick)
+            return;
+        node.tickProcessed = true;
+
+        // tick leader broadcasts tick data
+        const unsigned int leader = tick % config.numberOfComputors;
+        if (std::find(node.computorIndices.begin(), node.computorIndices.end(), leader) != node.computorIndices.end()
+            && !tickState(n, tick).tickData)
+        {
+            static BroadcastFutureTickData broadcastFutureTickData;
+            broadcastFutureTickData.tickData.computorIndex = leader;
+            broadcastFutureTickData.tickData.tick = tick;
+            Message message = makeMessage(broadcastFutureTickData, BroadcastFutureTickData::type, randomDejavu());
+            nodes[n].seenDejavus.insert(header(message)->dejavu());
+            storeTickData(n, message);
+            gossip(n, message, -1);
+        }
+        tryVoteAndAdvance(n);
+    }
+
+    void storeTickData(unsigned int n, const Message& message)
+    {
+        const unsigned int tick = payload<TickData>(message)->tick;
+        TickState& state = tickState(n, tick);
+        if (state.tickData)
+            return;
+        state.tickData = message;
+        if (tick == nodes[n].tick)
+        {
+            nodes[n].tickDataTime = now;
+            report.tickData.add(now - nodes[n].tickEnteredTime);
+        }
+    }
+
+    // Returns true if vote is new
+    bool storeVote(unsigned int n, const Message& message)
+    {
+        const Tick* vote = payload<Tick>(message);
+        if (vote->tick < nodes[n].tick || vote->computorIndex >= config.numberOfComputors)
+            return false;
+        TickState& state = tickState(n, vote->tick);
+        if (state.votes[vote->computorIndex])
+            return false;
+        state.votes[vote->computorIndex] = message;
+        state.numberOfVotes++;
+        return true;
+    }
+
+    void tryVoteAndAdvance(unsigned int n)
+    {
+        Node& node = nodes[n];
+        const unsigned int tick = node.tick;
+        TickState& state = tickState(n, tick);
+        if (!node.tickProcessed || !state.tickData)
+            return;
+        if (!node.tickDataTime)
+        {
+            // tick data arrived before the tick was entered
+            node.tickDataTime = now;
+            report.tickData.add(now - node.tickEnteredTime);
+        }
+
+        if (!node.voted)
+        {
+            node.voted = true;
+            for (unsigned int computorIndex : node.computorIndices)
+            {
+                BroadcastTick broadcastTick;
+                setMem(&broadcastTick, sizeof(broadcastTick), 0);
+                broadcastTick.tick.computorIndex = computorIndex;
+                broadcastTick.tick.tick = tick;
+                Message message = makeMessage(broadcastTick, BroadcastTick::type, randomDejavu());
+                node.seenDejavus.insert(header(message)->dejavu());
+                storeVote(n, message);
+                gossip(n, message, -1);
+            }
+        }
+
+        if (state.numberOfVotes >= config.numberOfComputors * 2 / 3 + 1)
+        {
+            report.voteCollection.add(now - node.tickDataTime);
+            enterTick(n, tick + 1);
+            tryVoteAndAdvance(n); // votes and tick data of next tick may already be there
+        }
+    }
+
+    void receive(unsigned int n, unsigned int from, const Message& message)
+    {
+        report.messagesDelivered++;
+        Node& node = nodes[n];
+        const int fromIndex = neighborIndex(n, from);
+        const unsigned int dejavu = header(message)->dejavu();
+        if (fromIndex >= 0)
+            node.neighbors[fromIndex].knownDejavus.add(dejavu);
+
+        if (dejavu)
+        {
+            if (node.seenDejavus.count(dejavu))
+            {
+                report.duplicatesReceived++;
+                return;
+            }
+            node.seenDejavus.insert(dejavu);
+        }
+
+        switch (header(message)->type())
+        {
+        case BroadcastTick::type:
+            if (storeVote(n, message) && dejavu)
+                schedule(Event::Relay, now + config.relayDelayMicroseconds, n, from, 0, message);
+            break;
+
+        case BroadcastFutureTickData::type:
+            if (payload<TickData>(message)->tick >= node.tick)
+            {
+                storeTickData(n, message);
+                if (dejavu)
+                    schedule(Event::Relay, now + config.relayDelayMicroseconds, n, from, 0, message);
+            }
+            break;
+
+        case RequestQuorumTick::type:
+            answerQuorumRequest(n, fromIndex, *payload<RequestQuorumTick>(message));
+            return;
+
+        case RequestTickData::type:
+            answerTickDataRequest(n, fromIndex, *payload<RequestTickData>(message));
+            return;
+        }
+        tryVoteAndAdvance(n);
+    }
+
+    void syncCheck(unsigned int n, unsigned int tick)
+    {
+        Node& node = nodes[n];
+        if (node.tick != tick || node.neighbors.empty())
+            return;
+
+        // no progress: request missing data from random neighbor, like the main loop of qubic.cpp
+        Neighbor& neighbor = node.neighbors[random() % node.neighbors.size()];
+        TickState& state = tickState(n, tick);
+        if (!state.tickData)
+        {
+            RequestTickData request;
+            request.requestedTickData.tick = tick;
+            send(n, neighbor, makeMessage(request, RequestTickData::type, randomDejavu()));
+        }
+        else
+        {
+            RequestQuorumTick request;
+            setMem(&request, sizeof(request), 0);
+            request.quorumTick.tick = tick;
+            for (unsigned int i = 0; i < config.numberOfComputors; i++)
+            {
+                if (state.votes[i])
+                    request.quorumTick.voteFlags[i >> 3] |= (1 << (i & 7));
+            }
+            send(n, neighbor, makeMessage(request, RequestQuorumTick::type, randomDejavu()));
+        }
+        report.syncRequests++;
+        schedule(Event::SyncCheck, now + config.syncRequestIntervalMicroseconds, n, n, tick, nullptr);
+    }
+
+    // Send copies of the messages as direct responses (dejavu 0, not relayed)
+    void respond(unsigned int n, int neighbor, const Message& message)
+    {
+        auto bytes = std::make_shared<std::vector<unsigned char>>(*message);
+        ((RequestResponseHeader*)bytes->data())->setDejavu(0);
+        send(n, nodes[n].neighbors[neighbor], bytes);
+    }
+
+    void answerQuorumRequest(unsigned int n, int neighbor, const RequestQuorumTick& request)
+    {
+        auto it = nodes[n].ticks.find(request.quorumTick.tick);
+        if (neighbor < 0 || it == nodes[n].ticks.end())
+            return;
+        for (unsigned int i = 0; i < config.numberOfComputors; i++)
+        {
+            if (it->second.votes[i] && !(request.quorumTick.voteFlags[i >> 3] & (1 << (i & 7))))
+                respond(n, neighbor, it->second.votes[i]);
+        }
+    }
+
+    void answerTickDataRequest(unsigned int n, int neighbor, const RequestTickData& request)
+    {
+        auto it = nodes[n].ticks.find(request.requestedTickData.tick);
+        if (neighbor >= 0 && it != nodes[n].ticks.end() && it->second.tickData)
+            respond(n, neighbor, it->second.tickData);
+    }
+};
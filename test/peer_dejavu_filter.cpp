@@ -0,0 +1,130 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/peer_dejavu_filter.h"
+
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+TEST(TestCorePeerDejavuFilter, AddContainsAndGenerations)
+{
+    std::vector<unsigned char> buffer(PeerDejavuFilter::bufferSize);
+    PeerDejavuFilter filter;
+    filter.setBuffer(buffer.data());
+    EXPECT_EQ(filter.getBuffer(), buffer.data());
+
+    std::mt19937 gen32(42);
+    std::vector<unsigned int> dejavus(3 * PeerDejavuFilter::insertionsPerGeneration);
+    for (auto& dejavu : dejavus)
+        dejavu = gen32() | 1;
+
+    // dejavu 0 is never contained
+    filter.add(0);
+    EXPECT_FALSE(filter.contains(0));
+
+    // everything of the last 1-2 generations is contained
+    for (unsigned int i = 0; i < dejavus.size(); ++i)
+    {
+        filter.add(dejavus[i]);
+        EXPECT_TRUE(filter.contains(dejavus[i]));
+        if (i >= PeerDejavuFilter::insertionsPerGeneration)
+            EXPECT_TRUE(filter.contains(dejavus[i - PeerDejavuFilter::insertionsPerGeneration]));
+    }
+
+    // false positive rate is low
+    unsigned int falsePositives = 0;
+    const unsigned int numberOfChecks = 100000;
+    for (unsigned int i = 0; i < numberOfChecks; ++i)
+    {
+        if (filter.contains((gen32() | 1)))
+            ++falsePositives;
+    }
+    EXPECT_LT(falsePositives, numberOfChecks * 4 / 100);
+
+    // first generation has been forgotten (except false positives)
+    unsigned int oldContained = 0;
+    for (unsigned int i = 0; i < PeerDejavuFilter::insertionsPerGeneration; ++i)
+    {
+        if (filter.contains(dejavus[i]))
+            ++oldContained;
+    }
+    EXPECT_LT(oldContained, PeerDejavuFilter::insertionsPerGeneration * 4 / 100);
+
+    filter.clear();
+    EXPECT_FALSE(filter.contains(dejavus.back()));
+
+    // buffer is swapped between generations, getBuffer() still returns the beginning
+    EXPECT_EQ(filter.getBuffer(), buffer.data());
+}
+
+// Relaying a message that arrives from some peers to 6 random peers: count sends to peers that already have it
+TEST(TestCorePeerDejavuFilter, GossipAvoidsRedundantSends)
+{
+    constexpr unsigned int numberOfPeers = 32;
+    constexpr unsigned int numberOfReceivers = 6;
+    constexpr unsigned int numberOfMessages = 20000;
+
+    std::vector<std::vector<unsigned char>> buffers(numberOfPeers, std::vector<unsigned char>(PeerDejavuFilter::bufferSize));
+    std::vector<PeerDejavuFilter> filters(numberOfPeers);
+    for (unsigned int p = 0; p < numberOfPeers; ++p)
+        filters[p].setBuffer(buffers[p].data());
+
+    std::mt19937_64 gen64(1234);
+    unsigned long long randomRedundantSends = 0, filteredRedundantSends = 0, filteredSends = 0;
+    for (unsigned int m = 0; m < numberOfMessages; ++m)
+    {
+        const unsigned int dejavu = (unsigned int)gen64() | 1;
+
+        // message arrives from 1 to 8 peers
+        std::vector<bool> hasMessage(numberOfPeers, false);
+        const unsigned int numberOfSenders = 1 + (unsigned int)(gen64() % 8);
+        for (unsigned int s = 0; s < numberOfSenders; ++s)
+        {
+            const unsigned int p = (unsigned int)(gen64() % numberOfPeers);
+            hasMessage[p] = true;
+            filters[p].add(dejavu);
+        }
+
+        // random selection (former pushCustom())
+        std::vector<unsigned int> candidates;
+        for (unsigned int p = 0; p < numberOfPeers; ++p)
+            candidates.push_back(p);
+        for (unsigned int r = 0; r < numberOfReceivers; ++r)
+        {
+            const unsigned int index = (unsigned int)(gen64() % candidates.size());
+            if (hasMessage[candidates[index]])
+                ++randomRedundantSends;
+            candidates[index] = candidates.back();
+            candidates.pop_back();
+        }
+
+        // selection skipping peers known to have the message
+        candidates.clear();
+        for (unsigned int p = 0; p < numberOfPeers; ++p)
+        {
+            if (!filters[p].contains(dejavu))
+                candidates.push_back(p);
+        }
+        for (unsigned int r = 0; r < numberOfReceivers && !candidates.empty(); ++r)
+        {
+            const unsigned int index = (unsigned int)(gen64() % candidates.size());
+            if (hasMessage[candidates[index]])
+                ++filteredRedundantSends;
+            filters[candidates[index]].add(dejavu);
+            ++filteredSends;
+            candidates[index] = candidates.back();
+            candidates.pop_back();
+        }
+    }
+
+    // messages are only sent to peers that have them if there are false positives
+    EXPECT_EQ(filteredRedundantSends, 0ull);
+    EXPECT_GT(randomRedundantSends, 0ull);
+    EXPECT_EQ(filteredSends, (unsigned long long)numberOfMessages * numberOfReceivers);
+
+    std::cout << "Redundant sends of " << numberOfMessages * numberOfReceivers << ": random " << randomRedundantSends
+        << ", skipping known peers " << filteredRedundantSends << std::endl;
+}
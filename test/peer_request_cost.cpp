@@ -0,0 +1,178 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/peer_request_cost.h"
+
+
+static constexpr unsigned long long testFrequency = 1000000000; // 1 GHz, so 1 cycle = 1 ns
+
+static PeerRequestLimits makeTestLimits()
+{
+    PeerRequestLimits limits;
+    limits.cpuMicrosecondsPerSecond[RequestCostClassGossip] = 0;
+    limits.cpuMicrosecondsPerSecond[RequestCostClassTickData] = 200000;
+    limits.cpuMicrosecondsPerSecond[RequestCostClassQuery] = 100000;
+    limits.cpuMicrosecondsPerSecond[RequestCostClassContractFunction] = 50000;
+    limits.responseBytesPerSecond = 1000000;
+    limits.burstSeconds = 2;
+    limits.frequency = testFrequency;
+    return limits;
+}
+
+// Simulated client sending a request every interval, each taking the given processing time and response size
+struct SimulatedClient
+{
+    unsigned char type;
+    unsigned long long intervalNs;
+    unsigned long long processingNs;
+    unsigned long long responseBytes;
+    unsigned long long nextRequestTime;
+    unsigned long long admittedProcessingNs;
+    unsigned long long admittedResponseBytes;
+    unsigned long long numberOfAdmitted;
+    unsigned long long numberOfRejected;
+    PeerRequestCost cost;
+};
+
+static void simulate(SimulatedClient* clients, unsigned int numberOfClients, unsigned long long begin, unsigned long long end, const PeerRequestLimits& limits)
+{
+    for (unsigned int i = 0; i < numberOfClients; ++i)
+        clients[i].nextRequestTime = begin;
+    while (true)
+    {
+        // next request in time of all clients
+        SimulatedClient* client = nullptr;
+        for (unsigned int i = 0; i < numberOfClients; ++i)
+        {
+            if (!client || clients[i].nextRequestTime < client->nextRequestTime)
+                client = &clients[i];
+        }
+        if (client->nextRequestTime >= end)
+            break;
+
+        const RequestCostClass costClass = getRequestCostClass(client->type);
+        if (client->cost.admit(costClass, client->nextRequestTime, limits))
+        {
+            client->cost.chargeCycles(costClass, client->processingNs, limits);
+            client->cost.chargeResponseBytes(client->responseBytes);
+            client->admittedProcessingNs += client->processingNs;
+            client->admittedResponseBytes += client->responseBytes;
+            client->numberOfAdmitted++;
+        }
+        else
+        {
+            client->numberOfRejected++;
+        }
+        client->nextRequestTime += client->intervalNs;
+    }
+}
+
+TEST(TestCorePeerRequestCost, RequestCostClasses)
+{
+    EXPECT_EQ(getRequestCostClass(BroadcastTick::type), RequestCostClassGossip);
+    EXPECT_EQ(getRequestCostClass(BROADCAST_TRANSACTION), RequestCostClassGossip);
+    EXPECT_EQ(getRequestCostClass(RequestTickData::type), RequestCostClassTickData);
+    EXPECT_EQ(getRequestCostClass(REQUEST_ENTITY), RequestCostClassQuery);
+    EXPECT_EQ(getRequestCostClass(RequestIssuedAssets::type), RequestCostClassQuery);
+    EXPECT_EQ(getRequestCostClass(RequestContractFunction::type), RequestCostClassContractFunction);
+    EXPECT_EQ(getRequestCostClass(255), RequestCostClassQuery);
+}
+
+TEST(TestCorePeerRequestCost, AbusivePeerIsLimited)
+{
+    const PeerRequestLimits limits = makeTestLimits();
+    const unsigned long long start = 12345;
+    const unsigned long long seconds = 10;
+
+    SimulatedClient clients[4] = {};
+    // abusive client flooding entity requests: 100000 requests per second with 50 us each = 5 processors busy
+    clients[0].type = REQUEST_ENTITY;
+    clients[0].intervalNs = 10000;
+    clients[0].processingNs = 50000;
+    clients[0].responseBytes = 100;
+    // abusive client requesting large responses with little CPU time
+    clients[1].type = RequestIssuedAssets::type;
+    clients[1].intervalNs = 1000000;
+    clients[1].processingNs = 1000;
+    clients[1].responseBytes = 100000;
+    // well-behaved client
+    clients[2].type = REQUEST_ENTITY;
+    clients[2].intervalNs = 10000000;
+    clients[2].processingNs = 50000;
+    clients[2].responseBytes = 100;
+    // node relaying votes, which are never limited
+    clients[3].type = BroadcastTick::type;
+    clients[3].intervalNs = 100000;
+    clients[3].processingNs = 20000;
+    clients[3].responseBytes = 0;
+    for (auto& client : clients)
+        client.cost.reset(start, limits);
+
+    simulate(clients, 4, start, start + seconds * testFrequency, limits);
+
+    // CPU time of abusive client limited to rate plus burst (plus one request that exceeds the budget)
+    const unsigned long long maxQueryNs = (seconds + limits.burstSeconds) * limits.cpuMicrosecondsPerSecond[RequestCostClassQuery] * 1000 + clients[0].processingNs;
+    EXPECT_LE(clients[0].admittedProcessingNs, maxQueryNs);
+    EXPECT_GE(clients[0].admittedProcessingNs, seconds * limits.cpuMicrosecondsPerSecond[RequestCostClassQuery] * 1000);
+    EXPECT_GT(clients[0].numberOfRejected, clients[0].numberOfAdmitted);
+    EXPECT_EQ(clients[0].cost.getNumberOfRejectedRequests(RequestCostClassQuery), clients[0].numberOfRejected);
+    EXPECT_EQ(clients[0].cost.getCycles(RequestCostClassQuery), clients[0].admittedProcessingNs);
+
+    // response bytes limited too
+    const unsigned long long maxResponseBytes = (seconds + limits.burstSeconds) * limits.responseBytesPerSecond + clients[1].responseBytes;
+    EXPECT_LE(clients[1].admittedResponseBytes, maxResponseBytes);
+    EXPECT_GE(clients[1].admittedResponseBytes, seconds * limits.responseBytesPerSecond);
+    EXPECT_EQ(clients[1].cost.getResponseBytes(), clients[1].admittedResponseBytes);
+
+    // others are not affected
+    EXPECT_EQ(clients[2].numberOfRejected, 0ull);
+    EXPECT_EQ(clients[2].numberOfAdmitted, seconds * 100);
+    EXPECT_EQ(clients[3].numberOfRejected, 0ull);
+
+    std::cout << "Abusive client: " << clients[0].numberOfAdmitted << " admitted, " << clients[0].numberOfRejected
+        << " rejected, " << clients[0].admittedProcessingNs / 1000000 << " ms CPU in " << seconds << " s" << std::endl;
+
+    // after pausing, the budget is refilled up to the burst size
+    const unsigned long long later = start + (seconds + 60) * testFrequency;
+    unsigned int burstRequests = 0;
+    while (clients[0].cost.admit(RequestCostClassQuery, later, limits))
+    {
+        clients[0].cost.chargeCycles(RequestCostClassQuery, clients[0].processingNs, limits);
+        ++burstRequests;
+    }
+    EXPECT_EQ(burstRequests, limits.burstSeconds * limits.cpuMicrosecondsPerSecond[RequestCostClassQuery] * 1000 / clients[0].processingNs);
+
+    // other classes have separate budgets
+    EXPECT_TRUE(clients[0].cost.admit(RequestCostClassContractFunction, later, limits));
+    EXPECT_TRUE(clients[0].cost.admit(RequestCostClassTickData, later, limits));
+}
+
+TEST(TestCorePeerRequestCost, RefillAccumulatesFractions)
+{
+    // refill in steps shorter than one token must not lose tokens
+    TokenBucket bucket;
+    bucket.reset(0, 1000, 1);
+    bucket.tokens = 0;
+    for (unsigned long long t = 300000; t <= testFrequency; t += 300000)
+        bucket.refill(t, 1000, 1, testFrequency);
+    EXPECT_GE(bucket.tokens, 999);
+    EXPECT_LE(bucket.tokens, 1000);
+
+    // limited by capacity
+    bucket.refill(10 * testFrequency, 1000, 1, testFrequency);
+    EXPECT_EQ(bucket.tokens, 1000);
+
+    // rate 0 means unlimited (bucket is not used)
+    PeerRequestLimits limits = makeTestLimits();
+    limits.cpuMicrosecondsPerSecond[RequestCostClassQuery] = 0;
+    limits.responseBytesPerSecond = 0;
+    PeerRequestCost cost;
+    cost.reset(0, limits);
+    for (unsigned int i = 0; i < 1000; ++i)
+    {
+        EXPECT_TRUE(cost.admit(RequestCostClassQuery, i, limits));
+        cost.chargeCycles(RequestCostClassQuery, testFrequency, limits);
+        cost.chargeResponseBytes(1000000);
+    }
+}
@@ -0,0 +1,238 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/ticking/pending_transaction_candidates.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+static constexpr unsigned long long testSlotSize = 1024 + sizeof(Transaction) + SIGNATURE_SIZE; // like MAX_TRANSACTION_SIZE
+
+static Transaction* getSlot(std::vector<unsigned char>& pool, unsigned long long slot)
+{
+    return (Transaction*)&pool[slot * testSlotSize];
+}
+
+static std::vector<unsigned int> getSortedCandidates(const auto& candidates)
+{
+    std::vector<unsigned int> slots;
+    for (unsigned int i = 0; i < candidates.getNumberOfCandidates(); ++i)
+        slots.push_back(candidates.getCandidate(i));
+    std::sort(slots.begin(), slots.end());
+    return slots;
+}
+
+TEST(TestCorePendingTransactionCandidates, TransactionsAddedDuringScanAreCollectedOnce)
+{
+    constexpr unsigned long long numberOfSlots = 100000;
+    typedef PendingTransactionCandidates<numberOfSlots, testSlotSize, 1024> Candidates;
+    std::vector<unsigned char> pool(numberOfSlots * testSlotSize, 0);
+    volatile char poolLock = 0;
+    Candidates* candidates = new Candidates();
+    EXPECT_TRUE(candidates->init(pool.data(), &poolLock));
+    EXPECT_TRUE(candidates->isComplete());
+    EXPECT_FALSE(candidates->isStarted(100));
+
+    std::mt19937 gen(42);
+    for (unsigned long long slot = 0; slot < numberOfSlots; ++slot)
+        getSlot(pool, slot)->tick = 95 + gen() % 10;
+
+    for (int round = 0; round < 3; ++round)
+    {
+        const unsigned int targetTick = 100 + round;
+        candidates->start(targetTick);
+        EXPECT_TRUE(candidates->isStarted(targetTick));
+
+        // processors scan while transactions with higher ticks replace pending ones (one per slot like in the
+        // entity pool, with the pool lock held)
+        std::atomic<bool> scanning(true);
+        std::thread adder([&]()
+            {
+                std::mt19937 addGen(round);
+                for (unsigned int i = 0; i < 20000 || scanning; ++i)
+                {
+                    const unsigned long long slot = addGen() % numberOfSlots;
+                    const unsigned int tick = targetTick + addGen() % 3;
+                    ACQUIRE(poolLock);
+                    if (getSlot(pool, slot)->tick < tick)
+                    {
+                        candidates->beginAdd(slot);
+                        getSlot(pool, slot)->tick = tick;
+                        candidates->endAdd(slot, tick);
+                    }
+                    RELEASE(poolLock);
+                    if (i > 1000000)
+                        break;
+                }
+            });
+        std::vector<std::thread> processors;
+        for (int p = 0; p < 3; ++p)
+        {
+            processors.emplace_back([&]()
+                {
+                    while (!candidates->isComplete())
+                        candidates->tryScanChunk();
+                });
+        }
+        for (auto& thread : processors)
+            thread.join();
+        scanning = false;
+        adder.join();
+
+        // every slot with a transaction for the target tick is collected exactly once, replaced ones may be included
+        ACQUIRE(poolLock);
+        const std::vector<unsigned int> slots = getSortedCandidates(*candidates);
+        EXPECT_TRUE(std::adjacent_find(slots.begin(), slots.end()) == slots.end());
+        unsigned long long expected = 0;
+        for (unsigned long long slot = 0; slot < numberOfSlots; ++slot)
+        {
+            if (getSlot(pool, slot)->tick == targetTick)
+            {
+                expected++;
+                EXPECT_TRUE(std::binary_search(slots.begin(), slots.end(), (unsigned int)slot));
+            }
+        }
+        EXPECT_GT(expected, 0ull);
+        EXPECT_GE(slots.size(), expected);
+
+        // removing by swapping in the last one
+        const unsigned int numberOfCandidates = candidates->getNumberOfCandidates();
+        const unsigned int last = candidates->getCandidate(numberOfCandidates - 1);
+        candidates->removeCandidate(0);
+        EXPECT_EQ(candidates->getNumberOfCandidates(), numberOfCandidates - 1);
+        EXPECT_EQ(candidates->getCandidate(0), last);
+        candidates->stop();
+        RELEASE(poolLock);
+        EXPECT_FALSE(candidates->isStarted(targetTick));
+
+        // adding after stop isn't recorded
+        ACQUIRE(poolLock);
+        candidates->beginAdd(0);
+        getSlot(pool, 0)->tick = targetTick + 5;
+        candidates->endAdd(0, targetTick + 5);
+        RELEASE(poolLock);
+        EXPECT_EQ(candidates->getNumberOfCandidates(), numberOfCandidates - 1);
+    }
+
+    candidates->deinit();
+    delete candidates;
+}
+
+
+// Leader part of tick data construction: select transactions randomly from the collected slots and copy them to the
+// tick transaction storage
+static unsigned int packTickTransactions(std::vector<unsigned char>& pool, unsigned int scheduledTick, auto getNumberOfCandidates,
+    auto getCandidate, auto removeCandidate, std::vector<unsigned char>& tickTransactions, std::mt19937& gen)
+{
+    unsigned int j = 0;
+    unsigned long long offset = 0;
+    while (j < 1024 && getNumberOfCandidates())
+    {
+        const unsigned int index = gen() % getNumberOfCandidates();
+        const Transaction* transaction = getSlot(pool, getCandidate(index));
+        if (transaction->tick == scheduledTick)
+        {
+            copyMem(&tickTransactions[offset], transaction, transaction->totalSize());
+            offset += transaction->totalSize();
+            j++;
+        }
+        removeCandidate(index);
+    }
+    return j;
+}
+
+TEST(TestCorePendingTransactionCandidates, LeaderTickDataLatency)
+{
+    constexpr unsigned long long numberOfSlots = 262144;
+    typedef PendingTransactionCandidates<numberOfSlots, testSlotSize> Candidates;
+    std::vector<unsigned char> pool(numberOfSlots * testSlotSize, 0);
+    std::vector<unsigned char> tickTransactions(1024 * testSlotSize);
+    volatile char poolLock = 0;
+    Candidates* candidates = new Candidates();
+    EXPECT_TRUE(candidates->init(pool.data(), &poolLock));
+
+    // about 2000 of the pending transactions are scheduled for the tick of the leader
+    constexpr unsigned int scheduledTick = 1000;
+    std::mt19937 gen(7);
+    for (unsigned long long slot = 0; slot < numberOfSlots; ++slot)
+    {
+        Transaction* transaction = getSlot(pool, slot);
+        transaction->tick = (gen() % 128 == 0) ? scheduledTick : scheduledTick + 1 + gen() % 20;
+        transaction->inputSize = gen() % 256;
+    }
+    const unsigned int numberOfHelpers = std::max(1u, std::min(8u, std::thread::hardware_concurrency() - 1));
+    constexpr int repetitions = 5;
+    double serialMs = 0, onDemandMs = 0, pipelinedMs = 0;
+    unsigned int packed[3] = { 0 };
+
+    for (int r = 0; r < repetitions; ++r)
+    {
+        // previous implementation: leader scans the whole pool when the tick begins
+        {
+            const auto beginning = std::chrono::high_resolution_clock::now();
+            std::vector<unsigned int> indices;
+            for (unsigned long long slot = 0; slot < numberOfSlots; ++slot)
+            {
+                if (getSlot(pool, slot)->tick == scheduledTick)
+                    indices.push_back((unsigned int)slot);
+            }
+            packed[0] = packTickTransactions(pool, scheduledTick, [&]() { return (unsigned int)indices.size(); },
+                [&](unsigned int i) { return indices[i]; }, [&](unsigned int i) { indices[i] = indices.back(); indices.pop_back(); },
+                tickTransactions, gen);
+            serialMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - beginning).count();
+        }
+
+        // scan started when the tick begins, helped by request processors
+        // and scan started in the previous tick, so the candidates are ready when the tick begins
+        for (int pipelined = 0; pipelined < 2; ++pipelined)
+        {
+            std::atomic<bool> stop(false);
+            std::vector<std::thread> helpers;
+            auto beginning = std::chrono::high_resolution_clock::now();
+            candidates->start(scheduledTick);
+            for (unsigned int h = 0; h < numberOfHelpers; ++h)
+            {
+                helpers.emplace_back([&]()
+                    {
+                        while (!stop)
+                            candidates->tryScanChunk();
+                    });
+            }
+            if (pipelined)
+            {
+                while (!candidates->isComplete())
+                    std::this_thread::yield();
+                beginning = std::chrono::high_resolution_clock::now();
+            }
+            while (!candidates->isComplete())
+                candidates->tryScanChunk();
+            ACQUIRE(poolLock);
+            packed[1 + pipelined] = packTickTransactions(pool, scheduledTick, [&]() { return candidates->getNumberOfCandidates(); },
+                [&](unsigned int i) { return candidates->getCandidate(i); }, [&](unsigned int i) { candidates->removeCandidate(i); },
+                tickTransactions, gen);
+            candidates->stop();
+            RELEASE(poolLock);
+            (pipelined ? pipelinedMs : onDemandMs) += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - beginning).count();
+            stop = true;
+            for (auto& thread : helpers)
+                thread.join();
+        }
+        EXPECT_EQ(packed[0], 1024u);
+        EXPECT_EQ(packed[1], 1024u);
+        EXPECT_EQ(packed[2], 1024u);
+    }
+
+    std::cout << "Leader tick data latency (" << numberOfSlots << " pending slots, " << numberOfHelpers
+        << " helpers): serial scan " << serialMs / repetitions << " ms, parallel scan at tick begin "
+        << onDemandMs / repetitions << " ms, scan started in previous tick " << pipelinedMs / repetitions << " ms" << std::endl;
+
+    candidates->deinit();
+    delete candidates;
+}
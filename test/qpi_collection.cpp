@@ -3,9 +3,10 @@
 #include "gtest/gtest.h"
 
 static void* __scratchpadBuffer = nullptr;
-static void* __scratchpad()
+static unsigned long long __scratchpadBufferSize = 0;
+static void* __scratchpad(unsigned long long size)
 {
-    return __scratchpadBuffer;
+    return (size <= __scratchpadBufferSize) ? __scratchpadBuffer : nullptr;
 }
 namespace QPI
 {
@@ -962,6 +963,46 @@ TEST(TestCoreQPI, CollectionMultiPovOneElement)
     testCollectionMultiPovOneElement<128>(cleanupAfterEachRemove);
 }
 
+TEST(TestCoreQPI, CollectionCleanupWithoutSufficientScratchpad)
+{
+    constexpr unsigned long long capacity = 64;
+    QPI::Collection<int, capacity>* coll = new QPI::Collection<int, capacity>;
+    coll->reset();
+    for (int i = 0; i < capacity; ++i)
+        EXPECT_NE(coll->add(QPI::id(i, 1, 2, 3), i, i), QPI::NULL_INDEX);
+    for (int i = 0; i < capacity; i += 2)
+        coll->remove(coll->headIndex(QPI::id(i, 1, 2, 3)));
+    EXPECT_EQ(coll->population(), capacity / 2);
+
+    // Without scratchpad buffer (or with a too small one), cleanup is skipped and the collection is unchanged
+    auto* copy = new QPI::Collection<int, capacity>;
+    copyMem(copy, coll, sizeof(*coll));
+    __scratchpadBuffer = new char[sizeof(*coll)];
+    __scratchpadBufferSize = 16;
+    coll->cleanup();
+    EXPECT_EQ(memcmp(copy, coll, sizeof(*coll)), 0);
+
+    // With sufficient scratchpad, cleanup keeps all elements that have not been removed
+    __scratchpadBufferSize = sizeof(*coll);
+    coll->cleanup();
+    EXPECT_EQ(coll->population(), capacity / 2);
+    for (int i = 0; i < capacity; ++i)
+    {
+        const QPI::id pov(i, 1, 2, 3);
+        EXPECT_EQ(coll->population(pov), (i % 2) ? 1 : 0);
+        if (i % 2)
+            EXPECT_EQ(coll->element(coll->headIndex(pov)), i);
+        else
+            EXPECT_EQ(coll->headIndex(pov), QPI::NULL_INDEX);
+    }
+
+    delete[] __scratchpadBuffer;
+    __scratchpadBuffer = nullptr;
+    __scratchpadBufferSize = 0;
+    delete copy;
+    delete coll;
+}
+
 TEST(TestCoreQPI, CollectionOneRemoveLastHeadTail)
 {
     // Minimal test cases for bug fixed in
@@ -1299,6 +1340,7 @@ void testCollectionCleanupPseudoRandom(int povs, int seed, bool povCollisions)
 TEST(TestCoreQPI, CollectionCleanup)
 {
     __scratchpadBuffer = new char[10 * 1024 * 1024];
+    __scratchpadBufferSize = 10 * 1024 * 1024;
     for (int i = 0; i < 3; ++i)
     {
         bool povCollisions = false;
@@ -1315,12 +1357,14 @@ TEST(TestCoreQPI, CollectionCleanup)
     }
     delete[] __scratchpadBuffer;
     __scratchpadBuffer = nullptr;
+    __scratchpadBufferSize = 0;
 }
 
 TEST(TestCoreQPI, CollectionCleanupWithPovCollisions)
 {
     // Shows bugs in cleanup() that occur in case of massive pov hash map collisions and in case of capacity < 32
     __scratchpadBuffer = new char[10 * 1024 * 1024];
+    __scratchpadBufferSize = 10 * 1024 * 1024;
     bool cleanupAfterEachRemove = true;
     testCollectionMultiPovOneElement<16>(cleanupAfterEachRemove);
     testCollectionMultiPovOneElement<32>(cleanupAfterEachRemove);
@@ -1328,6 +1372,7 @@ TEST(TestCoreQPI, CollectionCleanupWithPovCollisions)
     testCollectionMultiPovOneElement<128>(cleanupAfterEachRemove);
     delete[] __scratchpadBuffer;
     __scratchpadBuffer = nullptr;
+    __scratchpadBufferSize = 0;
 }
 
 
@@ -1447,6 +1492,7 @@ TEST(TestCoreQPI, CollectionPerformance)
 {
 
     __scratchpadBuffer = new char[16 * 1024 * 1024];
+    __scratchpadBufferSize = 16 * 1024 * 1024;
 
     std::vector<QPI::uint64> durations;
     std::vector<std::string> descriptions;
@@ -1477,6 +1523,7 @@ TEST(TestCoreQPI, CollectionPerformance)
 
     delete[] __scratchpadBuffer;
     __scratchpadBuffer = nullptr;
+    __scratchpadBufferSize = 0;
 
     bool verbose = true;
     if (verbose)
@@ -3,9 +3,10 @@
 #include "gtest/gtest.h"
 
 static void* __scratchpadBuffer = nullptr;
-static void* __scratchpad()
+static unsigned long long __scratchpadBufferSize = 0;
+static void* __scratchpad(unsigned long long size)
 {
-	return __scratchpadBuffer;
+	return (size <= __scratchpadBufferSize) ? __scratchpadBuffer : nullptr;
 }
 namespace QPI
 {
@@ -307,6 +308,7 @@ TYPED_TEST_P(QPIHashMapTest, TestCleanup)
 	QPI::HashMap<TypeParam::first_type, TypeParam::second_type, capacity> hashMap;
 
 	__scratchpadBuffer = new char[2 * sizeof(hashMap)];
+	__scratchpadBufferSize = 2 * sizeof(hashMap);
 
 	std::array<TypeParam, 4> keyValuePairs = HashMapTestData<TypeParam::first_type, TypeParam::second_type>::CreateKeyValueTestPairs();
 	auto ids = std::views::keys(keyValuePairs);
@@ -342,6 +344,7 @@ TYPED_TEST_P(QPIHashMapTest, TestCleanup)
 
 	delete[] __scratchpadBuffer;
 	__scratchpadBuffer = nullptr;
+	__scratchpadBufferSize = 0;
 }
 
 TYPED_TEST_P(QPIHashMapTest, TestCleanupPerformanceShortcuts)
@@ -378,6 +381,7 @@ TEST(NonTypedQPIHashMapTest, TestCleanupLargeMapSameHashes)
 	QPI::HashMap<QPI::id, int, capacity> hashMap;
 
 	__scratchpadBuffer = new char[2 * sizeof(hashMap)];
+	__scratchpadBufferSize = 2 * sizeof(hashMap);
 
 	for (QPI::uint64 i = 0; i < 64; ++i)
 	{
@@ -392,6 +396,7 @@ TEST(NonTypedQPIHashMapTest, TestCleanupLargeMapSameHashes)
 
 	delete[] __scratchpadBuffer;
 	__scratchpadBuffer = nullptr;
+	__scratchpadBufferSize = 0;
 }
 
 TYPED_TEST_P(QPIHashMapTest, TestReplace)
@@ -470,6 +475,7 @@ TEST(QPIHashMapTest, HashSet)
 	constexpr QPI::uint64 capacity = 128;
 	QPI::HashSet<QPI::id, capacity> hashSet;
 	__scratchpadBuffer = new char[2 * sizeof(hashSet)];
+	__scratchpadBufferSize = 2 * sizeof(hashSet);
 	EXPECT_EQ(hashSet.capacity(), capacity);
 
 	// Test add() and contains()
@@ -569,6 +575,7 @@ TEST(QPIHashMapTest, HashSet)
 
 	delete[] __scratchpadBuffer;
 	__scratchpadBuffer = nullptr;
+	__scratchpadBufferSize = 0;
 }
 
 template <class T, unsigned int capacity>
@@ -639,6 +646,7 @@ void testHashSetPseudoRandom(int seed, int cleanups, int percentAdd, int percent
 	QPI::HashSet<T, capacity> set;
 
 	__scratchpadBuffer = new char[2 * sizeof(set)];
+	__scratchpadBufferSize = 2 * sizeof(set);
 
 	set.reset();
 
@@ -697,6 +705,7 @@ void testHashSetPseudoRandom(int seed, int cleanups, int percentAdd, int percent
 
 	delete[] __scratchpadBuffer;
 	__scratchpadBuffer = nullptr;
+	__scratchpadBufferSize = 0;
 }
 
 TEST(QPIHashMapTest, HashSetPseudoRandom)
@@ -733,6 +742,7 @@ static void perfTestCleanup(int seed)
 
 	auto* set = new QPI::HashSet<QPI::id, capacity>();
 	__scratchpadBuffer = new char[sizeof(*set)];
+	__scratchpadBufferSize = sizeof(*set);
 
 	for (QPI::uint64 i = 1; i <= 100; ++i)
 	{
@@ -758,6 +768,7 @@ static void perfTestCleanup(int seed)
 	delete set;
 	delete[] __scratchpadBuffer;
 	__scratchpadBuffer = nullptr;
+	__scratchpadBufferSize = 0;
 }
 
 TEST(QPIHashMapTest, HashSetPerfTest)
@@ -0,0 +1,171 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/request_admission.h"
+
+#include <deque>
+#include <iostream>
+
+
+static constexpr unsigned long long testFrequency = 1000; // time unit is 1 ms
+
+static RequestAdmissionLimits makeTestLimits()
+{
+    RequestAdmissionLimits limits;
+    limits.maxFillPercent[RequestCostClassGossip] = 100;
+    limits.maxFillPercent[RequestCostClassTickData] = 80;
+    limits.maxFillPercent[RequestCostClassQuery] = 50;
+    limits.maxFillPercent[RequestCostClassContractFunction] = 50;
+    limits.maxWaitMilliseconds[RequestCostClassGossip] = 0;
+    limits.maxWaitMilliseconds[RequestCostClassTickData] = 5000;
+    limits.maxWaitMilliseconds[RequestCostClassQuery] = 1000;
+    limits.maxWaitMilliseconds[RequestCostClassContractFunction] = 1000;
+    limits.frequency = testFrequency;
+    return limits;
+}
+
+struct OverloadResult
+{
+    unsigned long long processed[NUMBER_OF_REQUEST_COST_CLASSES] = { 0 };
+    unsigned long long dropped[NUMBER_OF_REQUEST_COST_CLASSES] = { 0 };
+    unsigned long long maxWait[NUMBER_OF_REQUEST_COST_CLASSES] = { 0 };
+};
+
+// Request queue with fixed processing capacity, flooded with queries while votes and tick data requests arrive at a
+// constant rate. Without admission control, requests are only dropped if the queue is full.
+static OverloadResult simulateOverload(bool useAdmissionControl)
+{
+    constexpr unsigned int queueLength = 10000;
+    constexpr unsigned int processedPerMs = 5;
+    constexpr unsigned int durationMs = 20000;
+    const unsigned int arrivalsPerMs[NUMBER_OF_REQUEST_COST_CLASSES] = { 1, 1, 20, 1 }; // 23000 requests per second
+
+    const RequestAdmissionLimits limits = makeTestLimits();
+    RequestAdmissionControl admission;
+    admission.reset(0);
+    OverloadResult result;
+    std::deque<std::pair<RequestCostClass, unsigned long long>> queue;
+    unsigned long long numberOfProcessed = 0;
+
+    for (unsigned long long now = 0; now < durationMs; ++now)
+    {
+        // the flood of queries arrives first, taking the space freed by the processors
+        for (int c = NUMBER_OF_REQUEST_COST_CLASSES - 1; c >= 0; --c)
+        {
+            for (unsigned int a = 0; a < arrivalsPerMs[c]; ++a)
+            {
+                const RequestCostClass costClass = (RequestCostClass)c;
+                const unsigned int queuedRequests = (unsigned int)queue.size();
+                admission.update(now, numberOfProcessed, queuedRequests, limits);
+                if (queuedRequests == queueLength
+                    || (useAdmissionControl && !admission.admit(costClass, queuedRequests, queuedRequests * 100 / queueLength, limits)))
+                {
+                    result.dropped[c]++;
+                }
+                else
+                {
+                    queue.emplace_back(costClass, now);
+                }
+            }
+        }
+        for (unsigned int p = 0; p < processedPerMs && !queue.empty(); ++p)
+        {
+            const auto& request = queue.front();
+            result.processed[request.first]++;
+            if (now - request.second > result.maxWait[request.first])
+                result.maxWait[request.first] = now - request.second;
+            queue.pop_front();
+            numberOfProcessed++;
+        }
+    }
+
+    if (useAdmissionControl)
+    {
+        // rate estimate converges to the capacity of the processors
+        EXPECT_EQ(admission.getProcessingRate(), processedPerMs * testFrequency);
+        for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; ++c)
+            EXPECT_EQ(admission.getNumberOfShedRequests((RequestCostClass)c), result.dropped[c]);
+    }
+    return result;
+}
+
+TEST(TestCoreRequestAdmission, OverloadShedsQueriesFirst)
+{
+    const OverloadResult blind = simulateOverload(false);
+    const OverloadResult adaptive = simulateOverload(true);
+
+    for (const auto* result : { &blind, &adaptive })
+    {
+        std::cout << ((result == &blind) ? "Drop if full: " : "Admission control: ");
+        const char* names[NUMBER_OF_REQUEST_COST_CLASSES] = { "gossip", "tick data", "query", "contract function" };
+        for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; ++c)
+        {
+            std::cout << names[c] << " " << result->processed[c] << " processed, " << result->dropped[c]
+                << " dropped, max wait " << result->maxWait[c] << " ms" << ((c + 1 < NUMBER_OF_REQUEST_COST_CLASSES) ? " | " : "\n");
+        }
+    }
+
+    // without admission control, votes are lost and delayed like queries
+    EXPECT_GT(blind.dropped[RequestCostClassGossip], 0ull);
+    EXPECT_GT(blind.maxWait[RequestCostClassGossip], 1900ull);
+
+    // with admission control, no gossip or tick data is lost and the queue wait is limited by the query limits
+    EXPECT_EQ(adaptive.dropped[RequestCostClassGossip], 0ull);
+    EXPECT_EQ(adaptive.dropped[RequestCostClassTickData], 0ull);
+    EXPECT_GT(adaptive.dropped[RequestCostClassQuery], 0ull);
+    EXPECT_LT(adaptive.maxWait[RequestCostClassGossip], 1100ull);
+
+    // the processors are kept busy
+    unsigned long long processed = 0;
+    for (unsigned int c = 0; c < NUMBER_OF_REQUEST_COST_CLASSES; ++c)
+        processed += adaptive.processed[c];
+    EXPECT_GE(processed, 5ull * 19900);
+}
+
+TEST(TestCoreRequestAdmission, RateIsOnlyMeasuredWithBacklog)
+{
+    const RequestAdmissionLimits limits = makeTestLimits();
+    RequestAdmissionControl admission;
+    admission.reset(0);
+    EXPECT_EQ(admission.getProcessingRate(), 0ull);
+    EXPECT_EQ(admission.getEstimatedWaitMilliseconds(1000), 0ull);
+
+    // unknown rate: only fill limits apply
+    EXPECT_TRUE(admission.admit(RequestCostClassQuery, 1000, 49, limits));
+    EXPECT_FALSE(admission.admit(RequestCostClassQuery, 1000, 50, limits));
+    EXPECT_TRUE(admission.admit(RequestCostClassTickData, 1000, 50, limits));
+    EXPECT_TRUE(admission.admit(RequestCostClassGossip, 1000, 99, limits));
+
+    // first interval started idle, second is backlogged with 500 processed in 100 ms
+    admission.update(100, 0, 10, limits);
+    EXPECT_EQ(admission.getProcessingRate(), 0ull);
+    admission.update(150, 250, 10, limits);
+    admission.update(200, 500, 10, limits);
+    EXPECT_EQ(admission.getProcessingRate(), 5000ull);
+    EXPECT_EQ(admission.getEstimatedWaitMilliseconds(10000), 2000ull);
+
+    // interval with idle processors doesn't lower the estimate
+    admission.update(250, 505, 0, limits);
+    admission.update(300, 510, 10, limits);
+    EXPECT_EQ(admission.getProcessingRate(), 5000ull);
+
+    // wait limit
+    EXPECT_TRUE(admission.admit(RequestCostClassQuery, 5000, 10, limits));
+    EXPECT_FALSE(admission.admit(RequestCostClassQuery, 5005, 10, limits));
+    EXPECT_TRUE(admission.admit(RequestCostClassTickData, 5005, 10, limits));
+    EXPECT_EQ(admission.getNumberOfShedRequests(RequestCostClassQuery), 2ull);
+
+    // stalled processors with backlog: rate decays to 1 (not 0 = unknown), so the wait limits shed more
+    for (unsigned long long time = 400; time <= 5000; time += 100)
+        admission.update(time, 510, 10, limits);
+    EXPECT_EQ(admission.getProcessingRate(), 1ull);
+    EXPECT_EQ(admission.getEstimatedWaitMilliseconds(10), 10000ull);
+    EXPECT_FALSE(admission.admit(RequestCostClassQuery, 10, 10, limits));
+    EXPECT_FALSE(admission.admit(RequestCostClassTickData, 10, 10, limits));
+    EXPECT_TRUE(admission.admit(RequestCostClassGossip, 10, 10, limits));
+
+    // processors recover
+    admission.update(5100, 1010, 10, limits);
+    EXPECT_GT(admission.getProcessingRate(), 1000ull);
+}
@@ -0,0 +1,301 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/request_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+
+struct TestPeer
+{
+    unsigned int id;
+};
+
+static RequestResponseHeader* makeMessage(std::vector<unsigned char>& buffer, unsigned int size, unsigned char type)
+{
+    buffer.assign(size, type);
+    RequestResponseHeader* header = (RequestResponseHeader*)buffer.data();
+    header->checkAndSetSize(size);
+    header->setType(type);
+    header->setDejavu(type + 1);
+    return header;
+}
+
+static bool isMessageIntact(const RequestResponseHeader* header, unsigned int size, unsigned char type)
+{
+    if (header->size() != size || header->type() != type)
+        return false;
+    const unsigned char* payload = (const unsigned char*)header;
+    for (unsigned int i = sizeof(RequestResponseHeader); i < size; ++i)
+    {
+        if (payload[i] != type)
+            return false;
+    }
+    return true;
+}
+
+TEST(TestCoreRequestQueue, OutOfOrderFinishAndWrapAround)
+{
+    typedef RequestQueue<1000, 8, TestPeer> Queue;
+    Queue* queue = new Queue();
+    EXPECT_TRUE(queue->init());
+    TestPeer peers[2] = { { 1 }, { 2 } };
+    std::vector<unsigned char> buffer;
+
+    EXPECT_EQ(queue->claim(), Queue::invalidRequestIndex);
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 400, 1), &peers[0], 10));
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 400, 2), &peers[1], 20));
+    EXPECT_EQ(queue->getNumberOfWaitingRequests(), 2u);
+    EXPECT_EQ(queue->getNumberOfUsedBytes(), 800ull);
+
+    // requests are claimed in order
+    const unsigned int a = queue->claim();
+    const unsigned int b = queue->claim();
+    ASSERT_NE(a, Queue::invalidRequestIndex);
+    ASSERT_NE(b, Queue::invalidRequestIndex);
+    EXPECT_EQ(queue->claim(), Queue::invalidRequestIndex);
+    EXPECT_EQ(queue->getNumberOfWaitingRequests(), 0u);
+    EXPECT_TRUE(isMessageIntact(queue->getRequest(a), 400, 1));
+    EXPECT_EQ(queue->getContext(a), &peers[0]);
+    EXPECT_EQ(queue->getEnqueueTick(a), 10ull);
+    EXPECT_TRUE(isMessageIntact(queue->getRequest(b), 400, 2));
+    EXPECT_EQ(queue->getContext(b), &peers[1]);
+    const RequestResponseHeader* firstRequest = queue->getRequest(a);
+
+    // space of the second request cannot be reused before the first one is finished
+    queue->finish(b);
+    queue->releaseFinished();
+    EXPECT_EQ(queue->getNumberOfUsedElements(), 2u);
+    EXPECT_FALSE(queue->add(makeMessage(buffer, 300, 3), &peers[0], 30));
+
+    // first request finished: new one wraps around to the beginning of the buffer
+    queue->finish(a);
+    queue->releaseFinished();
+    EXPECT_EQ(queue->getNumberOfUsedElements(), 0u);
+    EXPECT_EQ(queue->getNumberOfUsedBytes(), 0ull);
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 600, 4), &peers[0], 40));
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 300, 5), &peers[0], 50));
+    const unsigned int c = queue->claim();
+    queue->finish(c);
+    queue->releaseFinished();
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 500, 6), &peers[1], 60));
+    const unsigned int d = queue->claim();
+    const unsigned int e = queue->claim();
+    EXPECT_TRUE(isMessageIntact(queue->getRequest(d), 300, 5));
+    EXPECT_TRUE(isMessageIntact(queue->getRequest(e), 500, 6));
+    EXPECT_EQ((const void*)queue->getRequest(e), (const void*)firstRequest);
+    EXPECT_EQ(queue->getNumberOfUsedBytes(), 900ull);
+
+    // wrapped request must not overwrite the oldest one in process
+    EXPECT_FALSE(queue->add(makeMessage(buffer, 100, 7), &peers[0], 70));
+    EXPECT_TRUE(queue->add(makeMessage(buffer, 99, 7), &peers[0], 70));
+    queue->finish(d);
+    queue->finish(e);
+    queue->releaseFinished();
+    EXPECT_EQ(queue->getNumberOfUsedElements(), 1u);
+    EXPECT_EQ(queue->getNumberOfUsedBytes(), 99ull);
+
+    // number of elements is limited too
+    const unsigned int f = queue->claim();
+    queue->finish(f);
+    queue->releaseFinished();
+    for (unsigned char i = 0; i < 8; ++i)
+        EXPECT_TRUE(queue->add(makeMessage(buffer, 16, i), &peers[0], i));
+    EXPECT_FALSE(queue->add(makeMessage(buffer, 16, 8), &peers[0], 8));
+    EXPECT_EQ(queue->getNumberOfWaitingRequests(), 8u);
+
+    // dropping queue (epoch transition) by claiming and finishing without processing
+    for (unsigned int requestIndex = queue->claim(); requestIndex != Queue::invalidRequestIndex; requestIndex = queue->claim())
+        queue->finish(requestIndex);
+    queue->releaseFinished();
+    EXPECT_EQ(queue->getNumberOfUsedElements(), 0u);
+
+    queue->deinit();
+    delete queue;
+}
+
+
+// Model of the previous request queue for comparison: processors copy the request into their own buffer while
+// holding the lock of the queue tail, which also releases the space.
+template <unsigned long long bufferSize, unsigned int length>
+struct CopyingRequestQueue
+{
+    static constexpr unsigned int maxMessageSize = 65536;
+    std::vector<unsigned char> buffer = std::vector<unsigned char>(bufferSize);
+    unsigned long long offsets[length];
+    volatile unsigned long long bufferHead = 0, bufferTail = 0;
+    volatile unsigned int elementHead = 0, elementTail = 0;
+    volatile char tailLock = 0;
+
+    bool add(const RequestResponseHeader* header)
+    {
+        const unsigned int size = header->size();
+        if ((bufferHead >= bufferTail || bufferHead + size < bufferTail) && elementHead + 1 - elementTail < length)
+        {
+            offsets[elementHead & (length - 1)] = bufferHead;
+            copyMem(&buffer[bufferHead], header, size);
+            unsigned long long newHead = bufferHead + size;
+            if (newHead > bufferSize - maxMessageSize)
+                newHead = 0;
+            bufferHead = newHead;
+            _mm_sfence();
+            elementHead++;
+            return true;
+        }
+        return false;
+    }
+
+    bool get(RequestResponseHeader* processorBuffer)
+    {
+        if (elementTail == elementHead)
+            return false;
+        ACQUIRE(tailLock);
+        if (elementTail == elementHead)
+        {
+            RELEASE(tailLock);
+            return false;
+        }
+        const RequestResponseHeader* header = (const RequestResponseHeader*)&buffer[offsets[elementTail & (length - 1)]];
+        copyMem(processorBuffer, header, header->size());
+        unsigned long long newTail = bufferTail + header->size();
+        if (newTail > bufferSize - maxMessageSize)
+            newTail = 0;
+        bufferTail = newTail;
+        elementTail++;
+        RELEASE(tailLock);
+        return true;
+    }
+};
+
+// Cheap processing that reads the whole message, like verifying a digest
+static unsigned long long processRequest(const RequestResponseHeader* header)
+{
+    const unsigned char* bytes = (const unsigned char*)header;
+    unsigned long long sum = 0;
+    for (unsigned int i = sizeof(RequestResponseHeader); i < header->size(); i += 8)
+        sum += bytes[i];
+    return sum + header->type();
+}
+
+TEST(TestCoreRequestQueue, DequeueThroughputMixedSizes)
+{
+    constexpr unsigned long long bufferSize = 64ULL * 1024 * 1024;
+    constexpr unsigned int length = 65536;
+    constexpr unsigned int numberOfRequests = 400000;
+    const unsigned int numberOfProcessors = std::max(2u, std::min(8u, std::thread::hardware_concurrency() - 1));
+
+    // mostly small messages (votes, requests), some tick data and transactions, rarely large ones
+    std::mt19937 gen(42);
+    std::vector<std::vector<unsigned char>> messages(1024);
+    unsigned long long expectedSum = 0;
+    std::vector<unsigned long long> messageSums(messages.size());
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        const unsigned int r = gen() % 100;
+        const unsigned int size = (r < 70) ? 40 + gen() % 200 : (r < 95) ? 1000 + gen() % 4000 : (r < 99) ? 8000 + gen() % 24000 : 65536;
+        makeMessage(messages[i], size, (unsigned char)(i & 0x7F));
+        messageSums[i] = processRequest((const RequestResponseHeader*)messages[i].data());
+    }
+    for (unsigned int i = 0; i < numberOfRequests; ++i)
+        expectedSum += messageSums[i % messages.size()];
+
+    TestPeer peer = { 0 };
+    double throughput[2];
+    for (int variant = 0; variant < 2; ++variant)
+    {
+        auto* copyingQueue = (variant == 0) ? new CopyingRequestQueue<bufferSize, length>() : nullptr;
+        auto* queue = (variant == 1) ? new RequestQueue<bufferSize, length, TestPeer>() : nullptr;
+        if (queue)
+            EXPECT_TRUE(queue->init());
+
+        std::atomic<unsigned long long> processed(0), sum(0);
+        std::atomic<bool> stop(false);
+        std::vector<std::thread> processors;
+        for (unsigned int p = 0; p < numberOfProcessors; ++p)
+        {
+            processors.emplace_back([&]()
+                {
+                    std::vector<unsigned char> processorBuffer(copyingQueue ? CopyingRequestQueue<bufferSize, length>::maxMessageSize : 0);
+                    unsigned long long localSum = 0, localProcessed = 0;
+                    while (!stop)
+                    {
+                        if (copyingQueue)
+                        {
+                            RequestResponseHeader* header = (RequestResponseHeader*)processorBuffer.data();
+                            if (!copyingQueue->get(header))
+                            {
+                                _mm_pause();
+                                continue;
+                            }
+                            localSum += processRequest(header);
+                        }
+                        else
+                        {
+                            const unsigned int requestIndex = queue->claim();
+                            if (requestIndex == queue->invalidRequestIndex)
+                            {
+                                _mm_pause();
+                                continue;
+                            }
+                            localSum += processRequest(queue->getRequest(requestIndex));
+                            queue->finish(requestIndex);
+                        }
+                        localProcessed++;
+                        if ((localProcessed & 255) == 0)
+                        {
+                            processed += 256;
+                        }
+                    }
+                    processed += localProcessed & 255;
+                    sum += localSum;
+                });
+        }
+
+        // main thread fills the queue as fast as space is released
+        const auto beginning = std::chrono::high_resolution_clock::now();
+        for (unsigned int i = 0; i < numberOfRequests; ++i)
+        {
+            const RequestResponseHeader* header = (const RequestResponseHeader*)messages[i % messages.size()].data();
+            if (copyingQueue)
+            {
+                while (!copyingQueue->add(header))
+                    _mm_pause();
+            }
+            else
+            {
+                while (!queue->add(header, &peer, i))
+                    queue->releaseFinished();
+            }
+        }
+        while (copyingQueue ? copyingQueue->elementTail != copyingQueue->elementHead : queue->getNumberOfWaitingRequests() != 0)
+            _mm_pause();
+        stop = true;
+        for (auto& thread : processors)
+            thread.join();
+        const double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - beginning).count();
+
+        EXPECT_EQ(processed.load(), (unsigned long long)numberOfRequests);
+        EXPECT_EQ(sum.load(), expectedSum);
+        throughput[variant] = numberOfRequests / seconds;
+
+        if (queue)
+        {
+            queue->releaseFinished();
+            EXPECT_EQ(queue->getNumberOfUsedElements(), 0u);
+            queue->deinit();
+            delete queue;
+        }
+        delete copyingQueue;
+    }
+
+    std::cout << "Dequeue throughput with " << numberOfProcessors << " processors: copy under lock "
+        << (unsigned long long)throughput[0] << " requests/s, in place " << (unsigned long long)throughput[1]
+        << " requests/s" << std::endl;
+}
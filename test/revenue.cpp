@@ -233,3 +233,82 @@ TEST(TestCoreRevenue, ReadFile)
         outfile.close();
     }
 }
+
+static void expectRunningRevenueMatchesBatch()
+{
+    static RevenueComponents running;
+    computeRunningRevenue(running);
+    computeRevenue(running.txScore, running.voteScore, running.customMiningScore);
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        EXPECT_EQ(running.txScoreFactor[i], gRevenueComponents.txScoreFactor[i]);
+        EXPECT_EQ(running.voteScoreFactor[i], gRevenueComponents.voteScoreFactor[i]);
+        EXPECT_EQ(running.customMiningScoreFactor[i], gRevenueComponents.customMiningScoreFactor[i]);
+        EXPECT_EQ(running.revenue[i], gRevenueComponents.revenue[i]);
+    }
+    EXPECT_EQ(gRunningRevenueScores.txScore.getQuorumScore(), getQuorumScore(running.txScore));
+    EXPECT_EQ(gRunningRevenueScores.voteScore.getQuorumScore(), getQuorumScore(running.voteScore));
+    EXPECT_EQ(gRunningRevenueScores.customMiningScore.getQuorumScore(), getQuorumScore(running.customMiningScore));
+}
+
+TEST(TestCoreRevenue, RunningRevenueMatchesBatch)
+{
+    resetRunningRevenueScores();
+    expectRunningRevenueMatchesBatch();
+
+    // Simulate ticks of an epoch: tick leader gets tx points, vote and custom mining counts grow
+    unsigned long long votes[NUMBER_OF_COMPUTORS] = { 0 };
+    unsigned long long customMiningShares[NUMBER_OF_COMPUTORS] = { 0 };
+    const unsigned int inactiveComputor = random(NUMBER_OF_COMPUTORS);
+    for (unsigned int tick = 1000; tick < 1000 + 5 * NUMBER_OF_COMPUTORS; tick++)
+    {
+        if (tick % NUMBER_OF_COMPUTORS != inactiveComputor)
+        {
+            addRunningTxScore(tick, random(NUMBER_OF_TRANSACTIONS_PER_TICK + 1));
+        }
+        for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+        {
+            if (i != inactiveComputor)
+            {
+                votes[i] += random(NUMBER_OF_COMPUTORS);
+                if (tick % 3 == 0)
+                {
+                    customMiningShares[i] += random(4);
+                }
+            }
+            setRunningVoteScore(i, votes[i]);
+            setRunningCustomMiningScore(i, customMiningShares[i]);
+        }
+        if (tick % 97 == 0)
+        {
+            expectRunningRevenueMatchesBatch();
+        }
+    }
+    expectRunningRevenueMatchesBatch();
+    EXPECT_EQ(gRunningRevenueScores.txScore.score[inactiveComputor], 0);
+
+    // Ties, decreasing and huge scores
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        gRunningRevenueScores.voteScore.set(i, (i % 3) * 1000);
+        gRunningRevenueScores.customMiningScore.set(i, 0xFFFFFFFFFFFFFULL - i);
+    }
+    expectRunningRevenueMatchesBatch();
+    for (unsigned int i = 0; i < NUMBER_OF_COMPUTORS; i++)
+    {
+        gRunningRevenueScores.customMiningScore.set(i, 7);
+    }
+    expectRunningRevenueMatchesBatch();
+
+    // Ranking stays consistent
+    const RevenueScoreRanking& ranking = gRunningRevenueScores.voteScore;
+    for (unsigned int r = 0; r < NUMBER_OF_COMPUTORS; r++)
+    {
+        EXPECT_EQ(ranking.rank[ranking.sortedComputorIndex[r]], r);
+        EXPECT_EQ(ranking.sortedScore[r], ranking.score[ranking.sortedComputorIndex[r]]);
+        if (r > 0)
+        {
+            EXPECT_GE(ranking.sortedScore[r - 1], ranking.sortedScore[r]);
+        }
+    }
+}
@@ -0,0 +1,382 @@
+#define NO_UEFI
+
+#include "gtest/gtest.h"
+
+#include "../src/network_core/shared_message_pool.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <vector>
+
+
+static RequestResponseHeader* makeMessage(std::vector<unsigned char>& buffer, unsigned int size, unsigned char type)
+{
+    buffer.assign(size, type);
+    RequestResponseHeader* header = (RequestResponseHeader*)buffer.data();
+    header->checkAndSetSize(size);
+    header->setType(type);
+    header->setDejavu(type + 1);
+    return header;
+}
+
+static bool isMessageIntact(const RequestResponseHeader* header, unsigned int size, unsigned char type)
+{
+    if (header->size() != size || header->type() != type)
+        return false;
+    const unsigned char* payload = (const unsigned char*)header;
+    for (unsigned int i = sizeof(RequestResponseHeader); i < size; ++i)
+    {
+        if (payload[i] != type)
+            return false;
+    }
+    return true;
+}
+
+TEST(TestCoreSharedMessagePool, ReferenceCountingAndWrapAround)
+{
+    typedef SharedMessagePool<2 * RequestResponseHeader::max_size + 4096, 8> Pool;
+    Pool* pool = new Pool();
+    EXPECT_TRUE(pool->init());
+
+    std::vector<unsigned char> buffer;
+    const unsigned int bigSize = RequestResponseHeader::max_size / 2;
+
+    // message is freed when caller and both receivers have released it
+    unsigned int a = pool->add(makeMessage(buffer, 100, 1));
+    EXPECT_NE(a, Pool::invalidMessageIndex);
+    pool->addReference(a);
+    pool->addReference(a);
+    pool->release(a);
+    pool->release(a);
+    EXPECT_EQ(pool->getNumberOfMessages(), 1u);
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(a), 100, 1));
+    pool->release(a);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+    EXPECT_EQ(pool->getUsedBytes(), 0ull);
+
+    // fill pool, the oldest message blocks reusing the space of newer messages that have been freed
+    unsigned int m[4];
+    for (unsigned char i = 0; i < 4; ++i)
+    {
+        m[i] = pool->add(makeMessage(buffer, bigSize, 10 + i));
+        EXPECT_NE(m[i], Pool::invalidMessageIndex);
+    }
+    EXPECT_EQ(pool->add(makeMessage(buffer, bigSize, 20)), Pool::invalidMessageIndex);
+    EXPECT_EQ(pool->getOldestMessage(), m[0]);
+    pool->release(m[1]);
+    EXPECT_EQ(pool->add(makeMessage(buffer, bigSize, 20)), Pool::invalidMessageIndex);
+    EXPECT_EQ(pool->getOldestMessage(), m[0]);
+
+    // releasing the oldest one frees the space of the first two, new message wraps around to the beginning
+    pool->release(m[0]);
+    EXPECT_EQ(pool->getOldestMessage(), m[2]);
+    unsigned int wrapped = pool->add(makeMessage(buffer, bigSize, 21));
+    EXPECT_NE(wrapped, Pool::invalidMessageIndex);
+    EXPECT_EQ((void*)pool->getMessage(wrapped), (void*)pool->getMessage(m[0]));
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(m[2]), bigSize, 12));
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(m[3]), bigSize, 13));
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(wrapped), bigSize, 21));
+
+    // wrapped message must not overwrite oldest message
+    EXPECT_EQ(pool->add(makeMessage(buffer, bigSize, 22)), Pool::invalidMessageIndex);
+
+    pool->release(m[2]);
+    pool->release(m[3]);
+    pool->release(wrapped);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+
+    // number of message descriptors is limited too
+    for (unsigned char i = 0; i < 8; ++i)
+        m[i & 3] = pool->add(makeMessage(buffer, 16, i));
+    EXPECT_EQ(pool->add(makeMessage(buffer, 16, 9)), Pool::invalidMessageIndex);
+
+    pool->deinit();
+    delete pool;
+}
+
+TEST(TestCoreSharedMessagePool, TransmitQueue)
+{
+    typedef SharedMessagePool<4 * RequestResponseHeader::max_size, 1024> Pool;
+    Pool* pool = new Pool();
+    EXPECT_TRUE(pool->init());
+    MessageReferenceQueue<8> queue;
+    queue.reset();
+
+    std::vector<unsigned char> buffer;
+    unsigned int messageIndices[6];
+    for (unsigned char i = 0; i < 6; ++i)
+    {
+        messageIndices[i] = pool->add(makeMessage(buffer, 100 + i, i));
+        pool->addReference(messageIndices[i]);
+        queue.push(messageIndices[i], 100 + i);
+        pool->release(messageIndices[i]);
+    }
+    EXPECT_EQ(queue.numberOfWaiting(), 6u);
+    EXPECT_EQ(queue.waitingBytes, 615u);
+    EXPECT_TRUE(queue.contains(messageIndices[5]));
+
+    // first 4 messages are passed to TCP stack, last 2 are dropped on closing but transmitting ones stay valid
+    for (unsigned int i = 0; i < 4; ++i)
+        EXPECT_EQ(queue.getWaiting(i), messageIndices[i]);
+    queue.beginTransmit(4, 406);
+    EXPECT_EQ(queue.numberOfWaiting(), 2u);
+    EXPECT_EQ(queue.getWaiting(0), messageIndices[4]);
+    queue.releaseWaiting(*pool);
+    EXPECT_EQ(queue.numberOfWaiting(), 0u);
+    EXPECT_EQ(queue.waitingBytes, 0u);
+    EXPECT_EQ(pool->getNumberOfMessages(), 6u); // last 2 are freed, but their descriptors are reused after the transmitting ones
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(messageIndices[3]), 103, 3));
+
+    queue.endTransmit(*pool);
+    EXPECT_EQ(queue.size(), 0u);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+
+    // head and tail wrap around
+    for (unsigned int round = 0; round < 20; ++round)
+    {
+        for (unsigned char i = 0; i < 5; ++i)
+        {
+            unsigned int messageIndex = pool->add(makeMessage(buffer, 50, i));
+            queue.push(messageIndex, 50);
+        }
+        queue.beginTransmit(3, 150);
+        queue.endTransmit(*pool);
+        EXPECT_EQ(queue.size(), 2u);
+        queue.releaseAll(*pool);
+        EXPECT_EQ(queue.size(), 0u);
+    }
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+
+    pool->deinit();
+    delete pool;
+}
+
+TEST(TestCoreSharedMessagePool, PriorityQueueDropsOldestLowPriority)
+{
+    typedef SharedMessagePool<4 * RequestResponseHeader::max_size, 1024> Pool;
+    Pool* pool = new Pool();
+    EXPECT_TRUE(pool->init());
+    PriorityMessageReferenceQueue<8> queue;
+    queue.reset();
+    unsigned long long dropped[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+    unsigned long long deferred[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+    constexpr unsigned long long maxWaitingBytes = 1000;
+
+    std::vector<unsigned char> buffer;
+    auto pushMessage = [&](unsigned int size, unsigned char type, TransmitPriority priority)
+    {
+        const unsigned int messageIndex = pool->add(makeMessage(buffer, size, type));
+        const bool queued = queue.push(*pool, messageIndex, priority, true, maxWaitingBytes, dropped);
+        pool->release(messageIndex);
+        return queued;
+    };
+
+    // large droppable messages of the lowest class fill the budget
+    EXPECT_TRUE(pushMessage(300, 1, TransmitPriorityQueryResponse));
+    EXPECT_TRUE(pushMessage(300, 2, TransmitPriorityQueryResponse));
+    EXPECT_TRUE(pushMessage(300, 3, TransmitPriorityQueryResponse));
+    EXPECT_TRUE(pushMessage(50, 4, TransmitPriorityTickData));
+
+    // vote doesn't fit, oldest query response is dropped for it
+    EXPECT_TRUE(pushMessage(100, 5, TransmitPriorityConsensus));
+    EXPECT_EQ(dropped[TransmitPriorityQueryResponse], 1ull);
+    EXPECT_EQ(queue.waitingBytes(), 750ull);
+
+    // query response doesn't drop messages of higher priority, but older query responses
+    EXPECT_TRUE(pushMessage(300, 6, TransmitPriorityQueryResponse));
+    EXPECT_EQ(dropped[TransmitPriorityQueryResponse], 2ull);
+    EXPECT_FALSE(pushMessage(990, 7, TransmitPriorityQueryResponse));
+    EXPECT_EQ(dropped[TransmitPriorityQueryResponse], 5ull);
+    EXPECT_EQ(queue.waitingBytes(), 150ull);
+    EXPECT_EQ(dropped[TransmitPriorityConsensus], 0ull);
+    EXPECT_EQ(dropped[TransmitPriorityTickData], 0ull);
+
+    // transmission in order of priority, within the class in order of pushing
+    EXPECT_TRUE(pushMessage(200, 8, TransmitPriorityQueryResponse));
+    EXPECT_TRUE(pushMessage(100, 9, TransmitPriorityConsensus));
+    unsigned int messageIndices[2];
+    EXPECT_EQ(queue.beginTransmit(*pool, 2, messageIndices, deferred), 2u);
+    EXPECT_EQ(pool->getMessage(messageIndices[0])->type(), 5);
+    EXPECT_EQ(pool->getMessage(messageIndices[1])->type(), 9);
+    EXPECT_EQ(deferred[TransmitPriorityConsensus], 0ull);
+    EXPECT_EQ(deferred[TransmitPriorityTickData], 1ull);
+    EXPECT_EQ(deferred[TransmitPriorityQueryResponse], 1ull);
+    EXPECT_EQ(queue.waitingBytes(), 250ull);
+
+    // dropping a waiting message while others are transmitting keeps the transmitting ones
+    EXPECT_TRUE(pushMessage(800, 10, TransmitPriorityConsensus));
+    EXPECT_EQ(dropped[TransmitPriorityQueryResponse], 6ull);
+    EXPECT_EQ(queue.waitingBytes(), 850ull);
+    EXPECT_TRUE(isMessageIntact(pool->getMessage(messageIndices[0]), 100, 5));
+    queue.endTransmit(*pool);
+    EXPECT_EQ(queue.beginTransmit(*pool, 8, messageIndices, deferred), 2u);
+    EXPECT_EQ(pool->getMessage(messageIndices[0])->type(), 10);
+    EXPECT_EQ(pool->getMessage(messageIndices[1])->type(), 4);
+    queue.endTransmit(*pool);
+    EXPECT_EQ(queue.numberOfWaiting(), 0u);
+
+    // queue length limits each class
+    for (unsigned char i = 0; i < 10; ++i)
+        EXPECT_TRUE(pushMessage(10, 20 + i, TransmitPriorityTickData));
+    EXPECT_EQ(dropped[TransmitPriorityTickData], 2ull);
+    EXPECT_EQ(pool->getMessage(queue.queues[TransmitPriorityTickData].getWaiting(0))->type(), 22);
+
+    queue.releaseAll(*pool);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+    pool->deinit();
+    delete pool;
+}
+
+TEST(TestCoreSharedMessagePool, PriorityQueueKeepsResponsesComplete)
+{
+    typedef SharedMessagePool<4 * RequestResponseHeader::max_size, 1024> Pool;
+    Pool* pool = new Pool();
+    EXPECT_TRUE(pool->init());
+    PriorityMessageReferenceQueue<8> queue;
+    queue.reset();
+    unsigned long long dropped[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+    unsigned long long deferred[NUMBER_OF_TRANSMIT_PRIORITIES] = { 0 };
+    constexpr unsigned long long maxWaitingBytes = 1000;
+
+    std::vector<unsigned char> buffer;
+    auto pushMessage = [&](unsigned int size, unsigned char type, TransmitPriority priority, bool isDroppable)
+    {
+        const unsigned int messageIndex = pool->add(makeMessage(buffer, size, type));
+        const bool queued = queue.push(*pool, messageIndex, priority, isDroppable, maxWaitingBytes, dropped);
+        pool->release(messageIndex);
+        return queued;
+    };
+
+    // broadcast followed by a response of 3 transactions and EndResponse
+    EXPECT_TRUE(pushMessage(200, 1, TransmitPriorityTickData, true));
+    EXPECT_TRUE(pushMessage(200, 2, TransmitPriorityTickData, false));
+    EXPECT_TRUE(pushMessage(200, 3, TransmitPriorityTickData, false));
+    EXPECT_TRUE(pushMessage(200, 4, TransmitPriorityTickData, false));
+    EXPECT_TRUE(pushMessage(8, 5, TransmitPriorityQueryResponse, false));
+
+    // vote only drops the broadcast, not the older messages of the response
+    EXPECT_TRUE(pushMessage(300, 6, TransmitPriorityConsensus, true));
+    EXPECT_EQ(dropped[TransmitPriorityTickData], 1ull);
+    EXPECT_EQ(queue.waitingBytes(), 908ull);
+    for (unsigned int i = 0; i < 3; ++i)
+        EXPECT_EQ(pool->getMessage(queue.queues[TransmitPriorityTickData].getWaiting(i))->type(), 2 + i);
+
+    // response message that doesn't fit is rejected (the caller closes the connection)
+    EXPECT_FALSE(pushMessage(200, 7, TransmitPriorityQueryResponse, false));
+    EXPECT_EQ(dropped[TransmitPriorityQueryResponse], 1ull);
+    EXPECT_EQ(queue.numberOfWaiting(), 5u);
+
+    // messages are counted as deferred only once, even if they wait for several transmissions
+    unsigned int messageIndices[1];
+    EXPECT_EQ(queue.beginTransmit(*pool, 1, messageIndices, deferred), 1u);
+    EXPECT_EQ(pool->getMessage(messageIndices[0])->type(), 6);
+    EXPECT_EQ(deferred[TransmitPriorityTickData], 3ull);
+    EXPECT_EQ(deferred[TransmitPriorityQueryResponse], 1ull);
+    queue.endTransmit(*pool);
+    EXPECT_EQ(queue.beginTransmit(*pool, 1, messageIndices, deferred), 1u);
+    EXPECT_EQ(pool->getMessage(messageIndices[0])->type(), 2);
+    EXPECT_EQ(deferred[TransmitPriorityTickData], 3ull);
+    EXPECT_EQ(deferred[TransmitPriorityQueryResponse], 1ull);
+
+    queue.releaseAll(*pool);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+    pool->deinit();
+    delete pool;
+}
+
+// Compare bytes copied in the main loop per broadcast: formerly each message was copied into dataToTransmit of each
+// receiving peer and then into the fragment buffer of the peer before transmission. With the shared pool, the message
+// is copied once and the peers transmit the pooled buffer directly.
+TEST(TestCoreSharedMessagePool, BenchmarkBytesCopiedPerBroadcast)
+{
+    constexpr unsigned int numberOfPeers = 64;
+    constexpr unsigned int numberOfReceivers = 6; // DISSEMINATION_MULTIPLIER
+    constexpr unsigned int numberOfBroadcasts = 20000;
+    constexpr unsigned long long peerBufferSize = 1 << 20;
+
+    typedef SharedMessagePool<256ULL << 20, 65536> Pool;
+    Pool* pool = new Pool();
+    EXPECT_TRUE(pool->init());
+    std::vector<MessageReferenceQueue<256>> queues(numberOfPeers);
+    for (auto& queue : queues)
+        queue.reset();
+
+    std::mt19937_64 gen64(42);
+    std::vector<unsigned int> sizes(numberOfBroadcasts);
+    for (auto& size : sizes)
+        size = 8 + (unsigned int)(gen64() % 2048);
+    std::vector<unsigned char> message;
+    makeMessage(message, RequestResponseHeader::max_size, 1);
+
+    // old model: dataToTransmit and transmit fragment buffer per peer
+    std::vector<std::vector<unsigned char>> dataToTransmit(numberOfPeers, std::vector<unsigned char>(peerBufferSize));
+    std::vector<std::vector<unsigned char>> fragmentBuffer(numberOfPeers, std::vector<unsigned char>(peerBufferSize));
+    std::vector<unsigned int> dataToTransmitSize(numberOfPeers, 0);
+    unsigned long long oldCopiedBytes = 0;
+    auto t0 = std::chrono::high_resolution_clock::now();
+    for (unsigned int b = 0; b < numberOfBroadcasts; ++b)
+    {
+        ((RequestResponseHeader*)message.data())->checkAndSetSize(sizes[b]);
+        for (unsigned int r = 0; r < numberOfReceivers; ++r)
+        {
+            const unsigned int peer = (b * 7 + r * 11) % numberOfPeers;
+            copyMem(&dataToTransmit[peer][dataToTransmitSize[peer]], message.data(), sizes[b]);
+            dataToTransmitSize[peer] += sizes[b];
+            oldCopiedBytes += sizes[b];
+        }
+        if (b % 8 == 7)
+        {
+            for (unsigned int peer = 0; peer < numberOfPeers; ++peer)
+            {
+                copyMem(fragmentBuffer[peer].data(), dataToTransmit[peer].data(), dataToTransmitSize[peer]);
+                oldCopiedBytes += dataToTransmitSize[peer];
+                dataToTransmitSize[peer] = 0;
+            }
+        }
+    }
+    auto t1 = std::chrono::high_resolution_clock::now();
+
+    // new model: copy into shared pool once, reference it from the transmit queues
+    pool->reset();
+    unsigned long long newTransmittedBytes = 0;
+    auto t2 = std::chrono::high_resolution_clock::now();
+    for (unsigned int b = 0; b < numberOfBroadcasts; ++b)
+    {
+        ((RequestResponseHeader*)message.data())->checkAndSetSize(sizes[b]);
+        const unsigned int messageIndex = pool->add((RequestResponseHeader*)message.data());
+        ASSERT_NE(messageIndex, Pool::invalidMessageIndex);
+        for (unsigned int r = 0; r < numberOfReceivers; ++r)
+        {
+            const unsigned int peer = (b * 7 + r * 11) % numberOfPeers;
+            pool->addReference(messageIndex);
+            queues[peer].push(messageIndex, sizes[b]);
+        }
+        pool->release(messageIndex);
+        if (b % 8 == 7)
+        {
+            for (unsigned int peer = 0; peer < numberOfPeers; ++peer)
+            {
+                const unsigned int count = queues[peer].numberOfWaiting();
+                newTransmittedBytes += queues[peer].waitingBytes;
+                queues[peer].beginTransmit(count, queues[peer].waitingBytes);
+                queues[peer].endTransmit(*pool);
+            }
+        }
+    }
+    auto t3 = std::chrono::high_resolution_clock::now();
+    const unsigned long long newCopiedBytes = pool->getNumberOfCopiedBytes();
+
+    EXPECT_EQ(oldCopiedBytes, 2 * newTransmittedBytes);
+    EXPECT_EQ(newCopiedBytes * numberOfReceivers, newTransmittedBytes);
+    EXPECT_EQ(pool->getNumberOfMessages(), 0u);
+
+    std::cout << "Bytes copied per broadcast to " << numberOfReceivers << " peers: per-peer buffers "
+        << oldCopiedBytes / numberOfBroadcasts << ", shared pool " << newCopiedBytes / numberOfBroadcasts << std::endl;
+    std::cout << "Time for " << numberOfBroadcasts << " broadcasts: per-peer buffers "
+        << std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() << " us, shared pool "
+        << std::chrono::duration_cast<std::chrono::microseconds>(t3 - t2).count() << " us" << std::endl;
+
+    pool->deinit();
+    delete pool;
+}
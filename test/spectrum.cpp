@@ -4,8 +4,10 @@
 
 #include "gtest/gtest.h"
 
+#include <atomic>
 #include <chrono>
 #include <random>
+#include <thread>
 
 #include "logging_test.h"
 #include "spectrum/spectrum.h"
@@ -407,3 +409,141 @@ TEST(TestCoreSpectrum, AntiDustEdgeCaseHugeBinZeroBalance)
     test.afterAntiDust();
 }
 
+
+TEST(TestCoreSpectrum, IncreaseEnergyBatchMatchesSingleIncreases)
+{
+    SpectrumTest test;
+    constexpr unsigned int holderCount = 100000;
+
+    // Generate 100k holders, including duplicates, colliding hash map indices, and invalid entries that are skipped
+    std::vector<EnergyIncrease> increases(holderCount);
+    for (unsigned int i = 0; i < holderCount; ++i)
+    {
+        increases[i].publicKey = m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        increases[i].amount = test.rnd64() % 1000000;
+        if (i % 1000 == 1)
+            increases[i].publicKey = increases[i - 1].publicKey;
+        if (i % 1000 == 2)
+            increases[i].publicKey.m256i_u32[0] = increases[i - 2].publicKey.m256i_u32[0];
+        if (i % 10000 == 3)
+            increases[i].publicKey = m256i::zero();
+        if (i % 10000 == 4)
+            increases[i].amount = -1;
+    }
+    std::vector<EnergyIncrease> batch = increases;
+
+    // Apply increases one by one, acquiring spectrumLock for each holder
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (unsigned int i = 0; i < holderCount; ++i)
+        increaseEnergy(increases[i].publicKey, increases[i].amount);
+    auto singleDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    const SpectrumInfo singleInfo = checkAndGetInfo();
+    std::vector<::Entity> singleSpectrum(spectrum, spectrum + SPECTRUM_CAPACITY);
+
+    // Apply same increases as one batch
+    test.clearSpectrum();
+    startTime = std::chrono::high_resolution_clock::now();
+    increaseEnergyBatch(batch.data(), holderCount);
+    auto batchDuration = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    const SpectrumInfo batchInfo = checkAndGetInfo();
+
+    std::cout << "Increasing energy of " << holderCount << " holders took " << singleDuration << " one by one and "
+        << batchDuration << " as batch" << std::endl;
+
+    // Batch is sorted by hash map index
+    for (unsigned int i = 1; i < holderCount; ++i)
+        EXPECT_FALSE(energyIncreaseLess(batch[i], batch[i - 1]));
+
+    // Balances and counters of all entities are the same (position in hash map may differ due to order of insertion)
+    EXPECT_EQ(singleInfo.numberOfEntities, batchInfo.numberOfEntities);
+    EXPECT_EQ(singleInfo.totalAmount, batchInfo.totalAmount);
+    for (unsigned int i = 0; i < SPECTRUM_CAPACITY; ++i)
+    {
+        if (isZero(singleSpectrum[i].publicKey))
+            continue;
+        const int index = spectrumIndex(singleSpectrum[i].publicKey);
+        ASSERT_GE(index, 0);
+        EXPECT_EQ(spectrum[index].incomingAmount, singleSpectrum[i].incomingAmount);
+        EXPECT_EQ(spectrum[index].outgoingAmount, singleSpectrum[i].outgoingAmount);
+        EXPECT_EQ(spectrum[index].numberOfIncomingTransfers, singleSpectrum[i].numberOfIncomingTransfers);
+    }
+}
+
+TEST(TestCoreSpectrum, ConcurrentReadsDuringTransfers)
+{
+    SpectrumTest test;
+    constexpr unsigned int entityCount = 8;
+    constexpr long long initialAmount = 1000000000;
+    constexpr long long transferAmount = 7;
+    constexpr unsigned int transferCount = 300000;
+
+    // Entities in neighboring hash map slots, so the readers probe through entities being changed
+    m256i publicKeys[entityCount];
+    for (unsigned int i = 0; i < entityCount; ++i)
+    {
+        publicKeys[i] = m256i(test.rnd64(), test.rnd64(), test.rnd64(), test.rnd64());
+        publicKeys[i].m256i_u32[0] = 12345;
+        increaseEnergy(publicKeys[i], initialAmount);
+    }
+
+    // Readers check that each entity record is consistent: every record is only changed by transfers of the same
+    // amount, so amounts and numbers of transfers have to match. A group read checks the total of all entities, which
+    // is lower by one transfer amount between decreaseEnergy() and increaseEnergy() of a transfer.
+    std::atomic<bool> stop(false);
+    std::atomic<unsigned long long> numberOfReads(0), numberOfInconsistentReads(0);
+    auto reader = [&](unsigned int readerIndex)
+    {
+        unsigned long long reads = 0, inconsistentReads = 0;
+        while (!stop)
+        {
+            ::Entity entity;
+            const unsigned int i = (unsigned int)(reads + readerIndex) % entityCount;
+            const int index = readEntity(publicKeys[i], entity);
+            if (index < 0 || entity.publicKey != publicKeys[i]
+                || entity.incomingAmount != initialAmount + transferAmount * (entity.numberOfIncomingTransfers - 1)
+                || entity.outgoingAmount != transferAmount * entity.numberOfOutgoingTransfers)
+            {
+                ++inconsistentReads;
+            }
+
+            long long total;
+            long long sequence;
+            do
+            {
+                sequence = beginSpectrumRead();
+                total = 0;
+                for (unsigned int j = 0; j < entityCount; ++j)
+                {
+                    const int idx = spectrumIndexWithoutLocking(publicKeys[j]);
+                    if (idx >= 0)
+                        total += energy(idx);
+                }
+            } while (!endSpectrumRead(sequence));
+            if (total != initialAmount * entityCount && total != initialAmount * entityCount - transferAmount)
+                ++inconsistentReads;
+
+            reads += 2;
+        }
+        numberOfReads += reads;
+        numberOfInconsistentReads += inconsistentReads;
+    };
+    std::vector<std::thread> readers;
+    for (unsigned int r = 0; r < 4; ++r)
+        readers.emplace_back(reader, r);
+
+    // Writer: transfers between random entities, like in the transaction phase of a tick
+    for (unsigned int t = 0; t < transferCount; ++t)
+    {
+        const unsigned int src = (unsigned int)(test.rnd64() % entityCount);
+        const unsigned int dst = (src + 1 + (unsigned int)(test.rnd64() % (entityCount - 1))) % entityCount;
+        EXPECT_TRUE(transfer(publicKeys[src], publicKeys[dst], transferAmount));
+    }
+    stop = true;
+    for (auto& thread : readers)
+        thread.join();
+
+    EXPECT_GT(numberOfReads.load(), 0ull);
+    EXPECT_EQ(numberOfInconsistentReads.load(), 0ull);
+    EXPECT_EQ((spectrumWriteSequence & 1), 0);
+    checkAndGetInfo();
+}
@@ -15,7 +15,9 @@ void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char type, unsi
 #define ADDON_TX_STATUS_REQUEST 1
 #include "../src/addons/tx_status_request.h"
 
+#include <chrono>
 #include <random>
+#include <vector>
 
 unsigned int numberOfTransactions = 0;
 
@@ -52,9 +54,36 @@ struct {
 
 RespondTxStatus responseMessage;
 
+struct {
+    RequestResponseHeader header;
+    RequestTxStatusOfDigest payload;
+} requestOfDigestMessage;
+
+struct {
+    RequestResponseHeader header;
+    RequestTxStatusOfDigests payload;
+} requestOfDigestsMessage;
+
+RespondTxStatusOfDigest responseOfDigestMessage;
+RespondTxStatusOfDigests responseOfDigestsMessage;
+
 
 static void enqueueResponse(Peer* peer, unsigned int dataSize, unsigned char type, unsigned int dejavu, const void* data)
 {
+    if (type == RESPOND_TX_STATUS_OF_DIGEST)
+    {
+        EXPECT_EQ(dataSize, sizeof(RespondTxStatusOfDigest));
+        copyMem(&responseOfDigestMessage, data, sizeof(RespondTxStatusOfDigest));
+        return;
+    }
+    if (type == RESPOND_TX_STATUS_OF_DIGESTS)
+    {
+        const RespondTxStatusOfDigests* txStatus = (const RespondTxStatusOfDigests*)data;
+        EXPECT_EQ(dataSize, txStatus->size());
+        copyMem(&responseOfDigestsMessage, txStatus, txStatus->size());
+        return;
+    }
+
     const RespondTxStatus* txStatus = (const RespondTxStatus*)data;
 
     EXPECT_EQ(type, RESPOND_TX_STATUS);
@@ -124,6 +153,36 @@ static void checkTick(unsigned int tick, unsigned long long seed, unsigned short
         unsigned char expectedMoneyFlew = gen64() % 2;
         EXPECT_EQ(receivedMoneyFlow, expectedMoneyFlew);
     }
+
+    // check that all transactions of tick are found by digest, one by one and as batch (with an unknown digest if
+    // there is space left)
+    const unsigned int numberOfDigests = (responseMessage.txCount < RequestTxStatusOfDigests::maxNumberOfDigests) ? responseMessage.txCount + 1 : responseMessage.txCount;
+    requestOfDigestsMessage.header.checkAndSetSize(sizeof(RequestResponseHeader) + numberOfDigests * sizeof(m256i));
+    requestOfDigestsMessage.header.setType(REQUEST_TX_STATUS_OF_DIGESTS);
+    for (unsigned int transaction = 0; transaction < responseMessage.txCount; ++transaction)
+        requestOfDigestsMessage.payload.digests[transaction] = responseMessage.txDigests[transaction];
+    if (numberOfDigests > responseMessage.txCount)
+        requestOfDigestsMessage.payload.digests[responseMessage.txCount] = m256i(seed, 1, 2, 3);
+    responseOfDigestsMessage.numberOfDigests = 0;
+    processRequestTxStatusOfDigests(nullptr, &requestOfDigestsMessage.header);
+    EXPECT_EQ(responseOfDigestsMessage.currentTickOfNode, system.tick);
+    EXPECT_EQ(responseOfDigestsMessage.numberOfDigests, numberOfDigests);
+    for (unsigned int transaction = 0; transaction < responseMessage.txCount; ++transaction)
+    {
+        const unsigned char moneyFlew = (responseMessage.moneyFlew[transaction / 8] >> (transaction % 8)) & 1;
+        EXPECT_EQ(responseOfDigestsMessage.status[transaction].tick, tick);
+        EXPECT_EQ(responseOfDigestsMessage.status[transaction].moneyFlew, moneyFlew);
+
+        requestOfDigestMessage.header.checkAndSetSize(sizeof(requestOfDigestMessage));
+        requestOfDigestMessage.header.setType(REQUEST_TX_STATUS_OF_DIGEST);
+        requestOfDigestMessage.payload.digest = responseMessage.txDigests[transaction];
+        processRequestTxStatusOfDigest(nullptr, &requestOfDigestMessage.header);
+        EXPECT_EQ(responseOfDigestMessage.digest, responseMessage.txDigests[transaction]);
+        EXPECT_EQ(responseOfDigestMessage.tick, tick);
+        EXPECT_EQ(responseOfDigestMessage.moneyFlew, moneyFlew);
+    }
+    if (numberOfDigests > responseMessage.txCount)
+        EXPECT_EQ(responseOfDigestsMessage.status[responseMessage.txCount].tick, 0u);
 }
 
 
@@ -222,3 +281,50 @@ TEST(TestCoreTxStatusRequestAddOn, EpochTransition)
     }
 }
 
+TEST(TestCoreTxStatusRequestAddOn, DigestIndexFootprintAndLookup)
+{
+    initTxStatusRequestAddOn();
+    system.initialTick = 1000;
+    numberOfTransactions = 0;
+    beginEpochTxStatusRequestAddOn(system.initialTick);
+
+    // fill all ticks of epoch with up to NUMBER_OF_TRANSACTIONS_PER_TICK transactions
+    std::vector<m256i> digests;
+    for (unsigned int i = 0; i < MAX_NUMBER_OF_TICKS_PER_EPOCH; ++i)
+        addTick(system.initialTick + i, i + 1, NUMBER_OF_TRANSACTIONS_PER_TICK);
+    for (unsigned int i = 0; i < numberOfTransactions && i < confirmedTxCurrentEpochLength; ++i)
+        digests.push_back(confirmedTx[i].digest);
+    system.tick = system.initialTick + MAX_NUMBER_OF_TICKS_PER_EPOCH;
+
+    std::cout << "Digest index of " << confirmedTxLength << " tx: " << confirmedTxIndexSize * sizeof(confirmedTxIndex[0])
+        << " bytes (" << confirmedTxIndexSize * sizeof(confirmedTxIndex[0]) * 100 / (confirmedTxLength * sizeof(ConfirmedTx))
+        << "% of confirmedTx), " << confirmedTxIndexPopulation << " tx indexed" << std::endl;
+    EXPECT_EQ(confirmedTxIndexPopulation, digests.size());
+
+    // lookup of all stored digests and of the same number of unknown digests
+    std::mt19937_64 gen64(1234);
+    unsigned long long found = 0;
+    auto startTime = std::chrono::high_resolution_clock::now();
+    for (const m256i& digest : digests)
+        found += findConfirmedTx(digest) != NULL;
+    auto hitDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    EXPECT_EQ(found, digests.size());
+
+    std::vector<m256i> unknownDigests(digests.size());
+    for (m256i& digest : unknownDigests)
+        digest = m256i(gen64(), gen64(), gen64(), gen64());
+    found = 0;
+    startTime = std::chrono::high_resolution_clock::now();
+    for (const m256i& digest : unknownDigests)
+        found += findConfirmedTx(digest) != NULL;
+    auto missDuration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::high_resolution_clock::now() - startTime);
+    EXPECT_EQ(found, 0);
+
+    if (!digests.empty())
+    {
+        std::cout << "Lookup of stored digest took " << hitDuration.count() / digests.size() << " ns, of unknown digest "
+            << missDuration.count() / digests.size() << " ns on average" << std::endl;
+    }
+
+    deinitTxStatusRequestAddOn();
+}
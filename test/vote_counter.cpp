@@ -18,6 +18,14 @@ public:
     void testUpdate10Bit(unsigned char* data, unsigned int idx, unsigned int value)
     {
         update10Bit(data, idx, value);
+    }
+    void testUnpack10BitValues(const unsigned char* data, unsigned int* values)
+    {
+        unpack10BitValues(data, values);
+    }
+    void testPack10BitValues(const unsigned int* values, unsigned char* data)
+    {
+        pack10BitValues(values, data);
     }
 };
 
@@ -47,6 +55,38 @@ TEST(TestCoreVoteCounter, TenBitsEncodeDecode) {
             }
         }
         EXPECT_TRUE(isMatched);
+    }
+}
+
+TEST(TestCoreVoteCounter, TenBitsSimdMatchesScalarEncoding) {
+    std::mt19937 gen(1234);
+    unsigned char packedScalar[848], packedSimd[848], randomData[848];
+    unsigned int values[676], unpacked[676];
+    for (int test = 0; test < 1000; test++)
+    {
+        // pack random values (full 10-bit range in some tests, realistic vote counts in others)
+        const unsigned int maxValue = (test & 1) ? 1023 : 676;
+        setMem(packedScalar, sizeof(packedScalar), 0);
+        for (int i = 0; i < 676; i++)
+        {
+            values[i] = gen() % (maxValue + 1);
+            tvc.testUpdate10Bit(packedScalar, i, values[i]);
+        }
+        setMem(packedSimd, sizeof(packedSimd), 0xff);
+        tvc.testPack10BitValues(values, packedSimd);
+        EXPECT_EQ(memcmp(packedScalar, packedSimd, sizeof(packedSimd)), 0);
+
+        tvc.testUnpack10BitValues(packedSimd, unpacked);
+        EXPECT_EQ(memcmp(values, unpacked, sizeof(values)), 0);
+
+        // unpack random bytes
+        for (auto& byte : randomData)
+            byte = (unsigned char)gen();
+        tvc.testUnpack10BitValues(randomData, unpacked);
+        for (int i = 0; i < 676; i++)
+        {
+            EXPECT_EQ(unpacked[i], tvc.testExtract10Bit(randomData, i));
+        }
     }
 }
 